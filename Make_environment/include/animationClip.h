@@ -0,0 +1,178 @@
+/*
+* Animation Clip
+* Keyframed translation / rotation / scale tracks, compressed, and sampled in batches
+*
+* A clip is made from tracks sampled at a fixed rate (one value per frame). compress()
+* shrinks them in two steps:
+*   quantize -> every component is stored in 16 bits, relative to the track's own range
+*               (rotations are kept on one hemisphere first, so neighbouring keys are close)
+*   reduce   -> a key is dropped whenever interpolating the keys around it (as quantized)
+*               gives back every sample in between within the error settings, so the error
+*               of the clip is bounded, not just of each key
+* A key is 8 bytes (frame index + 4 x 16 bit values) instead of 16 bytes of float per frame.
+*
+* AnimationSampler samples every track of a clip at once. Tracks are sorted by channel, so
+* 4 tracks of the same kind go through the SSE loop together: keys decoded, turned into
+* structure of arrays, then lerp (translation, scale) or nlerp / slerp (rotation) for all 4.
+* Each track remembers the key it was last between (its cursor); playing forward only ever
+* steps a cursor ahead a key or two, so there is no binary search per track per frame
+* (only when time jumps backwards, like a loop starting over).
+*
+* Slerp is the nlerp of a corrected t (t' = t + t (t - 0.5) (t - 1) k(|cos|)), within about
+* 1e-3 radians of the real thing and with no trigonometry, so it stays in SIMD.
+*
+* Usage:
+*   clip.compress(rawTracks, frames, 60.0f, defaultAnimCompressSettings());   //Once
+*   sampler.setClip(clip);
+*   sampler.sample(time);                   //Every frame
+*   sampler.getValue(clip.findTrack(target, ANIM_ROTATION));
+*/
+#pragma once
+
+#include <vmath.h>  //Graphics utilities
+#include <vector>
+#include <stdint.h>
+
+//What a track moves
+enum animChannels{
+    ANIM_TRANSLATION = 0,   //xyz
+    ANIM_ROTATION    = 1,   //Quaternion (x, y, z, w)
+    ANIM_SCALE       = 2,   //xyz
+    ANIM_CHANNELS    = 3
+};
+
+//How rotation keys are interpolated
+enum animRotationModes{
+    ANIM_NLERP = 0,         //Normalized lerp, cheapest, speeds up a little mid way between keys far apart
+    ANIM_SLERP = 1          //Constant speed (approximated, see above)
+};
+
+//Uncompressed track, one value per frame
+struct anim_raw_track_t{
+    int target;                         //What the track moves (object, node, joint...)
+    int channel;                        //animChannels
+    std::vector<vmath::vec4> samples;   //xyz (w unused) for translation and scale, quaternion for rotation
+};
+
+//How far a compressed clip may be off the raw samples, anywhere in the clip
+struct anim_compress_settings_t{
+    float translationError;     //World units
+    float rotationError;        //Radians
+    float scaleError;
+    int rotationMode;           //animRotationModes, the clip is sampled the way it is checked
+};
+
+//Bounds tight enough that nothing moving in the maze visibly swims
+anim_compress_settings_t defaultAnimCompressSettings();
+
+//What compress() did
+struct anim_clip_stats_t{
+    size_t tracks;
+    size_t rawKeys;                 //Samples given (tracks * frames)
+    size_t keys;                    //Kept
+    size_t rawBytes;                //As 4 floats a sample
+    size_t bytes;                   //Keys plus track headers
+    float maxError[ANIM_CHANNELS];  //Largest error measured over every frame (same units as the settings)
+    double compressSeconds;
+};
+
+//A compressed track, its keys are in the clip's key arrays
+struct anim_track_t{
+    uint32_t firstKey;
+    uint32_t keyCount;
+    int target;
+    int channel;
+    vmath::vec4 rangeMin;       //value = rangeMin + quantized * rangeScale
+    vmath::vec4 rangeScale;
+};
+
+class AnimationClip{
+    public:
+        AnimationClip();
+
+        //Quantize the samples and drop every key that isn't needed to stay inside the error settings
+        // raw        -> every track holds frames samples (or it is skipped)
+        // sampleRate -> frames per second
+        void compress(const std::vector<anim_raw_track_t> &raw, int frames, float sampleRate,
+                      const anim_compress_settings_t &settings);
+
+        //Track index of a target's channel, -1 when there is none
+        int findTrack(int target, int channel) const;
+
+        //One track at time seconds (looped), found with a binary search, one track at a time
+        //This is the reference AnimationSampler is checked against
+        vmath::vec4 sampleTrack(size_t track, float time) const;
+
+        //Time in frames (looped) the tracks are sampled at for time seconds
+        float frameAt(float time) const;
+
+        float getDuration() const {return frameCount > 1 ? (frameCount - 1) / sampleRate : 0.0f;}
+        int getRotationMode() const {return rotationMode;}
+        size_t getTrackCount() const {return tracks.size();}
+        const anim_track_t& getTrack(size_t track) const {return tracks[track];}
+        size_t channelBegin(int channel) const {return channelStart[channel];} //Tracks are sorted by channel
+        uint16_t keyFrame(size_t key) const {return keyFrames[key];}
+        const uint16_t* keyData(size_t key) const {return &keyValues[key * 4];}
+        vmath::vec4 keyValue(const anim_track_t &track, size_t key) const;
+        const anim_clip_stats_t& getStats() const {return stats;}
+
+    private:
+        std::vector<anim_track_t> tracks;
+        size_t channelStart[ANIM_CHANNELS + 1];
+        std::vector<uint16_t> keyFrames;    //Frame of every key
+        std::vector<uint16_t> keyValues;    //4 per key
+        float sampleRate;
+        int frameCount;
+        int rotationMode;
+        anim_clip_stats_t stats;
+};
+
+//Cursor upkeep of the last sample() call
+struct anim_sampler_stats_t{
+    size_t tracks;
+    size_t cursorSteps;         //Keys stepped over moving forward
+    size_t seeks;               //Tracks that had to binary search (time went backwards)
+};
+
+class AnimationSampler{
+    public:
+        AnimationSampler();
+
+        //Sample clip from now on (it has to outlive the sampler), cursors start at the first key
+        void setClip(const AnimationClip &clip);
+
+        //Every track at time seconds (looped over the clip), 4 tracks at a time with SSE
+        void sample(float time);
+
+        const vmath::vec4& getValue(size_t track) const {return values[track];}
+        const std::vector<vmath::vec4>& getValues() const {return values;}
+        const anim_sampler_stats_t& getStats() const {return stats;}
+
+    private:
+        //Move a track's cursor to the key at or before frame, counting what it took
+        uint32_t advance(size_t track, float frame, size_t &steps, size_t &seeks);
+
+        const AnimationClip* clip;
+        std::vector<uint32_t> cursors;      //Per track, key index (from the track's first key)
+        std::vector<vmath::vec4> values;    //Per track, last sample
+        anim_sampler_stats_t stats;
+};
+
+//Translation, rotation and scale as one object to world matrix (scale first, translation last)
+vmath::mat4 trsMatrix(const vmath::vec3 &translation, const vmath::quaternion &rotation, const vmath::vec3 &scale);
+
+//What benchmarkAnimation measured
+struct anim_benchmark_t{
+    size_t tracks;
+    int frames;                 //Frames sampled
+    anim_clip_stats_t clip;     //How the test clip compressed
+    double samplerSeconds;      //AnimationSampler, every track every frame
+    double referenceSeconds;    //sampleTrack (binary search, scalar), every track every frame
+    double tracksPerSecond;     //Through the sampler
+    double referenceTracksPerSecond;
+    float maxDifference;        //Largest difference between the two, any component
+};
+
+//Make a clip of targets x 3 tracks of wobbling motion, compress it and sample it frames times at 60 Hz
+//CPU only, nothing needs to be drawn
+void benchmarkAnimation(int targets, int frames, anim_benchmark_t &result);
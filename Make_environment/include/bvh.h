@@ -0,0 +1,75 @@
+/*
+* Triangle BVH
+* Bounding volume hierarchy over a static triangle mesh, for ray casts on the CPU
+*
+* Built top down with the surface area heuristic over SAH_BINS centroid bins per
+* axis, leaves hold up to BVH_LEAF_SIZE triangles. Nodes are 32 bytes and stored
+* depth first, a node's left child is always right after it, so only the right
+* child's index is kept. Triangles are copied into leaf order with their edges
+* precomputed for the ray/triangle test (Moller-Trumbore).
+*
+* Built once, then read only: intersect() and occluded() are safe to call from
+* many threads at once.
+*
+* Usage:
+*   bvh.build(positions, indices);                  //Once
+*   if(bvh.intersect(origin, direction, tMax, hit)) //Closest hit, hit.triangle is the index into indices / 3
+*   if(bvh.occluded(origin, direction, tMax))       //Any hit, cheaper (shadow rays)
+*/
+#pragma once
+
+#include <vmath.h> //Graphics utilities
+#include <vector>
+
+const int BVH_LEAF_SIZE = 4;   //Most triangles in one leaf
+const int SAH_BINS = 12;       //Split candidates tried per axis
+const int BVH_MAX_DEPTH = 64;  //Deepest a tree gets, leaves there take whatever triangles are left
+
+//Closest hit along a ray
+struct bvh_hit_t{
+    float t;                //Distance along the direction
+    float u, v;             //Barycentrics of vertex 1 and 2
+    unsigned int triangle;  //Triangle in the order it was given to build()
+};
+
+class TriangleBVH{
+    public:
+        TriangleBVH();
+
+        //Build over an indexed triangle list, replaces any previous build
+        // positions -> vertex positions
+        // indices   -> 3 per triangle
+        void build(const std::vector<vmath::vec3> &positions, const std::vector<unsigned int> &indices);
+
+        //Closest hit with t in (0, tMax), false if there is none
+        // direction -> need not be unit length, t is in its units
+        bool intersect(const vmath::vec3 &origin, const vmath::vec3 &direction, float tMax, bvh_hit_t &hit) const;
+
+        //True as soon as anything is hit with t in (0, tMax)
+        bool occluded(const vmath::vec3 &origin, const vmath::vec3 &direction, float tMax) const;
+
+        //Utility information
+        size_t getNodeCount() const {return nodes.size();}
+        size_t getTriangleCount() const {return triangles.size();}
+        int getDepth() const {return depth;}
+
+    private:
+        struct node_t{
+            float boundsMin[3];
+            unsigned int offset;    //Leaf: first triangle, inner: right child
+            float boundsMax[3];
+            unsigned int count;     //Leaf: triangle count, inner: 0
+        };
+
+        struct triangle_t{
+            vmath::vec3 v0, edge1, edge2;
+            unsigned int id;        //Index in build() order
+        };
+
+        //Shared traversal, stops at the first hit when anyHit is set
+        bool traverse(const vmath::vec3 &origin, const vmath::vec3 &direction, float tMax, bool anyHit, bvh_hit_t &hit) const;
+
+        std::vector<node_t> nodes;
+        std::vector<triangle_t> triangles;
+        int depth;
+};
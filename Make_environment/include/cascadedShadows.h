@@ -0,0 +1,166 @@
+/*
+* Cascaded Shadows
+* Directional light shadow maps with cached static geometry
+*
+* The camera's view range is split into SHADOW_CASCADES pieces (near ones short,
+* far ones long), and each piece gets its own layer of a depth texture array,
+* looking down the light direction. Each cascade's window is a square around the
+* bounding sphere of its piece of the view frustum, so its size never changes when
+* the camera turns, and it only moves in whole texels, so shadow edges stay still
+* while the camera moves.
+*
+* Static geometry (the maze) is not drawn into the cascades every frame. Light
+* space is cut into a fixed grid of pages (SHADOW_PAGE_SIZE texels, world size
+* depends on the cascade). Each page is drawn once into a cache (a second depth
+* array) and reused for as long as the light does not move; a cascade's window
+* is a whole number of pages, so putting it together is just copying its pages
+* out of the cache (glCopyImageSubData). Only pages the window has newly moved
+* onto are drawn. Dynamic objects are then drawn on top of the copied depth.
+*
+* Rendering is left to the caller (it knows what is static and what isn't), this
+* class picks what needs drawing, with which matrix, into which layer.
+*
+* Matching GLSL (see fs.glsl):
+*   layout (std140, binding = 1) uniform ShadowBlock { mat4 cascadeViewProjection[4]; vec4 splits; vec4 lightDirection; vec4 lightColor; vec4 texelSize; } shadow;
+*   layout (binding = 1) uniform sampler2DArrayShadow shadowMap;
+*
+* Usage:
+*   shadows.create(sceneMin, sceneMax);       //Once, box around everything that casts or receives
+*   shadows.update(lightDir, camera...);      //Each frame, CPU only
+*   shadows.beginFrame();
+*   for(size_t i = 0; i < shadows.getDirtyPageCount(); i++){ draw static with shadows.beginPage(i); }
+*   shadows.composeCascades();
+*   for(int c = 0; c < SHADOW_CASCADES; c++){ draw dynamic with shadows.beginCascade(c); }
+*   shadows.endPasses(windowWidth, windowHeight);
+*   shadows.upload();
+*   ... draw the scene ...
+*   shadows.endFrame();
+*/
+#pragma once
+
+#include <sb7.h>   //OpenGL commands and utilities
+#include <vmath.h> //Graphics utilities
+#include <sb7ringbuffer.h>
+#include <vector>
+
+//Binding points shared with the shaders
+enum shadowBindings{
+    SHADOW_UBO_BINDING   = 1,  //Uniform block binding (FrameBlock is 0)
+    SHADOW_TEXTURE_UNIT  = 1   //twoDTex is unit 0
+};
+
+const int SHADOW_CASCADES = 4;
+const int SHADOW_MAP_SIZE = 1024;                                //Texels per side of a cascade
+const int SHADOW_PAGE_SIZE = 256;                                //Texels per side of a cached page
+const int SHADOW_PAGES_PER_SIDE = SHADOW_MAP_SIZE / SHADOW_PAGE_SIZE;
+const int SHADOW_CACHE_PAGES = 24;                               //Cached pages per cascade (a window needs 16)
+
+//std140 layout of ShadowBlock
+struct shadow_uniforms_t{
+    vmath::mat4 cascadeViewProjection[SHADOW_CASCADES]; //World to shadow clip space
+    vmath::vec4 splits;         //View distance where each cascade ends
+    vmath::vec4 lightDirection; //xyz direction the light travels
+    vmath::vec4 lightColor;     //rgb, w number of cascades
+    vmath::vec4 texelSize;      //World size of one texel in each cascade
+};
+
+//What update() and the passes did this frame
+struct shadow_stats_t{
+    size_t pagesDrawn;      //Static pages drawn into the cache this frame
+    size_t pagesCopied;     //Cached pages copied into cascades this frame
+    size_t cachedPages;     //Pages currently holding valid depth
+    size_t invalidations;   //Times the whole cache was thrown away (light moved)
+};
+
+class CascadedShadows{
+    public:
+        CascadedShadows();
+
+        //Allocate the depth textures, framebuffer and uniform stream
+        // sceneMin/sceneMax -> world box around every caster and receiver (fixes the light space depth range)
+        void create(const vmath::vec3 &sceneMin, const vmath::vec3 &sceneMax);
+
+        //Release everything
+        void destroy();
+
+        //Work out the cascades and which pages are missing from the cache (CPU only)
+        // lightDirection -> direction the light travels, a change throws away the cache
+        // cameraForward  -> unit view direction
+        // shadowDistance -> shadows end here (or at cameraFar, whichever is closer)
+        void update(const vmath::vec3 &lightDirection, const vmath::vec3 &lightColor,
+                    const vmath::vec3 &cameraPosition, const vmath::vec3 &cameraForward,
+                    float fovy, float aspect, float cameraNear, float cameraFar, float shadowDistance);
+
+        //Start/finish a frame of streamed uploads
+        void beginFrame();
+        void endFrame();
+
+        //Static pages that have to be drawn this frame
+        size_t getDirtyPageCount() const {return dirtyPages.size();}
+
+        //Get ready to draw static geometry into dirty page i, returns the page's light view projection
+        const vmath::mat4& beginPage(size_t i);
+
+        //Copy every cascade's pages out of the cache
+        void composeCascades();
+
+        //Get ready to draw dynamic geometry over cascade c, returns its light view projection
+        const vmath::mat4& beginCascade(int c);
+
+        //Back to the window's framebuffer
+        void endPasses(int width, int height);
+
+        //Stream the cascade uniforms and bind them and the shadow map
+        void upload();
+
+        const shadow_uniforms_t& getUniforms() const {return uniforms;}
+        const shadow_stats_t& getStats() const {return stats;}
+
+    private:
+        //Cached page, keyed by its position in its cascade's page grid
+        struct page_t{
+            int x, y;
+            bool valid;
+            unsigned int lastUsed;  //Frame it was last part of a window
+        };
+
+        //Page waiting to be drawn
+        struct dirty_page_t{
+            int cascade;
+            int layer;              //Cache layer it is drawn into
+            vmath::mat4 viewProjection;
+        };
+
+        //Cache layer holding page (x, y) of a cascade, -1 if it isn't cached
+        int findPage(int cascade, int x, int y) const;
+
+        //Free (or least recently used) cache layer of a cascade
+        int claimPage(int cascade);
+
+        //Orthographic light projection of a rectangle of light space
+        vmath::mat4 lightProjection(float left, float right, float bottom, float top) const;
+
+        void invalidateCache();
+
+        GLuint cascadeTexture;  //SHADOW_CASCADES layers of SHADOW_MAP_SIZE^2
+        GLuint cacheTexture;    //SHADOW_CASCADES * SHADOW_CACHE_PAGES layers of SHADOW_PAGE_SIZE^2
+        GLuint framebuffer;
+        sb7::ring_buffer stream;
+
+        vmath::vec3 sceneMin, sceneMax;
+        vmath::vec3 lightDir;       //What the cache was drawn for
+        vmath::mat4 lightView;      //World to light space (rotation only)
+        float depthNear, depthFar;  //Light space depth range covering the scene
+
+        //Per cascade
+        float pageWorldSize[SHADOW_CASCADES];   //0 until the first update
+        int windowX[SHADOW_CASCADES];           //Page grid position of the window's corner
+        int windowY[SHADOW_CASCADES];
+        page_t pages[SHADOW_CASCADES][SHADOW_CACHE_PAGES];
+        int windowLayers[SHADOW_CASCADES][SHADOW_PAGES_PER_SIDE * SHADOW_PAGES_PER_SIDE];
+
+        std::vector<dirty_page_t> dirtyPages;
+        shadow_uniforms_t uniforms;
+        unsigned int frame;
+        shadow_stats_t stats;
+};
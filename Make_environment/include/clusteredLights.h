@@ -0,0 +1,155 @@
+/*
+* Clustered Lights
+* Light lists for clustered forward shading
+*
+* The view frustum is cut into a grid of clusters: CLUSTER_GRID_X x CLUSTER_GRID_Y
+* screen tiles, each split into CLUSTER_GRID_Z depth slices that grow
+* exponentially with distance (so clusters stay roughly cube shaped). Every
+* frame each light's bounding sphere is tested against the view space box of
+* every cluster it could reach (4 clusters at a time with SSE, lights spread
+* over threads with OpenMP), and the result is stored as one compact list of
+* light indices plus an (offset, count) pair per cluster.
+*
+* A fragment finds its cluster from gl_FragCoord and its view depth, and only
+* loops over that cluster's lights, so the cost per pixel depends on how many
+* lights actually reach it rather than on the number of lights in the scene.
+*
+* bin() only touches CPU memory (it runs in the frame's prepare phase), upload()
+* streams the lists through a ring buffer and binds them.
+*
+* Matching GLSL (see fs.glsl):
+*   layout (std430, binding = 5) readonly buffer LightBlock { Light lights[]; };
+*   layout (std430, binding = 6) readonly buffer ClusterBlock { uvec4 grid; vec4 depthParams; vec4 tileParams; uvec2 clusters[]; };
+*   layout (std430, binding = 7) readonly buffer LightIndexBlock { uint lightIndices[]; };
+*
+* Usage:
+*   lights.create(maxLights, maxIndices);            //Once
+*   lights.bin(sceneLights, view, projection, ...);  //Each frame, before drawing
+*   lights.beginFrame();
+*   lights.upload();
+*   ... draw ...
+*   lights.endFrame();
+*/
+#pragma once
+
+#include <sb7.h>   //OpenGL commands and utilities
+#include <vmath.h> //Graphics utilities
+#include <sb7ringbuffer.h>
+#include <vector>
+#include <stdint.h>
+
+//Binding points shared with the shaders
+enum lightBindings{
+    LIGHT_SSBO_BINDING       = 5,
+    CLUSTER_SSBO_BINDING     = 6,
+    LIGHT_INDEX_SSBO_BINDING = 7
+};
+
+//Cluster grid size (tiles across, tiles down, depth slices)
+//X * Y must be a multiple of 4 so every slice is whole SSE batches
+const int CLUSTER_GRID_X = 16;
+const int CLUSTER_GRID_Y = 9;
+const int CLUSTER_GRID_Z = 24;
+const int CLUSTER_COUNT = CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z;
+
+enum lightTypes{
+    LIGHT_POINT = 0,
+    LIGHT_SPOT  = 1
+};
+
+//One light as the scene describes it (world space)
+struct light_t{
+    vmath::vec3 position;
+    float radius;           //Nothing past this distance is lit
+    vmath::vec3 color;      //Already multiplied by intensity
+    int type;               //lightTypes
+    vmath::vec3 direction;  //Spot only, unit length
+    float cosOuter;         //Spot only, cos of the cone's half angle (edge of the light)
+    float cosInner;         //Spot only, full brightness inside this
+};
+
+//std430 layout of Light in fs.glsl
+struct gpu_light_t{
+    vmath::vec4 positionRadius; //xyz world position, w radius
+    vmath::vec4 colorType;      //rgb color, w type
+    vmath::vec4 direction;      //xyz spot direction, w cosOuter
+    vmath::vec4 spot;           //x cosInner, yzw unused
+};
+
+//std430 header of ClusterBlock, followed by one (offset, count) per cluster
+struct cluster_header_t{
+    GLuint gridX, gridY, gridZ, lightCount;
+    float nearPlane, farPlane;
+    float sliceScale, sliceBias;   //slice = log(viewDepth) * sliceScale - sliceBias
+    float tileWidth, tileHeight;   //In pixels
+    float pad[2];
+};
+
+//What bin() did this frame
+struct cluster_stats_t{
+    size_t lights;          //Lights binned
+    size_t visibleLights;   //Lights that reached at least one cluster
+    size_t indices;         //Entries in the light index list
+    size_t dropped;         //Entries that did not fit in maxIndices
+    size_t usedClusters;    //Clusters with at least one light
+    double binSeconds;      //CPU time spent in bin()
+};
+
+class ClusteredLights{
+    public:
+        ClusteredLights();
+
+        //Allocate the streaming buffer
+        // maxLights  -> most lights bin() will be given
+        // maxIndices -> length of the light index list (every light in every cluster it touches)
+        void create(GLuint maxLights, GLuint maxIndices);
+
+        //Release the buffer
+        void destroy();
+
+        //Put every light into the clusters it touches (CPU only)
+        // view/projection -> camera matrices, projection must be a symmetric perspective
+        void bin(const std::vector<light_t> &lights, const vmath::mat4 &view, const vmath::mat4 &projection,
+                 float nearPlane, float farPlane, int width, int height);
+
+        //Start/finish a frame of streamed uploads
+        void beginFrame();
+        void endFrame();
+
+        //Copy the lists into the stream and bind them to their binding points
+        void upload();
+
+        const cluster_stats_t& getStats() const {return stats;}
+
+    private:
+        //View space box of every cluster, rebuilt when the projection or screen size changes
+        void buildClusterBounds(const vmath::mat4 &projection, float nearPlane, float farPlane, int width, int height);
+
+        //Depth slice of a view space distance
+        int sliceOf(float depth) const;
+
+        //Test one light against the clusters it could touch, appends (cluster, light) pairs
+        void binLight(const light_t &light, uint32_t index, const vmath::mat4 &view, std::vector<uint32_t> &pairs) const;
+
+        GLuint maxLights;
+        GLuint maxIndices;
+        sb7::ring_buffer stream;
+
+        //Cluster boxes (view space), structure of arrays for SSE
+        std::vector<float> boxMinX, boxMinY, boxMinZ;
+        std::vector<float> boxMaxX, boxMaxY, boxMaxZ;
+        vmath::mat4 boundsProjection;       //What the boxes were built for
+        int boundsWidth, boundsHeight;
+
+        //Results of bin(), in GPU layout
+        cluster_header_t header;
+        std::vector<gpu_light_t> gpuLights;
+        std::vector<GLuint> clusterRanges;   //(offset, count) per cluster
+        std::vector<GLuint> lightIndices;
+
+        //Scratch
+        std::vector<std::vector<uint32_t> > jobPairs; //(cluster, light) pairs found by each job
+        std::vector<GLuint> clusterCursor;
+
+        cluster_stats_t stats;
+};
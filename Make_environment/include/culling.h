@@ -0,0 +1,82 @@
+/*
+* Culling
+* Bounding volumes and SIMD view frustum culling
+*
+* Bounds are computed once when a mesh is loaded. Every frame the world space
+* boxes of everything that could be drawn are put into a CullList, which keeps
+* them as separate arrays (structure of arrays) so 4 (SSE) or 8 (AVX) boxes are
+* tested against a frustum plane with a handful of instructions. Long lists
+* are split into blocks that are culled on separate threads (OpenMP).
+*
+* Usage:
+*   frustum_t frustum = extractFrustum(camera.proj_Matrix * camera.view_mat);
+*   list.clear();
+*   list.add(boxMin, boxMax);            //Returns the index of this box
+*   list.cull(frustum, visible, stats);  //visible holds the indices that survived
+*/
+#pragma once
+
+#include <vmath.h>  //Graphics utilities
+#include <vector>
+#include <stdint.h>
+
+//Bounding volumes of a mesh, computed at load time in object space
+struct bounds_t{
+    vmath::vec3 aabbMin; //Axis aligned box
+    vmath::vec3 aabbMax;
+    vmath::vec3 center;  //Bounding sphere (around the box center)
+    float radius;
+};
+
+//Six planes (a,b,c,d) with normals pointing into the frustum
+//A point p is inside a plane when a*p.x + b*p.y + c*p.z + d >= 0
+struct frustum_t{
+    vmath::vec4 planes[6]; //left, right, bottom, top, near, far
+};
+
+//How much work culling did this frame
+struct cull_stats_t{
+    size_t tested;  //Boxes tested
+    size_t visible; //Boxes that survived
+};
+
+//Box and sphere around a list of vertices (like load_obj produces)
+bounds_t computeBounds(const std::vector<vmath::vec4> &vertices);
+
+//World space box of object space bounds moved by transform
+// Uses the absolute value of the rotation/scale part, so the result is tight for boxes
+void transformBounds(const bounds_t &bounds, const vmath::mat4 &transform, vmath::vec3 &worldMin, vmath::vec3 &worldMax);
+
+//Pull the frustum planes out of a projection * view matrix (Gribb/Hartmann)
+frustum_t extractFrustum(const vmath::mat4 &viewProjection);
+
+//Boxes stored as center/extent arrays, ready to be tested in SIMD batches
+class CullList{
+    public:
+        //Forget every box (capacity is kept)
+        void clear();
+
+        //Add a world space box, returns its index
+        uint32_t add(const vmath::vec3 &boxMin, const vmath::vec3 &boxMax);
+
+        //Number of boxes added
+        size_t size() const {return count;}
+
+        //Test every box against the frustum
+        // visible -> cleared then filled with the indices of boxes touching the frustum
+        // stats   -> tested/visible counts are added to whatever is already there
+        void cull(const frustum_t &frustum, std::vector<uint32_t> &visible, cull_stats_t &stats) const;
+
+    private:
+        //Boxes per threaded block (a multiple of 8 so blocks start on a SIMD batch)
+        static const size_t CULL_BLOCK_SIZE = 1024;
+
+        //Test boxes begin..end-1, survivors are appended to visible
+        void cullRange(const frustum_t &frustum, size_t begin, size_t end, std::vector<uint32_t> &visible) const;
+
+        size_t count = 0;
+        //Padded to a multiple of 8 so SIMD loops never need a scalar tail
+        std::vector<float> centerX, centerY, centerZ;
+        std::vector<float> extentX, extentY, extentZ;
+        mutable std::vector<std::vector<uint32_t> > blockVisible; //Per block survivors (scratch for cull)
+};
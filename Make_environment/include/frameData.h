@@ -0,0 +1,88 @@
+/*
+* Frame Data
+* Per-frame uniform buffer and per-object storage buffer
+*
+* Camera matrices are the same for every object, so they are uploaded once a
+* frame into a std140 uniform block. Object transforms are uploaded as one
+* array into a std430 storage buffer and the vertex shader picks its own
+* transform with the draw id (see MeshArena::enableDrawID). Once both are
+* bound, drawing is nothing but draw calls, no glUniform traffic per object.
+*
+* Between beginFrame() and endFrame() all uploads go through a persistently
+* mapped ring buffer (sb7ringbuffer.h) instead of glBufferSubData, so the CPU
+* never waits for the GPU to finish with last frame's data: the camera block
+* is bound straight out of the ring, and transforms are written into the ring
+* and copied into the object buffer on the GPU. Outside a frame (startup)
+* uploads fall back to glBufferSubData, and so does anything that doesn't
+* fit in this frame's part of the ring.
+*
+* Matching GLSL (see vs.glsl):
+*   layout (std140, binding = 0) uniform FrameBlock { ... } frame;
+*   layout (std430, binding = 1) readonly buffer ObjectBlock { mat4 obj2world[]; };
+*/
+#pragma once
+
+#include <sb7.h>   //OpenGL commands and utilities
+#include <vmath.h> //Graphics utilities
+#include <sb7ringbuffer.h>
+
+//Binding points shared with the shaders
+enum frameBindings{
+    FRAME_UBO_BINDING   = 0,
+    OBJECT_SSBO_BINDING = 1
+};
+
+//std140 layout of FrameBlock
+//Every member is a multiple of 16 bytes so C++ and GLSL agree without extra padding rules
+struct frame_uniforms_t{
+    vmath::mat4 view;           //World to camera
+    vmath::mat4 projection;     //Camera to clip
+    vmath::mat4 viewProjection; //projection * view, saves a multiply per vertex
+    vmath::vec4 cameraPosition; //World space, w unused
+    float time;                 //Simulated seconds of the frame being drawn (interpolated between ticks)
+    float pad[3];               //Round the block up to a vec4
+};
+
+class FrameData{
+    public:
+        FrameData();
+
+        //Create the uniform and storage buffers
+        // maxObjects         -> number of transforms the object buffer can hold
+        // maxStreamedObjects -> most transforms uploaded inside one frame (the ring is sized for these,
+        //                       static ranges uploaded once at startup don't count)
+        // extraBytes         -> room left in the ring each frame for others to stream through it (draw commands)
+        void create(GLuint maxObjects, GLuint maxStreamedObjects, GLsizeiptr extraBytes = 0);
+
+        //Release the buffers
+        void destroy();
+
+        //Start/finish a frame of streamed uploads
+        void beginFrame();
+        void endFrame();
+
+        //Upload this frame's camera info (call once per frame)
+        void updateFrame(const frame_uniforms_t &frame);
+
+        //Upload object transforms, transform i is read by draw id first + i
+        //Static transforms (like maze walls) can be uploaded once into their own range
+        // returns the number actually uploaded (clamped to maxObjects)
+        GLuint updateObjects(const vmath::mat4* transforms, GLuint count, GLuint first = 0);
+
+        //Bind both buffers to their binding points
+        void bind() const;
+
+        GLuint getMaxObjects() const {return maxObjects;}
+
+        //Streaming buffer, for its fence wait counters and for anything else streamed each frame (extraBytes)
+        const sb7::ring_buffer& getStream() const {return stream;}
+        sb7::ring_buffer& getStream() {return stream;}
+
+    private:
+        GLuint frameBuffer;  //Uniform buffer holding frame_uniforms_t (used outside a frame)
+        GLuint objectBuffer; //Storage buffer holding mat4[maxObjects]
+        GLuint maxObjects;
+        sb7::ring_buffer stream; //Per-frame uploads
+        bool frameStreamed;      //This frame's camera block lives in the ring at frameOffset
+        GLintptr frameOffset;
+};
@@ -0,0 +1,69 @@
+/*
+* G-Buffer
+* Render targets for deferred shading
+*
+* Two RGBA8 color targets and a depth texture, 12 bytes a pixel:
+*   target 0 -> rg octahedral encoded world normal, b roughness, a metalness
+*   target 1 -> rgb albedo, a ambient visibility (see vertexTransfer.h)
+*   depth    -> 32 bit float, positions are rebuilt from it in the light pass
+*
+* Octahedral encoding folds the unit sphere onto a square, so a normal fits in two
+* 8 bit channels with under a degree of error instead of three 16 bit ones.
+*
+* The scene is drawn into the G-buffer once (gbuffer_fs.glsl), then a single full
+* screen pass (deferred_fs.glsl) reads it back and does all the lighting, using the
+* same clustered light lists as forward shading (see clusteredLights.h).
+*
+* Usage:
+*   gbuffer.create(width, height);   //Once
+*   gbuffer.resize(width, height);   //Each frame, only re-allocates when the size changed
+*   gbuffer.bindForWrite();          //Then clear and draw the scene
+*   gbuffer.bindForRead();           //Back to the window, G-buffer on its texture units
+*   ... full screen light pass ...
+*/
+#pragma once
+
+#include <sb7.h>   //OpenGL commands and utilities
+
+//Texture units the light pass reads the G-buffer from (0 and 1 are the scene texture and the shadow map)
+enum gBufferUnits{
+    GBUFFER_NORMAL_UNIT = 2,
+    GBUFFER_ALBEDO_UNIT = 3,
+    GBUFFER_DEPTH_UNIT  = 4
+};
+
+class GBuffer{
+    public:
+        GBuffer();
+
+        //Allocate the targets and the framebuffer
+        void create(int width, int height);
+
+        //Release everything
+        void destroy();
+
+        //Re-allocate the targets if the window size changed
+        void resize(int width, int height);
+
+        //Draw into the G-buffer (viewport set to its size)
+        void bindForWrite();
+
+        //Draw into the window again, with the targets bound to their texture units
+        void bindForRead();
+
+        //Utility information
+        GLuint getFramebuffer() const {return framebuffer;}
+        int getWidth() const {return width;}
+        int getHeight() const {return height;}
+        size_t getBytes() const {return static_cast<size_t>(width) * height * 12;}
+
+    private:
+        //Textures for the current size
+        void allocateTargets();
+
+        GLuint framebuffer;
+        GLuint normalTexture;   //RGBA8
+        GLuint albedoTexture;   //RGBA8
+        GLuint depthTexture;    //DEPTH_COMPONENT32F
+        int width, height;
+};
@@ -0,0 +1,82 @@
+/*
+* GPU Culling
+* Frustum culling and draw command generation on the GPU
+*
+* Every instance (mesh + world box + transform index) is uploaded once into a
+* storage buffer. Each frame a compute shader (cull_cs.glsl) tests all of them
+* against the frustum and writes one indirect draw command per survivor, and
+* the draws are issued straight from that buffer. The CPU only sets six plane
+* uniforms, dispatches and draws, so its cost no longer depends on how many
+* instances there are.
+*
+* With GL_ARB_indirect_parameters the survivors are packed to the front and
+* the draw count comes from a GPU buffer (glMultiDrawElementsIndirectCountARB).
+* Without it every instance keeps its own slot and culled ones are written
+* with zero instances, so the plain multi-draw over all slots draws nothing
+* for them.
+*
+* Usage:
+*   culler.create(cullProgram, instances);  //Once, program linked from cull_cs.glsl
+*   culler.cull(frustum);                   //Each frame, before drawing
+*   arena.bind();
+*   culler.draw();                          //With the scene program bound
+*/
+#pragma once
+
+#include <sb7.h>       //OpenGL commands and utilities
+#include <vmath.h>     //Graphics utilities
+#include <meshArena.h> //mesh_t
+#include <culling.h>   //frustum_t
+#include <vector>
+
+//Binding points used by cull_cs.glsl
+enum gpuCullBindings{
+    INSTANCE_SSBO_BINDING = 2,
+    COMMAND_SSBO_BINDING  = 3,
+    COUNT_SSBO_BINDING    = 4
+};
+
+//One instance, std430 layout of Instance in cull_cs.glsl
+struct gpu_instance_t{
+    vmath::vec4 center;   //World space box center
+    vmath::vec4 extent;   //World space half size
+    GLuint firstIndex;    //Mesh to draw
+    GLuint indexCount;
+    GLint  baseVertex;
+    GLuint drawID;        //Transform index (baseInstance)
+};
+
+//Fill in an instance of mesh covering the world box boxMin..boxMax
+gpu_instance_t makeGpuInstance(const mesh_t &mesh, const vmath::vec3 &boxMin, const vmath::vec3 &boxMax, GLuint drawID);
+
+class GpuCuller{
+    public:
+        GpuCuller();
+
+        //Upload the instances and make the command/count buffers
+        // program -> linked compute program from cull_cs.glsl (owned by the caller)
+        void create(GLuint program, const std::vector<gpu_instance_t> &instances);
+
+        //Release the buffers
+        void destroy();
+
+        //Dispatch the culling shader for this frame
+        void cull(const frustum_t &frustum);
+
+        //Draw the survivors (arena vao and scene program must be bound)
+        void draw();
+
+        GLuint getInstanceCount() const {return instanceCount;}
+        bool usesIndirectCount() const {return indirectCount;}
+
+    private:
+        GLuint program;
+        GLuint instanceBuffer;  //gpu_instance_t[instanceCount]
+        GLuint commandBuffer;   //draw_elements_indirect_t[instanceCount]
+        GLuint countBuffer;     //One uint, the number of commands written
+        GLuint instanceCount;
+        bool indirectCount;     //glMultiDrawElementsIndirectCountARB is available
+        GLint planesLocation;
+        GLint numInstancesLocation;
+        GLint compactLocation;
+};
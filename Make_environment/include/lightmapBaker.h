@@ -0,0 +1,124 @@
+/*
+* Lightmap Baker
+* Bakes the light that never changes on the static maze mesh into one texture
+*
+* Runs once at startup, on the CPU, on every core:
+*   unwrap  -> every quad of the maze mesh (see mazeGeometry.h) gets its own rectangle
+*              (chart) in the atlas, packed in shelves, and its lightmapUV written
+*   trace   -> each texel path traces the sky cube and the sun through a BVH of the
+*              mesh (see pathTrace.h), with settings.bounces bounces of indirect light
+*   denoise -> a few a-trous passes that stay inside a chart and stop at edges in
+*              the lighting (weighted by each texel's sample variance)
+*   dilate  -> the gutter around each chart, and texels that ended up inside a wall,
+*              are filled from their neighbours so bilinear filtering never sees black
+*
+* A texel stores incoming light already divided by pi, so shading is albedo * lightmap,
+* the same scale fs.glsl uses for the sun (lightColor * albedo * N.L).
+*
+* Every texel has its own random sequence, seeded from its position and settings.seed,
+* so a bake gives the same texture no matter how many threads ran it.
+*
+* Usage:
+*   LightmapBaker baker;
+*   baker.bake(vertices, indices, sky, defaultLightmapSettings()); //Before the mesh is uploaded, fills in lightmapUV
+*   GLuint lightmap = baker.createTexture();                      //RGBA16F, bind on LIGHTMAP_TEXTURE_UNIT
+*   baker.save(".\\bin\\media\\lightmap.ktx");
+*/
+#pragma once
+
+#include <sb7.h>        //OpenGL commands and utilities
+#include <vmath.h>      //Graphics utilities
+#include <meshArena.h>  //arena_vertex_t
+#include <skybox.h>     //sky_cube_t
+#include <bvh.h>
+#include <vector>
+
+//Texture unit lightmap_fs.glsl reads the lightmap from (0-4 are taken, see gBuffer.h)
+enum lightmapBindings{
+    LIGHTMAP_TEXTURE_UNIT = 5
+};
+
+//What to bake and how hard to try
+struct lightmap_settings_t{
+    float texelsPerUnit;        //Lightmap resolution in texels per world unit
+    int atlasWidth;             //Texels, the height grows to fit
+    int padding;                //Gutter texels around each chart
+    int samples;                //Paths per texel
+    int bounces;                //Times light may reflect before reaching a texel (0 = sky and sun only)
+    int denoisePasses;          //A-trous passes, each one twice as wide (0 turns the denoiser off)
+    vmath::vec3 sunDirection;   //Direction the sun's light travels
+    vmath::vec3 sunColor;
+    float skyIntensity;         //Scale on the sky cube's colors
+    vmath::vec3 albedo;         //Reflectance of every surface (matches fs.glsl)
+    unsigned int seed;
+};
+
+//Settings that look right for the maze and bake in a few seconds
+lightmap_settings_t defaultLightmapSettings();
+
+//What the last bake did
+struct lightmap_stats_t{
+    int width, height;          //Atlas size in texels
+    size_t charts;
+    size_t texels;              //Texels that were traced (gutters excluded)
+    size_t rays;                //Every ray cast, shadow rays included
+    int threads;
+    double unwrapSeconds;
+    double bvhSeconds;
+    double traceSeconds;
+    double denoiseSeconds;      //Denoise and dilate
+    double totalSeconds;
+};
+
+class LightmapBaker{
+    public:
+        LightmapBaker();
+
+        //Unwrap, trace, denoise and dilate
+        // vertices -> the static mesh, made of quads of 4 vertices each (origin, +u, +u+v, +v), lightmapUV is written
+        // indices  -> 6 per quad
+        // sky      -> light arriving from everything the rays don't hit
+        void bake(std::vector<arena_vertex_t> &vertices, const std::vector<GLuint> &indices,
+                  const sky_cube_t &sky, const lightmap_settings_t &settings);
+
+        //Upload the result as an immutable RGBA16F texture (linear filtering, no mips, they would bleed across charts)
+        GLuint createTexture() const;
+
+        //Write the result to a KTX file, false if it couldn't be written
+        bool save(const char *filename) const;
+
+        //Baked rgb, width * height * 3 floats
+        const std::vector<float>& getTexels() const {return texels;}
+        const lightmap_stats_t& getStats() const {return stats;}
+
+    private:
+        //One quad's rectangle in the atlas
+        struct chart_t{
+            vmath::vec3 origin, edgeU, edgeV;   //World space quad
+            vmath::vec3 normal;
+            int x, y;                           //Atlas corner of the first (non gutter) texel
+            int width, height;                  //Texels, gutters excluded
+        };
+
+        //Give every quad a chart and write the uvs
+        void unwrap(std::vector<arena_vertex_t> &vertices, const lightmap_settings_t &settings);
+
+        //Path trace every chart texel
+        void trace(const sky_cube_t &sky, const lightmap_settings_t &settings);
+
+        //Edge stopping a-trous passes inside each chart
+        void denoise(const lightmap_settings_t &settings);
+
+        //Grow every chart into its gutter and over texels marked invalid
+        void dilate(const lightmap_settings_t &settings);
+
+        TriangleBVH bvh;
+        std::vector<vmath::vec3> triangleNormals;   //Per triangle, to tell back faces apart
+        std::vector<chart_t> charts;
+        int width, height;
+        std::vector<float> texels;      //rgb
+        std::vector<float> variance;    //Of each texel's mean luminance
+        std::vector<int> texelChart;    //Chart owning each texel (gutters included), -1 for none
+        std::vector<char> texelValid;   //Traced and not inside a wall
+        lightmap_stats_t stats;
+};
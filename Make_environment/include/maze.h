@@ -1,5 +1,7 @@
+#pragma once
+
 #include<iostream>
-#include<map>
+#include<vector>
 #include<time.h>
 
 //Class for the maze
@@ -20,15 +22,12 @@ class Maze{
             mazeWidth = width;
             mazeHeight = height;
 
-            for(int i = 0; i < mazeHeight; i++){
-                for(int j = 0; j < mazeWidth; j++){
-                    maze.insert(std::pair<std::pair<int, int>, mazeTiles>(std::pair<int, int>(i, j), empty));
-                }
-            }
+            //One flat row-major array, this keeps big mazes (1000x1000) cheap to build and look up
+            maze.assign(mazeWidth * mazeHeight, empty);
 
             //Add start and end in opposite corners of the maze
-            maze.at(std::pair<int, int>(0, 0)) = start;
-            maze.at(std::pair<int, int>(mazeHeight - 1, mazeWidth - 1)) = end;
+            at(0, 0) = start;
+            at(mazeHeight - 1, mazeWidth - 1) = end;
 
             //Generate the maze
             generateMaze(0, mazeWidth - 1, 0, mazeHeight - 1, (bool)(rand() % 2));
@@ -62,7 +61,7 @@ class Maze{
                 //Set all tiles in the subsection at that split to wall tiles
                 for(int i = startHeight; i < endHeight + 1; i++){
                     if(i != splitConnection){
-                        maze.at(std::pair<int, int>(i, splitAt)) = wall;
+                        at(i, splitAt) = wall;
                     }
                 }
                 
@@ -84,7 +83,7 @@ class Maze{
                 //Set all tiles in the subsection at that split to wall tiles
                 for(int i = startWidth; i < endWidth + 1; i++){
                     if(i != splitConnection){
-                        maze.at(std::pair<int, int>(splitAt, i)) = wall;
+                        at(splitAt, i) = wall;
                     }
                 }
 
@@ -137,11 +136,21 @@ class Maze{
         int getWidth() {return mazeWidth;}
         int getHeight() {return mazeHeight;}
         //Get a tile in the maze
-        mazeTiles getTile(int x, int z){ return maze.at(std::pair<int, int>(z, x));}
+        mazeTiles getTile(int x, int z){ return maze[z * mazeWidth + x];}
+        //True for wall tiles, anything outside the maze counts as the outer wall
+        bool isWall(int x, int z){
+            if(x < 0 || z < 0 || x >= mazeWidth || z >= mazeHeight){
+                return true;
+            }
+            return getTile(x, z) == wall;
+        }
 
     private:
         int mazeWidth = 0;
         int mazeHeight = 0;
-        //key is width then height for the pair
-        std::map<std::pair<int, int>, mazeTiles> maze;
+        //Tiles stored row by row, tile (x, z) is at z * mazeWidth + x
+        std::vector<mazeTiles> maze;
+
+        //Access by (height, width) to match the order generateMaze works in
+        mazeTiles& at(int row, int col){ return maze[row * mazeWidth + col];}
 };
\ No newline at end of file
@@ -0,0 +1,71 @@
+/*
+* Maze Geometry
+* Turns the Maze tile grid into things that can be drawn
+*
+* Tile (x, z) sits at world ((x + 1) * MAZE_TILE_SIZE, 0, (z + 1) * MAZE_TILE_SIZE),
+* so the outer boundary ring (x or z of -1 / width / height) starts at the world origin.
+* Wall pieces are the 2x2x2 cube from cube.obj, which exactly fills one tile.
+*/
+#pragma once
+
+#include <maze.h>
+#include <meshArena.h> //arena_vertex_t / mesh_t
+#include <vmath.h>     //Graphics utilities
+#include <vector>
+
+//Width (and depth) of one maze tile in world units
+const float MAZE_TILE_SIZE = 2.0f;
+//Walls run from -MAZE_WALL_HALF_HEIGHT to +MAZE_WALL_HALF_HEIGHT in y (same as cube.obj)
+const float MAZE_WALL_HALF_HEIGHT = 1.0f;
+
+//A square block of tiles inside the static maze mesh
+//Chunks are contiguous index ranges so they can be drawn (or culled) on their own
+struct maze_chunk_t{
+    mesh_t mesh;              //Sub range of the maze mesh (filled in when the maze mesh is added to an arena)
+    GLuint firstIndex;        //Offset into the indices built by buildMazeMesh
+    GLuint indexCount;
+    vmath::vec3 boundsMin;    //World space box around every quad in the chunk
+    vmath::vec3 boundsMax;
+    int tileX0, tileZ0;       //Tile range covered by the chunk (inclusive, boundary ring included)
+    int tileX1, tileZ1;
+};
+
+//How much the mesher saved
+struct maze_mesh_stats_t{
+    size_t wallTiles;      //Wall tiles including the boundary ring
+    size_t cubeTriangles;  //Triangles if every wall tile was a full cube
+    size_t quads;          //Quads after merging and face culling (floor included)
+    size_t triangles;      //quads * 2
+};
+
+//World space center of tile (x, z), works for the boundary ring too
+vmath::vec3 mazeTileToWorld(int x, int z);
+
+//Tile containing a world space position (may be outside the maze)
+void worldToMazeTile(float worldX, float worldZ, int &x, int &z);
+
+//One transform per wall cube: every interior wall tile plus the outer boundary ring
+// transforms is cleared and filled, ready to be uploaded as per-instance data
+void buildWallTransforms(Maze &maze, std::vector<vmath::mat4> &transforms);
+
+//Build a single static mesh for every wall in the maze (world space, no transform needed)
+// Only wall faces touching an empty tile are kept, faces between two walls, tops and bottoms
+// can never be seen from inside the maze and are dropped. Each chunk gets one floor quad.
+// Every quad is 4 vertices and 6 indices of its own, so the mesh can be unwrapped per quad (see lightmapBaker.h)
+// Neighbouring faces that line up are merged into one long quad (greedy meshing),
+// uvs are taken from world position so textures line up across merged quads.
+// chunkSize -> tiles per chunk side, quads never cross a chunk so chunks can be culled
+// vertices/indices/chunks are cleared and filled, stats is optional
+void buildMazeMesh(Maze &maze, int chunkSize,
+                   std::vector<arena_vertex_t> &vertices,
+                   std::vector<GLuint> &indices,
+                   std::vector<maze_chunk_t> &chunks,
+                   maze_mesh_stats_t* stats = NULL);
+
+//Point each chunk's mesh at its range inside mazeMesh (after the maze mesh was added to an arena)
+void setMazeChunkMeshes(const mesh_t &mazeMesh, std::vector<maze_chunk_t> &chunks);
+
+//Boxes covering every wall tile (boundary ring included) with as few boxes as possible
+// Walls are merged into runs along x first, whatever is left over is merged along z.
+// Used as occluders (see occlusion.h), boxMin/boxMax are cleared and filled in world space
+void buildWallRuns(Maze &maze, std::vector<vmath::vec3> &boxMin, std::vector<vmath::vec3> &boxMax);
@@ -0,0 +1,86 @@
+/*
+* Maze Visibility
+* Precomputed potentially visible sets (PVS) for every empty maze cell
+*
+* The maze never changes after it is generated, so which tiles can be seen
+* from which cell can be worked out once at startup. For each empty cell the
+* maze is flooded outwards (up to a view distance) from edge to edge between
+* open tiles, keeping only the part of each edge a straight line from the cell
+* can still reach through all the edges before it. Whole tiles and whole cell
+* edges are tested, never sample points, so nothing that can be seen from
+* anywhere in the cell is missed (the set may hold a few tiles too many).
+* Cells are processed in parallel (OpenMP, when available).
+*
+* Each cell's set is stored as the window of tiles it covers plus run lengths
+* of visible/hidden tiles inside that window, which is tiny in a maze.
+*
+* At runtime the camera's cell is decoded once each time the camera changes
+* cells, and anything (maze chunks, objects) not touching a visible tile can be
+* thrown away before any frustum test.
+*
+* Tiles use maze coordinates, the boundary ring (-1 / width / height) included.
+*/
+#pragma once
+
+#include <maze.h>
+#include <vector>
+#include <stdint.h>
+
+//Decoded visible set of one cell
+struct pvs_window_t{
+    int x0, z0;                  //First tile of the window
+    int width, height;           //Window size in tiles
+    std::vector<uint8_t> bits;   //1 if tile (x0 + i, z0 + j) is visible, row major
+
+    //Is tile (x, z) visible (anything outside the window is not)
+    bool test(int x, int z) const {
+        int i = x - x0;
+        int j = z - z0;
+        if(i < 0 || j < 0 || i >= width || j >= height){
+            return false;
+        }
+        return bits[j * width + i] != 0;
+    }
+
+    //Is any tile in the inclusive range visible
+    bool testRange(int tx0, int tz0, int tx1, int tz1) const;
+};
+
+//Numbers from the last build
+struct pvs_stats_t{
+    size_t cells;           //Empty cells with a PVS
+    size_t visibleTiles;    //Sum of visible tiles over every cell
+    size_t rawBytes;        //Size as one plain bitset over the whole grid per cell
+    size_t compressedBytes; //Size as stored
+    double buildSeconds;    //Wall clock time to build
+};
+
+class MazePVS{
+    public:
+        //Build the PVS for every empty cell
+        // maxDistance -> view distance in tiles from the camera, nothing farther is ever visible (the
+        //                far plane's corners, not its center), padded inside for the camera and tile sizes
+        void build(Maze &maze, float maxDistance);
+
+        //Is there a PVS for the cell (false for walls and outside the maze)
+        bool has(int x, int z) const;
+
+        //Decode the visible set of cell (x, z), returns false if the cell has none
+        bool decode(int x, int z, pvs_window_t &window) const;
+
+        const pvs_stats_t& getStats() const {return stats;}
+
+    private:
+        //One cell's compressed set
+        struct cell_t{
+            int32_t x0, z0;             //Window of tiles the set covers
+            int32_t width, height;
+            std::vector<uint16_t> runs; //Alternating hidden/visible run lengths, starting with hidden
+        };
+
+        int mazeWidth = 0;
+        int mazeHeight = 0;
+        std::vector<cell_t> cells;      //mazeWidth * mazeHeight, empty runs for wall cells
+        std::vector<uint8_t> hasSet;    //1 if cells[i] is valid
+        pvs_stats_t stats;
+};
@@ -0,0 +1,178 @@
+/*
+* Mesh Arena
+* Shared vertex/index storage for every mesh of one vertex format
+*
+* Instead of every object owning its own vertex buffers and VAO, meshes are
+* suballocated inside one large vertex buffer and one large index buffer.
+* A single VAO describes the format, so switching between meshes only changes
+* the draw parameters (first index / base vertex), and different meshes can be
+* batched together with one multi-draw call.
+*
+* Usage:
+*   MeshArena arena;
+*   arena.create(standardVertexFormat(), maxVertices, maxIndices);
+*   arena.addMesh(verts.data(), verts.size(), indices.data(), indices.size(), mesh);
+*   arena.bind();
+*   arena.draw(mesh);
+*
+* Depth-only passes can use a second, position-only copy of the vertices
+* (enablePositionStream() before adding meshes, then bindPositionOnly()).
+* Tightly packed positions are 12 bytes a vertex instead of the full
+* interleaved vertex, so the vertex fetch of a depth prepass reads far less.
+* Meshes keep the same handles, both vaos share the index buffer and draw ids.
+*/
+#pragma once
+
+#include <sb7.h>   //OpenGL commands and utilities
+#include <vmath.h> //Graphics utilities
+#include <vector>  //Attribute lists and mesh data
+#include <sb7ringbuffer.h>
+
+//Fixed attribute locations, these match the layout(location = N) in vs.glsl
+enum arenaAttribs{
+    ATTRIB_POSITION = 0,
+    ATTRIB_NORMAL   = 1,
+    ATTRIB_UV       = 2,
+    ATTRIB_DRAW_ID  = 3, //Per-instance, equals baseInstance + gl_InstanceID (see enableDrawID)
+    ATTRIB_LIGHTMAP_UV = 4, //Unique (non repeating) uvs into a baked lightmap, (0,0) when there is none
+    ATTRIB_TRANSFER = 5,    //Baked ambient occlusion / bent normal, all 0 when there is none (see vertexTransfer.h)
+    ATTRIB_JOINTS   = 6,    //Skinned meshes only, 4 joint indices (see skinning.h)
+    ATTRIB_WEIGHTS  = 7     //Skinned meshes only, 4 weights
+};
+
+//One attribute inside an interleaved vertex
+struct vertex_attrib_t{
+    GLuint location;      //Shader attribute location
+    GLint components;     //Number of components (1-4)
+    GLenum type;          //GL_FLOAT, GL_UNSIGNED_BYTE, ...
+    GLboolean normalized; //Normalize integer data to [0,1] / [-1,1]
+    GLuint offset;        //Byte offset from the start of the vertex
+};
+
+//Describes the layout of one interleaved vertex
+struct vertex_format_t{
+    GLuint stride;                        //Size of one vertex in bytes
+    std::vector<vertex_attrib_t> attribs; //Every attribute inside the vertex
+};
+
+//Vertex used by the standard (obj file) format
+struct arena_vertex_t{
+    vmath::vec4 position;
+    vmath::vec4 normal;
+    vmath::vec2 uv;
+    vmath::vec2 lightmapUV; //See lightmapBaker.h
+    signed char transfer[4];//See vertexTransfer.h
+};
+
+//Handle to a mesh living inside an arena
+//Everything needed to draw it is here, no GL objects are owned by the mesh
+struct mesh_t{
+    GLuint firstIndex;  //Offset (in indices) into the arena index buffer
+    GLuint indexCount;  //Number of indices making up the mesh
+    GLint  baseVertex;  //Offset (in vertices) added to every index
+    GLuint vertexCount; //Number of unique vertices used by the mesh
+};
+
+//Layout of one command in a GL_DRAW_INDIRECT_BUFFER (glMultiDrawElementsIndirect)
+struct draw_elements_indirect_t{
+    GLuint count;         //Number of indices
+    GLuint instanceCount; //Number of instances
+    GLuint firstIndex;    //Offset (in indices) into the index buffer
+    GLint  baseVertex;    //Added to every index
+    GLuint baseInstance;  //First value of the draw id attribute
+};
+
+//Position / normal / uv / lightmap uv / transfer format matching arena_vertex_t
+vertex_format_t standardVertexFormat();
+
+//Turn a triangle soup (like load_obj produces) into unique vertices + indices
+// Identical position/normal/uv triplets are welded together
+// outVertices and outIndices are cleared before being filled
+void indexTriangles(const std::vector<vmath::vec4> &vertices,
+                    const std::vector<vmath::vec4> &normals,
+                    const std::vector<vmath::vec2> &uvs,
+                    std::vector<arena_vertex_t> &outVertices,
+                    std::vector<GLuint> &outIndices);
+
+class MeshArena{
+    public:
+        MeshArena();
+
+        //Allocate GPU storage for the arena, sizes are fixed after this
+        // format      -> layout of one vertex
+        // maxVertices -> capacity of the vertex buffer (in vertices)
+        // maxIndices  -> capacity of the index buffer (in indices)
+        void create(const vertex_format_t &format, GLuint maxVertices, GLuint maxIndices);
+
+        //Release all GL objects, every mesh_t handed out becomes invalid
+        void destroy();
+
+        //Copy a mesh into the arena
+        // vertices must be laid out as described by the arena's format
+        // indices are relative to the first vertex of this mesh
+        // returns false (and leaves mesh untouched) if the arena is full
+        bool addMesh(const void* vertices, GLuint vertexCount,
+                     const GLuint* indices, GLuint indexCount,
+                     mesh_t &mesh);
+
+        //Add a per-instance uint attribute counting 0,1,2,... to the vao
+        //Because it advances once per instance, the shader sees baseInstance + gl_InstanceID,
+        //which lets a draw (or a multi-draw sub command) index per-object data in a buffer
+        // location -> shader attribute location (ATTRIB_DRAW_ID)
+        // maxDraws -> largest baseInstance + instanceCount that will be used
+        void enableDrawID(GLuint location, GLuint maxDraws);
+
+        //Keep a tightly packed copy of every vertex position in its own buffer and vao
+        //Must be called before any mesh is added, the format's ATTRIB_POSITION must be 3+ floats
+        // maxVertices are the same as the main vertex buffer
+        void enablePositionStream();
+
+        //Bind the shared VAO, this only needs to happen once for any number of meshes
+        void bind() const;
+
+        //Bind the position-only VAO (falls back to the full one without a position stream)
+        void bindPositionOnly() const;
+        bool hasPositionStream() const {return positionVao != 0;}
+
+        //Draw one mesh (arena must be bound)
+        void draw(const mesh_t &mesh, GLuint instanceCount = 1, GLuint baseInstance = 0) const;
+
+        //Draw several meshes with a single call (arena must be bound)
+        // baseInstances -> draw id given to each mesh, NULL means mesh i gets draw id i
+        // stream        -> ring buffer inside its frame to write the indirect commands into, NULL (or full)
+        //                  uses the arena's own command buffer with glBufferSubData
+        void multiDraw(const mesh_t* meshes, GLsizei count, const GLuint* baseInstances = NULL, sb7::ring_buffer* stream = NULL);
+
+        //Utility information
+        GLuint getVAO() const {return vao;}
+        GLuint getVertexBuffer() const {return vertexBuffer;}
+        GLuint getIndexBuffer() const {return indexBuffer;}
+        GLuint getUsedVertices() const {return usedVertices;}
+        GLuint getUsedIndices() const {return usedIndices;}
+        const vertex_format_t& getFormat() const {return format;}
+
+    private:
+        vertex_format_t format;
+
+        GLuint vao;
+        GLuint vertexBuffer;
+        GLuint indexBuffer;
+        GLuint drawIDBuffer;    //0,1,2,... used by the draw id attribute
+        GLuint indirectBuffer;  //Commands written by multiDraw when there is no stream to put them in
+        GLuint positionVao;     //Position (+ draw id) only, see enablePositionStream
+        GLuint positionBuffer;  //vec3 per vertex, same vertex numbering as vertexBuffer
+        GLuint drawIDLocation;
+        GLsizei indirectCapacity;
+
+        GLuint maxVertices;  //Capacity
+        GLuint maxIndices;
+        GLuint usedVertices; //Bump allocation cursors
+        GLuint usedIndices;
+
+        //Scratch space for multiDraw so it doesn't allocate every call
+        std::vector<draw_elements_indirect_t> scratchCommands;
+        std::vector<float> scratchPositions; //addMesh, positions pulled out of the interleaved vertices
+
+        //Point location at the draw id buffer in the bound vao
+        void setDrawIDAttrib(GLuint location);
+};
@@ -0,0 +1,93 @@
+/*
+* Occlusion
+* Software rasterized occlusion culling
+*
+* A handful of big, nearby occluders (maze wall runs) are rasterized on the CPU
+* into a small depth buffer, then everything that survived frustum culling is
+* tested against it before a draw is issued. Nothing is read back from the GPU,
+* so the result is ready in the same frame without any stall.
+*
+* The buffer is split into tiles that are rasterized in parallel (OpenMP), each
+* tile walking its pixels 4 at a time with SSE edge functions. Once every
+* occluder is in, a max-depth mip chain is built so a box only ever has to
+* look at a few texels no matter how big it is on screen.
+*
+* Depth is z/w mapped to 0 (near) .. 1 (far), the buffer clears to 1.
+*
+* Usage:
+*   buffer.create(256, 128);                      //Once
+*   buffer.beginFrame();                          //Each frame
+*   buffer.addOccluder(boxMin, boxMax);           //Nearest few occluders
+*   buffer.render(viewProjection);                //Rasterize + build the mip chain
+*   if(buffer.testBox(boxMin, boxMax)) draw...;   //False when completely hidden
+*/
+#pragma once
+
+#include <vmath.h>  //Graphics utilities
+#include <vector>
+#include <stdint.h>
+
+//Counters for the current frame
+struct occlusion_stats_t{
+    size_t occluders;  //Boxes rasterized
+    size_t triangles;  //Triangles that made it to the rasterizer (after near clipping)
+    size_t tested;     //Boxes tested
+    size_t occluded;   //Boxes found to be hidden
+};
+
+class OcclusionBuffer{
+    public:
+        //Allocate the depth buffer, width is rounded up to the tile size
+        // width/height -> resolution in pixels, does not need to match the window (it covers the same NDC range)
+        void create(int width, int height);
+
+        //Forget last frame's occluders and counters
+        void beginFrame();
+
+        //Queue a world space box as an occluder
+        void addOccluder(const vmath::vec3 &boxMin, const vmath::vec3 &boxMax);
+
+        //Rasterize every queued occluder and build the max-depth mip chain
+        void render(const vmath::mat4 &viewProjection);
+
+        //Could any part of a world space box be visible (conservative, true when unsure)
+        //Safe to call from several threads at once after render()
+        bool testBox(const vmath::vec3 &boxMin, const vmath::vec3 &boxMax);
+
+        int getWidth() const {return width;}
+        int getHeight() const {return height;}
+        const occlusion_stats_t& getStats() const {return stats;}
+
+        //Depth of one mip level (0 is full resolution), for debugging
+        const std::vector<float>& getDepth(int level) const {return levels[level];}
+
+    private:
+        //Triangle in screen space, ready to rasterize
+        struct screen_tri_t{
+            float x[3], y[3], z[3];
+            int minX, minY, maxX, maxY; //Pixel bounds (inclusive, clamped to the screen)
+        };
+
+        //Near clip and project one clip space triangle
+        void addTriangle(const vmath::vec4 &a, const vmath::vec4 &b, const vmath::vec4 &c);
+        //Rasterize every triangle touching one tile
+        void rasterizeTile(int tileX, int tileY);
+        //Max-depth mips from level 0
+        void buildHierarchy();
+
+        static const int TILE_WIDTH = 32;  //Multiple of 4 (SSE width)
+        static const int TILE_HEIGHT = 16;
+
+        int width = 0;
+        int height = 0;
+        int tilesX = 0;
+        int tilesY = 0;
+        float viewProjection[16];                 //Column major copy for transforming box corners
+        std::vector<vmath::vec3> occluderMin;
+        std::vector<vmath::vec3> occluderMax;
+        std::vector<screen_tri_t> triangles;
+        std::vector<std::vector<float> > levels;  //levels[0] is the depth buffer, each next one is half the size
+        std::vector<int> levelWidth;
+        std::vector<int> levelHeight;
+        occlusion_stats_t stats;
+};
@@ -0,0 +1,52 @@
+/*
+* Path Trace
+* The radiance kernel shared by the CPU bakers (lightmapBaker.h, probeGrid.h)
+*
+* A path leaves a point along a direction through a BVH of the static mesh: where it
+* escapes it picks up the sky, where it hits the front of a surface it picks up that
+* surface's sun (one shadow ray) and carries on in a cosine weighted direction, losing
+* the surface's albedo each time. The back of a surface ends the path, nothing comes
+* from inside a wall. Light is divided by pi throughout, the scale fs.glsl shades with.
+*
+* Only reads the scene, so any number of threads can trace at once, each with its own
+* bake_random_t (see sampling.h).
+*
+* Usage:
+*   trace_scene_t scene = { &bvh, &triangleNormals, &sky, sunDirection, sunColor, skyIntensity, albedo };
+*   vmath::vec3 light = traceRadiance(scene, origin, direction, bounces, random, rays, backFace);
+*/
+#pragma once
+
+#include <vmath.h>      //Graphics utilities
+#include <bvh.h>
+#include <skybox.h>     //sky_cube_t
+#include <sampling.h>
+#include <vector>
+
+//How far rays start off a surface, so they don't hit the surface they left
+const float RAY_OFFSET = 1e-3f;
+
+//What a path can see
+struct trace_scene_t{
+    const TriangleBVH* bvh;
+    const std::vector<vmath::vec3>* triangleNormals;    //Per triangle, to tell back faces apart
+    const sky_cube_t* sky;
+    vmath::vec3 sunDirection;   //Direction the sun's light travels
+    vmath::vec3 sunColor;
+    float skyIntensity;         //Scale on the sky cube's colors
+    vmath::vec3 albedo;         //Reflectance of every surface
+};
+
+//Light reaching a point straight from the sun
+// rays -> counts the shadow ray, if one was needed
+vmath::vec3 sunLight(const trace_scene_t &scene, const vmath::vec3 &position, const vmath::vec3 &normal, long long &rays);
+
+//Light arriving at origin from direction
+// bounces  -> surfaces along the path that reflect light towards origin, the sky still shows past the last one
+// rays     -> counts every ray cast, shadow rays included
+// backFace -> set when the first thing hit is the back of a surface (origin is inside a wall)
+vmath::vec3 traceRadiance(const trace_scene_t &scene, vmath::vec3 origin, vmath::vec3 direction, int bounces,
+                          bake_random_t &random, long long &rays, bool &backFace);
+
+//Threads an omp parallel loop gets, 1 without OpenMP
+int bakeThreadCount();
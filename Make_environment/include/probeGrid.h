@@ -0,0 +1,117 @@
+/*
+* Probe Grid
+* Indirect light for things that move through the maze, baked into light probes on the tile grid
+*
+* Every open tile holds 2x2 probes (at its quarter points) on each of PROBE_LAYERS heights.
+* A probe path traces rays over the whole sphere through a BVH of the maze mesh, the same
+* way the lightmap does (see pathTrace.h): sky where a ray escapes, sun and bounces
+* where it hits. The sun reaching the probe itself is left out, fs.glsl already draws it
+* with shadows. Probes are baked in parallel, each with its own seed.
+*
+* A probe keeps the light around it as a linear function of direction (L1 SH, the same form
+* vertexTransfer.h shades with), L(w) = base + slope . w, so an object lights itself with
+*   albedo * (base * visibility + slope . bent)
+* using its own baked occlusion.
+*
+* Walls take up whole tiles, so filtering is made wall aware in the data: the probes of a
+* wall tile copy the open probe on their side of it. A lookup in an open tile then only ever
+* blends its own probes, the probes of open tiles next to it, and copies of its own, so light
+* never leaks through a wall (only tiles that touch diagonally at a single corner still mix, there
+* the wall corner is in the way of anything being lit). The lookup is plain hardware trilinear
+* filtering of one RGBA16F 3D texture:
+*   x -> 2 probes per tile along x, z -> 2 per tile along z
+*   y -> color channel * PROBE_LAYERS + layer, each texel (base, slope.xyz) for that channel
+* so it costs one texture() per color channel, with y clamped inside the channel's layers.
+*
+* Matching GLSL (see fs.glsl):
+*   layout (std140, binding = 3) uniform ProbeBlock { vec4 gridMin; vec4 gridSize; } probes;
+*   layout (binding = 7) uniform sampler3D probeGrid;
+*
+* Usage:
+*   probes.bake(maze, skyImages, defaultProbeSettings()); //CPU, any time after the maze is made
+*   probes.upload();                                      //Texture and uniforms
+*   probes.bind();                                        //Each frame, before drawing
+*/
+#pragma once
+
+#include <sb7.h>        //OpenGL commands and utilities
+#include <vmath.h>      //Graphics utilities
+#include <maze.h>
+#include <skybox.h>     //sky_cube_t
+#include <vector>
+
+//Binding points shared with the shaders
+enum probeGridBindings{
+    PROBE_UBO_BINDING   = 3,  //Sky lighting has 2 (see skyLighting.h)
+    PROBE_TEXTURE_UNIT  = 7   //Sky lighting has 6
+};
+
+const int PROBE_LAYERS = 2;           //Probe heights, a quarter of the wall height above and below its middle
+const int PROBE_MAX_TILES = 1024;     //Widest maze that fits in a 3D texture (2 probes per tile, 2048 texels)
+
+//What to bake
+struct probe_settings_t{
+    int strata;                 //Rays per probe is strata * strata, one per cell of the sphere
+    int bounces;                //Times light may reflect after the first hit
+    vmath::vec3 sunDirection;   //Direction the sun's light travels
+    vmath::vec3 sunColor;
+    float skyIntensity;         //Scale on the sky cube's colors
+    vmath::vec3 albedo;         //Reflectance of the walls and floor
+    unsigned int seed;
+};
+
+//Settings that match defaultLightmapSettings()
+probe_settings_t defaultProbeSettings();
+
+//What the last bake did
+struct probe_stats_t{
+    int width, height;          //Probes along x and z (2 per tile)
+    size_t probes;              //Probes that were traced (open tiles only, every layer)
+    size_t rays;                //Every ray cast, shadow rays included
+    int threads;
+    double bvhSeconds;
+    double traceSeconds;
+};
+
+//std140 layout of ProbeBlock
+struct probe_uniforms_t{
+    vmath::vec4 gridMin;    //xyz world position at texture coordinate 0 (y is the lowest layer), w normal offset
+    vmath::vec4 gridSize;   //xyz world size the texture covers (y from the lowest to the highest layer), w PROBE_LAYERS once baked (0 before)
+};
+
+class ProbeGrid{
+    public:
+        ProbeGrid();
+
+        //Trace every probe in the open tiles and fill the wall tiles (CPU only)
+        // maze -> its walls are meshed again here, so the bake works whichever way the walls are drawn
+        // sky  -> light arriving from everything the rays don't hit
+        void bake(Maze &maze, const sky_cube_t &sky, const probe_settings_t &settings);
+
+        //Create the 3D texture and the uniform block from the last bake
+        void upload();
+
+        //Release the GPU copies
+        void destroy();
+
+        //Put the uniforms and the texture on their binding points
+        void bind();
+
+        //Baked probes, texture layout (x fastest, then channel * PROBE_LAYERS + layer, then z), (base, slope.xyz)
+        const std::vector<vmath::vec4>& getTexels() const {return texels;}
+        const probe_uniforms_t& getUniforms() const {return uniforms;}
+        const probe_stats_t& getStats() const {return stats;}
+
+    private:
+        //Index into texels of probe (x, z) on layer for channel
+        size_t texelIndex(int x, int z, int layer, int channel) const{
+            return ((size_t)z * 3 * PROBE_LAYERS + channel * PROBE_LAYERS + layer) * width + x;
+        }
+
+        GLuint uniformBuffer;
+        GLuint texture;
+        int width, height;
+        std::vector<vmath::vec4> texels;
+        probe_uniforms_t uniforms;
+        probe_stats_t stats;
+};
@@ -0,0 +1,119 @@
+/*
+* Render Queue
+* Sorted list of draws for one frame
+*
+* Instead of drawing things in whatever order they are stored, every visible
+* draw is pushed with a 64 bit sort key and a small packet describing it.
+* The keys are radix sorted, so draws sharing a program, vao and texture end
+* up next to each other, and submit() only touches GL state when it actually
+* changes. Runs of draws with the same state are merged into one multi-draw.
+*
+* Key layout (most significant bits first):
+*   pass 4 | program 8 | texture 12 | arena 6 | mesh 10 | depth 24
+* Ids only need to be unique inside their field (GL names are masked to fit),
+* submit() compares the real state from the packet so a clash costs a little
+* sorting quality but never draws anything wrong.
+*
+* makeDepthFirstSortKey moves the depth up to just below the pass:
+*   pass 4 | depth 24 | program 8 | texture 12 | arena 6 | mesh 10
+* so opaque draws go strictly front to back (least overdraw) at the cost of
+* more state changes. That is the better order without a depth prepass, with
+* one the shading pass only touches visible pixels anyway and state order wins.
+*
+* submitDepth() draws the opaque packets again with one depth-only program,
+* the arenas' position streams, and no texture changes, for a depth prepass.
+*
+* Usage:
+*   queue.clear();
+*   queue.push(makeSortKey(PASS_OPAQUE, program, texture, 0, meshID, depth), packet);
+*   queue.sort();
+*   queue.submit();
+*
+* Packets can be built on several threads at once by giving each job its own
+* queue and appending them (in job order) to the one that gets submitted.
+*/
+#pragma once
+
+#include <sb7.h>       //OpenGL commands and utilities
+#include <meshArena.h> //mesh_t / MeshArena
+#include <vector>
+#include <stdint.h>
+
+//Passes are drawn in this order
+enum renderPasses{
+    PASS_OPAQUE      = 0, //Sorted front to back
+    PASS_TRANSPARENT = 1  //Sorted back to front
+};
+
+//Pack a sort key
+// depth -> view distance scaled to 0 (near) .. 1 (far), clamped, flipped for transparent passes
+uint64_t makeSortKey(GLuint pass, GLuint program, GLuint texture, GLuint arena, GLuint mesh, float depth);
+
+//Same fields, but depth sorts before state (front to back for opaque)
+uint64_t makeDepthFirstSortKey(GLuint pass, GLuint program, GLuint texture, GLuint arena, GLuint mesh, float depth);
+
+//Everything needed to issue one draw
+struct render_packet_t{
+    GLuint program;        //Program to use
+    MeshArena* arena;      //Arena the mesh lives in (its vao gets bound)
+    GLuint texture;        //GL_TEXTURE_2D bound to unit 0, 0 leaves textures alone
+    mesh_t mesh;           //What to draw
+    GLuint drawID;         //Draw id of the first instance (baseInstance)
+    GLuint instanceCount;  //1 for normal draws
+};
+
+//What submit() did this frame, plus what the same draws would have cost in push order
+struct render_queue_stats_t{
+    size_t packets;                  //Draws pushed
+    size_t drawCalls;                //GL draw calls issued (a multi-draw counts once)
+    size_t programSwitches;          //glUseProgram calls
+    size_t vaoSwitches;              //Vao binds
+    size_t textureSwitches;          //glBindTexture calls
+    size_t unsortedProgramSwitches;  //Switches needed if the packets were drawn unsorted
+    size_t unsortedVaoSwitches;
+    size_t unsortedTextureSwitches;
+    size_t depthDrawCalls;           //GL draw calls issued by submitDepth()
+};
+
+class RenderQueue{
+    public:
+        //Forget every packet (capacity is kept)
+        void clear();
+
+        //Add a draw
+        void push(uint64_t key, const render_packet_t &packet);
+
+        //Add every draw of another (unsorted) queue
+        void append(const RenderQueue &other);
+
+        //Sort the draws by key (LSD radix sort, 8 bits a pass, passes where every key agrees are skipped)
+        void sort();
+
+        //Issue the sorted draws, only changing state where it differs from the previous draw
+        void submit();
+
+        //Issue the sorted opaque draws with depthProgram and position-only vaos (see MeshArena::enablePositionStream)
+        //Color/depth state is up to the caller
+        void submitDepth(GLuint depthProgram);
+
+        //Ring buffer the multi-draw commands are streamed through (see MeshArena::multiDraw), NULL for none
+        void setCommandStream(sb7::ring_buffer* stream) {commandStream = stream;}
+
+        size_t size() const {return keys.size();}
+        const render_queue_stats_t& getStats() const {return stats;}
+
+    private:
+        //Draw whatever has been batched so far
+        void flush();
+
+        std::vector<uint64_t> keys;
+        std::vector<uint32_t> order;            //Packet index of each key, sorted along with the keys
+        std::vector<render_packet_t> packets;   //In push order
+        std::vector<uint64_t> scratchKeys;      //Radix sort ping-pong buffers
+        std::vector<uint32_t> scratchOrder;
+        std::vector<mesh_t> batchMeshes;        //Current run of draws with identical state
+        std::vector<GLuint> batchDrawIDs;
+        MeshArena* batchArena = NULL;
+        sb7::ring_buffer* commandStream = NULL;
+        render_queue_stats_t stats;
+};
@@ -0,0 +1,66 @@
+/*
+* Sampling
+* Random numbers and directions shared by the CPU bakers (lightmapBaker.h, vertexTransfer.h, probeGrid.h)
+*
+* Every texel / vertex / probe seeds its own generator from its index, so a bake
+* gives the same result no matter how many threads it was split over.
+*
+* Usage:
+*   bake_random_t random;
+*   random.state = hashSeed(index ^ hashSeed(seed));
+*   vmath::vec3 d = cosineDirection(normal, random.next(), random.next());
+*/
+#pragma once
+
+#include <vmath.h> //Graphics utilities
+#include <cmath>
+
+//Small PCG generator, one per texel / vertex
+struct bake_random_t{
+    unsigned int state;
+
+    //Uniform in [0, 1)
+    float next(){
+        state = state * 747796405u + 2891336453u;
+        unsigned int word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+        return ((word >> 22u) ^ word) / 4294967296.0f;
+    }
+};
+
+//Spreads neighbouring seeds far apart
+inline unsigned int hashSeed(unsigned int x){
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+//Two unit vectors that make an orthonormal basis with n, without a branch on which axis to cross with (Duff et al. 2017)
+inline void orthonormalBasis(const vmath::vec3 &n, vmath::vec3 &tangent, vmath::vec3 &bitangent){
+    float sign = n[2] >= 0.0f ? 1.0f : -1.0f;
+    float a = -1.0f / (sign + n[2]);
+    float b = n[0] * n[1] * a;
+    tangent = vmath::vec3(1.0f + sign * n[0] * n[0] * a, sign * b, -sign * n[0]);
+    bitangent = vmath::vec3(b, sign + n[1] * n[1] * a, -n[1]);
+}
+
+//Cosine weighted direction around unit n, so averaging the light along it needs no further weights
+// u1, u2 -> uniform in [0, 1)
+inline vmath::vec3 cosineDirection(const vmath::vec3 &n, float u1, float u2){
+    vmath::vec3 tangent, bitangent;
+    orthonormalBasis(n, tangent, bitangent);
+    float r = sqrtf(u1);
+    float phi = 2.0f * 3.14159265f * u2;
+    return tangent * (r * cosf(phi)) + bitangent * (r * sinf(phi)) + n * sqrtf(vmath::max(0.0f, 1.0f - u1));
+}
+
+//Direction spread evenly over the whole sphere
+// u1, u2 -> uniform in [0, 1)
+inline vmath::vec3 uniformSphereDirection(float u1, float u2){
+    float z = 1.0f - 2.0f * u1;
+    float r = sqrtf(vmath::max(0.0f, 1.0f - z * z));
+    float phi = 2.0f * 3.14159265f * u2;
+    return vmath::vec3(r * cosf(phi), r * sinf(phi), z);
+}
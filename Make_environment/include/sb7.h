@@ -45,6 +45,7 @@
 #include "GLFW/glfw3.h"
 
 #include "sb7ext.h"
+#include "sb7framepacer.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -157,12 +158,61 @@ public:
             }
         }
 
+        if (info.flags.vsync)
+        {
+            pacer.set_vsync(info.flags.adaptive_vsync ? frame_pacer::VSYNC_ADAPTIVE : frame_pacer::VSYNC_ON);
+        }
+
         startup();
 
+        // Simulation runs in fixed steps of 1 / updateRate seconds, however
+        // long frames take. Time left over (less than a step) is handed to
+        // render() as update_alpha so it can blend the last two states.
+        double accumulator = 0.0;
+        const double max_frame_time = 0.25;
+        update_alpha = 1.0;
+        pacer.init(info.frameRateCap);
+
         do
         {
-            render(glfwGetTime());
+            double now = glfwGetTime();
+            // The fixed-step clock follows real time, so sim time stays
+            // locked to wall time and update_alpha means what it says.
+            // The smoothed delta is only for variable-step animation.
+            double smoothed_time = pacer.begin_frame();
+            double frame_time = pacer.frame_seconds();
+
+            // A long stall (window drag, breakpoint) would otherwise be
+            // caught up all at once
+            if (frame_time > max_frame_time)
+            {
+                frame_time = max_frame_time;
+            }
+            if (smoothed_time > max_frame_time)
+            {
+                smoothed_time = max_frame_time;
+            }
+
+            if (info.updateRate > 0)
+            {
+                const double step = 1.0 / info.updateRate;
+                accumulator += frame_time;
+                while (accumulator >= step)
+                {
+                    update(step);
+                    accumulator -= step;
+                }
+                update_alpha = accumulator / step;
+            }
+            else
+            {
+                update(smoothed_time);
+                update_alpha = 1.0;
+            }
 
+            render(now);
+
+            pacer.limit();
             glfwSwapBuffers(window);
             glfwPollEvents();
 
@@ -189,6 +239,8 @@ public:
         info.minorVersion = 3;
 #endif
         info.samples = 0;
+        info.updateRate = 60;
+        info.frameRateCap = 0;
         info.flags.all = 0;
         info.flags.cursor = 1;
 #ifdef _DEBUG
@@ -201,6 +253,13 @@ public:
 
     }
 
+    // Called info.updateRate times a second with dt = 1 / updateRate
+    // (or once a frame with the frame time when updateRate is 0)
+    virtual void update(double dt)
+    {
+
+    }
+
     virtual void render(double currentTime)
     {
 
@@ -273,6 +332,8 @@ public:
         int majorVersion;
         int minorVersion;
         int samples;
+        int updateRate;     // Fixed update() ticks per second, 0 to update once per frame
+        int frameRateCap;   // Frames per second run() won't go over, 0 for no cap
         union
         {
             struct
@@ -283,6 +344,7 @@ public:
                 unsigned int    stereo      : 1;
                 unsigned int    debug       : 1;
                 unsigned int    robust      : 1;
+                unsigned int    adaptive_vsync : 1; // With vsync: tear instead of waiting a whole refresh when late
             };
             unsigned int        all;
         } flags;
@@ -292,6 +354,8 @@ protected:
     APPINFO     info;
     static      sb7::application * app;
     GLFWwindow* window;
+    double      update_alpha;       // How far render() is between the last two update() ticks (0..1)
+    frame_pacer pacer;              // Frame rate cap, vsync mode and frame timing stats
 
     static void glfw_onResize(GLFWwindow* window, int w, int h)
     {
@@ -321,7 +385,20 @@ protected:
     void setVsync(bool enable)
     {
         info.flags.vsync = enable ? 1 : 0;
-        glfwSwapInterval((int)info.flags.vsync);
+        if (enable && info.flags.adaptive_vsync)
+        {
+            pacer.set_vsync(frame_pacer::VSYNC_ADAPTIVE);
+        }
+        else
+        {
+            pacer.set_vsync(enable ? frame_pacer::VSYNC_ON : frame_pacer::VSYNC_OFF);
+        }
+    }
+
+    void setFrameRateCap(int fps)
+    {
+        info.frameRateCap = fps;
+        pacer.set_target_fps(fps);
     }
 };
 
@@ -0,0 +1,96 @@
+/*
+ * Frame pacing
+ *
+ * Keeps the main loop from running faster than it needs to and measures how
+ * evenly frames come out.
+ *
+ * - Frame rate cap: limit() waits until the next frame is due. It sleeps in
+ *   1ms steps while there is clearly time left, then spins for the last bit,
+ *   because a sleep can overshoot by a scheduler tick. How long a sleep really
+ *   takes is measured as it goes (mean + deviation), so the spin is only as
+ *   long as this machine needs.
+ * - Adaptive vsync: a swap interval of -1 (EXT_swap_control_tear) waits for
+ *   vblank when the frame is on time, and tears instead of waiting a whole
+ *   extra refresh when it is late. Falls back to normal vsync.
+ * - Smoothing: begin_frame() returns an averaged frame time, so variable-step
+ *   animation does not stutter because of one-off spikes in the measured delta.
+ *   Fixed-step simulation should accumulate the raw frame_seconds() instead,
+ *   or it drifts from wall time and catches up late after a stall.
+ * - Jitter: how far each frame's length was from the target (the cap, or the
+ *   average frame time when uncapped), with the mean and max over the last
+ *   HISTORY frames.
+ *
+ * Usage:
+ *   pacer.init(60.0);                          // 0 = uncapped
+ *   pacer.set_vsync(frame_pacer::VSYNC_ADAPTIVE); // Needs a current context
+ *   every frame:
+ *     double dt = pacer.begin_frame();
+ *     ... update / render ...
+ *     pacer.limit();
+ *     swap buffers
+ */
+
+#ifndef __SB7FRAMEPACER_H__
+#define __SB7FRAMEPACER_H__
+
+namespace sb7
+{
+
+class frame_pacer
+{
+public:
+    enum vsync_mode
+    {
+        VSYNC_OFF,
+        VSYNC_ON,
+        VSYNC_ADAPTIVE
+    };
+
+    enum { HISTORY = 120 };
+
+    frame_pacer();
+
+    void init(double target_fps);
+    void set_target_fps(double target_fps);     // 0 removes the cap
+    double target_fps() const { return target_period > 0.0 ? 1.0 / target_period : 0.0; }
+
+    // Returns the mode that was actually set (adaptive falls back to on)
+    vsync_mode set_vsync(vsync_mode mode);
+    vsync_mode vsync() const { return vsync_current; }
+
+    // Start of a frame, returns the smoothed frame time in seconds
+    double begin_frame();
+
+    // Wait until the next frame is due (does nothing when uncapped)
+    void limit();
+
+    double frame_seconds() const { return last_frame; }        // Raw length of the last frame
+    double smoothed_seconds() const { return smoothed_frame; }
+    double jitter_seconds() const { return last_jitter; }      // Of the last frame
+    double mean_jitter_seconds() const;                         // Over the history
+    double max_jitter_seconds() const;
+    double waited_seconds() const { return last_wait; }         // Time limit() spent waiting last frame
+
+private:
+    double      target_period;
+    double      next_deadline;
+    double      last_time;
+    double      last_frame;
+    double      smoothed_frame;
+    double      last_jitter;
+    double      last_wait;
+    double      jitter[HISTORY];
+    unsigned    jitter_count;
+    unsigned    jitter_next;
+    bool        started;
+    vsync_mode  vsync_current;
+
+    // Running estimate of what a 1ms sleep really costs (Welford)
+    double      sleep_mean;
+    double      sleep_m2;
+    unsigned    sleep_samples;
+};
+
+}
+
+#endif /* __SB7FRAMEPACER_H__ */
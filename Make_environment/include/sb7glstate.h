@@ -0,0 +1,86 @@
+/*
+ * GL state cache
+ *
+ * Thin wrappers around the most common binding calls that remember what is
+ * currently bound and skip calls that would not change anything. Every call
+ * is counted as issued (reached the driver) or skipped, per function, so the
+ * number of redundant calls the cache saved each frame can be shown.
+ *
+ * The cache only knows about calls that go through it. Code that binds things
+ * directly (loaders, sb7::object, ...) must be followed by invalidate(), and
+ * objects should be deleted through the delete_* wrappers so a recycled name
+ * is never mistaken for one that is still bound.
+ *
+ * One GL context is assumed.
+ */
+
+#ifndef __SB7GLSTATE_H__
+#define __SB7GLSTATE_H__
+
+#include <sb7.h>
+
+namespace sb7
+{
+
+namespace glstate
+{
+
+enum call_id
+{
+    CALL_USE_PROGRAM,
+    CALL_BIND_VERTEX_ARRAY,
+    CALL_BIND_BUFFER,
+    CALL_BIND_BUFFER_BASE,
+    CALL_BIND_BUFFER_RANGE,
+    CALL_ACTIVE_TEXTURE,
+    CALL_BIND_TEXTURE,
+    CALL_ENABLE,
+    CALL_DEPTH_FUNC,
+    CALL_DEPTH_MASK,
+    CALL_COUNT
+};
+
+struct counters
+{
+    unsigned int issued[CALL_COUNT];
+    unsigned int skipped[CALL_COUNT];
+
+    unsigned int total_issued() const;
+    unsigned int total_skipped() const;
+};
+
+// Binding
+void use_program(GLuint program);
+void bind_vertex_array(GLuint vao);
+void bind_buffer(GLenum target, GLuint buffer);
+void bind_buffer_base(GLenum target, GLuint index, GLuint buffer);
+void bind_buffer_range(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+void active_texture(GLenum unit);
+void bind_texture(GLenum target, GLuint texture);           // On the active unit
+void bind_texture_unit(GLuint unit, GLenum target, GLuint texture);
+
+// Fixed function state
+void enable(GLenum cap);
+void disable(GLenum cap);
+void depth_func(GLenum func);
+void depth_mask(GLboolean flag);
+
+// Deleting through the cache drops any binding of the deleted names
+void delete_program(GLuint program);
+void delete_vertex_arrays(GLsizei n, const GLuint * vaos);
+void delete_buffers(GLsizei n, const GLuint * buffers);
+void delete_textures(GLsizei n, const GLuint * textures);
+
+// Forget everything, the next call of each kind always reaches GL
+void invalidate();
+
+// Reset the counters (call once at the start of a frame)
+void begin_frame();
+const counters& frame_counters();
+const char* call_name(call_id id);
+
+}
+
+}
+
+#endif /* __SB7GLSTATE_H__ */
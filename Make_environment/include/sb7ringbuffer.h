@@ -0,0 +1,80 @@
+/*
+ * Streaming ring buffer
+ *
+ * One buffer created with glBufferStorage and mapped once for good
+ * (persistent + coherent), split into a region per frame in flight. Each
+ * frame hands out pieces of its region with allocate(), the CPU writes
+ * straight into mapped memory, and the region is fenced when the frame is
+ * done. A region is only reused once its fence has signalled, so the CPU
+ * never overwrites data the GPU is still reading and the driver never has to
+ * stall or copy behind our back.
+ *
+ * The buffer is not tied to a target, the same allocation can be used as a
+ * uniform block (glBindBufferRange), shader storage, a pixel unpack source or
+ * the source of glCopyBufferSubData.
+ *
+ * Usage:
+ *   ring.init(1 << 20);                 // 1MB per frame, 3 frames in flight
+ *   ring.begin_frame();                 // Waits only if the GPU is 3 frames behind
+ *   GLintptr offset;
+ *   void * p = ring.allocate(size, ring.uniform_alignment(), offset);
+ *   memcpy(p, data, size);
+ *   ... draw using ring.buffer() at offset ...
+ *   ring.end_frame();
+ */
+
+#ifndef __SB7RINGBUFFER_H__
+#define __SB7RINGBUFFER_H__
+
+#include <sb7.h>
+
+namespace sb7
+{
+
+class ring_buffer
+{
+public:
+    enum { MAX_FRAMES = 4 };
+
+    ring_buffer();
+
+    // frame_size -> bytes available each frame, frames -> regions (frames in flight, up to MAX_FRAMES)
+    bool init(GLsizeiptr frame_size, int frames = 3);
+    void teardown();
+
+    // Move to the next region, waiting on its fence if the GPU is still using it
+    void begin_frame();
+    // Fence everything written since begin_frame()
+    void end_frame();
+
+    // Reserve size bytes in this frame's region, returns where to write (NULL when the region is full)
+    // offset -> set to the position inside buffer() for GL calls
+    void * allocate(GLsizeiptr size, GLsizeiptr alignment, GLintptr& offset);
+
+    GLuint buffer() const { return buf; }
+    bool in_frame() const { return inside_frame; }
+    GLsizeiptr uniform_alignment() const { return ubo_alignment; }
+    GLsizeiptr storage_alignment() const { return ssbo_alignment; }
+
+    // Number of begin_frame() calls that had to block on a fence, and for how long in total
+    unsigned int wait_count() const { return waits; }
+    double wait_seconds() const { return wait_time; }
+
+private:
+    GLuint          buf;
+    char *          mapped;
+    GLsizeiptr      region_size;
+    int             region_count;
+    int             region;
+    GLsizeiptr      head;
+    GLsync          fences[MAX_FRAMES];
+    bool            inside_frame;
+    GLsizeiptr      ubo_alignment;
+    GLsizeiptr      ssbo_alignment;
+    unsigned int    waits;
+    double          wait_time;
+};
+
+}
+
+#endif /* __SB7RINGBUFFER_H__ */
@@ -27,6 +27,7 @@
 #define __SB7TEXTOVERLAY_H__
 
 #include <sb7.h>
+#include <sb7ringbuffer.h>
 
 namespace sb7
 {
@@ -57,6 +58,7 @@ private:
     GLuint      vao;
 
     GLuint      text_program;
+    ring_buffer upload_stream;      // Screen text goes to the texture through this (as a pixel unpack buffer)
     char *      screen_buffer;
     int         buffer_width;
     int         buffer_height;
@@ -15,6 +15,19 @@ GLuint load(const char * filename,
             bool check_errors = false);
 #endif
 
+// Same as load(), with the text of header_filename put in right after the
+// shader's #version line (GLSL has no #include, this shares declarations and
+// functions between shaders). Errors give header lines as 1(line), the
+// shader's own as 0(line).
+GLuint load_with_header(const char * header_filename,
+                        const char * filename,
+                        GLenum shader_type = GL_FRAGMENT_SHADER,
+#ifdef _DEBUG
+                        bool check_errors = true);
+#else
+                        bool check_errors = false);
+#endif
+
 GLuint from_string(const char * source,
                    GLenum shader_type,
 #ifdef _DEBUG
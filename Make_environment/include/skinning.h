@@ -0,0 +1,213 @@
+/*
+* Skinning
+* Skeletal animation for crowds of characters, blended with dual quaternions
+*
+* Every joint's pose is a rigid transform kept as a unit dual quaternion (rotation in
+* real, translation in dual = 0.5 * t * real). A vertex is moved by up to
+* SKIN_MAX_INFLUENCES joints: their dual quaternions are added up by weight (each one
+* flipped onto the same side as the first, q and -q are the same rotation), normalized,
+* and applied to the position and normal. Unlike blending matrices this never shrinks
+* the mesh around a twisting joint, and a joint is 2 vec4s instead of a 4x3 matrix.
+*
+* Two back ends do the same blend:
+*   GPU -> the palette of every visible character (one dual quaternion per joint) is
+*          streamed into a shader storage block each frame, and all characters are drawn
+*          with one instanced draw, the instance (draw id) picks its palette (skin_vs.glsl)
+*   CPU -> skinVerticesSSE blends and transforms 4 vertices at a time (structure of arrays
+*          inside the loop), for running without a GPU and for benchmarking the blend itself
+*
+* Poses are computed on the CPU in prepareFrame (no GL calls), characters spread over
+* threads with OpenMP, each one only writing its own part of the palette buffer.
+*
+* Vertex attributes (see meshArena.h):
+*   ATTRIB_JOINTS  -> 4 joint indices, GL_UNSIGNED_BYTE (up to 256 joints)
+*   ATTRIB_WEIGHTS -> 4 weights, GL_UNSIGNED_BYTE normalized (they should add up to 255)
+*
+* Matching GLSL (see skin_vs.glsl):
+*   layout (std430, binding = 0) readonly buffer SkinBlock { uvec4 skinInfo; vec4 joints[]; };
+*
+* Usage:
+*   crowd.create(skeleton, vertices, indices, maxCharacters);   //Once
+*   crowd.addCharacter(position, yaw, phase, speed);            //Any number, up to maxCharacters
+*   crowd.pose(visibleThenCasters, visibleCount, time);         //Each frame, CPU only
+*   crowd.beginFrame(); crowd.upload();
+*   crowd.drawDepth(shadowProgram, casterSlots);                //Per shadow pass
+*   crowd.draw(program); crowd.endFrame();
+*/
+#pragma once
+
+#include <sb7.h>            //OpenGL commands and utilities
+#include <vmath.h>          //Graphics utilities
+#include <meshArena.h>      //Vertex formats and the arena the characters live in
+#include <sb7ringbuffer.h>
+#include <vector>
+#include <stdint.h>
+
+//Binding points shared with the shaders
+enum skinningBindings{
+    SKIN_SSBO_BINDING = 0   //Storage blocks 1-7 are taken, 0 keeps inside the 8 every GL 4.3 driver has
+};
+
+const int SKIN_MAX_INFLUENCES = 4;      //Joints that can move one vertex
+const int SKIN_MAX_JOINTS = 256;        //Joint indices are bytes
+
+//Vertex of a skinned mesh
+struct skin_vertex_t{
+    vmath::vec4 position;           //Bind pose, model space
+    vmath::vec4 normal;
+    vmath::vec2 uv;
+    unsigned char joints[SKIN_MAX_INFLUENCES];
+    unsigned char weights[SKIN_MAX_INFLUENCES]; //Out of 255
+};
+
+//Position / normal / uv / joints / weights format matching skin_vertex_t
+vertex_format_t skinnedVertexFormat();
+
+//Rigid transform: rotation, then translation
+struct dual_quat_t{
+    vmath::quaternion real;     //Unit rotation (x, y, z, w)
+    vmath::quaternion dual;     //0.5 * (translation, 0) * real
+};
+
+//Rotation of angle radians around a unit axis
+vmath::quaternion axisAngleQuaternion(const vmath::vec3 &axis, float angle);
+
+//Dual quaternion doing rotation, then translation
+dual_quat_t makeDualQuat(const vmath::quaternion &rotation, const vmath::vec3 &translation);
+
+//a * b, does b first
+dual_quat_t multiplyDualQuat(const dual_quat_t &a, const dual_quat_t &b);
+
+//Transform of a point / a direction by a unit dual quaternion
+vmath::vec3 dualQuatPoint(const dual_quat_t &dq, const vmath::vec3 &point);
+vmath::vec3 dualQuatVector(const dual_quat_t &dq, const vmath::vec3 &vector);
+
+//Joint hierarchy in its bind pose
+struct skeleton_t{
+    std::vector<int> parents;               //Parent before child, -1 for the root
+    std::vector<vmath::vec3> offsets;       //Joint position relative to its parent in the bind pose
+    std::vector<dual_quat_t> inverseBind;   //Model space -> joint space in the bind pose
+};
+
+//A test character for crowds: a capped tube standing on the origin, bending along a chain of joints
+//(there are no skinned assets to load, obj files have no joints)
+// joints -> chain length (1 - SKIN_MAX_JOINTS), joint 0 at the bottom
+// sides  -> vertices around the tube
+void buildTubeCharacter(int joints, float height, float radius, int sides,
+                        skeleton_t &skeleton, std::vector<skin_vertex_t> &vertices, std::vector<GLuint> &indices);
+
+//Local joint rotations -> skinning palette (root * joint's model transform * inverse bind), one per joint
+// localRotations -> one per joint, relative to the parent
+// root           -> where the character is in the world
+void computeSkinPalette(const skeleton_t &skeleton, const vmath::quaternion* localRotations,
+                        const dual_quat_t &root, dual_quat_t* palette);
+
+//Pose used by the crowd, every joint sways a little behind the one below it
+// rotations -> one per joint
+void swayPose(int joints, float time, vmath::quaternion* rotations);
+
+//Skin vertices on the CPU, 4 at a time with SSE (any count, the tail is padded)
+// positions -> one per vertex, w = 1
+// normals   -> one per vertex, w = 0, not normalized
+void skinVerticesSSE(const skin_vertex_t* vertices, size_t count, const dual_quat_t* palette,
+                     vmath::vec4* positions, vmath::vec4* normals);
+
+//One vertex at a time, the reference skinVerticesSSE is checked against
+void skinVerticesScalar(const skin_vertex_t* vertices, size_t count, const dual_quat_t* palette,
+                        vmath::vec4* positions, vmath::vec4* normals);
+
+//What a CPU benchmark run measured
+struct skin_benchmark_t{
+    int characters;
+    int frames;
+    size_t vertices;            //Skinned in total, every character every frame
+    int threads;
+    double poseSeconds;         //Palettes
+    double skinSeconds;         //Blending and transforming vertices
+    double verticesPerSecond;   //Skinning only
+    float maxPositionDifference;    //Largest difference from skinVerticesScalar on the last frame, any component
+    float maxNormalDifference;
+};
+
+//Pose and skin a crowd of tube characters for a number of frames, CPU only (no GL, runs headless)
+//The last frame is skinned again with skinVerticesScalar and compared
+void benchmarkCpuSkinning(int characters, int frames, skin_benchmark_t &result);
+
+//What the crowd did last frame
+struct skin_stats_t{
+    size_t characters;          //In the crowd
+    size_t posed;               //Visible, posed and drawn
+    size_t shadowOnly;          //Out of view, posed only to cast shadows
+    size_t joints;              //Palette entries computed
+    size_t vertices;            //Skinned on the GPU by the main draw (posed * mesh vertices)
+    size_t paletteBytes;        //Streamed to the GPU
+    double poseSeconds;
+    double gpuMilliseconds;     //Time the skinned draw took on the GPU, a frame or two behind
+};
+
+class SkinnedCrowd{
+    public:
+        SkinnedCrowd();
+
+        //Upload the mesh into the crowd's own arena and size the palette stream
+        void create(const skeleton_t &skeleton, const std::vector<skin_vertex_t> &vertices,
+                    const std::vector<GLuint> &indices, GLuint maxCharacters);
+
+        //Release every GL object
+        void destroy();
+
+        //Add a character standing at position, facing yaw radians around y
+        // phase, speed -> where it starts in its animation and how fast it plays
+        // returns false when the crowd is full
+        bool addCharacter(const vmath::vec3 &position, float yaw, float phase, float speed);
+
+        //World box of character i (it never leaves it whatever its pose)
+        void characterBounds(size_t i, vmath::vec3 &worldMin, vmath::vec3 &worldMax) const;
+        size_t getCharacterCount() const {return characters.size();}
+
+        //Pose the given characters at time seconds (CPU only)
+        // drawn -> the first drawn characters are drawn in the view in this order, the rest are only
+        //          posed for drawDepth (shadows of characters out of view)
+        void pose(const std::vector<uint32_t> &characterList, size_t drawn, double time);
+
+        //Stream the palettes of the posed characters and bind them (between beginFrame and endFrame)
+        void upload();
+
+        //Every character posed to be drawn in one instanced draw, with the depth test state as it is
+        void draw(GLuint program);
+
+        //Some posed characters, by their position in pose()'s list, one draw each (shadow passes)
+        //The program's uniforms (light matrix) have to be set already
+        void drawDepth(GLuint program, const std::vector<uint32_t> &slots);
+
+        void beginFrame();
+        void endFrame();
+
+        const skin_stats_t& getStats() const {return stats;}
+
+    private:
+        struct character_t{
+            dual_quat_t root;
+            vmath::vec3 boundsMin;  //World box
+            vmath::vec3 boundsMax;
+            float phase;
+            float speed;
+        };
+
+        MeshArena arena;            //Skinned vertex format, draw id per instance
+        mesh_t mesh;
+        skeleton_t skeleton;
+        vmath::vec3 meshMin;        //Bind pose box grown to cover any pose
+        vmath::vec3 meshMax;
+        std::vector<character_t> characters;
+        GLuint maxCharacters;
+
+        std::vector<dual_quat_t> palettes;          //Posed characters, joints of each one after the other
+        std::vector<vmath::quaternion> rotations;   //Scratch, one block of joints per posed character
+        size_t posed;               //Palettes computed this frame
+        size_t drawn;               //The first ones, drawn in the view
+        sb7::ring_buffer stream;
+        GLuint timerQueries[2];     //GL_TIME_ELAPSED, alternating so last frame's can be read without a stall
+        GLuint timerFrame;
+        skin_stats_t stats;
+};
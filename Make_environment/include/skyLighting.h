@@ -0,0 +1,91 @@
+/*
+* Sky Lighting
+* Light from the sky cube for everything that isn't baked: 9 spherical harmonic
+* coefficients for diffuse, and a prefiltered cube map for specular
+*
+* Diffuse: the sky is projected onto the first three SH bands (9 coefficients per
+* color), every texel weighted by the solid angle it covers. The projection walks
+* 4 texels at a time with SSE, with OpenMP over the rows of all six faces; each row
+* keeps its own sum and the rows are added up in order afterwards, so the result
+* does not depend on the thread count. Convolving with the cosine lobe turns that
+* into irradiance, which a shader gets back for any normal with a few multiply-adds
+* (no cube map lookups).
+*
+* Specular: a small cube map whose mip levels hold the sky blurred by a GGX lobe of
+* increasing roughness (level = roughness * (SKY_SPECULAR_LEVELS - 1)), importance
+* sampled from a box filtered copy of the sky at the mip the lobe's width calls for.
+*
+* Both are in world directions: a texel / SH lookup at d is the sky seen looking along d
+* (the sky box itself is looked up at -d, see sc_vs.glsl). Irradiance is divided by pi,
+* the same scale the lightmap and fs.glsl use for the sun, so diffuse is albedo * irradiance.
+*
+* Matching GLSL (see fs.glsl):
+*   layout (std140, binding = 2) uniform SkyBlock { vec4 irradiance[9]; vec4 specular; } sky;
+*   layout (binding = 6) uniform samplerCube skySpecular;
+*
+* Usage:
+*   sky_cube_t images; loadCubeImages(directory, images);
+*   skyLighting.create(images, 1.0f);   //Once, CPU work then uploads
+*   skyLighting.bind();                 //Each frame, before drawing
+*/
+#pragma once
+
+#include <sb7.h>    //OpenGL commands and utilities
+#include <vmath.h>  //Graphics utilities
+#include <skybox.h> //sky_cube_t
+
+//Binding points shared with the shaders
+enum skyLightingBindings{
+    SKY_UBO_BINDING     = 2,  //FrameBlock is 0, ShadowBlock is 1
+    SKY_SPECULAR_UNIT   = 6   //Units 0-5 are taken (see lightmapBaker.h)
+};
+
+const int SKY_SPECULAR_SIZE = 128;      //Texels per side of the sharpest specular level
+const int SKY_SPECULAR_LEVELS = 5;      //128 down to 8, roughness 0 to 1
+const int SKY_SPECULAR_SAMPLES = 64;    //GGX samples per specular texel
+
+//std140 layout of SkyBlock
+struct sky_uniforms_t{
+    vmath::vec4 irradiance[9];  //rgb SH coefficients of irradiance / pi
+    vmath::vec4 specular;       //x highest mip level of the specular cube
+};
+
+//What create() did
+struct sky_lighting_stats_t{
+    size_t texels;              //Sky texels projected
+    double projectSeconds;
+    double prefilterSeconds;
+};
+
+//Sky seen along every direction, as 9 rgb SH coefficients (solid angle weighted)
+void projectSkySH9(const sky_cube_t &sky, vmath::vec3 radiance[9]);
+
+//Radiance coefficients -> irradiance / pi coefficients (cosine convolution, band by band)
+void irradianceSH9(const vmath::vec3 radiance[9], vmath::vec3 irradiance[9]);
+
+//Value of 9 SH coefficients along a unit direction
+vmath::vec3 evaluateSH9(const vmath::vec3 coefficients[9], const vmath::vec3 &direction);
+
+class SkyLighting{
+    public:
+        SkyLighting();
+
+        //Project and prefilter the sky, then upload both
+        // intensity -> scale on the sky's colors (keep it the same as the lightmap's skyIntensity)
+        void create(const sky_cube_t &sky, float intensity);
+
+        //Release everything
+        void destroy();
+
+        //Put the uniforms and the specular cube on their binding points
+        void bind();
+
+        const sky_uniforms_t& getUniforms() const {return uniforms;}
+        const sky_lighting_stats_t& getStats() const {return stats;}
+
+    private:
+        GLuint uniformBuffer;
+        GLuint specularTexture;   //RGBA16F cube, SKY_SPECULAR_LEVELS mips
+        sky_uniforms_t uniforms;
+        sky_lighting_stats_t stats;
+};
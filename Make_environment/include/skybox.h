@@ -55,3 +55,18 @@ void loadCubeTextures(std::string directory, GLuint texture_ID);
 // side       -> ex: GL_TEXTURE_CUBE_MAP_POSITIVE_X
 //               Which texture side is being uploaded 
 void loadCubeSide(GLint texture_ID, GLenum side, std::string file);
+
+//CPU copy of a sky cube, for baking light from it (see lightmapBaker.h)
+// faces are in GL order (+X, -X, +Y, -Y, +Z, -Z), rgb floats 0-1, size x size texels each
+struct sky_cube_t{
+    int size;
+    std::vector<float> faces[6];
+};
+
+//Load the same six files loadCubeTextures() does into memory, onto the same faces
+// returns false if a side is missing or the sides aren't all the same square size
+bool loadCubeImages(std::string directory, sky_cube_t &sky);
+
+//Bilinear lookup the way a GL cube map sampler does it
+// direction -> lookup vector, need not be unit length (sc_vs.glsl looks up -direction for the sky seen along direction)
+vmath::vec3 sampleCube(const sky_cube_t &sky, const vmath::vec3 &direction);
@@ -0,0 +1,17 @@
+/*
+* Timing
+* Wall clock seconds for the stats the bakers and CPU animation report
+*
+* Usage:
+*   std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+*   ...
+*   stats.seconds = secondsSince(start);
+*/
+#pragma once
+
+#include <chrono>
+
+//Seconds from start until now
+inline double secondsSince(const std::chrono::high_resolution_clock::time_point &start){
+    return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
@@ -0,0 +1,94 @@
+/*
+* Transform Hierarchy
+* Nodes with a local translation / rotation / scale under a parent, and their world matrices
+*
+* Nodes live in flat arrays in parent before child order (a node can only be added under one
+* that already exists), one array per field: the local transforms as structure of arrays,
+* then the parents, dirty flags, local matrices and world matrices. Changing a node's local
+* transform only marks it dirty; update() then does two linear passes:
+*   1 -> local matrices of the changed nodes, built from the TRS arrays 4 nodes at a time
+*        with SSE (blocks of 4 with nothing changed are skipped)
+*   2 -> in order, a node is dirty if it changed or its parent is dirty, and every dirty node
+*        gets world = parent's world * local, an SSE 4x4 multiply each
+* Parents come first, so both passes are a single walk over the arrays with no recursion, a
+* parent's world matrix is always ready before its children need it, and clean subtrees cost
+* one flag test per node.
+*
+* Usage:
+*   int root = nodes.addNode(-1, position, rotation, scale);
+*   int child = nodes.addNode(root, offset, identity, one);
+*   nodes.setRotation(root, spin);  //Any number of changes
+*   nodes.update();                 //Once, before the world matrices are read
+*   obj2world = nodes.getWorld(child);
+*/
+#pragma once
+
+#include <vmath.h>  //Graphics utilities
+#include <vector>
+
+//What the last update() did
+struct hierarchy_stats_t{
+    size_t nodes;
+    size_t changed;             //Nodes marked dirty since the update before
+    size_t updated;             //World matrices recomputed (changed nodes and everything under them)
+    double seconds;
+};
+
+class TransformHierarchy{
+    public:
+        TransformHierarchy();
+
+        //Forget every node
+        void clear();
+
+        //Add a node, it is dirty until the next update()
+        // parent -> a node that already exists, or -1 for a root
+        // returns the new node's index, -1 when parent doesn't exist (yet)
+        int addNode(int parent, const vmath::vec3 &translation, const vmath::quaternion &rotation, const vmath::vec3 &scale);
+
+        //Change a node's local transform (relative to its parent)
+        void setTranslation(int node, const vmath::vec3 &translation);
+        void setRotation(int node, const vmath::quaternion &rotation);   //Unit length
+        void setScale(int node, const vmath::vec3 &scale);
+        void setLocal(int node, const vmath::vec3 &translation, const vmath::quaternion &rotation, const vmath::vec3 &scale);
+
+        //Recompute the world matrices of every dirty node and everything below it
+        void update();
+
+        const vmath::mat4& getWorld(int node) const {return worlds[node];}
+        const vmath::mat4& getLocal(int node) const {return locals[node];}
+        int getParent(int node) const {return parents[node];}
+        size_t getNodeCount() const {return parents.size();}
+        const hierarchy_stats_t& getStats() const {return stats;}
+
+    private:
+        //Grow the TRS arrays to a multiple of 4 nodes (padding is an identity transform)
+        void padArrays();
+
+        //Local transforms, structure of arrays (padded to a multiple of 4 for SSE)
+        std::vector<float> tx, ty, tz;
+        std::vector<float> rx, ry, rz, rw;
+        std::vector<float> sx, sy, sz;
+        std::vector<unsigned char> dirty;   //Local transform changed, padded like the TRS arrays
+
+        std::vector<int> parents;           //-1 for roots, always less than the node's own index
+        std::vector<vmath::mat4> locals;
+        std::vector<vmath::mat4> worlds;
+        size_t changed;
+        hierarchy_stats_t stats;
+};
+
+//What benchmarkTransformHierarchy measured
+struct hierarchy_benchmark_t{
+    size_t nodes;
+    int depth;                  //Deepest chain of parents
+    int frames;
+    double allDirtyMilliseconds;    //Average update() with every node animated
+    double someDirtyMilliseconds;   //Average update() with one node in 16 animated (their subtrees follow)
+    double cleanMilliseconds;       //Average update() with nothing changed
+    size_t someDirtyUpdated;        //World matrices a partly animated update recomputed, on average
+};
+
+//Build a tree of nodes (each under a random earlier node), animate it frames times and time update()
+//CPU only, nothing needs to be drawn
+void benchmarkTransformHierarchy(int nodes, int frames, hierarchy_benchmark_t &result);
@@ -0,0 +1,62 @@
+/*
+* Vertex Transfer
+* Per vertex ambient occlusion and spherical harmonic transfer, baked for loaded meshes
+*
+* Ambient light is treated as a linear function of direction, L(w) = base + slope * w,
+* which is what the first two spherical harmonic bands (L1, 4 coefficients) hold.
+* How much of it reaches a vertex once the mesh shadows itself comes down to:
+*   A = 1/pi * integral of V(w) max(n.w, 0)       -> ambient occlusion (1 = nothing in the way)
+*   B = 1/pi * integral of V(w) max(n.w, 0) w     -> bent normal, scaled by how open the vertex is
+* where V(w) is 0 if the mesh is hit looking along w. Light is then albedo * (base * A + slope * B),
+* a few dot products in the shader instead of a screen space AO pass. A and B are the mesh's
+* L1 transfer coefficients, written in the x/y/z basis instead of the SH one.
+*
+* V is found by casting stratified cosine weighted rays against the mesh's own BVH (see bvh.h),
+* with OpenMP over vertices. Each vertex has its own seed, so bakes repeat exactly.
+*
+* Stored in 4 bytes (ATTRIB_TRANSFER, GL_BYTE normalized) as the difference from an open
+* vertex (A = 1, B = 2/3 n), so vertices that were never baked (all 0) are unoccluded:
+*   x   -> 1 - A
+*   yzw -> (B - 2/3 n) * 0.75, object space (|B - 2/3 n| is at most 4/3)
+*
+* Usage:
+*   indexTriangles(verticies, normals, uvs, vertices, indices);  //Welded vertices
+*   bakeVertexTransfer(vertices, indices, defaultTransferSettings(), &stats);
+*   arena.addMesh(vertices.data(), vertices.size(), indices.data(), indices.size(), mesh);
+*/
+#pragma once
+
+#include <sb7.h>        //OpenGL commands and utilities
+#include <vmath.h>      //Graphics utilities
+#include <meshArena.h>  //arena_vertex_t
+#include <vector>
+
+//How the bake samples
+struct transfer_settings_t{
+    int strata;             //Rays per vertex is strata * strata (one jittered ray per cell)
+    float range;            //Occluders further away than range * mesh size are ignored
+    unsigned int seed;
+};
+
+//Settings that give smooth results on obj file props
+transfer_settings_t defaultTransferSettings();
+
+//What a bake did
+struct transfer_stats_t{
+    size_t vertices;
+    size_t rays;
+    double averageOcclusion;    //Mean of 1 - A over every vertex
+    int threads;
+    double bvhSeconds;
+    double traceSeconds;
+};
+
+//Bake every vertex's transfer into its transfer bytes (object space, run before the mesh is added to an arena)
+// vertices -> welded mesh, positions and normals are read
+// indices  -> 3 per triangle
+// stats is optional
+void bakeVertexTransfer(std::vector<arena_vertex_t> &vertices, const std::vector<GLuint> &indices,
+                        const transfer_settings_t &settings, transfer_stats_t* stats = NULL);
+
+//Pack A (visibility) and B (bent) for a vertex with unit normal
+void packTransfer(float visibility, const vmath::vec3 &bent, const vmath::vec3 &normal, signed char transfer[4]);
@@ -0,0 +1,73 @@
+#version 450 core
+
+//One invocation per instance: test its box against the frustum and write a draw command for it
+layout (local_size_x = 64) in;
+
+//Matches gpu_instance_t (see gpuCulling.h)
+struct Instance {
+    vec4 center;      //World space box center (w unused)
+    vec4 extent;      //Half size (w unused)
+    uint firstIndex;  //Mesh inside the arena
+    uint indexCount;
+    int  baseVertex;
+    uint drawID;      //Transform index, becomes baseInstance
+};
+
+//Matches draw_elements_indirect_t (see meshArena.h)
+struct Command {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int  baseVertex;
+    uint baseInstance;
+};
+
+layout (std430, binding = 2) readonly buffer InstanceBlock {
+    Instance instances[];
+};
+
+layout (std430, binding = 3) writeonly buffer CommandBlock {
+    Command commands[];
+};
+
+//Number of commands written, read back by the GPU as the draw count
+layout (std430, binding = 4) buffer CountBlock {
+    uint drawCount;
+};
+
+uniform vec4 planes[6];     //Frustum planes, normals pointing in
+uniform uint numInstances;
+uniform bool compact;       //Pack survivors to the front (draw count from CountBlock)
+                            //otherwise every slot is written and culled ones draw nothing
+
+void main(void) {
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= numInstances) {
+        return;
+    }
+    Instance inst = instances[i];
+
+    //Box is outside a plane when (distance of center) + (projected extent) < 0
+    bool visible = true;
+    for (int p = 0; p < 6; p++) {
+        float d = dot(planes[p].xyz, inst.center.xyz) + planes[p].w;
+        float r = dot(abs(planes[p].xyz), inst.extent.xyz);
+        visible = visible && (d + r >= 0.0);
+    }
+
+    Command cmd;
+    cmd.count = inst.indexCount;
+    cmd.instanceCount = 1;
+    cmd.firstIndex = inst.firstIndex;
+    cmd.baseVertex = inst.baseVertex;
+    cmd.baseInstance = inst.drawID;
+
+    if (compact) {
+        if (visible) {
+            commands[atomicAdd(drawCount, 1)] = cmd;
+        }
+    } else {
+        cmd.instanceCount = visible ? 1 : 0;
+        commands[i] = cmd;
+    }
+}
@@ -0,0 +1,58 @@
+#version 450 core
+
+//Deferred shading, second pass: one full screen triangle lights every pixel of the G-buffer (see gBuffer.h)
+//The lighting is fs.glsl's (both use lighting.glsl), only the surface comes from the G-buffer instead of the vertex shader
+
+out vec4 color;
+
+//Uniform blocks, lights, shadows, sky and probes come from lighting.glsl
+
+//G-buffer (see gBuffer.h)
+layout (binding = 2) uniform sampler2D gNormal; //Octahedral normal, roughness, metalness
+layout (binding = 3) uniform sampler2D gAlbedo;
+layout (binding = 4) uniform sampler2D gDepth;
+
+//Inverse of octEncode in gbuffer_fs.glsl
+vec3 octDecode(vec2 e)
+{
+    e = e * 2.0 - 1.0;
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+    {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+
+void main(void)
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    if (depth >= 1.0)
+    {
+        discard; //Nothing drawn here, leave the sky
+    }
+
+    //View space position from depth, using the projection's z terms (z_ndc = (A z + B) / -z)
+    vec2 ndc = gl_FragCoord.xy / vec2(textureSize(gDepth, 0)) * 2.0 - 1.0;
+    float viewZ = -frame.projection[3][2] / (depth * 2.0 - 1.0 + frame.projection[2][2]);
+    vec3 viewPos = vec3(ndc.x * -viewZ / frame.projection[0][0], ndc.y * -viewZ / frame.projection[1][1], viewZ);
+    //The view matrix is a rotation and a translation, so its inverse is the transposed rotation
+    vec3 worldPos = transpose(mat3(frame.view)) * (viewPos - frame.view[3].xyz);
+    float viewDepth = -viewZ;
+
+    vec4 normalRoughMetal = texelFetch(gNormal, pixel, 0);
+    vec4 albedoVisibility = texelFetch(gAlbedo, pixel, 0);
+    vec3 albedo = albedoVisibility.rgb;
+    float visibility = albedoVisibility.a;
+    float roughness = normalRoughMetal.z;
+
+    vec3 n = octDecode(normalRoughMetal.xy);
+    vec3 v = normalize(frame.cameraPosition.xyz - worldPos);
+    //No room for the bent normal in the G-buffer, the open one scaled by visibility stands in for it
+    vec3 lit = albedo * ambientLight(worldPos, n, visibility, n * (visibility * 2.0 / 3.0)) + skyReflection(n, v, roughness, visibility);
+    lit += sunLight(worldPos, viewDepth, n, albedo);
+    lit += clusterLights(clusterRange(gl_FragCoord.xy, viewDepth), worldPos, n, v, albedo, blinnPhongExponent(roughness));
+
+    color = vec4(lit, 1.0);
+}
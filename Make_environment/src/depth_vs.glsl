@@ -0,0 +1,26 @@
+#version 450 core
+
+//Depth prepass, positions only (see MeshArena::enablePositionStream)
+//Must compute gl_Position exactly like vs.glsl, the shading pass uses GL_EQUAL
+invariant gl_Position;
+
+//Camera info, uploaded once per frame (see frameData.h)
+layout (std140, binding = 0) uniform FrameBlock {
+    mat4 view;           //world to Camera transform
+    mat4 projection;     //Perspective transform
+    mat4 viewProjection; //projection * view
+    vec4 cameraPosition; //World space camera position
+    float time;          //Seconds since start
+} frame;
+
+//Every object's transform, indexed by draw_id
+layout (std430, binding = 1) readonly buffer ObjectBlock {
+    mat4 obj2world[];
+};
+
+layout (location = 0) in vec4 obj_vertex; //xyz from the position stream, w defaults to 1
+layout (location = 3) in uint draw_id;    //baseInstance + gl_InstanceID, picks the transform
+
+void main(void) {
+    gl_Position = frame.viewProjection * obj2world[draw_id] * obj_vertex;
+}
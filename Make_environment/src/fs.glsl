@@ -1,14 +1,32 @@
-#version 450 core                                                 
+#version 450 core
 
 in vec4 vs_color;
-in vec2 vs_uv;   
+in vec2 vs_uv;
+in vec3 vs_world_pos;
+in vec3 vs_normal;
+in float vs_view_depth;
+in float vs_visibility;
+in vec3 vs_bent;
 
-uniform sampler2D twoDTex; 
+uniform sampler2D twoDTex;
 
-out vec4 color;  
-                                                                  
-void main(void)                                                   
-{                     
-   // color = texture(twoDTex, vs_uv * vec2(1.0,1.0));//Texture interpolation                            
-    color = vec4(1.0f, 0.0f, 0.0f, 1.0f);
-} 
+out vec4 color;
+
+//Uniform blocks, lights, shadows, sky and probes come from lighting.glsl
+
+const vec3 albedo = vec3(0.6, 0.6, 0.6);
+const float roughness = 0.5;
+
+void main(void)
+{
+    // color = texture(twoDTex, vs_uv * vec2(1.0,1.0));//Texture interpolation
+
+    vec3 n = normalize(vs_normal);
+    vec3 v = normalize(frame.cameraPosition.xyz - vs_world_pos);
+    //Probes (or the sky outside the maze), with the mesh's own baked shadowing
+    vec3 lit = albedo * ambientLight(vs_world_pos, n, vs_visibility, vs_bent) + skyReflection(n, v, roughness, vs_visibility);
+    lit += sunLight(vs_world_pos, vs_view_depth, n, albedo);
+    lit += clusterLights(clusterRange(gl_FragCoord.xy, vs_view_depth), vs_world_pos, n, v, albedo, blinnPhongExponent(roughness));
+
+    color = vec4(lit, 1.0);
+}
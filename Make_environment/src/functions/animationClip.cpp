@@ -0,0 +1,503 @@
+/*
+* Animation Clip
+* See ./include/animationClip.h for usage
+*/
+#include <animationClip.h>
+#include <timing.h>
+#include <emmintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+//Longest gap between two keys (in frames), keeps the key reduction from checking whole clips at once
+const int ANIM_MAX_KEY_SPAN = 64;
+
+//Largest 16 bit key value
+const float ANIM_QUANTIZE_STEPS = 65535.0f;
+
+//Batches of 4 tracks handed to a thread at a time
+const int ANIM_SAMPLE_BLOCK = 64;
+
+static float dot4(const vmath::vec4 &a, const vmath::vec4 &b){
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+}
+
+//Corrected t that makes nlerp follow slerp, d is |cos| of the angle between the two quaternions
+//(fitted polynomials, the error is largest for keys far apart and stays near 1e-3 radians)
+static float slerpT(float t, float d){
+    float a = 1.0904f + d * (-3.2452f + d * (3.55645f - d * 1.43519f));
+    float b = 0.848013f + d * (-1.06021f + d * 0.215638f);
+    float k = a * (t - 0.5f) * (t - 0.5f) + b;
+    return t + t * (t - 0.5f) * (t - 1.0f) * k;
+}
+
+//Value between two keys, the scalar version of what the sampler does 4 tracks at a time
+static vmath::vec4 interpolateKeys(int channel, int rotationMode, const vmath::vec4 &a, vmath::vec4 b, float t){
+    if(channel != ANIM_ROTATION){
+        return a + (b - a) * t;
+    }
+    float d = dot4(a, b);
+    if(d < 0.0f){
+        b = -b; //Short way round
+        d = -d;
+    }
+    if(rotationMode == ANIM_SLERP){
+        t = slerpT(t, d);
+    }
+    vmath::vec4 q = a + (b - a) * t;
+    return q * (1.0f / sqrtf(dot4(q, q)));
+}
+
+//How far a sampled value is from the raw one, in the units of the error settings
+static float keyError(int channel, const vmath::vec4 &value, const vmath::vec4 &raw){
+    if(channel != ANIM_ROTATION){
+        vmath::vec3 d(value[0] - raw[0], value[1] - raw[1], value[2] - raw[2]);
+        return vmath::length(d);
+    }
+    float d = fabsf(dot4(value, raw)) / sqrtf(dot4(value, value) * dot4(raw, raw));
+    return 2.0f * acosf(d < 1.0f ? d : 1.0f);
+}
+
+//One track compressed on its own, joined with the others afterwards
+struct anim_track_work_t{
+    anim_track_t track;
+    std::vector<uint16_t> frames;
+    std::vector<uint16_t> values;
+    float error;
+};
+
+static void compressTrack(const anim_raw_track_t &raw, int frames, const anim_compress_settings_t &settings,
+                          anim_track_work_t &work){
+    const int channel = raw.channel;
+    std::vector<vmath::vec4> samples(raw.samples.begin(), raw.samples.begin() + frames);
+    if(channel == ANIM_ROTATION){
+        //Unit length, and every sample on the same side as the one before it
+        for(int f = 0; f < frames; f++){
+            samples[f] = samples[f] * (1.0f / sqrtf(dot4(samples[f], samples[f])));
+            if(f > 0 && dot4(samples[f], samples[f - 1]) < 0.0f){
+                samples[f] = -samples[f];
+            }
+        }
+    } else {
+        for(int f = 0; f < frames; f++){
+            samples[f][3] = 0.0f;
+        }
+    }
+
+    //16 bits across each component's range
+    vmath::vec4 low = samples[0];
+    vmath::vec4 high = samples[0];
+    for(int f = 1; f < frames; f++){
+        for(int c = 0; c < 4; c++){
+            low[c] = vmath::min(low[c], samples[f][c]);
+            high[c] = vmath::max(high[c], samples[f][c]);
+        }
+    }
+    work.track.target = raw.target;
+    work.track.channel = channel;
+    work.track.rangeMin = low;
+    work.track.rangeScale = (high - low) * (1.0f / ANIM_QUANTIZE_STEPS);
+
+    std::vector<uint16_t> quantized((size_t)frames * 4);
+    std::vector<vmath::vec4> decoded(frames);
+    for(int f = 0; f < frames; f++){
+        for(int c = 0; c < 4; c++){
+            float scale = work.track.rangeScale[c];
+            float q = scale > 0.0f ? (samples[f][c] - low[c]) / scale + 0.5f : 0.0f;
+            quantized[(size_t)f * 4 + c] = static_cast<uint16_t>(q < ANIM_QUANTIZE_STEPS ? q : ANIM_QUANTIZE_STEPS);
+            decoded[f][c] = low[c] + quantized[(size_t)f * 4 + c] * scale;
+        }
+    }
+
+    float tolerance = channel == ANIM_TRANSLATION ? settings.translationError :
+                      (channel == ANIM_ROTATION ? settings.rotationError : settings.scaleError);
+
+    //Greedy: from each kept key, reach as far as interpolation stays inside the tolerance for every frame skipped
+    std::vector<int> keys(1, 0);
+    int start = 0;
+    while(start < frames - 1){
+        int end = start + 1;
+        int last = vmath::min(frames - 1, start + ANIM_MAX_KEY_SPAN);
+        for(int candidate = start + 2; candidate <= last; candidate++){
+            bool fits = true;
+            for(int f = start + 1; f < candidate && fits; f++){
+                float t = static_cast<float>(f - start) / (candidate - start);
+                vmath::vec4 value = interpolateKeys(channel, settings.rotationMode, decoded[start], decoded[candidate], t);
+                fits = keyError(channel, value, samples[f]) <= tolerance;
+            }
+            if(!fits){
+                break;
+            }
+            end = candidate;
+        }
+        keys.push_back(end);
+        start = end;
+    }
+
+    //Measure what was kept over every frame (quantization included)
+    work.error = 0.0f;
+    for(size_t k = 0; k < keys.size(); k++){
+        int a = keys[k];
+        int b = k + 1 < keys.size() ? keys[k + 1] : a;
+        for(int f = a; f < b || f == a; f++){
+            float t = b > a ? static_cast<float>(f - a) / (b - a) : 0.0f;
+            vmath::vec4 value = interpolateKeys(channel, settings.rotationMode, decoded[a], decoded[b], t);
+            work.error = vmath::max(work.error, keyError(channel, value, samples[f]));
+        }
+    }
+
+    work.frames.resize(keys.size());
+    work.values.resize(keys.size() * 4);
+    for(size_t k = 0; k < keys.size(); k++){
+        work.frames[k] = static_cast<uint16_t>(keys[k]);
+        memcpy(&work.values[k * 4], &quantized[(size_t)keys[k] * 4], 4 * sizeof(uint16_t));
+    }
+}
+
+anim_compress_settings_t defaultAnimCompressSettings(){
+    anim_compress_settings_t settings;
+    settings.translationError = 0.001f;
+    settings.rotationError = 0.002f;
+    settings.scaleError = 0.001f;
+    settings.rotationMode = ANIM_SLERP;
+    return settings;
+}
+
+AnimationClip::AnimationClip(){
+    for(int c = 0; c <= ANIM_CHANNELS; c++){
+        channelStart[c] = 0;
+    }
+    sampleRate = 1.0f;
+    frameCount = 0;
+    rotationMode = ANIM_NLERP;
+    memset(&stats, 0, sizeof(stats));
+}
+
+void AnimationClip::compress(const std::vector<anim_raw_track_t> &raw, int frames, float newSampleRate,
+                             const anim_compress_settings_t &settings){
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    tracks.clear();
+    keyFrames.clear();
+    keyValues.clear();
+    memset(&stats, 0, sizeof(stats));
+    sampleRate = newSampleRate > 0.0f ? newSampleRate : 1.0f;
+    frameCount = vmath::max(0, vmath::min(frames, 65536)); //Key frames are 16 bit
+    rotationMode = settings.rotationMode;
+
+    //Sorted by channel (then target), so the sampler's batches are all one kind
+    std::vector<size_t> order;
+    for(size_t i = 0; i < raw.size(); i++){
+        if(frameCount > 0 && raw[i].samples.size() >= (size_t)frameCount && raw[i].channel >= 0 && raw[i].channel < ANIM_CHANNELS){
+            order.push_back(i);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&raw](size_t a, size_t b){
+        return raw[a].channel != raw[b].channel ? raw[a].channel < raw[b].channel : raw[a].target < raw[b].target;
+    });
+
+    //Tracks don't depend on each other
+    std::vector<anim_track_work_t> work(order.size());
+    const int count = static_cast<int>(order.size());
+    #pragma omp parallel for schedule(dynamic, 8)
+    for(int i = 0; i < count; i++){
+        compressTrack(raw[order[i]], frameCount, settings, work[i]);
+    }
+
+    //Joined in track order, so the result doesn't depend on the threads
+    for(int c = 0; c <= ANIM_CHANNELS; c++){
+        channelStart[c] = 0;
+    }
+    for(int i = 0; i < count; i++){
+        anim_track_t track = work[i].track;
+        track.firstKey = static_cast<uint32_t>(keyFrames.size());
+        track.keyCount = static_cast<uint32_t>(work[i].frames.size());
+        keyFrames.insert(keyFrames.end(), work[i].frames.begin(), work[i].frames.end());
+        keyValues.insert(keyValues.end(), work[i].values.begin(), work[i].values.end());
+        tracks.push_back(track);
+        channelStart[track.channel + 1] = tracks.size();
+        stats.maxError[track.channel] = vmath::max(stats.maxError[track.channel], work[i].error);
+    }
+    for(int c = 1; c <= ANIM_CHANNELS; c++){
+        channelStart[c] = vmath::max(channelStart[c], channelStart[c - 1]); //Channels with no tracks
+    }
+
+    stats.tracks = tracks.size();
+    stats.rawKeys = tracks.size() * frameCount;
+    stats.keys = keyFrames.size();
+    stats.rawBytes = stats.rawKeys * sizeof(vmath::vec4);
+    stats.bytes = keyFrames.size() * sizeof(uint16_t) + keyValues.size() * sizeof(uint16_t) + tracks.size() * sizeof(anim_track_t);
+    stats.compressSeconds = secondsSince(start);
+}
+
+int AnimationClip::findTrack(int target, int channel) const{
+    if(channel < 0 || channel >= ANIM_CHANNELS){
+        return -1;
+    }
+    for(size_t i = channelStart[channel]; i < channelStart[channel + 1]; i++){
+        if(tracks[i].target == target){
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+float AnimationClip::frameAt(float time) const{
+    if(frameCount <= 1){
+        return 0.0f;
+    }
+    float span = static_cast<float>(frameCount - 1);
+    float frame = fmodf(time * sampleRate, span);
+    return frame < 0.0f ? frame + span : frame;
+}
+
+vmath::vec4 AnimationClip::keyValue(const anim_track_t &track, size_t key) const{
+    const uint16_t* q = &keyValues[key * 4];
+    vmath::vec4 value;
+    for(int c = 0; c < 4; c++){
+        value[c] = track.rangeMin[c] + q[c] * track.rangeScale[c];
+    }
+    return value;
+}
+
+vmath::vec4 AnimationClip::sampleTrack(size_t index, float time) const{
+    const anim_track_t &track = tracks[index];
+    float frame = frameAt(time);
+
+    //Last key at or before frame
+    uint32_t low = 0;
+    uint32_t high = track.keyCount;
+    while(high - low > 1){
+        uint32_t middle = (low + high) / 2;
+        if(keyFrames[track.firstKey + middle] <= frame){
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    size_t a = track.firstKey + low;
+    size_t b = low + 1 < track.keyCount ? a + 1 : a;
+    float t = b > a ? (frame - keyFrames[a]) / (keyFrames[b] - keyFrames[a]) : 0.0f;
+    return interpolateKeys(track.channel, rotationMode, keyValue(track, a), keyValue(track, b), t);
+}
+
+AnimationSampler::AnimationSampler(){
+    clip = NULL;
+    memset(&stats, 0, sizeof(stats));
+}
+
+void AnimationSampler::setClip(const AnimationClip &newClip){
+    clip = &newClip;
+    cursors.assign(clip->getTrackCount(), 0);
+    values.assign(clip->getTrackCount(), vmath::vec4(0.0f, 0.0f, 0.0f, 0.0f));
+    memset(&stats, 0, sizeof(stats));
+}
+
+uint32_t AnimationSampler::advance(size_t index, float frame, size_t &steps, size_t &seeks){
+    const anim_track_t &track = clip->getTrack(index);
+    uint32_t cursor = cursors[index];
+    if(clip->keyFrame(track.firstKey + cursor) > frame){
+        //Went backwards, find the key again
+        uint32_t low = 0;
+        uint32_t high = cursor;
+        while(high - low > 1){
+            uint32_t middle = (low + high) / 2;
+            if(clip->keyFrame(track.firstKey + middle) <= frame){
+                low = middle;
+            } else {
+                high = middle;
+            }
+        }
+        cursor = low;
+        seeks++;
+    }
+    while(cursor + 1 < track.keyCount && clip->keyFrame(track.firstKey + cursor + 1) <= frame){
+        cursor++;
+        steps++;
+    }
+    cursors[index] = cursor;
+    return cursor;
+}
+
+//4 quantized values of a key -> floats
+static inline __m128 decodeKey(const uint16_t* key, __m128 rangeMin, __m128 rangeScale){
+    __m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(key));
+    __m128 q = _mm_cvtepi32_ps(_mm_unpacklo_epi16(packed, _mm_setzero_si128()));
+    return _mm_add_ps(rangeMin, _mm_mul_ps(q, rangeScale));
+}
+
+void AnimationSampler::sample(float time){
+    if(!clip){
+        return;
+    }
+    float frame = clip->frameAt(time);
+    const bool slerp = clip->getRotationMode() == ANIM_SLERP;
+    size_t steps = 0;
+    size_t seeks = 0;
+
+    //Batches of 4 never cross from one channel to the next
+    int batchStart[ANIM_CHANNELS + 1];
+    batchStart[0] = 0;
+    for(int channel = 0; channel < ANIM_CHANNELS; channel++){
+        batchStart[channel + 1] = batchStart[channel] + static_cast<int>((clip->channelBegin(channel + 1) - clip->channelBegin(channel) + 3) / 4);
+    }
+    const int batches = batchStart[ANIM_CHANNELS];
+
+    //Every batch only touches its own tracks' cursors and values
+    #pragma omp parallel for schedule(static) reduction(+:steps, seeks) if(batches > ANIM_SAMPLE_BLOCK)
+    for(int batch = 0; batch < batches; batch++){
+        int channel = 0;
+        while(batch >= batchStart[channel + 1]){
+            channel++;
+        }
+        const size_t end = clip->channelBegin(channel + 1);
+        size_t base = clip->channelBegin(channel) + (size_t)(batch - batchStart[channel]) * 4;
+        size_t lanes = end - base < 4 ? end - base : 4;
+
+        //Keys on both sides of frame for each lane, lanes past the end repeat the last track
+        __m128 a[4], b[4];
+        float laneT[4];
+        for(size_t l = 0; l < 4; l++){
+            if(l >= lanes){
+                a[l] = a[lanes - 1];
+                b[l] = b[lanes - 1];
+                laneT[l] = laneT[lanes - 1];
+                continue;
+            }
+            const anim_track_t &track = clip->getTrack(base + l);
+            uint32_t cursor = advance(base + l, frame, steps, seeks);
+
+            size_t keyA = track.firstKey + cursor;
+            size_t keyB = cursor + 1 < track.keyCount ? keyA + 1 : keyA;
+            uint16_t frameA = clip->keyFrame(keyA);
+            uint16_t frameB = clip->keyFrame(keyB);
+            laneT[l] = frameB > frameA ? (frame - frameA) / (frameB - frameA) : 0.0f;
+            __m128 rangeMin = _mm_loadu_ps(&track.rangeMin[0]);
+            __m128 rangeScale = _mm_loadu_ps(&track.rangeScale[0]);
+            a[l] = decodeKey(clip->keyData(keyA), rangeMin, rangeScale);
+            b[l] = decodeKey(clip->keyData(keyB), rangeMin, rangeScale);
+        }
+        _MM_TRANSPOSE4_PS(a[0], a[1], a[2], a[3]);
+        _MM_TRANSPOSE4_PS(b[0], b[1], b[2], b[3]);
+        __m128 t = _mm_loadu_ps(laneT);
+
+        __m128 out[4];
+        if(channel != ANIM_ROTATION){
+            for(int c = 0; c < 4; c++){
+                out[c] = _mm_add_ps(a[c], _mm_mul_ps(_mm_sub_ps(b[c], a[c]), t));
+            }
+        } else {
+            //Short way round: flip b where it is on the other side of a
+            const __m128 signBit = _mm_set1_ps(-0.0f);
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0], b[0]), _mm_mul_ps(a[1], b[1])),
+                                  _mm_add_ps(_mm_mul_ps(a[2], b[2]), _mm_mul_ps(a[3], b[3])));
+            __m128 flip = _mm_and_ps(d, signBit);
+            for(int c = 0; c < 4; c++){
+                b[c] = _mm_xor_ps(b[c], flip);
+            }
+            if(slerp){
+                //Same correction as slerpT, 4 at a time
+                d = _mm_andnot_ps(signBit, d);
+                __m128 ka = _mm_add_ps(_mm_set1_ps(1.0904f), _mm_mul_ps(d, _mm_add_ps(_mm_set1_ps(-3.2452f),
+                            _mm_mul_ps(d, _mm_sub_ps(_mm_set1_ps(3.55645f), _mm_mul_ps(d, _mm_set1_ps(1.43519f)))))));
+                __m128 kb = _mm_add_ps(_mm_set1_ps(0.848013f), _mm_mul_ps(d, _mm_add_ps(_mm_set1_ps(-1.06021f),
+                            _mm_mul_ps(d, _mm_set1_ps(0.215638f)))));
+                __m128 half = _mm_sub_ps(t, _mm_set1_ps(0.5f));
+                __m128 k = _mm_add_ps(_mm_mul_ps(ka, _mm_mul_ps(half, half)), kb);
+                t = _mm_add_ps(t, _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, half), _mm_sub_ps(t, _mm_set1_ps(1.0f))), k));
+            }
+            for(int c = 0; c < 4; c++){
+                out[c] = _mm_add_ps(a[c], _mm_mul_ps(_mm_sub_ps(b[c], a[c]), t));
+            }
+            __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(out[0], out[0]), _mm_mul_ps(out[1], out[1])),
+                                              _mm_add_ps(_mm_mul_ps(out[2], out[2]), _mm_mul_ps(out[3], out[3])));
+            __m128 inverseLength = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(lengthSquared));
+            for(int c = 0; c < 4; c++){
+                out[c] = _mm_mul_ps(out[c], inverseLength);
+            }
+        }
+
+        _MM_TRANSPOSE4_PS(out[0], out[1], out[2], out[3]);
+        for(size_t l = 0; l < lanes; l++){
+            _mm_storeu_ps(&values[base + l][0], out[l]);
+        }
+    }
+
+    stats.tracks = clip->getTrackCount();
+    stats.cursorSteps = steps;
+    stats.seeks = seeks;
+}
+
+vmath::mat4 trsMatrix(const vmath::vec3 &translation, const vmath::quaternion &rotation, const vmath::vec3 &scale){
+    float x = rotation[0], y = rotation[1], z = rotation[2], w = rotation[3];
+    vmath::mat4 m;
+    //Columns: the rotated, scaled axes, then the translation
+    m[0] = vmath::vec4(1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + w * z), 2.0f * (x * z - w * y), 0.0f) * scale[0];
+    m[1] = vmath::vec4(2.0f * (x * y - w * z), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + w * x), 0.0f) * scale[1];
+    m[2] = vmath::vec4(2.0f * (x * z + w * y), 2.0f * (y * z - w * x), 1.0f - 2.0f * (x * x + y * y), 0.0f) * scale[2];
+    m[3] = vmath::vec4(translation[0], translation[1], translation[2], 1.0f);
+    return m;
+}
+
+void benchmarkAnimation(int targets, int frames, anim_benchmark_t &result){
+    memset(&result, 0, sizeof(result));
+    targets = vmath::max(targets, 1);
+    frames = vmath::max(frames, 1);
+
+    //5 seconds of smooth, different motion for every target
+    const float sampleRate = 60.0f;
+    const int clipFrames = 301;
+    std::vector<anim_raw_track_t> raw(targets * ANIM_CHANNELS);
+    for(int i = 0; i < targets; i++){
+        for(int c = 0; c < ANIM_CHANNELS; c++){
+            anim_raw_track_t &track = raw[i * ANIM_CHANNELS + c];
+            track.target = i;
+            track.channel = c;
+            track.samples.resize(clipFrames);
+        }
+        vmath::vec3 axis = vmath::normalize(vmath::vec3(sinf(i * 1.3f), 1.0f, cosf(i * 0.7f)));
+        for(int f = 0; f < clipFrames; f++){
+            float t = f / sampleRate;
+            raw[i * ANIM_CHANNELS + ANIM_TRANSLATION].samples[f] =
+                vmath::vec4(2.0f * sinf(0.7f * t + i), 0.3f * sinf(2.1f * t + 0.5f * i), 2.0f * cosf(0.9f * t + i), 0.0f);
+            float angle = 1.5f * sinf(0.8f * t + i);
+            float s = sinf(angle * 0.5f);
+            raw[i * ANIM_CHANNELS + ANIM_ROTATION].samples[f] = vmath::vec4(axis[0] * s, axis[1] * s, axis[2] * s, cosf(angle * 0.5f));
+            float scale = 1.0f + 0.1f * sinf(1.3f * t + i);
+            raw[i * ANIM_CHANNELS + ANIM_SCALE].samples[f] = vmath::vec4(scale, scale, scale, 0.0f);
+        }
+    }
+
+    AnimationClip clip;
+    clip.compress(raw, clipFrames, sampleRate, defaultAnimCompressSettings());
+    AnimationSampler sampler;
+    sampler.setClip(clip);
+    const size_t tracks = clip.getTrackCount();
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    for(int f = 0; f < frames; f++){
+        sampler.sample(f / 60.0f);
+    }
+    result.samplerSeconds = secondsSince(start);
+
+    std::vector<vmath::vec4> reference(tracks);
+    start = std::chrono::high_resolution_clock::now();
+    for(int f = 0; f < frames; f++){
+        for(size_t i = 0; i < tracks; i++){
+            reference[i] = clip.sampleTrack(i, f / 60.0f);
+        }
+    }
+    result.referenceSeconds = secondsSince(start);
+
+    //Both ended on the same frame
+    for(size_t i = 0; i < tracks; i++){
+        for(int c = 0; c < 4; c++){
+            result.maxDifference = vmath::max(result.maxDifference, fabsf(reference[i][c] - sampler.getValue(i)[c]));
+        }
+    }
+
+    result.tracks = tracks;
+    result.frames = frames;
+    result.clip = clip.getStats();
+    result.tracksPerSecond = result.samplerSeconds > 0.0 ? tracks * frames / result.samplerSeconds : 0.0;
+    result.referenceTracksPerSecond = result.referenceSeconds > 0.0 ? tracks * frames / result.referenceSeconds : 0.0;
+}
@@ -0,0 +1,279 @@
+/*
+* Triangle BVH
+* See ./include/bvh.h for usage
+*/
+#include <bvh.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+//Everything the recursive build needs, kept out of the class so the header stays small
+struct bvh_build_t{
+    std::vector<vmath::vec3> boxMin, boxMax, centroid;  //Per triangle
+    std::vector<unsigned int> order;                    //Triangles in leaf order, sorted in place
+};
+
+//Half the surface area of a box, the SAH only compares them
+static float halfArea(const vmath::vec3 &low, const vmath::vec3 &high){
+    vmath::vec3 e = high - low;
+    if(e[0] < 0.0f){
+        return 0.0f; //Empty
+    }
+    return e[0] * e[1] + e[1] * e[2] + e[2] * e[0];
+}
+
+//Template arguments spelled out, otherwise the scalar min/max wins and compares the vectors as pointers
+static void grow(vmath::vec3 &low, vmath::vec3 &high, const vmath::vec3 &pointLow, const vmath::vec3 &pointHigh){
+    low = vmath::min<float, 3>(low, pointLow);
+    high = vmath::max<float, 3>(high, pointHigh);
+}
+
+//Build the node for order[begin, end) and everything under it, returns the tree depth below it
+// level -> depth of this node, the root is 1
+template <typename node_t>
+static int buildNode(bvh_build_t &build, std::vector<node_t> &nodes, unsigned int begin, unsigned int end, int level){
+    unsigned int index = static_cast<unsigned int>(nodes.size());
+    nodes.push_back(node_t());
+
+    vmath::vec3 low(FLT_MAX), high(-FLT_MAX), centroidLow(FLT_MAX), centroidHigh(-FLT_MAX);
+    for(unsigned int i = begin; i < end; i++){
+        unsigned int t = build.order[i];
+        grow(low, high, build.boxMin[t], build.boxMax[t]);
+        grow(centroidLow, centroidHigh, build.centroid[t], build.centroid[t]);
+    }
+    for(int a = 0; a < 3; a++){
+        nodes[index].boundsMin[a] = low[a];
+        nodes[index].boundsMax[a] = high[a];
+    }
+
+    //Past BVH_MAX_DEPTH the rest goes into one (bigger) leaf, so traversal's stack always has room
+    unsigned int count = end - begin;
+    if(count <= static_cast<unsigned int>(BVH_LEAF_SIZE) || level == BVH_MAX_DEPTH){
+        nodes[index].offset = begin;
+        nodes[index].count = count;
+        return 1;
+    }
+
+    //Binned SAH, cheapest split plane over all three axes
+    int bestAxis = -1;
+    int bestBin = 0;
+    float bestCost = FLT_MAX;
+    for(int a = 0; a < 3; a++){
+        float extent = centroidHigh[a] - centroidLow[a];
+        if(extent <= 0.0f){
+            continue;
+        }
+        float scale = SAH_BINS / extent;
+        unsigned int binCount[SAH_BINS] = {0};
+        vmath::vec3 binLow[SAH_BINS], binHigh[SAH_BINS];
+        for(int b = 0; b < SAH_BINS; b++){
+            binLow[b] = vmath::vec3(FLT_MAX);
+            binHigh[b] = vmath::vec3(-FLT_MAX);
+        }
+        for(unsigned int i = begin; i < end; i++){
+            unsigned int t = build.order[i];
+            int b = vmath::min(static_cast<int>((build.centroid[t][a] - centroidLow[a]) * scale), SAH_BINS - 1);
+            binCount[b]++;
+            grow(binLow[b], binHigh[b], build.boxMin[t], build.boxMax[t]);
+        }
+
+        //Sweep from the right for the right hand areas, then from the left
+        float rightArea[SAH_BINS];
+        unsigned int rightCount[SAH_BINS];
+        vmath::vec3 sweepLow(FLT_MAX), sweepHigh(-FLT_MAX);
+        unsigned int sweepCount = 0;
+        for(int b = SAH_BINS - 1; b > 0; b--){
+            grow(sweepLow, sweepHigh, binLow[b], binHigh[b]);
+            sweepCount += binCount[b];
+            rightArea[b] = halfArea(sweepLow, sweepHigh);
+            rightCount[b] = sweepCount;
+        }
+        sweepLow = vmath::vec3(FLT_MAX);
+        sweepHigh = vmath::vec3(-FLT_MAX);
+        sweepCount = 0;
+        for(int b = 0; b < SAH_BINS - 1; b++){
+            grow(sweepLow, sweepHigh, binLow[b], binHigh[b]);
+            sweepCount += binCount[b];
+            if(sweepCount == 0 || rightCount[b + 1] == 0){
+                continue;
+            }
+            float cost = sweepCount * halfArea(sweepLow, sweepHigh) + rightCount[b + 1] * rightArea[b + 1];
+            if(cost < bestCost){
+                bestCost = cost;
+                bestAxis = a;
+                bestBin = b;
+            }
+        }
+    }
+
+    //Split, falling back on halving the list when every centroid is in the same place
+    unsigned int middle;
+    if(bestAxis >= 0){
+        float scale = SAH_BINS / (centroidHigh[bestAxis] - centroidLow[bestAxis]);
+        float lowEdge = centroidLow[bestAxis];
+        middle = static_cast<unsigned int>(std::partition(build.order.begin() + begin, build.order.begin() + end,
+            [&](unsigned int t){
+                return vmath::min(static_cast<int>((build.centroid[t][bestAxis] - lowEdge) * scale), SAH_BINS - 1) <= bestBin;
+            }) - build.order.begin());
+    } else {
+        middle = begin + count / 2;
+    }
+
+    //Left child is the next node, so only the right one is recorded
+    int leftDepth = buildNode(build, nodes, begin, middle, level + 1);
+    nodes[index].offset = static_cast<unsigned int>(nodes.size());
+    nodes[index].count = 0;
+    int rightDepth = buildNode(build, nodes, middle, end, level + 1);
+    return 1 + vmath::max(leftDepth, rightDepth);
+}
+
+//Slab test, distance to where the ray enters the box or FLT_MAX if it misses (or enters past tMax)
+static inline float slab(const float *boxMin, const float *boxMax, const vmath::vec3 &origin, const vmath::vec3 &inverse, float tMax){
+    float t0 = 0.0f;
+    float t1 = tMax;
+    for(int a = 0; a < 3; a++){
+        float tNear = (boxMin[a] - origin[a]) * inverse[a];
+        float tFar = (boxMax[a] - origin[a]) * inverse[a];
+        if(tNear > tFar){
+            std::swap(tNear, tFar);
+        }
+        t0 = tNear > t0 ? tNear : t0;
+        t1 = tFar < t1 ? tFar : t1;
+    }
+    return t0 <= t1 ? t0 : FLT_MAX;
+}
+
+TriangleBVH::TriangleBVH(){
+    depth = 0;
+}
+
+void TriangleBVH::build(const std::vector<vmath::vec3> &positions, const std::vector<unsigned int> &indices){
+    nodes.clear();
+    triangles.clear();
+    depth = 0;
+
+    size_t count = indices.size() / 3;
+    if(count == 0){
+        return;
+    }
+
+    bvh_build_t data;
+    data.boxMin.resize(count);
+    data.boxMax.resize(count);
+    data.centroid.resize(count);
+    data.order.resize(count);
+    for(size_t t = 0; t < count; t++){
+        const vmath::vec3 &a = positions[indices[t * 3 + 0]];
+        const vmath::vec3 &b = positions[indices[t * 3 + 1]];
+        const vmath::vec3 &c = positions[indices[t * 3 + 2]];
+        data.boxMin[t] = a;
+        data.boxMax[t] = a;
+        grow(data.boxMin[t], data.boxMax[t], b, b);
+        grow(data.boxMin[t], data.boxMax[t], c, c);
+        data.centroid[t] = (data.boxMin[t] + data.boxMax[t]) * 0.5f;
+        data.order[t] = static_cast<unsigned int>(t);
+    }
+
+    //At most 2n - 1 nodes
+    nodes.reserve(count * 2);
+    depth = buildNode(data, nodes, 0, static_cast<unsigned int>(count), 1);
+
+    //Copy the triangles into leaf order, ready for the intersection test
+    triangles.resize(count);
+    for(size_t i = 0; i < count; i++){
+        unsigned int t = data.order[i];
+        const vmath::vec3 &a = positions[indices[t * 3 + 0]];
+        triangles[i].v0 = a;
+        triangles[i].edge1 = positions[indices[t * 3 + 1]] - a;
+        triangles[i].edge2 = positions[indices[t * 3 + 2]] - a;
+        triangles[i].id = t;
+    }
+}
+
+bool TriangleBVH::intersect(const vmath::vec3 &origin, const vmath::vec3 &direction, float tMax, bvh_hit_t &hit) const{
+    return traverse(origin, direction, tMax, false, hit);
+}
+
+bool TriangleBVH::occluded(const vmath::vec3 &origin, const vmath::vec3 &direction, float tMax) const{
+    bvh_hit_t hit;
+    return traverse(origin, direction, tMax, true, hit);
+}
+
+bool TriangleBVH::traverse(const vmath::vec3 &origin, const vmath::vec3 &direction, float tMax, bool anyHit, bvh_hit_t &hit) const{
+    if(nodes.empty()){
+        return false;
+    }
+
+    //Infinite where the direction is 0, the slab test still works out with IEEE floats
+    vmath::vec3 inverse(1.0f / direction[0], 1.0f / direction[1], 1.0f / direction[2]);
+    float closest = tMax;
+    bool found = false;
+
+    //One entry per level at most, the deepest leaf never pushes (build() keeps depth <= BVH_MAX_DEPTH)
+    unsigned int stack[BVH_MAX_DEPTH];
+    int top = 0;
+    unsigned int current = 0;
+    if(slab(nodes[0].boundsMin, nodes[0].boundsMax, origin, inverse, closest) == FLT_MAX){
+        return false;
+    }
+
+    while(true){
+        const node_t &node = nodes[current];
+        if(node.count > 0){
+            for(unsigned int i = node.offset; i < node.offset + node.count; i++){
+                //Moller-Trumbore
+                const triangle_t &tri = triangles[i];
+                vmath::vec3 p = vmath::cross(direction, tri.edge2);
+                float det = vmath::dot(tri.edge1, p);
+                if(fabsf(det) < 1e-12f){
+                    continue; //Parallel
+                }
+                float inv = 1.0f / det;
+                vmath::vec3 s = origin - tri.v0;
+                float u = vmath::dot(s, p) * inv;
+                if(u < 0.0f || u > 1.0f){
+                    continue;
+                }
+                vmath::vec3 q = vmath::cross(s, tri.edge1);
+                float v = vmath::dot(direction, q) * inv;
+                if(v < 0.0f || u + v > 1.0f){
+                    continue;
+                }
+                float t = vmath::dot(tri.edge2, q) * inv;
+                if(t > 0.0f && t < closest){
+                    closest = t;
+                    hit.t = t;
+                    hit.u = u;
+                    hit.v = v;
+                    hit.triangle = tri.id;
+                    found = true;
+                    if(anyHit){
+                        return true;
+                    }
+                }
+            }
+        } else {
+            //Visit the nearer child first, the other waits on the stack
+            unsigned int left = current + 1;
+            unsigned int right = node.offset;
+            float leftDistance = slab(nodes[left].boundsMin, nodes[left].boundsMax, origin, inverse, closest);
+            float rightDistance = slab(nodes[right].boundsMin, nodes[right].boundsMax, origin, inverse, closest);
+            if(leftDistance > rightDistance){
+                std::swap(left, right);
+                std::swap(leftDistance, rightDistance);
+            }
+            if(leftDistance != FLT_MAX){
+                if(rightDistance != FLT_MAX){
+                    stack[top++] = right;
+                }
+                current = left;
+                continue;
+            }
+        }
+        if(top == 0){
+            break;
+        }
+        current = stack[--top];
+    }
+    return found;
+}
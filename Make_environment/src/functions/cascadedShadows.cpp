@@ -0,0 +1,300 @@
+/*
+* Cascaded Shadows
+* See ./include/cascadedShadows.h for usage
+*/
+#include <cascadedShadows.h>
+#include <sb7glstate.h>
+#include <math.h>
+#include <string.h>
+
+//How far the cascade splits lean towards logarithmic (1) rather than even (0) spacing
+static const float SPLIT_LAMBDA = 0.75f;
+
+//Attach one layer of a depth array to the framebuffer and get ready to draw depth into it
+static void startDepthPass(GLuint framebuffer, GLuint texture, int layer, int size){
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, layer);
+    glViewport(0, 0, size, size);
+    sb7::glstate::depth_mask(GL_TRUE);
+    //Slope scaled offset keeps lit surfaces from shadowing themselves (acne)
+    sb7::glstate::enable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+}
+
+CascadedShadows::CascadedShadows(){
+    cascadeTexture = 0;
+    cacheTexture = 0;
+    framebuffer = 0;
+    depthNear = 0.0f;
+    depthFar = 1.0f;
+    frame = 0;
+    memset(&stats, 0, sizeof(stats));
+    memset(pages, 0, sizeof(pages));
+    for(int c = 0; c < SHADOW_CASCADES; c++){
+        pageWorldSize[c] = 0.0f;
+        windowX[c] = 0;
+        windowY[c] = 0;
+    }
+}
+
+void CascadedShadows::create(const vmath::vec3 &newSceneMin, const vmath::vec3 &newSceneMax){
+    destroy(); //Just in case this is being re-used
+    sceneMin = newSceneMin;
+    sceneMax = newSceneMax;
+    lightDir = vmath::vec3(0.0f, 0.0f, 0.0f); //Nothing drawn yet, the first update() sets it up
+    invalidateCache();
+
+    //Cascades are sampled with hardware depth comparison (sampler2DArrayShadow), filtered 2x2
+    glGenTextures(1, &cascadeTexture);
+    sb7::glstate::bind_texture_unit(SHADOW_TEXTURE_UNIT, GL_TEXTURE_2D_ARRAY, cascadeTexture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, SHADOW_CASCADES);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+    //Same format as the cascades, so pages can be copied straight across
+    glGenTextures(1, &cacheTexture);
+    sb7::glstate::bind_texture_unit(SHADOW_TEXTURE_UNIT, GL_TEXTURE_2D_ARRAY, cacheTexture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, SHADOW_PAGE_SIZE, SHADOW_PAGE_SIZE, SHADOW_CASCADES * SHADOW_CACHE_PAGES);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    //Depth only, the layer is attached per pass
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    stream.init(sizeof(shadow_uniforms_t) + 256);
+}
+
+void CascadedShadows::destroy(){
+    if(cascadeTexture){
+        sb7::glstate::delete_textures(1, &cascadeTexture);
+        sb7::glstate::delete_textures(1, &cacheTexture);
+        glDeleteFramebuffers(1, &framebuffer);
+        stream.teardown();
+    }
+    cascadeTexture = 0;
+    cacheTexture = 0;
+    framebuffer = 0;
+    dirtyPages.clear();
+}
+
+void CascadedShadows::invalidateCache(){
+    for(int c = 0; c < SHADOW_CASCADES; c++){
+        for(int i = 0; i < SHADOW_CACHE_PAGES; i++){
+            pages[c][i].valid = false;
+        }
+    }
+}
+
+vmath::mat4 CascadedShadows::lightProjection(float left, float right, float bottom, float top) const {
+    //Built by hand, vmath::ortho gets the depth mapping backwards
+    vmath::mat4 projection(vmath::vec4(2.0f / (right - left), 0.0f, 0.0f, 0.0f),
+                           vmath::vec4(0.0f, 2.0f / (top - bottom), 0.0f, 0.0f),
+                           vmath::vec4(0.0f, 0.0f, -2.0f / (depthFar - depthNear), 0.0f),
+                           vmath::vec4(-(right + left) / (right - left), -(top + bottom) / (top - bottom),
+                                       -(depthFar + depthNear) / (depthFar - depthNear), 1.0f));
+    return projection * lightView;
+}
+
+int CascadedShadows::findPage(int cascade, int x, int y) const {
+    for(int i = 0; i < SHADOW_CACHE_PAGES; i++){
+        const page_t &page = pages[cascade][i];
+        if(page.valid && page.x == x && page.y == y){
+            return i;
+        }
+    }
+    return -1;
+}
+
+int CascadedShadows::claimPage(int cascade){
+    //Empty layers first, then whichever was used longest ago (never one that is part of this frame's window)
+    int best = -1;
+    for(int i = 0; i < SHADOW_CACHE_PAGES; i++){
+        const page_t &page = pages[cascade][i];
+        if(!page.valid){
+            return i;
+        }
+        if(page.lastUsed != frame && (best < 0 || page.lastUsed < pages[cascade][best].lastUsed)){
+            best = i;
+        }
+    }
+    return best;
+}
+
+void CascadedShadows::update(const vmath::vec3 &lightDirection, const vmath::vec3 &lightColor,
+                             const vmath::vec3 &cameraPosition, const vmath::vec3 &cameraForward,
+                             float fovy, float aspect, float cameraNear, float cameraFar, float shadowDistance){
+    frame++;
+    dirtyPages.clear();
+
+    //A new light direction changes every page, start the cache over
+    vmath::vec3 dir = vmath::normalize(lightDirection);
+    if(vmath::dot(dir, lightDir) < 0.99999f){
+        if(vmath::length(lightDir) > 0.0f){
+            stats.invalidations++;
+        }
+        lightDir = dir;
+        invalidateCache();
+
+        //Light space basis, looking down -z along the light
+        vmath::vec3 up = fabsf(dir[1]) > 0.99f ? vmath::vec3(1.0f, 0.0f, 0.0f) : vmath::vec3(0.0f, 1.0f, 0.0f);
+        vmath::vec3 side = vmath::normalize(vmath::cross(dir, up));
+        up = vmath::cross(side, dir);
+        lightView = vmath::mat4(vmath::vec4(side[0], up[0], -dir[0], 0.0f),
+                                vmath::vec4(side[1], up[1], -dir[1], 0.0f),
+                                vmath::vec4(side[2], up[2], -dir[2], 0.0f),
+                                vmath::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+
+        //One depth range for every page and cascade (copied pages have to agree), covering the whole scene
+        float minZ = 1e30f, maxZ = -1e30f;
+        for(int corner = 0; corner < 8; corner++){
+            vmath::vec3 p((corner & 1) ? sceneMax[0] : sceneMin[0],
+                          (corner & 2) ? sceneMax[1] : sceneMin[1],
+                          (corner & 4) ? sceneMax[2] : sceneMin[2]);
+            float z = -vmath::dot(dir, p);
+            minZ = fminf(minZ, z);
+            maxZ = fmaxf(maxZ, z);
+        }
+        depthNear = -maxZ - 1.0f;
+        depthFar = -minZ + 1.0f;
+    }
+    vmath::vec3 side(lightView[0][0], lightView[1][0], lightView[2][0]);
+    vmath::vec3 up(lightView[0][1], lightView[1][1], lightView[2][1]);
+
+    //Split distances, a blend of even and logarithmic spacing
+    float end = fminf(cameraFar, shadowDistance);
+    float splits[SHADOW_CASCADES];
+    for(int c = 0; c < SHADOW_CASCADES; c++){
+        float p = static_cast<float>(c + 1) / SHADOW_CASCADES;
+        float logSplit = cameraNear * powf(end / cameraNear, p);
+        float evenSplit = cameraNear + (end - cameraNear) * p;
+        splits[c] = evenSplit + (logSplit - evenSplit) * SPLIT_LAMBDA;
+    }
+
+    //Squared tangent of the angle from the view axis to a frustum corner
+    float tanY = tanf(fovy * 0.5f * 3.14159265f / 180.0f);
+    float cornerTan2 = tanY * tanY * (1.0f + aspect * aspect);
+
+    for(int c = 0; c < SHADOW_CASCADES; c++){
+        //Smallest sphere around this piece of the frustum, it only depends on the projection,
+        //so turning the camera never changes a cascade's size
+        float d0 = c == 0 ? cameraNear : splits[c - 1];
+        float d1 = splits[c];
+        float centerDistance = (d1 + d0) * (1.0f + cornerTan2) * 0.5f;
+        float radius;
+        if(centerDistance >= d1){
+            centerDistance = d1;
+            radius = d1 * sqrtf(cornerTan2);
+        } else {
+            radius = sqrtf((d1 - centerDistance) * (d1 - centerDistance) + d1 * d1 * cornerTan2);
+        }
+
+        //A window of PAGES_PER_SIDE pages always holds the sphere when snapped to the page grid
+        float pageSize = 2.0f * radius / (SHADOW_PAGES_PER_SIDE - 1);
+        if(pageSize != pageWorldSize[c]){
+            pageWorldSize[c] = pageSize;
+            for(int i = 0; i < SHADOW_CACHE_PAGES; i++){
+                pages[c][i].valid = false;
+            }
+        }
+
+        //Snapping to pages also snaps to texels, so the window only ever moves in whole texels
+        vmath::vec3 center = cameraPosition + cameraForward * centerDistance;
+        windowX[c] = static_cast<int>(floorf((vmath::dot(side, center) - radius) / pageSize));
+        windowY[c] = static_cast<int>(floorf((vmath::dot(up, center) - radius) / pageSize));
+        uniforms.cascadeViewProjection[c] = lightProjection(windowX[c] * pageSize, (windowX[c] + SHADOW_PAGES_PER_SIDE) * pageSize,
+                                                            windowY[c] * pageSize, (windowY[c] + SHADOW_PAGES_PER_SIDE) * pageSize);
+        uniforms.splits[c] = d1;
+        uniforms.texelSize[c] = pageSize / SHADOW_PAGE_SIZE;
+
+        //Reuse what is cached, queue the rest to be drawn
+        for(int py = 0; py < SHADOW_PAGES_PER_SIDE; py++){
+            for(int px = 0; px < SHADOW_PAGES_PER_SIDE; px++){
+                int x = windowX[c] + px;
+                int y = windowY[c] + py;
+                int layer = findPage(c, x, y);
+                if(layer < 0){
+                    layer = claimPage(c);
+                    page_t &page = pages[c][layer];
+                    page.x = x;
+                    page.y = y;
+                    page.valid = true;
+                    dirty_page_t dirty = { c, layer, lightProjection(x * pageSize, (x + 1) * pageSize, y * pageSize, (y + 1) * pageSize) };
+                    dirtyPages.push_back(dirty);
+                }
+                pages[c][layer].lastUsed = frame;
+                windowLayers[c][py * SHADOW_PAGES_PER_SIDE + px] = layer;
+            }
+        }
+    }
+
+    uniforms.lightDirection = vmath::vec4(dir[0], dir[1], dir[2], 0.0f);
+    uniforms.lightColor = vmath::vec4(lightColor[0], lightColor[1], lightColor[2], static_cast<float>(SHADOW_CASCADES));
+
+    stats.pagesDrawn = dirtyPages.size();
+    stats.cachedPages = 0;
+    for(int c = 0; c < SHADOW_CASCADES; c++){
+        for(int i = 0; i < SHADOW_CACHE_PAGES; i++){
+            stats.cachedPages += pages[c][i].valid ? 1 : 0;
+        }
+    }
+}
+
+void CascadedShadows::beginFrame(){
+    stream.begin_frame();
+}
+
+void CascadedShadows::endFrame(){
+    stream.end_frame();
+}
+
+const vmath::mat4& CascadedShadows::beginPage(size_t i){
+    const dirty_page_t &page = dirtyPages[i];
+    startDepthPass(framebuffer, cacheTexture, page.cascade * SHADOW_CACHE_PAGES + page.layer, SHADOW_PAGE_SIZE);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    return page.viewProjection;
+}
+
+void CascadedShadows::composeCascades(){
+    stats.pagesCopied = 0;
+    for(int c = 0; c < SHADOW_CASCADES; c++){
+        for(int p = 0; p < SHADOW_PAGES_PER_SIDE * SHADOW_PAGES_PER_SIDE; p++){
+            int px = p % SHADOW_PAGES_PER_SIDE;
+            int py = p / SHADOW_PAGES_PER_SIDE;
+            glCopyImageSubData(cacheTexture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, c * SHADOW_CACHE_PAGES + windowLayers[c][p],
+                               cascadeTexture, GL_TEXTURE_2D_ARRAY, 0, px * SHADOW_PAGE_SIZE, py * SHADOW_PAGE_SIZE, c,
+                               SHADOW_PAGE_SIZE, SHADOW_PAGE_SIZE, 1);
+            stats.pagesCopied++;
+        }
+    }
+}
+
+const vmath::mat4& CascadedShadows::beginCascade(int c){
+    //No clear, dynamic objects are drawn over the static depth that was copied in
+    startDepthPass(framebuffer, cascadeTexture, c, SHADOW_MAP_SIZE);
+    return uniforms.cascadeViewProjection[c];
+}
+
+void CascadedShadows::endPasses(int width, int height){
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, width, height);
+    sb7::glstate::disable(GL_POLYGON_OFFSET_FILL);
+}
+
+void CascadedShadows::upload(){
+    GLintptr offset;
+    void* dst = stream.allocate(sizeof(uniforms), stream.uniform_alignment(), offset);
+    if(!dst){
+        return; //Only outside beginFrame/endFrame
+    }
+    memcpy(dst, &uniforms, sizeof(uniforms));
+    sb7::glstate::bind_buffer_range(GL_UNIFORM_BUFFER, SHADOW_UBO_BINDING, stream.buffer(), offset, sizeof(uniforms));
+    sb7::glstate::bind_texture_unit(SHADOW_TEXTURE_UNIT, GL_TEXTURE_2D_ARRAY, cascadeTexture);
+}
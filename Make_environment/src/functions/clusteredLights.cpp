@@ -0,0 +1,287 @@
+/*
+* Clustered Lights
+* See ./include/clusteredLights.h for usage
+*/
+#include <clusteredLights.h>
+#include <sb7glstate.h>
+#include <math.h>
+#include <string.h>
+#include <chrono>
+#include <emmintrin.h>
+
+//Lights handed to a thread at a time
+static const int LIGHTS_PER_JOB = 32;
+
+//Sphere around a light's whole reach (a cone's is much smaller than its radius)
+static void lightSphere(const light_t &light, vmath::vec3 &center, float &radius){
+    if(light.type != LIGHT_SPOT){
+        center = light.position;
+        radius = light.radius;
+        return;
+    }
+    //Tightest sphere around a cone: wide cones are capped by the disc at their end,
+    //narrow ones are enclosed by a sphere through the apex
+    float cosAngle = light.cosOuter;
+    float sinAngle = sqrtf(fmaxf(0.0f, 1.0f - cosAngle * cosAngle));
+    if(cosAngle < 0.70710678f){
+        center = light.position + light.direction * (cosAngle * light.radius);
+        radius = sinAngle * light.radius;
+    } else {
+        radius = light.radius / (2.0f * cosAngle);
+        center = light.position + light.direction * radius;
+    }
+}
+
+ClusteredLights::ClusteredLights(){
+    maxLights = 0;
+    maxIndices = 0;
+    boundsWidth = 0;
+    boundsHeight = 0;
+    memset(&header, 0, sizeof(header));
+    memset(&stats, 0, sizeof(stats));
+}
+
+void ClusteredLights::create(GLuint newMaxLights, GLuint newMaxIndices){
+    destroy(); //Just in case this is being re-used
+    maxLights = newMaxLights;
+    maxIndices = newMaxIndices;
+
+    //Room for all three blocks every frame, plus alignment between them
+    GLsizeiptr frameSize = (GLsizeiptr)maxLights * sizeof(gpu_light_t) +
+                           sizeof(cluster_header_t) + (GLsizeiptr)CLUSTER_COUNT * 2 * sizeof(GLuint) +
+                           (GLsizeiptr)maxIndices * sizeof(GLuint) + 3 * 256;
+    stream.init(frameSize);
+
+    gpuLights.reserve(maxLights);
+    clusterRanges.assign(CLUSTER_COUNT * 2, 0);
+    lightIndices.reserve(maxIndices);
+    header.lightCount = 0;
+}
+
+void ClusteredLights::destroy(){
+    stream.teardown();
+    boundsWidth = 0;
+    boundsHeight = 0;
+}
+
+void ClusteredLights::buildClusterBounds(const vmath::mat4 &projection, float nearPlane, float farPlane, int width, int height){
+    bool same = (width == boundsWidth && height == boundsHeight &&
+                 header.nearPlane == nearPlane && header.farPlane == farPlane);
+    for(int c = 0; c < 4 && same; c++){
+        for(int r = 0; r < 4 && same; r++){
+            same = (projection[c][r] == boundsProjection[c][r]);
+        }
+    }
+    if(same){
+        return;
+    }
+    boundsProjection = projection;
+    boundsWidth = width;
+    boundsHeight = height;
+
+    header.gridX = CLUSTER_GRID_X;
+    header.gridY = CLUSTER_GRID_Y;
+    header.gridZ = CLUSTER_GRID_Z;
+    header.nearPlane = nearPlane;
+    header.farPlane = farPlane;
+    float logRatio = logf(farPlane / nearPlane);
+    header.sliceScale = CLUSTER_GRID_Z / logRatio;
+    header.sliceBias = CLUSTER_GRID_Z * logf(nearPlane) / logRatio;
+    header.tileWidth = ceilf(static_cast<float>(width) / CLUSTER_GRID_X);
+    header.tileHeight = ceilf(static_cast<float>(height) / CLUSTER_GRID_Y);
+
+    boxMinX.resize(CLUSTER_COUNT);
+    boxMinY.resize(CLUSTER_COUNT);
+    boxMinZ.resize(CLUSTER_COUNT);
+    boxMaxX.resize(CLUSTER_COUNT);
+    boxMaxY.resize(CLUSTER_COUNT);
+    boxMaxZ.resize(CLUSTER_COUNT);
+
+    //A point at view distance d and normalized device (nx, ny) is at (nx * d / P00, ny * d / P11, -d)
+    float invX = 1.0f / projection[0][0];
+    float invY = 1.0f / projection[1][1];
+    for(int z = 0; z < CLUSTER_GRID_Z; z++){
+        float d0 = nearPlane * powf(farPlane / nearPlane, static_cast<float>(z) / CLUSTER_GRID_Z);
+        float d1 = nearPlane * powf(farPlane / nearPlane, static_cast<float>(z + 1) / CLUSTER_GRID_Z);
+        for(int y = 0; y < CLUSTER_GRID_Y; y++){
+            float ny0 = (y * header.tileHeight) / height * 2.0f - 1.0f;
+            float ny1 = ((y + 1) * header.tileHeight) / height * 2.0f - 1.0f;
+            for(int x = 0; x < CLUSTER_GRID_X; x++){
+                float nx0 = (x * header.tileWidth) / width * 2.0f - 1.0f;
+                float nx1 = ((x + 1) * header.tileWidth) / width * 2.0f - 1.0f;
+
+                //The tile's side planes go through the eye, so the extremes are on the near or far face
+                int i = (z * CLUSTER_GRID_Y + y) * CLUSTER_GRID_X + x;
+                boxMinX[i] = fminf(nx0 * d0, nx0 * d1) * invX;
+                boxMaxX[i] = fmaxf(nx1 * d0, nx1 * d1) * invX;
+                boxMinY[i] = fminf(ny0 * d0, ny0 * d1) * invY;
+                boxMaxY[i] = fmaxf(ny1 * d0, ny1 * d1) * invY;
+                boxMinZ[i] = -d1;
+                boxMaxZ[i] = -d0;
+            }
+        }
+    }
+}
+
+int ClusteredLights::sliceOf(float depth) const {
+    int slice = static_cast<int>(floorf(logf(depth) * header.sliceScale - header.sliceBias));
+    return slice < 0 ? 0 : (slice >= CLUSTER_GRID_Z ? CLUSTER_GRID_Z - 1 : slice);
+}
+
+void ClusteredLights::binLight(const light_t &light, uint32_t index, const vmath::mat4 &view, std::vector<uint32_t> &pairs) const {
+    vmath::vec3 worldCenter;
+    float radius;
+    lightSphere(light, worldCenter, radius);
+    vmath::vec3 center;
+    for(int r = 0; r < 3; r++){
+        center[r] = view[0][r] * worldCenter[0] + view[1][r] * worldCenter[1] + view[2][r] * worldCenter[2] + view[3][r];
+    }
+
+    //Depth slices the sphere spans (view space looks down -z)
+    float nearest = -center[2] - radius;
+    float farthest = -center[2] + radius;
+    if(farthest < header.nearPlane || nearest > header.farPlane){
+        return;
+    }
+    int slice0 = sliceOf(fmaxf(nearest, header.nearPlane));
+    int slice1 = sliceOf(fminf(farthest, header.farPlane));
+
+    //Sphere vs box: squared distance from the center to the box, 4 boxes at a time
+    __m128 cx = _mm_set1_ps(center[0]);
+    __m128 cy = _mm_set1_ps(center[1]);
+    __m128 cz = _mm_set1_ps(center[2]);
+    __m128 r2 = _mm_set1_ps(radius * radius);
+    __m128 zero = _mm_setzero_ps();
+    const int perSlice = CLUSTER_GRID_X * CLUSTER_GRID_Y;
+    for(int slice = slice0; slice <= slice1; slice++){
+        for(int i = slice * perSlice; i < (slice + 1) * perSlice; i += 4){
+            __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&boxMinX[i]), cx), _mm_sub_ps(cx, _mm_loadu_ps(&boxMaxX[i]))), zero);
+            __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&boxMinY[i]), cy), _mm_sub_ps(cy, _mm_loadu_ps(&boxMaxY[i]))), zero);
+            __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&boxMinZ[i]), cz), _mm_sub_ps(cz, _mm_loadu_ps(&boxMaxZ[i]))), zero);
+            __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            int mask = _mm_movemask_ps(_mm_cmple_ps(d2, r2));
+            while(mask){
+                int bit = __builtin_ctz(mask);
+                mask &= mask - 1;
+                pairs.push_back(static_cast<uint32_t>(i + bit));
+                pairs.push_back(index);
+            }
+        }
+    }
+}
+
+void ClusteredLights::bin(const std::vector<light_t> &lights, const vmath::mat4 &view, const vmath::mat4 &projection,
+                          float nearPlane, float farPlane, int width, int height){
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    buildClusterBounds(projection, nearPlane, farPlane, width, height);
+
+    const int lightCount = static_cast<int>(lights.size() < maxLights ? lights.size() : maxLights);
+    header.lightCount = lightCount;
+    gpuLights.resize(lightCount);
+
+    //Each job tests its own lights and keeps its own pair list, nothing is shared until the merge
+    const int jobs = (lightCount + LIGHTS_PER_JOB - 1) / LIGHTS_PER_JOB;
+    if(jobPairs.size() < static_cast<size_t>(jobs)){
+        jobPairs.resize(jobs);
+    }
+    #pragma omp parallel for schedule(dynamic)
+    for(int job = 0; job < jobs; job++){
+        std::vector<uint32_t> &pairs = jobPairs[job];
+        pairs.clear();
+        int end = (job + 1) * LIGHTS_PER_JOB < lightCount ? (job + 1) * LIGHTS_PER_JOB : lightCount;
+        for(int i = job * LIGHTS_PER_JOB; i < end; i++){
+            const light_t &light = lights[i];
+            gpu_light_t &out = gpuLights[i];
+            out.positionRadius = vmath::vec4(light.position[0], light.position[1], light.position[2], light.radius);
+            out.colorType = vmath::vec4(light.color[0], light.color[1], light.color[2], static_cast<float>(light.type));
+            out.direction = vmath::vec4(light.direction[0], light.direction[1], light.direction[2], light.cosOuter);
+            out.spot = vmath::vec4(light.cosInner, 0.0f, 0.0f, 0.0f);
+            binLight(light, static_cast<uint32_t>(i), view, pairs);
+        }
+    }
+
+    //Count per cluster, then give every cluster its range of the index list
+    memset(&clusterRanges[0], 0, clusterRanges.size() * sizeof(GLuint));
+    std::vector<unsigned char> lightSeen(lightCount, 0);
+    for(int job = 0; job < jobs; job++){
+        const std::vector<uint32_t> &pairs = jobPairs[job];
+        for(size_t p = 0; p < pairs.size(); p += 2){
+            clusterRanges[pairs[p] * 2 + 1]++;
+            lightSeen[pairs[p + 1]] = 1;
+        }
+    }
+    size_t total = 0;
+    stats.usedClusters = 0;
+    stats.dropped = 0;
+    clusterCursor.resize(CLUSTER_COUNT);
+    for(int c = 0; c < CLUSTER_COUNT; c++){
+        GLuint count = clusterRanges[c * 2 + 1];
+        //Out of index space, whatever doesn't fit is dropped (the cluster just gets fewer lights)
+        GLuint room = total < maxIndices ? static_cast<GLuint>(maxIndices - total) : 0;
+        if(count > room){
+            stats.dropped += count - room;
+            count = room;
+        }
+        clusterRanges[c * 2 + 0] = static_cast<GLuint>(total);
+        clusterRanges[c * 2 + 1] = count;
+        clusterCursor[c] = static_cast<GLuint>(total);
+        total += count;
+        stats.usedClusters += count > 0 ? 1 : 0;
+    }
+
+    //Scatter in job order, so the lists never depend on how the threads were scheduled
+    lightIndices.resize(total);
+    for(int job = 0; job < jobs; job++){
+        const std::vector<uint32_t> &pairs = jobPairs[job];
+        for(size_t p = 0; p < pairs.size(); p += 2){
+            uint32_t c = pairs[p];
+            if(clusterCursor[c] < clusterRanges[c * 2] + clusterRanges[c * 2 + 1]){
+                lightIndices[clusterCursor[c]++] = pairs[p + 1];
+            }
+        }
+    }
+
+    stats.lights = lightCount;
+    stats.visibleLights = 0;
+    for(int i = 0; i < lightCount; i++){
+        stats.visibleLights += lightSeen[i];
+    }
+    stats.indices = total;
+    stats.binSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void ClusteredLights::beginFrame(){
+    stream.begin_frame();
+}
+
+void ClusteredLights::endFrame(){
+    stream.end_frame();
+}
+
+void ClusteredLights::upload(){
+    GLsizeiptr alignment = stream.storage_alignment();
+    GLsizeiptr lightBytes = (GLsizeiptr)(gpuLights.size() > 0 ? gpuLights.size() : 1) * sizeof(gpu_light_t);
+    GLsizeiptr clusterBytes = sizeof(cluster_header_t) + (GLsizeiptr)clusterRanges.size() * sizeof(GLuint);
+    GLsizeiptr indexBytes = (GLsizeiptr)(lightIndices.size() > 0 ? lightIndices.size() : 1) * sizeof(GLuint);
+
+    GLintptr lightOffset, clusterOffset, indexOffset;
+    char* lightDst = static_cast<char*>(stream.allocate(lightBytes, alignment, lightOffset));
+    char* clusterDst = static_cast<char*>(stream.allocate(clusterBytes, alignment, clusterOffset));
+    char* indexDst = static_cast<char*>(stream.allocate(indexBytes, alignment, indexOffset));
+    if(!lightDst || !clusterDst || !indexDst){
+        return; //Only outside beginFrame/endFrame, the stream is sized for the most create() allows
+    }
+
+    if(!gpuLights.empty()){
+        memcpy(lightDst, gpuLights.data(), gpuLights.size() * sizeof(gpu_light_t));
+    }
+    memcpy(clusterDst, &header, sizeof(header));
+    memcpy(clusterDst + sizeof(header), clusterRanges.data(), clusterRanges.size() * sizeof(GLuint));
+    if(!lightIndices.empty()){
+        memcpy(indexDst, lightIndices.data(), lightIndices.size() * sizeof(GLuint));
+    }
+
+    sb7::glstate::bind_buffer_range(GL_SHADER_STORAGE_BUFFER, LIGHT_SSBO_BINDING, stream.buffer(), lightOffset, lightBytes);
+    sb7::glstate::bind_buffer_range(GL_SHADER_STORAGE_BUFFER, CLUSTER_SSBO_BINDING, stream.buffer(), clusterOffset, clusterBytes);
+    sb7::glstate::bind_buffer_range(GL_SHADER_STORAGE_BUFFER, LIGHT_INDEX_SSBO_BINDING, stream.buffer(), indexOffset, indexBytes);
+}
@@ -0,0 +1,204 @@
+/*
+* Culling
+* See ./include/culling.h for usage
+*/
+#include <culling.h>
+#include <math.h>
+
+//SSE2 is always there on x86-64, AVX is used when the compiler is allowed to (-mavx)
+#include <emmintrin.h>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+bounds_t computeBounds(const std::vector<vmath::vec4> &vertices){
+    bounds_t bounds;
+    if(vertices.empty()){
+        bounds.aabbMin = vmath::vec3(0.0f, 0.0f, 0.0f);
+        bounds.aabbMax = vmath::vec3(0.0f, 0.0f, 0.0f);
+        bounds.center = vmath::vec3(0.0f, 0.0f, 0.0f);
+        bounds.radius = 0.0f;
+        return bounds;
+    }
+
+    bounds.aabbMin = vmath::vec3(vertices[0][0], vertices[0][1], vertices[0][2]);
+    bounds.aabbMax = bounds.aabbMin;
+    for(size_t i = 1; i < vertices.size(); i++){
+        vmath::vec3 p(vertices[i][0], vertices[i][1], vertices[i][2]);
+        //Template arguments spelled out, otherwise the scalar min/max wins and compares the vectors as pointers
+        bounds.aabbMin = vmath::min<float, 3>(bounds.aabbMin, p);
+        bounds.aabbMax = vmath::max<float, 3>(bounds.aabbMax, p);
+    }
+
+    //Sphere around the box center, radius is the farthest actual vertex (tighter than the box corner)
+    bounds.center = (bounds.aabbMin + bounds.aabbMax) * 0.5f;
+    float radius2 = 0.0f;
+    for(size_t i = 0; i < vertices.size(); i++){
+        vmath::vec3 d = vmath::vec3(vertices[i][0], vertices[i][1], vertices[i][2]) - bounds.center;
+        radius2 = vmath::max(radius2, vmath::dot(d, d));
+    }
+    bounds.radius = sqrtf(radius2);
+    return bounds;
+}
+
+void transformBounds(const bounds_t &bounds, const vmath::mat4 &transform, vmath::vec3 &worldMin, vmath::vec3 &worldMax){
+    vmath::vec3 center = (bounds.aabbMin + bounds.aabbMax) * 0.5f;
+    vmath::vec3 extent = (bounds.aabbMax - bounds.aabbMin) * 0.5f;
+
+    //Arvo: new center is the transformed center, new extent is |M| * extent
+    for(int row = 0; row < 3; row++){
+        float c = transform[3][row];
+        float e = 0.0f;
+        for(int col = 0; col < 3; col++){
+            c += transform[col][row] * center[col];
+            e += fabsf(transform[col][row]) * extent[col];
+        }
+        worldMin[row] = c - e;
+        worldMax[row] = c + e;
+    }
+}
+
+frustum_t extractFrustum(const vmath::mat4 &m){
+    //vmath is column major, row r of the matrix is (m[0][r], m[1][r], m[2][r], m[3][r])
+    vmath::vec4 rows[4];
+    for(int r = 0; r < 4; r++){
+        rows[r] = vmath::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+    }
+
+    frustum_t frustum;
+    frustum.planes[0] = rows[3] + rows[0]; //left
+    frustum.planes[1] = rows[3] - rows[0]; //right
+    frustum.planes[2] = rows[3] + rows[1]; //bottom
+    frustum.planes[3] = rows[3] - rows[1]; //top
+    frustum.planes[4] = rows[3] + rows[2]; //near
+    frustum.planes[5] = rows[3] - rows[2]; //far
+
+    //Normalize so plane distances are in world units
+    for(int i = 0; i < 6; i++){
+        vmath::vec4 &p = frustum.planes[i];
+        float len = sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]);
+        if(len > 0.0f){
+            p = p * (1.0f / len);
+        }
+    }
+    return frustum;
+}
+
+void CullList::clear(){
+    count = 0;
+}
+
+uint32_t CullList::add(const vmath::vec3 &boxMin, const vmath::vec3 &boxMax){
+    //Grow in blocks of 8 so the padding is always there
+    if(count + 1 > centerX.size()){
+        size_t newSize = (centerX.size() + 8) * 2;
+        centerX.resize(newSize, 0.0f);
+        centerY.resize(newSize, 0.0f);
+        centerZ.resize(newSize, 0.0f);
+        extentX.resize(newSize, 0.0f);
+        extentY.resize(newSize, 0.0f);
+        extentZ.resize(newSize, 0.0f);
+    }
+
+    centerX[count] = (boxMin[0] + boxMax[0]) * 0.5f;
+    centerY[count] = (boxMin[1] + boxMax[1]) * 0.5f;
+    centerZ[count] = (boxMin[2] + boxMax[2]) * 0.5f;
+    extentX[count] = (boxMax[0] - boxMin[0]) * 0.5f;
+    extentY[count] = (boxMax[1] - boxMin[1]) * 0.5f;
+    extentZ[count] = (boxMax[2] - boxMin[2]) * 0.5f;
+    return static_cast<uint32_t>(count++);
+}
+
+void CullList::cull(const frustum_t &frustum, std::vector<uint32_t> &visible, cull_stats_t &stats) const {
+    visible.clear();
+    stats.tested += count;
+
+    //Small lists are not worth waking the other threads for
+    if(count < 2 * CULL_BLOCK_SIZE){
+        cullRange(frustum, 0, count, visible);
+        stats.visible += visible.size();
+        return;
+    }
+
+    //Each block is culled on its own, then the results are joined in block order
+    //so the indices come out exactly as the single threaded loop would produce them
+    const int blocks = static_cast<int>((count + CULL_BLOCK_SIZE - 1) / CULL_BLOCK_SIZE);
+    if(blockVisible.size() < static_cast<size_t>(blocks)){
+        blockVisible.resize(blocks);
+    }
+    #pragma omp parallel for schedule(dynamic)
+    for(int b = 0; b < blocks; b++){
+        size_t begin = b * CULL_BLOCK_SIZE;
+        size_t end = begin + CULL_BLOCK_SIZE < count ? begin + CULL_BLOCK_SIZE : count;
+        blockVisible[b].clear();
+        cullRange(frustum, begin, end, blockVisible[b]);
+    }
+    for(int b = 0; b < blocks; b++){
+        visible.insert(visible.end(), blockVisible[b].begin(), blockVisible[b].end());
+    }
+    stats.visible += visible.size();
+}
+
+void CullList::cullRange(const frustum_t &frustum, size_t begin, size_t end, std::vector<uint32_t> &visible) const {
+    //A box is outside a plane when (distance of center) + (projected extent) < 0
+    //Every plane is tested, boxes are rejected with a mask instead of branching
+    size_t i = begin;
+#ifdef __AVX__
+    for(; i + 8 <= centerX.size() && i < end; i += 8){
+        __m256 cx = _mm256_loadu_ps(&centerX[i]);
+        __m256 cy = _mm256_loadu_ps(&centerY[i]);
+        __m256 cz = _mm256_loadu_ps(&centerZ[i]);
+        __m256 ex = _mm256_loadu_ps(&extentX[i]);
+        __m256 ey = _mm256_loadu_ps(&extentY[i]);
+        __m256 ez = _mm256_loadu_ps(&extentZ[i]);
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+        for(int p = 0; p < 6; p++){
+            const vmath::vec4 &plane = frustum.planes[p];
+            __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(plane[0])),
+                                                   _mm256_mul_ps(cy, _mm256_set1_ps(plane[1]))),
+                                     _mm256_add_ps(_mm256_mul_ps(cz, _mm256_set1_ps(plane[2])),
+                                                   _mm256_set1_ps(plane[3])));
+            __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, _mm256_set1_ps(fabsf(plane[0]))),
+                                                   _mm256_mul_ps(ey, _mm256_set1_ps(fabsf(plane[1])))),
+                                     _mm256_mul_ps(ez, _mm256_set1_ps(fabsf(plane[2]))));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(d, r), _mm256_setzero_ps(), _CMP_GE_OQ));
+        }
+
+        int mask = _mm256_movemask_ps(inside);
+        for(int bit = 0; bit < 8; bit++){
+            if((mask & (1 << bit)) && i + bit < end){
+                visible.push_back(static_cast<uint32_t>(i + bit));
+            }
+        }
+    }
+#endif
+    for(; i < end; i += 4){
+        __m128 cx = _mm_loadu_ps(&centerX[i]);
+        __m128 cy = _mm_loadu_ps(&centerY[i]);
+        __m128 cz = _mm_loadu_ps(&centerZ[i]);
+        __m128 ex = _mm_loadu_ps(&extentX[i]);
+        __m128 ey = _mm_loadu_ps(&extentY[i]);
+        __m128 ez = _mm_loadu_ps(&extentZ[i]);
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+        for(int p = 0; p < 6; p++){
+            const vmath::vec4 &plane = frustum.planes[p];
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane[0])),
+                                             _mm_mul_ps(cy, _mm_set1_ps(plane[1]))),
+                                  _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane[2])),
+                                             _mm_set1_ps(plane[3])));
+            __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(fabsf(plane[0]))),
+                                             _mm_mul_ps(ey, _mm_set1_ps(fabsf(plane[1])))),
+                                  _mm_mul_ps(ez, _mm_set1_ps(fabsf(plane[2]))));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, r), _mm_setzero_ps()));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for(int bit = 0; bit < 4; bit++){
+            if((mask & (1 << bit)) && i + bit < end){
+                visible.push_back(static_cast<uint32_t>(i + bit));
+            }
+        }
+    }
+}
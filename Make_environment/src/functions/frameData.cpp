@@ -0,0 +1,104 @@
+/*
+* Frame Data
+* See ./include/frameData.h for usage
+*/
+#include <frameData.h>
+#include <sb7glstate.h>
+#include <cstring>
+
+FrameData::FrameData(){
+    frameBuffer = 0;
+    objectBuffer = 0;
+    maxObjects = 0;
+    frameStreamed = false;
+    frameOffset = 0;
+}
+
+void FrameData::create(GLuint newMaxObjects, GLuint maxStreamedObjects, GLsizeiptr extraBytes){
+    destroy(); //Just in case this is being re-used
+    maxObjects = newMaxObjects;
+
+    //Both stores are written by the GPU: the camera block is bound straight from the ring, transforms are
+    //copied over from it. glBufferSubData is only for uploads outside a frame, so no mapping is needed here
+    glGenBuffers(1, &frameBuffer);
+    sb7::glstate::bind_buffer(GL_UNIFORM_BUFFER, frameBuffer);
+    glBufferStorage(GL_UNIFORM_BUFFER, sizeof(frame_uniforms_t), NULL, GL_DYNAMIC_STORAGE_BIT);
+
+    glGenBuffers(1, &objectBuffer);
+    sb7::glstate::bind_buffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)maxObjects * sizeof(vmath::mat4), NULL, GL_DYNAMIC_STORAGE_BIT);
+
+    //Room for the camera block, the streamed transforms and whatever else shares the ring every frame (alignment padding included)
+    if(maxStreamedObjects > maxObjects){
+        maxStreamedObjects = maxObjects;
+    }
+    stream.init(2 * 256 + sizeof(frame_uniforms_t) + (GLsizeiptr)maxStreamedObjects * sizeof(vmath::mat4) + extraBytes);
+}
+
+void FrameData::destroy(){
+    if(frameBuffer){
+        sb7::glstate::delete_buffers(1, &frameBuffer);
+        sb7::glstate::delete_buffers(1, &objectBuffer);
+    }
+    stream.teardown();
+    frameBuffer = 0;
+    objectBuffer = 0;
+    maxObjects = 0;
+}
+
+void FrameData::beginFrame(){
+    stream.begin_frame();
+    frameStreamed = false;
+}
+
+void FrameData::endFrame(){
+    stream.end_frame();
+}
+
+void FrameData::updateFrame(const frame_uniforms_t &frame){
+    void* dst = stream.allocate(sizeof(frame_uniforms_t), stream.uniform_alignment(), frameOffset);
+    if(dst){
+        memcpy(dst, &frame, sizeof(frame_uniforms_t));
+        frameStreamed = true;
+        return;
+    }
+    sb7::glstate::bind_buffer(GL_UNIFORM_BUFFER, frameBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(frame_uniforms_t), &frame);
+    frameStreamed = false;
+}
+
+GLuint FrameData::updateObjects(const vmath::mat4* transforms, GLuint count, GLuint first){
+    if(first >= maxObjects){
+        return 0;
+    }
+    if(count > maxObjects - first){
+        count = maxObjects - first;
+    }
+    if(count == 0){
+        return 0;
+    }
+    //vmath matrices are column major, same as GLSL, so they go across as is
+    GLsizeiptr size = (GLsizeiptr)count * sizeof(vmath::mat4);
+    GLintptr offset;
+    void* dst = stream.allocate(size, sizeof(vmath::vec4), offset);
+    if(dst){
+        //Copy on the GPU, ordered after last frame's draws without the CPU waiting for them
+        memcpy(dst, transforms, size);
+        sb7::glstate::bind_buffer(GL_COPY_READ_BUFFER, stream.buffer());
+        sb7::glstate::bind_buffer(GL_COPY_WRITE_BUFFER, objectBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, (GLintptr)first * sizeof(vmath::mat4), size);
+        return count;
+    }
+    sb7::glstate::bind_buffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, (GLintptr)first * sizeof(vmath::mat4), (GLsizeiptr)count * sizeof(vmath::mat4), transforms);
+    return count;
+}
+
+void FrameData::bind() const {
+    if(frameStreamed){
+        sb7::glstate::bind_buffer_range(GL_UNIFORM_BUFFER, FRAME_UBO_BINDING, stream.buffer(), frameOffset, sizeof(frame_uniforms_t));
+    } else {
+        sb7::glstate::bind_buffer_base(GL_UNIFORM_BUFFER, FRAME_UBO_BINDING, frameBuffer);
+    }
+    sb7::glstate::bind_buffer_base(GL_SHADER_STORAGE_BUFFER, OBJECT_SSBO_BINDING, objectBuffer);
+}
@@ -0,0 +1,91 @@
+/*
+* G-Buffer
+* See ./include/gBuffer.h for usage
+*/
+#include <gBuffer.h>
+#include <sb7glstate.h>
+
+//Immutable 2D texture sampled with texelFetch (no filtering, no mips)
+static GLuint makeTarget(GLenum format, int width, int height){
+    GLuint texture;
+    glGenTextures(1, &texture);
+    sb7::glstate::bind_texture_unit(GBUFFER_NORMAL_UNIT, GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+GBuffer::GBuffer(){
+    framebuffer = 0;
+    normalTexture = 0;
+    albedoTexture = 0;
+    depthTexture = 0;
+    width = 0;
+    height = 0;
+}
+
+void GBuffer::create(int newWidth, int newHeight){
+    destroy(); //Just in case this is being re-used
+    width = newWidth;
+    height = newHeight;
+    glGenFramebuffers(1, &framebuffer);
+    allocateTargets();
+}
+
+void GBuffer::destroy(){
+    if(framebuffer){
+        sb7::glstate::delete_textures(1, &normalTexture);
+        sb7::glstate::delete_textures(1, &albedoTexture);
+        sb7::glstate::delete_textures(1, &depthTexture);
+        glDeleteFramebuffers(1, &framebuffer);
+    }
+    framebuffer = 0;
+    normalTexture = 0;
+    albedoTexture = 0;
+    depthTexture = 0;
+}
+
+void GBuffer::resize(int newWidth, int newHeight){
+    if(newWidth == width && newHeight == height){
+        return;
+    }
+    width = newWidth;
+    height = newHeight;
+    //Immutable storage can't change size, the textures are made again
+    sb7::glstate::delete_textures(1, &normalTexture);
+    sb7::glstate::delete_textures(1, &albedoTexture);
+    sb7::glstate::delete_textures(1, &depthTexture);
+    allocateTargets();
+}
+
+void GBuffer::allocateTargets(){
+    normalTexture = makeTarget(GL_RGBA8, width, height);
+    albedoTexture = makeTarget(GL_RGBA8, width, height);
+    depthTexture = makeTarget(GL_DEPTH_COMPONENT32F, width, height);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, normalTexture, 0);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, albedoTexture, 0);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0);
+    static const GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+    glDrawBuffers(2, drawBuffers);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE){
+        printf("G-buffer framebuffer is incomplete (%dx%d)\n", width, height);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void GBuffer::bindForWrite(){
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, width, height);
+}
+
+void GBuffer::bindForRead(){
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    sb7::glstate::bind_texture_unit(GBUFFER_NORMAL_UNIT, GL_TEXTURE_2D, normalTexture);
+    sb7::glstate::bind_texture_unit(GBUFFER_ALBEDO_UNIT, GL_TEXTURE_2D, albedoTexture);
+    sb7::glstate::bind_texture_unit(GBUFFER_DEPTH_UNIT, GL_TEXTURE_2D, depthTexture);
+}
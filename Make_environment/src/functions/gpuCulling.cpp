@@ -0,0 +1,111 @@
+/*
+* GPU Culling
+* See ./include/gpuCulling.h for usage
+*/
+#include <gpuCulling.h>
+#include <sb7ext.h>
+#include <sb7glstate.h>
+
+gpu_instance_t makeGpuInstance(const mesh_t &mesh, const vmath::vec3 &boxMin, const vmath::vec3 &boxMax, GLuint drawID){
+    gpu_instance_t inst;
+    vmath::vec3 center = (boxMin + boxMax) * 0.5f;
+    vmath::vec3 extent = (boxMax - boxMin) * 0.5f;
+    inst.center = vmath::vec4(center[0], center[1], center[2], 1.0f);
+    inst.extent = vmath::vec4(extent[0], extent[1], extent[2], 0.0f);
+    inst.firstIndex = mesh.firstIndex;
+    inst.indexCount = mesh.indexCount;
+    inst.baseVertex = mesh.baseVertex;
+    inst.drawID = drawID;
+    return inst;
+}
+
+GpuCuller::GpuCuller(){
+    program = 0;
+    instanceBuffer = 0;
+    commandBuffer = 0;
+    countBuffer = 0;
+    instanceCount = 0;
+    indirectCount = false;
+    planesLocation = -1;
+    numInstancesLocation = -1;
+    compactLocation = -1;
+}
+
+void GpuCuller::create(GLuint newProgram, const std::vector<gpu_instance_t> &instances){
+    destroy(); //Just in case this is being re-used
+    program = newProgram;
+    instanceCount = static_cast<GLuint>(instances.size());
+
+    planesLocation = glGetUniformLocation(program, "planes");
+    numInstancesLocation = glGetUniformLocation(program, "numInstances");
+    compactLocation = glGetUniformLocation(program, "compact");
+
+    //The count variant is core in 4.6, the extension covers older drivers
+    indirectCount = (sb6IsExtensionSupported("GL_ARB_indirect_parameters") != 0) && (glMultiDrawElementsIndirectCountARB != NULL);
+
+    //Instances never change, commands and the count are only ever written by the GPU
+    GLsizeiptr instanceBytes = (GLsizeiptr)(instanceCount > 0 ? instanceCount : 1) * sizeof(gpu_instance_t);
+    glGenBuffers(1, &instanceBuffer);
+    sb7::glstate::bind_buffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, instanceBytes, instances.empty() ? NULL : instances.data(), 0);
+
+    glGenBuffers(1, &commandBuffer);
+    sb7::glstate::bind_buffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)(instanceCount > 0 ? instanceCount : 1) * sizeof(draw_elements_indirect_t), NULL, 0);
+
+    GLuint zero = 0;
+    glGenBuffers(1, &countBuffer);
+    sb7::glstate::bind_buffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), &zero, 0);
+}
+
+void GpuCuller::destroy(){
+    if(instanceBuffer){
+        sb7::glstate::delete_buffers(1, &instanceBuffer);
+        sb7::glstate::delete_buffers(1, &commandBuffer);
+        sb7::glstate::delete_buffers(1, &countBuffer);
+    }
+    instanceBuffer = 0;
+    commandBuffer = 0;
+    countBuffer = 0;
+    instanceCount = 0;
+}
+
+void GpuCuller::cull(const frustum_t &frustum){
+    if(instanceCount == 0){
+        return;
+    }
+
+    sb7::glstate::use_program(program);
+    glUniform4fv(planesLocation, 6, &frustum.planes[0][0]);
+    glUniform1ui(numInstancesLocation, instanceCount);
+    glUniform1i(compactLocation, indirectCount ? 1 : 0);
+
+    //Start the count over, the shader bumps it once per survivor
+    GLuint zero = 0;
+    sb7::glstate::bind_buffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+    sb7::glstate::bind_buffer_base(GL_SHADER_STORAGE_BUFFER, INSTANCE_SSBO_BINDING, instanceBuffer);
+    sb7::glstate::bind_buffer_base(GL_SHADER_STORAGE_BUFFER, COMMAND_SSBO_BINDING, commandBuffer);
+    sb7::glstate::bind_buffer_base(GL_SHADER_STORAGE_BUFFER, COUNT_SSBO_BINDING, countBuffer);
+    glDispatchCompute((instanceCount + 63) / 64, 1, 1);
+
+    //Commands and the count are read by the draw as indirect data
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void GpuCuller::draw(){
+    if(instanceCount == 0){
+        return;
+    }
+
+    sb7::glstate::bind_buffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    if(indirectCount){
+        sb7::glstate::bind_buffer(GL_PARAMETER_BUFFER_ARB, countBuffer);
+        //ARB signature takes the indirect offset as a GLintptr
+        glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, 0, 0, instanceCount, 0);
+    } else {
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, NULL, instanceCount, 0);
+    }
+}
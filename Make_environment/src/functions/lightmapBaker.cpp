@@ -0,0 +1,377 @@
+/*
+* Lightmap Baker
+* See ./include/lightmapBaker.h for usage
+*/
+#include <lightmapBaker.h>
+#include <timing.h>
+#include <pathTrace.h>
+#include <sb7glstate.h>
+#include <sb7ktx.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+//A first hit on the back of a wall from more than this share of a texel's paths means the texel is inside it
+const float INSIDE_WALL_FRACTION = 0.1f;
+
+static float luminance(const vmath::vec3 &c){
+    return c[0] * 0.2126f + c[1] * 0.7152f + c[2] * 0.0722f;
+}
+
+//IEEE half from a float, rounded to nearest
+static unsigned short floatToHalf(float value){
+    unsigned int bits;
+    memcpy(&bits, &value, sizeof(bits));
+    unsigned int sign = (bits >> 16) & 0x8000u;
+    int exponent = static_cast<int>((bits >> 23) & 0xffu) - 127 + 15;
+    unsigned int mantissa = bits & 0x7fffffu;
+    if(exponent <= 0){
+        //Too small for a normal half, shift into a subnormal (or zero)
+        if(exponent < -10){
+            return static_cast<unsigned short>(sign);
+        }
+        mantissa |= 0x800000u;
+        unsigned int shift = static_cast<unsigned int>(14 - exponent);
+        return static_cast<unsigned short>(sign | ((mantissa + (1u << (shift - 1))) >> shift));
+    }
+    if(exponent >= 31){
+        return static_cast<unsigned short>(sign | 0x7c00u); //Infinity
+    }
+    //A carry out of the mantissa correctly bumps the exponent
+    unsigned int half = sign | (static_cast<unsigned int>(exponent) << 10) | (mantissa >> 13);
+    half += (mantissa >> 12) & 1u;
+    return static_cast<unsigned short>(half);
+}
+
+lightmap_settings_t defaultLightmapSettings(){
+    lightmap_settings_t settings;
+    settings.texelsPerUnit = 4.0f;
+    settings.atlasWidth = 1024;
+    settings.padding = 2;
+    settings.samples = 64;
+    settings.bounces = 2;
+    settings.denoisePasses = 3;
+    settings.sunDirection = vmath::vec3(0.33f, -1.0f, 0.23f);
+    settings.sunColor = vmath::vec3(0.9f, 0.85f, 0.7f);
+    settings.skyIntensity = 1.0f;
+    settings.albedo = vmath::vec3(0.6f, 0.6f, 0.6f);
+    settings.seed = 1;
+    return settings;
+}
+
+LightmapBaker::LightmapBaker(){
+    width = 0;
+    height = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+void LightmapBaker::bake(std::vector<arena_vertex_t> &vertices, const std::vector<GLuint> &indices,
+                         const sky_cube_t &sky, const lightmap_settings_t &settings){
+    memset(&stats, 0, sizeof(stats));
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    unwrap(vertices, settings);
+    stats.unwrapSeconds = secondsSince(start);
+
+    std::chrono::high_resolution_clock::time_point phase = std::chrono::high_resolution_clock::now();
+    std::vector<vmath::vec3> positions(vertices.size());
+    for(size_t i = 0; i < vertices.size(); i++){
+        positions[i] = vmath::vec3(vertices[i].position[0], vertices[i].position[1], vertices[i].position[2]);
+    }
+    bvh.build(positions, indices);
+    triangleNormals.resize(indices.size() / 3);
+    for(size_t t = 0; t < triangleNormals.size(); t++){
+        const vmath::vec4 &n = vertices[indices[t * 3]].normal;
+        triangleNormals[t] = vmath::vec3(n[0], n[1], n[2]);
+    }
+    stats.bvhSeconds = secondsSince(phase);
+
+    phase = std::chrono::high_resolution_clock::now();
+    trace(sky, settings);
+    stats.traceSeconds = secondsSince(phase);
+
+    phase = std::chrono::high_resolution_clock::now();
+    denoise(settings);
+    dilate(settings);
+    stats.denoiseSeconds = secondsSince(phase);
+
+    stats.totalSeconds = secondsSince(start);
+}
+
+void LightmapBaker::unwrap(std::vector<arena_vertex_t> &vertices, const lightmap_settings_t &settings){
+    size_t quadCount = vertices.size() / 4;
+    charts.resize(quadCount);
+    std::vector<int> order(quadCount);
+    int widest = 0;
+    for(size_t q = 0; q < quadCount; q++){
+        const arena_vertex_t *v = &vertices[q * 4];
+        chart_t &chart = charts[q];
+        chart.origin = vmath::vec3(v[0].position[0], v[0].position[1], v[0].position[2]);
+        chart.edgeU = vmath::vec3(v[1].position[0], v[1].position[1], v[1].position[2]) - chart.origin;
+        chart.edgeV = vmath::vec3(v[3].position[0], v[3].position[1], v[3].position[2]) - chart.origin;
+        chart.normal = vmath::normalize(vmath::vec3(v[0].normal[0], v[0].normal[1], v[0].normal[2]));
+        chart.width = vmath::max(1, static_cast<int>(ceilf(vmath::length(chart.edgeU) * settings.texelsPerUnit)));
+        chart.height = vmath::max(1, static_cast<int>(ceilf(vmath::length(chart.edgeV) * settings.texelsPerUnit)));
+        widest = vmath::max(widest, chart.width);
+        order[q] = static_cast<int>(q);
+    }
+
+    //Tallest first packs shelves tightly, ties broken by index so the layout never changes
+    std::sort(order.begin(), order.end(), [&](int a, int b){
+        if(charts[a].height != charts[b].height){
+            return charts[a].height > charts[b].height;
+        }
+        if(charts[a].width != charts[b].width){
+            return charts[a].width > charts[b].width;
+        }
+        return a < b;
+    });
+
+    int pad = settings.padding;
+    width = vmath::max(settings.atlasWidth, widest + 2 * pad);
+    int x = 0;
+    int y = 0;
+    int shelfHeight = 0;
+    for(size_t i = 0; i < order.size(); i++){
+        chart_t &chart = charts[order[i]];
+        int paddedWidth = chart.width + 2 * pad;
+        int paddedHeight = chart.height + 2 * pad;
+        if(x + paddedWidth > width){
+            //Next shelf
+            y += shelfHeight;
+            x = 0;
+            shelfHeight = 0;
+        }
+        chart.x = x + pad;
+        chart.y = y + pad;
+        x += paddedWidth;
+        shelfHeight = vmath::max(shelfHeight, paddedHeight);
+    }
+    height = vmath::max(4, (y + shelfHeight + 3) & ~3);
+
+    //Texel edges line up with the quad's edges, so texel centers sit half a texel in
+    texelChart.assign(width * height, -1);
+    for(size_t q = 0; q < quadCount; q++){
+        const chart_t &chart = charts[q];
+        float u0 = static_cast<float>(chart.x) / width;
+        float v0 = static_cast<float>(chart.y) / height;
+        float u1 = static_cast<float>(chart.x + chart.width) / width;
+        float v1 = static_cast<float>(chart.y + chart.height) / height;
+        vertices[q * 4 + 0].lightmapUV = vmath::vec2(u0, v0);
+        vertices[q * 4 + 1].lightmapUV = vmath::vec2(u1, v0);
+        vertices[q * 4 + 2].lightmapUV = vmath::vec2(u1, v1);
+        vertices[q * 4 + 3].lightmapUV = vmath::vec2(u0, v1);
+
+        for(int ty = chart.y - pad; ty < chart.y + chart.height + pad; ty++){
+            for(int tx = chart.x - pad; tx < chart.x + chart.width + pad; tx++){
+                texelChart[ty * width + tx] = static_cast<int>(q);
+            }
+        }
+    }
+
+    stats.width = width;
+    stats.height = height;
+    stats.charts = quadCount;
+}
+
+void LightmapBaker::trace(const sky_cube_t &sky, const lightmap_settings_t &settings){
+    int texelCount = width * height;
+    texels.assign(texelCount * 3, 0.0f);
+    variance.assign(texelCount, 0.0f);
+    texelValid.assign(texelCount, 0);
+
+    int threads = bakeThreadCount();
+    trace_scene_t scene = { &bvh, &triangleNormals, &sky, settings.sunDirection, settings.sunColor, settings.skyIntensity, settings.albedo };
+
+    int samples = vmath::max(1, settings.samples);
+    unsigned int seed = hashSeed(settings.seed);
+    long long rays = 0;
+    long long traced = 0;
+
+    //Texels are independent, each one only writes itself
+    #pragma omp parallel for schedule(dynamic, 64) reduction(+:rays, traced)
+    for(int index = 0; index < texelCount; index++){
+        int c = texelChart[index];
+        if(c < 0){
+            continue;
+        }
+        const chart_t &chart = charts[c];
+        int i = index % width - chart.x;
+        int j = index / width - chart.y;
+        if(i < 0 || j < 0 || i >= chart.width || j >= chart.height){
+            continue; //Gutter
+        }
+        traced++;
+
+        bake_random_t random;
+        random.state = hashSeed(static_cast<unsigned int>(index) ^ seed);
+
+        vmath::vec3 sum(0.0f, 0.0f, 0.0f);
+        float sumLuminance = 0.0f;
+        float sumSquares = 0.0f;
+        int backFaces = 0;
+        for(int s = 0; s < samples; s++){
+            //Somewhere inside the texel's footprint on the quad
+            float a = (i + random.next()) / chart.width;
+            float b = (j + random.next()) / chart.height;
+            vmath::vec3 origin = chart.origin + chart.edgeU * a + chart.edgeV * b + chart.normal * RAY_OFFSET;
+            vmath::vec3 light = sunLight(scene, origin, chart.normal, rays);
+
+            bool backFace;
+            vmath::vec3 direction = cosineDirection(chart.normal, random.next(), random.next());
+            light += traceRadiance(scene, origin, direction, settings.bounces, random, rays, backFace);
+            if(backFace){
+                backFaces++;
+            }
+
+            sum += light;
+            float l = luminance(light);
+            sumLuminance += l;
+            sumSquares += l * l;
+        }
+
+        float mean = sumLuminance / samples;
+        for(int k = 0; k < 3; k++){
+            texels[index * 3 + k] = sum[k] / samples;
+        }
+        variance[index] = vmath::max(0.0f, sumSquares / samples - mean * mean) / samples;
+        texelValid[index] = backFaces <= INSIDE_WALL_FRACTION * samples;
+    }
+
+    stats.texels = static_cast<size_t>(traced);
+    stats.rays = static_cast<size_t>(rays);
+    stats.threads = threads;
+}
+
+void LightmapBaker::denoise(const lightmap_settings_t &settings){
+    static const float kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+    std::vector<float> filtered(texels.size());
+
+    for(int pass = 0; pass < settings.denoisePasses; pass++){
+        int step = 1 << pass;
+        #pragma omp parallel for schedule(static)
+        for(int y = 0; y < height; y++){
+            for(int x = 0; x < width; x++){
+                int index = y * width + x;
+                if(!texelValid[index]){
+                    for(int k = 0; k < 3; k++){
+                        filtered[index * 3 + k] = texels[index * 3 + k];
+                    }
+                    continue;
+                }
+
+                //Neighbours much brighter or darker than the noise explains are kept out (shadow edges)
+                int c = texelChart[index];
+                float centerLuminance = luminance(vmath::vec3(texels[index * 3], texels[index * 3 + 1], texels[index * 3 + 2]));
+                float phi = 4.0f * sqrtf(variance[index]) + 1e-4f;
+                vmath::vec3 sum(0.0f, 0.0f, 0.0f);
+                float weights = 0.0f;
+                for(int dy = -2; dy <= 2; dy++){
+                    int ny = y + dy * step;
+                    if(ny < 0 || ny >= height){
+                        continue;
+                    }
+                    for(int dx = -2; dx <= 2; dx++){
+                        int nx = x + dx * step;
+                        if(nx < 0 || nx >= width){
+                            continue;
+                        }
+                        int neighbour = ny * width + nx;
+                        if(texelChart[neighbour] != c || !texelValid[neighbour]){
+                            continue;
+                        }
+                        vmath::vec3 value(texels[neighbour * 3], texels[neighbour * 3 + 1], texels[neighbour * 3 + 2]);
+                        float w = kernel[dx + 2] * kernel[dy + 2] * expf(-fabsf(luminance(value) - centerLuminance) / phi);
+                        sum += value * w;
+                        weights += w;
+                    }
+                }
+                //The center always counts, so weights is never 0
+                for(int k = 0; k < 3; k++){
+                    filtered[index * 3 + k] = sum[k] / weights;
+                }
+            }
+        }
+        texels.swap(filtered);
+    }
+}
+
+void LightmapBaker::dilate(const lightmap_settings_t &settings){
+    //Each pass grows every chart by a texel, enough passes to cover the gutters and most wall bases
+    std::vector<char> filled(texelValid.size());
+    int passes = 2 * settings.padding + 8;
+    for(int pass = 0; pass < passes; pass++){
+        bool changed = false;
+        std::fill(filled.begin(), filled.end(), 0);
+        for(int y = 0; y < height; y++){
+            for(int x = 0; x < width; x++){
+                int index = y * width + x;
+                int c = texelChart[index];
+                if(c < 0 || texelValid[index]){
+                    continue;
+                }
+                vmath::vec3 sum(0.0f, 0.0f, 0.0f);
+                int count = 0;
+                for(int dy = -1; dy <= 1; dy++){
+                    for(int dx = -1; dx <= 1; dx++){
+                        int nx = x + dx;
+                        int ny = y + dy;
+                        if(nx < 0 || ny < 0 || nx >= width || ny >= height){
+                            continue;
+                        }
+                        int neighbour = ny * width + nx;
+                        if(texelChart[neighbour] == c && texelValid[neighbour]){
+                            sum += vmath::vec3(texels[neighbour * 3], texels[neighbour * 3 + 1], texels[neighbour * 3 + 2]);
+                            count++;
+                        }
+                    }
+                }
+                if(count > 0){
+                    for(int k = 0; k < 3; k++){
+                        texels[index * 3 + k] = sum[k] / count;
+                    }
+                    filled[index] = 1;
+                    changed = true;
+                }
+            }
+        }
+        //Only mark them now, so a pass never reads a texel it filled itself
+        for(size_t i = 0; i < filled.size(); i++){
+            if(filled[i]){
+                texelValid[i] = 1;
+            }
+        }
+        if(!changed){
+            break;
+        }
+    }
+}
+
+GLuint LightmapBaker::createTexture() const{
+    std::vector<unsigned short> data(width * height * 4);
+    for(int i = 0; i < width * height; i++){
+        for(int k = 0; k < 3; k++){
+            data[i * 4 + k] = floatToHalf(texels[i * 3 + k]);
+        }
+        data[i * 4 + 3] = 0x3c00; //1.0
+    }
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+    sb7::glstate::bind_texture_unit(LIGHTMAP_TEXTURE_UNIT, GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, width, height);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_HALF_FLOAT, data.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+bool LightmapBaker::save(const char *filename) const{
+    //The KTX writer reads the texels back from GL
+    GLuint texture = createTexture();
+    bool saved = sb7::ktx::file::save(filename, GL_TEXTURE_2D, texture);
+    sb7::glstate::delete_textures(1, &texture);
+    return saved;
+}
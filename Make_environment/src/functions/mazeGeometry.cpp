@@ -0,0 +1,266 @@
+/*
+* Maze Geometry
+* See ./include/mazeGeometry.h for usage
+*/
+#include <mazeGeometry.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+vmath::vec3 mazeTileToWorld(int x, int z){
+    return vmath::vec3((x + 1) * MAZE_TILE_SIZE, 0.0f, (z + 1) * MAZE_TILE_SIZE);
+}
+
+void worldToMazeTile(float worldX, float worldZ, int &x, int &z){
+    //Tile centers are on multiples of the tile size, round to the nearest one
+    x = static_cast<int>(floor(worldX / MAZE_TILE_SIZE + 0.5f)) - 1;
+    z = static_cast<int>(floor(worldZ / MAZE_TILE_SIZE + 0.5f)) - 1;
+}
+
+void buildWallTransforms(Maze &maze, std::vector<vmath::mat4> &transforms){
+    transforms.clear();
+
+    //Walk the maze with a one tile border, the border is the outer wall
+    //isWall() treats anything outside the maze as wall, so one loop covers both
+    for(int z = -1; z <= maze.getHeight(); z++){
+        for(int x = -1; x <= maze.getWidth(); x++){
+            if(maze.isWall(x, z)){
+                transforms.push_back(vmath::translate(mazeTileToWorld(x, z)));
+            }
+        }
+    }
+}
+
+//Append one rectangle to the mesh, corners go origin, origin + edgeU, origin + edgeU + edgeV, origin + edgeV
+// edgeU/edgeV -> sides of the rectangle, chosen so edgeU x edgeV points along normal (CCW from outside)
+// uvs are in world units along the two sides, one texture repeat per tile
+static void addQuad(const vmath::vec3 &origin, const vmath::vec3 &edgeU, const vmath::vec3 &edgeV, const vmath::vec3 &normal,
+                    std::vector<arena_vertex_t> &vertices, std::vector<GLuint> &indices,
+                    vmath::vec3 &boundsMin, vmath::vec3 &boundsMax){
+    GLuint base = static_cast<GLuint>(vertices.size());
+
+    vmath::vec3 corners[4];
+    corners[0] = origin;
+    corners[1] = origin + edgeU;
+    corners[2] = corners[1] + edgeV;
+    corners[3] = origin + edgeV;
+
+    vmath::vec3 dirU = vmath::normalize(edgeU);
+    vmath::vec3 dirV = vmath::normalize(edgeV);
+    for(int i = 0; i < 4; i++){
+        arena_vertex_t v;
+        v.position = vmath::vec4(corners[i][0], corners[i][1], corners[i][2], 1.0f);
+        v.normal = vmath::vec4(normal[0], normal[1], normal[2], 0.0f);
+        //World space uvs, so textures line up across neighbouring quads
+        v.uv = vmath::vec2(vmath::dot(corners[i], dirU) / MAZE_TILE_SIZE,
+                           (vmath::dot(corners[i], dirV) + MAZE_WALL_HALF_HEIGHT) / MAZE_TILE_SIZE);
+        v.lightmapUV = vmath::vec2(0.0f, 0.0f); //Filled in by a lightmap bake
+        memset(v.transfer, 0, sizeof(v.transfer)); //Unoccluded (see vertexTransfer.h)
+        vertices.push_back(v);
+
+        //Template arguments spelled out, otherwise the scalar min/max wins and compares the vectors as pointers
+        boundsMin = vmath::min<float, 3>(boundsMin, corners[i]);
+        boundsMax = vmath::max<float, 3>(boundsMax, corners[i]);
+    }
+
+    //Two CCW triangles
+    indices.push_back(base + 0);
+    indices.push_back(base + 1);
+    indices.push_back(base + 2);
+    indices.push_back(base + 0);
+    indices.push_back(base + 2);
+    indices.push_back(base + 3);
+}
+
+void buildMazeMesh(Maze &maze, int chunkSize,
+                   std::vector<arena_vertex_t> &vertices,
+                   std::vector<GLuint> &indices,
+                   std::vector<maze_chunk_t> &chunks,
+                   maze_mesh_stats_t* stats){
+    vertices.clear();
+    indices.clear();
+    chunks.clear();
+
+    //Work on the maze plus its boundary ring, tiles -1..width / -1..height
+    const int minTile = -1;
+    const int maxX = maze.getWidth();
+    const int maxZ = maze.getHeight();
+    const int tilesX = maxX - minTile + 1;
+    const int tilesZ = maxZ - minTile + 1;
+    const float half = MAZE_TILE_SIZE / 2.0f;
+
+    size_t wallTiles = 0;
+    size_t quads = 0;
+
+    //The four side directions, tangents picked so (tangent x up) == normal
+    const vmath::vec3 normals[4]  = { vmath::vec3( 1, 0, 0), vmath::vec3(-1, 0, 0), vmath::vec3(0, 0,  1), vmath::vec3( 0, 0, -1) };
+    const vmath::vec3 tangents[4] = { vmath::vec3( 0, 0,-1), vmath::vec3( 0, 0, 1), vmath::vec3(1, 0,  0), vmath::vec3(-1, 0,  0) };
+    const int stepX[4] = { 1, -1, 0,  0 }; //Neighbour the face looks at
+    const int stepZ[4] = { 0,  0, 1, -1 };
+
+    for(int cz = 0; cz * chunkSize < tilesZ; cz++){
+        for(int cx = 0; cx * chunkSize < tilesX; cx++){
+            maze_chunk_t chunk;
+            chunk.tileX0 = minTile + cx * chunkSize;
+            chunk.tileZ0 = minTile + cz * chunkSize;
+            chunk.tileX1 = vmath::min(chunk.tileX0 + chunkSize - 1, maxX);
+            chunk.tileZ1 = vmath::min(chunk.tileZ0 + chunkSize - 1, maxZ);
+            chunk.firstIndex = static_cast<GLuint>(indices.size());
+            chunk.boundsMin = vmath::vec3(1e30f, 1e30f, 1e30f);
+            chunk.boundsMax = vmath::vec3(-1e30f, -1e30f, -1e30f);
+
+            for(int z = chunk.tileZ0; z <= chunk.tileZ1; z++){
+                for(int x = chunk.tileX0; x <= chunk.tileX1; x++){
+                    if(maze.isWall(x, z)){
+                        wallTiles++;
+                    }
+                }
+            }
+
+            for(int dir = 0; dir < 4; dir++){
+                //X facing walls run along z, Z facing walls run along x
+                bool alongZ = (stepX[dir] != 0);
+                int lineStart = alongZ ? chunk.tileX0 : chunk.tileZ0;
+                int lineEnd   = alongZ ? chunk.tileX1 : chunk.tileZ1;
+                int runStart  = alongZ ? chunk.tileZ0 : chunk.tileX0;
+                int runEnd    = alongZ ? chunk.tileZ1 : chunk.tileX1;
+
+                for(int line = lineStart; line <= lineEnd; line++){
+                    int run = runStart;
+                    while(run <= runEnd){
+                        //Does the tile at this step have a visible face in this direction?
+                        int x = alongZ ? line : run;
+                        int z = alongZ ? run : line;
+                        bool visible = maze.isWall(x, z) && !maze.isWall(x + stepX[dir], z + stepZ[dir]);
+                        if(!visible){
+                            run++;
+                            continue;
+                        }
+
+                        //Grow the run as far as the faces keep lining up
+                        int first = run;
+                        while(run + 1 <= runEnd){
+                            int nx = alongZ ? line : run + 1;
+                            int nz = alongZ ? run + 1 : line;
+                            if(!(maze.isWall(nx, nz) && !maze.isWall(nx + stepX[dir], nz + stepZ[dir]))){
+                                break;
+                            }
+                            run++;
+                        }
+                        int last = run;
+                        run++;
+
+                        //Face sits on the tile edge facing the empty neighbour
+                        int fx0 = alongZ ? line : first;
+                        int fz0 = alongZ ? first : line;
+                        int fx1 = alongZ ? line : last;
+                        int fz1 = alongZ ? last : line;
+                        vmath::vec3 c0 = mazeTileToWorld(fx0, fz0);
+                        vmath::vec3 c1 = mazeTileToWorld(fx1, fz1);
+                        vmath::vec3 faceCenter0 = c0 + normals[dir] * half;
+                        vmath::vec3 faceCenter1 = c1 + normals[dir] * half;
+                        //Start the quad on whichever end the tangent points away from
+                        vmath::vec3 startCenter = vmath::dot(faceCenter0, tangents[dir]) < vmath::dot(faceCenter1, tangents[dir]) ? faceCenter0 : faceCenter1;
+                        vmath::vec3 origin = startCenter - tangents[dir] * half;
+                        origin[1] = -MAZE_WALL_HALF_HEIGHT;
+
+                        addQuad(origin, tangents[dir] * ((last - first + 1) * MAZE_TILE_SIZE),
+                                vmath::vec3(0.0f, 2.0f * MAZE_WALL_HALF_HEIGHT, 0.0f), normals[dir],
+                                vertices, indices, chunk.boundsMin, chunk.boundsMax);
+                        quads++;
+                    }
+                }
+            }
+
+            //One floor quad under the whole chunk, if anything in it is open
+            bool open = false;
+            for(int z = chunk.tileZ0; z <= chunk.tileZ1 && !open; z++){
+                for(int x = chunk.tileX0; x <= chunk.tileX1 && !open; x++){
+                    open = !maze.isWall(x, z);
+                }
+            }
+            if(open){
+                vmath::vec3 low = mazeTileToWorld(chunk.tileX0, chunk.tileZ0) - vmath::vec3(half, MAZE_WALL_HALF_HEIGHT, half);
+                vmath::vec3 high = mazeTileToWorld(chunk.tileX1, chunk.tileZ1) + vmath::vec3(half, -MAZE_WALL_HALF_HEIGHT, half);
+                //+x then -z faces up
+                addQuad(vmath::vec3(low[0], low[1], high[2]), vmath::vec3(high[0] - low[0], 0.0f, 0.0f),
+                        vmath::vec3(0.0f, 0.0f, low[2] - high[2]), vmath::vec3(0.0f, 1.0f, 0.0f),
+                        vertices, indices, chunk.boundsMin, chunk.boundsMax);
+                quads++;
+            }
+
+            chunk.indexCount = static_cast<GLuint>(indices.size()) - chunk.firstIndex;
+            if(chunk.indexCount > 0){
+                chunks.push_back(chunk); //Chunks with nothing visible are dropped entirely
+            }
+        }
+    }
+
+    if(stats){
+        stats->wallTiles = wallTiles;
+        stats->cubeTriangles = wallTiles * 12;
+        stats->quads = quads;
+        stats->triangles = quads * 2;
+    }
+}
+
+void setMazeChunkMeshes(const mesh_t &mazeMesh, std::vector<maze_chunk_t> &chunks){
+    for(size_t i = 0; i < chunks.size(); i++){
+        chunks[i].mesh.firstIndex = mazeMesh.firstIndex + chunks[i].firstIndex;
+        chunks[i].mesh.indexCount = chunks[i].indexCount;
+        chunks[i].mesh.baseVertex = mazeMesh.baseVertex;
+        chunks[i].mesh.vertexCount = mazeMesh.vertexCount;
+    }
+}
+
+//Box from tile (x0, z0) to tile (x1, z1) inclusive, full wall height
+static void addWallRun(int x0, int z0, int x1, int z1, std::vector<vmath::vec3> &boxMin, std::vector<vmath::vec3> &boxMax){
+    const float half = MAZE_TILE_SIZE / 2.0f;
+    boxMin.push_back(mazeTileToWorld(x0, z0) - vmath::vec3(half, MAZE_WALL_HALF_HEIGHT, half));
+    boxMax.push_back(mazeTileToWorld(x1, z1) + vmath::vec3(half, MAZE_WALL_HALF_HEIGHT, half));
+}
+
+void buildWallRuns(Maze &maze, std::vector<vmath::vec3> &boxMin, std::vector<vmath::vec3> &boxMax){
+    boxMin.clear();
+    boxMax.clear();
+
+    const int minTile = -1;
+    const int maxX = maze.getWidth();
+    const int maxZ = maze.getHeight();
+    const int tilesX = maxX - minTile + 1;
+    std::vector<uint8_t> used((maxZ - minTile + 1) * tilesX, 0);
+
+    //Runs of two or more along x
+    for(int z = minTile; z <= maxZ; z++){
+        int x = minTile;
+        while(x <= maxX){
+            int first = x;
+            while(x <= maxX && maze.isWall(x, z)){
+                x++;
+            }
+            if(x - first >= 2){
+                addWallRun(first, z, x - 1, z, boxMin, boxMax);
+                for(int i = first; i < x; i++){
+                    used[(z - minTile) * tilesX + (i - minTile)] = 1;
+                }
+            }
+            x = (x == first) ? x + 1 : x;
+        }
+    }
+
+    //Everything else along z (single tiles end up as runs of one)
+    for(int x = minTile; x <= maxX; x++){
+        int z = minTile;
+        while(z <= maxZ){
+            int first = z;
+            while(z <= maxZ && maze.isWall(x, z) && !used[(z - minTile) * tilesX + (x - minTile)]){
+                z++;
+            }
+            if(z > first){
+                addWallRun(x, first, x, z - 1, boxMin, boxMax);
+            } else {
+                z++;
+            }
+        }
+    }
+}
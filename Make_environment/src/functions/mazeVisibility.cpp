@@ -0,0 +1,400 @@
+/*
+* Maze Visibility
+* See ./include/mazeVisibility.h for usage
+*/
+#include <mazeVisibility.h>
+#include <math.h>
+#include <stdlib.h>
+#include <chrono>
+
+bool pvs_window_t::testRange(int tx0, int tz0, int tx1, int tz1) const {
+    //Clip the range to the window first, most ranges miss it completely
+    int i0 = tx0 - x0 < 0 ? 0 : tx0 - x0;
+    int j0 = tz0 - z0 < 0 ? 0 : tz0 - z0;
+    int i1 = tx1 - x0 >= width ? width - 1 : tx1 - x0;
+    int j1 = tz1 - z0 >= height ? height - 1 : tz1 - z0;
+    for(int j = j0; j <= j1; j++){
+        for(int i = i0; i <= i1; i++){
+            if(bits[j * width + i]){
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+//Solid/empty copy of the maze with the boundary ring, shared read-only by every thread
+struct solid_grid_t{
+    int width, height;          //Maze size plus the ring on each side
+    std::vector<uint8_t> solid; //1 for walls
+
+    //Maze tile coordinates (ring is -1), anything off the grid is solid
+    bool isSolid(int x, int z) const {
+        int gx = x + 1;
+        int gz = z + 1;
+        if(gx < 0 || gz < 0 || gx >= width || gz >= height){
+            return true;
+        }
+        return solid[gz * width + gx] != 0;
+    }
+};
+
+//Closed segment in tile units (tile centers are on integers, tile edges on halves)
+struct pvs_segment_t{
+    float x0, z0, x1, z1;
+};
+
+//Anything this close counts as touching
+const float PVS_EPSILON = 1e-5f;
+
+//Which side of the line through (ax, az) and (bx, bz) point (px, pz) is on, positive to the left
+static float lineSide(float ax, float az, float bx, float bz, float px, float pz){
+    return (bx - ax) * (pz - az) - (bz - az) * (px - ax);
+}
+
+//Keep the part of s on the side of the line where lineSide * sign >= 0
+//False when nothing but a point (or nothing) is left, a line only grazing there sees nothing
+static bool clipSegment(pvs_segment_t &s, float ax, float az, float bx, float bz, float sign){
+    float d0 = lineSide(ax, az, bx, bz, s.x0, s.z0) * sign;
+    float d1 = lineSide(ax, az, bx, bz, s.x1, s.z1) * sign;
+    if(d0 <= PVS_EPSILON && d1 <= PVS_EPSILON){
+        return false;
+    }
+    if(d0 < 0.0f || d1 < 0.0f){
+        float t = d0 / (d0 - d1);
+        float x = s.x0 + (s.x1 - s.x0) * t;
+        float z = s.z0 + (s.z1 - s.z0) * t;
+        if(d0 < 0.0f){
+            s.x0 = x;
+            s.z0 = z;
+        } else {
+            s.x1 = x;
+            s.z1 = z;
+        }
+    }
+    return fabsf(s.x1 - s.x0) + fabsf(s.z1 - s.z0) > PVS_EPSILON;
+}
+
+//Part of target that a straight line from source, through pass, can reach
+//(near is any point on the side of pass the lines come from)
+//Every line clipped against separates source from pass, so all of source is on one side of it and all
+//of pass on the other: a line through both can only carry on to pass's side. Nothing reachable is ever
+//cut off, the result can only be too big (conservative), never too small.
+static bool clipToPass(const pvs_segment_t &source, const pvs_segment_t &pass, float nearX, float nearZ, pvs_segment_t &target){
+    //Only the part of the source in front of pass can send lines through it, and they come out behind it
+    float nearSign = lineSide(pass.x0, pass.z0, pass.x1, pass.z1, nearX, nearZ) > 0.0f ? 1.0f : -1.0f;
+    pvs_segment_t from = source;
+    if(!clipSegment(from, pass.x0, pass.z0, pass.x1, pass.z1, nearSign)){
+        return false; //Source on the line of pass (or behind it), only grazing lines
+    }
+    if(!clipSegment(target, pass.x0, pass.z0, pass.x1, pass.z1, -nearSign)){
+        return false;
+    }
+
+    //Separating lines: through one end of the source and one end of pass, with the other ends on opposite sides
+    const float sx[2] = { from.x0, from.x1 }, sz[2] = { from.z0, from.z1 };
+    const float px[2] = { pass.x0, pass.x1 }, pz[2] = { pass.z0, pass.z1 };
+    for(int i = 0; i < 2; i++){
+        for(int j = 0; j < 2; j++){
+            if(fabsf(sx[i] - px[j]) + fabsf(sz[i] - pz[j]) <= PVS_EPSILON){
+                continue; //Shared corner, no line
+            }
+            float otherSource = lineSide(sx[i], sz[i], px[j], pz[j], sx[1 - i], sz[1 - i]);
+            float otherPass = lineSide(sx[i], sz[i], px[j], pz[j], px[1 - j], pz[1 - j]);
+            if(fabsf(otherSource) <= PVS_EPSILON && fabsf(otherPass) <= PVS_EPSILON){
+                continue; //Everything on one line
+            }
+            if((otherSource > PVS_EPSILON && otherPass > PVS_EPSILON) || (otherSource < -PVS_EPSILON && otherPass < -PVS_EPSILON)){
+                continue; //Not separating
+            }
+            float keep = fabsf(otherPass) > PVS_EPSILON ? (otherPass > 0.0f ? 1.0f : -1.0f) : (otherSource > 0.0f ? -1.0f : 1.0f);
+            if(!clipSegment(target, sx[i], sz[i], px[j], pz[j], keep)){
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+//Tile steps for the 4 edges of a tile: +x, -x, +z, -z
+static const int PVS_STEP_X[4] = { 1, -1, 0, 0 };
+static const int PVS_STEP_Z[4] = { 0, 0, 1, -1 };
+
+//Edge of tile (x, z) on side dir
+static pvs_segment_t tileEdge(int x, int z, int dir){
+    pvs_segment_t e;
+    if(dir < 2){
+        e.x0 = e.x1 = x + 0.5f * PVS_STEP_X[dir];
+        e.z0 = z - 0.5f;
+        e.z1 = z + 0.5f;
+    } else {
+        e.z0 = e.z1 = z + 0.5f * PVS_STEP_Z[dir];
+        e.x0 = x - 0.5f;
+        e.x1 = x + 0.5f;
+    }
+    return e;
+}
+
+//Tile waiting to be flowed through: entered through pass (clipped to what the source can reach) going dir
+struct pvs_item_t{
+    int x, z;
+    int dir;
+    pvs_segment_t pass;
+    bool first;                  //Entered straight from the source cell, every line out of it is fine
+};
+
+//Per thread scratch space so flood fills don't clear a whole grid each cell
+struct pvs_scratch_t{
+    std::vector<uint32_t> stamp;     //== generation when a tile was found visible this cell
+    uint32_t generation;
+    std::vector<uint32_t> edgeStamp; //== edgeGeneration when an edge has been flowed through from this source edge
+    std::vector<float> edgeLow;      //and the part of it that was (along z for x edges, along x for z edges)
+    std::vector<float> edgeHigh;
+    uint32_t edgeGeneration;
+    std::vector<pvs_item_t> queue;   //Portal flow queue
+    std::vector<int> visible;        //Tiles that are visible (grid indices)
+};
+
+//Work out the visible tiles of one empty cell (sx, sz)
+//A line of sight from anywhere in the cell leaves it through one of its open edges, so each of those is a
+//source, and tiles are flowed through edge by edge (the portals) keeping only the part of each edge that
+//a straight line from the source, through every edge so far, can still reach. Tiles are tested against
+//their whole extent, not sample points, so nothing visible from any point in the cell is ever left out.
+static void computeCell(const solid_grid_t &grid, int sx, int sz, float maxDistance, pvs_scratch_t &scratch){
+    scratch.generation++;
+    scratch.visible.clear();
+
+    const int gw = grid.width;
+    const int gh = grid.height;
+    const int verticalEdges = gh * (gw + 1); //x edges come first, then z edges
+    const float maxDist2 = maxDistance * maxDistance;
+
+    //The cell and its neighbours are always visible
+    for(int dz = -1; dz <= 1; dz++){
+        for(int dx = -1; dx <= 1; dx++){
+            int index = (sz + dz + 1) * gw + (sx + dx + 1);
+            if(scratch.stamp[index] != scratch.generation){
+                scratch.stamp[index] = scratch.generation;
+                scratch.visible.push_back(index);
+            }
+        }
+    }
+
+    for(int sourceDir = 0; sourceDir < 4; sourceDir++){
+        int firstX = sx + PVS_STEP_X[sourceDir];
+        int firstZ = sz + PVS_STEP_Z[sourceDir];
+        if(grid.isSolid(firstX, firstZ)){
+            continue; //Lines out this way go straight into a wall
+        }
+        const pvs_segment_t source = tileEdge(sx, sz, sourceDir);
+        scratch.edgeGeneration++;
+        scratch.queue.clear();
+        pvs_item_t start = { firstX, firstZ, sourceDir, source, true };
+        scratch.queue.push_back(start);
+
+        for(size_t q = 0; q < scratch.queue.size(); q++){
+            const pvs_item_t item = scratch.queue[q];
+            for(int dir = 0; dir < 4; dir++){
+                if(PVS_STEP_X[dir] == -PVS_STEP_X[item.dir] && PVS_STEP_Z[dir] == -PVS_STEP_Z[item.dir]){
+                    continue; //Back the way it came
+                }
+                int nx = item.x + PVS_STEP_X[dir];
+                int nz = item.z + PVS_STEP_Z[dir];
+                if(nx < -1 || nz < -1 || nx + 1 >= gw || nz + 1 >= gh){
+                    continue;
+                }
+                float ddx = static_cast<float>(nx - sx);
+                float ddz = static_cast<float>(nz - sz);
+                if(ddx * ddx + ddz * ddz > maxDist2){
+                    continue; //Past the far plane
+                }
+
+                pvs_segment_t portal = tileEdge(item.x, item.z, dir);
+                if(!item.first && !clipToPass(source, item.pass, static_cast<float>(item.x - PVS_STEP_X[item.dir]),
+                                              static_cast<float>(item.z - PVS_STEP_Z[item.dir]), portal)){
+                    continue;
+                }
+
+                int nIndex = (nz + 1) * gw + (nx + 1);
+                if(scratch.stamp[nIndex] != scratch.generation){
+                    scratch.stamp[nIndex] = scratch.generation;
+                    scratch.visible.push_back(nIndex);
+                }
+                if(grid.isSolid(nx, nz)){
+                    continue; //Walls can be seen but not seen through
+                }
+
+                //Each edge is flowed through once per source with everything that reached it: what can be seen
+                //beyond only depends on the source and the part of the edge, so a part already covered adds nothing
+                //and a new part is merged into one span (more than the lines really cover, never less)
+                int edge = dir < 2 ? (item.z + 1) * (gw + 1) + (item.x + 1) + (dir == 0 ? 1 : 0)
+                                   : verticalEdges + (item.z + 1 + (dir == 2 ? 1 : 0)) * gw + (item.x + 1);
+                float low = dir < 2 ? fminf(portal.z0, portal.z1) : fminf(portal.x0, portal.x1);
+                float high = dir < 2 ? fmaxf(portal.z0, portal.z1) : fmaxf(portal.x0, portal.x1);
+                if(scratch.edgeStamp[edge] == scratch.edgeGeneration){
+                    if(low >= scratch.edgeLow[edge] - PVS_EPSILON && high <= scratch.edgeHigh[edge] + PVS_EPSILON){
+                        continue;
+                    }
+                    low = fminf(low, scratch.edgeLow[edge]);
+                    high = fmaxf(high, scratch.edgeHigh[edge]);
+                }
+                scratch.edgeStamp[edge] = scratch.edgeGeneration;
+                scratch.edgeLow[edge] = low;
+                scratch.edgeHigh[edge] = high;
+                if(dir < 2){
+                    portal.z0 = low;
+                    portal.z1 = high;
+                } else {
+                    portal.x0 = low;
+                    portal.x1 = high;
+                }
+                pvs_item_t next = { nx, nz, dir, portal, false };
+                scratch.queue.push_back(next);
+            }
+        }
+    }
+}
+
+void MazePVS::build(Maze &maze, float maxDistance){
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+    mazeWidth = maze.getWidth();
+    mazeHeight = maze.getHeight();
+
+    solid_grid_t grid;
+    grid.width = mazeWidth + 2;
+    grid.height = mazeHeight + 2;
+    grid.solid.resize(grid.width * grid.height);
+    for(int z = -1; z <= mazeHeight; z++){
+        for(int x = -1; x <= mazeWidth; x++){
+            grid.solid[(z + 1) * grid.width + (x + 1)] = maze.isWall(x, z) ? 1 : 0;
+        }
+    }
+
+    cells.assign(mazeWidth * mazeHeight, cell_t());
+    hasSet.assign(mazeWidth * mazeHeight, 0);
+    const int cellCount = mazeWidth * mazeHeight;
+
+    //Distances are measured between tile centers, but the camera can be anywhere in its cell and
+    //any part of a tile can be seen, up to half a diagonal each
+    const float reach = maxDistance + sqrtf(2.0f);
+
+    #pragma omp parallel
+    {
+        pvs_scratch_t scratch;
+        scratch.stamp.assign(grid.width * grid.height, 0);
+        scratch.generation = 0;
+        size_t edgeCount = grid.height * (grid.width + 1) + (grid.height + 1) * grid.width;
+        scratch.edgeStamp.assign(edgeCount, 0);
+        scratch.edgeLow.resize(edgeCount);
+        scratch.edgeHigh.resize(edgeCount);
+        scratch.edgeGeneration = 0;
+
+        //Open areas cost far more than corridors, so hand cells out dynamically
+        #pragma omp for schedule(dynamic, 64)
+        for(int cell = 0; cell < cellCount; cell++){
+            int sx = cell % mazeWidth;
+            int sz = cell / mazeWidth;
+            if(grid.isSolid(sx, sz)){
+                continue;
+            }
+            computeCell(grid, sx, sz, reach, scratch);
+
+            //Window around the visible tiles
+            cell_t &out = cells[cell];
+            int minX = sx, minZ = sz, maxX = sx, maxZ = sz;
+            for(size_t v = 0; v < scratch.visible.size(); v++){
+                int tx = scratch.visible[v] % grid.width - 1;
+                int tz = scratch.visible[v] / grid.width - 1;
+                minX = tx < minX ? tx : minX;
+                minZ = tz < minZ ? tz : minZ;
+                maxX = tx > maxX ? tx : maxX;
+                maxZ = tz > maxZ ? tz : maxZ;
+            }
+            out.x0 = minX;
+            out.z0 = minZ;
+            out.width = maxX - minX + 1;
+            out.height = maxZ - minZ + 1;
+
+            //Stamp visible tiles into a window bitmap, then run length encode it
+            std::vector<uint8_t> bits(out.width * out.height, 0);
+            for(size_t v = 0; v < scratch.visible.size(); v++){
+                int tx = scratch.visible[v] % grid.width - 1;
+                int tz = scratch.visible[v] / grid.width - 1;
+                bits[(tz - out.z0) * out.width + (tx - out.x0)] = 1;
+            }
+            uint8_t current = 0; //Runs start with hidden tiles
+            uint32_t run = 0;
+            for(size_t b = 0; b < bits.size(); b++){
+                if(bits[b] != current){
+                    //Long runs are split with an empty run of the other value in between
+                    while(run > 0xFFFF){
+                        out.runs.push_back(0xFFFF);
+                        out.runs.push_back(0);
+                        run -= 0xFFFF;
+                    }
+                    out.runs.push_back(static_cast<uint16_t>(run));
+                    current = bits[b];
+                    run = 0;
+                }
+                run++;
+            }
+            while(run > 0xFFFF){
+                out.runs.push_back(0xFFFF);
+                out.runs.push_back(0);
+                run -= 0xFFFF;
+            }
+            out.runs.push_back(static_cast<uint16_t>(run));
+            hasSet[cell] = 1;
+        }
+    }
+
+    //Gather numbers for reporting
+    stats.cells = 0;
+    stats.visibleTiles = 0;
+    stats.compressedBytes = 0;
+    size_t gridBytes = (grid.width * grid.height + 7) / 8;
+    pvs_window_t window;
+    for(int cell = 0; cell < cellCount; cell++){
+        if(!hasSet[cell]){
+            continue;
+        }
+        stats.cells++;
+        stats.compressedBytes += sizeof(cell_t) + cells[cell].runs.size() * sizeof(uint16_t);
+        decode(cell % mazeWidth, cell / mazeWidth, window);
+        for(size_t b = 0; b < window.bits.size(); b++){
+            stats.visibleTiles += window.bits[b];
+        }
+    }
+    stats.rawBytes = stats.cells * gridBytes;
+    stats.buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+bool MazePVS::has(int x, int z) const {
+    if(x < 0 || z < 0 || x >= mazeWidth || z >= mazeHeight){
+        return false;
+    }
+    return hasSet[z * mazeWidth + x] != 0;
+}
+
+bool MazePVS::decode(int x, int z, pvs_window_t &window) const {
+    if(!has(x, z)){
+        return false;
+    }
+    const cell_t &cell = cells[z * mazeWidth + x];
+    window.x0 = cell.x0;
+    window.z0 = cell.z0;
+    window.width = cell.width;
+    window.height = cell.height;
+    window.bits.resize(cell.width * cell.height);
+
+    size_t b = 0;
+    uint8_t value = 0;
+    for(size_t r = 0; r < cell.runs.size(); r++){
+        for(uint16_t i = 0; i < cell.runs[r]; i++){
+            window.bits[b++] = value;
+        }
+        value ^= 1;
+    }
+    return true;
+}
@@ -0,0 +1,296 @@
+/*
+* Mesh Arena
+* See ./include/meshArena.h for usage
+*/
+#include <meshArena.h>
+#include <sb7glstate.h>
+#include <map>
+#include <cstring>
+#include <cstddef>
+
+vertex_format_t standardVertexFormat(){
+    vertex_format_t format;
+    format.stride = sizeof(arena_vertex_t);
+
+    //Each attribute: location, components, type, normalize, offset
+    format.attribs.push_back({ATTRIB_POSITION, 4, GL_FLOAT, GL_FALSE, (GLuint)offsetof(arena_vertex_t, position)});
+    format.attribs.push_back({ATTRIB_NORMAL,   4, GL_FLOAT, GL_FALSE, (GLuint)offsetof(arena_vertex_t, normal)});
+    format.attribs.push_back({ATTRIB_UV,       2, GL_FLOAT, GL_FALSE, (GLuint)offsetof(arena_vertex_t, uv)});
+    format.attribs.push_back({ATTRIB_LIGHTMAP_UV, 2, GL_FLOAT, GL_FALSE, (GLuint)offsetof(arena_vertex_t, lightmapUV)});
+    format.attribs.push_back({ATTRIB_TRANSFER, 4, GL_BYTE, GL_TRUE, (GLuint)offsetof(arena_vertex_t, transfer)});
+    return format;
+}
+
+//Byte-wise ordering so identical vertices land on the same map key
+struct vertexLess{
+    bool operator()(const arena_vertex_t &a, const arena_vertex_t &b) const {
+        return memcmp(&a, &b, sizeof(arena_vertex_t)) < 0;
+    }
+};
+
+void indexTriangles(const std::vector<vmath::vec4> &vertices,
+                    const std::vector<vmath::vec4> &normals,
+                    const std::vector<vmath::vec2> &uvs,
+                    std::vector<arena_vertex_t> &outVertices,
+                    std::vector<GLuint> &outIndices){
+    outVertices.clear();
+    outIndices.clear();
+    outIndices.reserve(vertices.size());
+
+    std::map<arena_vertex_t, GLuint, vertexLess> seen; //Vertex -> index it was given
+    for(size_t i = 0; i < vertices.size(); i++){
+        arena_vertex_t v;
+        memset((void*)&v, 0, sizeof(v)); //Keep padding deterministic for the byte compare
+        v.position = vertices[i];
+        v.normal = i < normals.size() ? normals[i] : vmath::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+        v.uv = i < uvs.size() ? uvs[i] : vmath::vec2(0.0f, 0.0f);
+
+        std::map<arena_vertex_t, GLuint, vertexLess>::iterator found = seen.find(v);
+        if(found != seen.end()){
+            //Already have this exact vertex, just reference it
+            outIndices.push_back(found->second);
+        } else {
+            GLuint index = static_cast<GLuint>(outVertices.size());
+            seen[v] = index;
+            outVertices.push_back(v);
+            outIndices.push_back(index);
+        }
+    }
+}
+
+MeshArena::MeshArena(){
+    vao = 0;
+    vertexBuffer = 0;
+    indexBuffer = 0;
+    drawIDBuffer = 0;
+    indirectBuffer = 0;
+    indirectCapacity = 0;
+    positionVao = 0;
+    positionBuffer = 0;
+    drawIDLocation = 0;
+    maxVertices = 0;
+    maxIndices = 0;
+    usedVertices = 0;
+    usedIndices = 0;
+}
+
+void MeshArena::create(const vertex_format_t &newFormat, GLuint newMaxVertices, GLuint newMaxIndices){
+    destroy(); //Just in case this is being re-used
+
+    format = newFormat;
+    maxVertices = newMaxVertices;
+    maxIndices = newMaxIndices;
+
+    //Immutable storage, meshes are copied in with glBufferSubData
+    glGenBuffers(1, &vertexBuffer);
+    sb7::glstate::bind_buffer(GL_ARRAY_BUFFER, vertexBuffer);
+    glBufferStorage(GL_ARRAY_BUFFER, (GLsizeiptr)maxVertices * format.stride, NULL, GL_DYNAMIC_STORAGE_BIT);
+
+    //Describe the vertex format once, this VAO is shared by every mesh in the arena
+    glGenVertexArrays(1, &vao);
+    sb7::glstate::bind_vertex_array(vao);
+    for(size_t i = 0; i < format.attribs.size(); i++){
+        const vertex_attrib_t &attrib = format.attribs[i];
+        glEnableVertexAttribArray(attrib.location);
+        glVertexAttribPointer(attrib.location,
+                              attrib.components,
+                              attrib.type,
+                              attrib.normalized,
+                              format.stride,
+                              (const void*)(uintptr_t)attrib.offset);
+    }
+
+    //Element buffer binding is VAO state, so this sticks with the VAO
+    glGenBuffers(1, &indexBuffer);
+    sb7::glstate::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    glBufferStorage(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)maxIndices * sizeof(GLuint), NULL, GL_DYNAMIC_STORAGE_BIT);
+
+    sb7::glstate::bind_vertex_array(0);
+}
+
+void MeshArena::destroy(){
+    if(vao){
+        sb7::glstate::delete_vertex_arrays(1, &vao);
+        sb7::glstate::delete_buffers(1, &vertexBuffer);
+        sb7::glstate::delete_buffers(1, &indexBuffer);
+    }
+    if(drawIDBuffer){
+        sb7::glstate::delete_buffers(1, &drawIDBuffer);
+    }
+    if(indirectBuffer){
+        sb7::glstate::delete_buffers(1, &indirectBuffer);
+    }
+    if(positionVao){
+        sb7::glstate::delete_vertex_arrays(1, &positionVao);
+        sb7::glstate::delete_buffers(1, &positionBuffer);
+    }
+    vao = 0;
+    positionVao = 0;
+    positionBuffer = 0;
+    vertexBuffer = 0;
+    indexBuffer = 0;
+    drawIDBuffer = 0;
+    indirectBuffer = 0;
+    indirectCapacity = 0;
+    usedVertices = 0;
+    usedIndices = 0;
+}
+
+bool MeshArena::addMesh(const void* vertices, GLuint vertexCount,
+                        const GLuint* indices, GLuint indexCount,
+                        mesh_t &mesh){
+    //Out of room, let the caller decide what to do
+    if(usedVertices + vertexCount > maxVertices || usedIndices + indexCount > maxIndices){
+        return false;
+    }
+
+    sb7::glstate::bind_buffer(GL_COPY_WRITE_BUFFER, vertexBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)usedVertices * format.stride, (GLsizeiptr)vertexCount * format.stride, vertices);
+    sb7::glstate::bind_buffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)usedIndices * sizeof(GLuint), (GLsizeiptr)indexCount * sizeof(GLuint), indices);
+
+    //Same vertices again, positions only
+    if(positionVao){
+        GLuint positionOffset = 0;
+        for(size_t i = 0; i < format.attribs.size(); i++){
+            if(format.attribs[i].location == ATTRIB_POSITION){
+                positionOffset = format.attribs[i].offset;
+            }
+        }
+        scratchPositions.resize((size_t)vertexCount * 3);
+        const unsigned char* src = static_cast<const unsigned char*>(vertices);
+        for(GLuint v = 0; v < vertexCount; v++){
+            memcpy(&scratchPositions[v * 3], src + (size_t)v * format.stride + positionOffset, 3 * sizeof(float));
+        }
+        sb7::glstate::bind_buffer(GL_COPY_WRITE_BUFFER, positionBuffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr)usedVertices * 3 * sizeof(float), (GLsizeiptr)vertexCount * 3 * sizeof(float), scratchPositions.data());
+    }
+    sb7::glstate::bind_buffer(GL_COPY_WRITE_BUFFER, 0);
+
+    //Indices stay mesh relative, base vertex shifts them at draw time
+    mesh.firstIndex = usedIndices;
+    mesh.indexCount = indexCount;
+    mesh.baseVertex = static_cast<GLint>(usedVertices);
+    mesh.vertexCount = vertexCount;
+
+    usedVertices += vertexCount;
+    usedIndices += indexCount;
+    return true;
+}
+
+void MeshArena::enableDrawID(GLuint location, GLuint maxDraws){
+    std::vector<GLuint> ids(maxDraws);
+    for(GLuint i = 0; i < maxDraws; i++){
+        ids[i] = i;
+    }
+
+    if(drawIDBuffer){
+        sb7::glstate::delete_buffers(1, &drawIDBuffer);
+    }
+    glGenBuffers(1, &drawIDBuffer);
+    sb7::glstate::bind_buffer(GL_ARRAY_BUFFER, drawIDBuffer);
+    glBufferStorage(GL_ARRAY_BUFFER, ids.size() * sizeof(GLuint), ids.data(), 0);
+
+    drawIDLocation = location;
+    sb7::glstate::bind_vertex_array(vao);
+    setDrawIDAttrib(location);
+    if(positionVao){
+        sb7::glstate::bind_vertex_array(positionVao);
+        setDrawIDAttrib(location);
+    }
+    sb7::glstate::bind_vertex_array(0);
+}
+
+void MeshArena::setDrawIDAttrib(GLuint location){
+    sb7::glstate::bind_buffer(GL_ARRAY_BUFFER, drawIDBuffer);
+    glEnableVertexAttribArray(location);
+    glVertexAttribIPointer(location, 1, GL_UNSIGNED_INT, 0, NULL); //Integer attribute, no float conversion
+    glVertexAttribDivisor(location, 1); //Advance once per instance instead of once per vertex
+}
+
+void MeshArena::enablePositionStream(){
+    if(positionVao || !vao){
+        return;
+    }
+
+    glGenBuffers(1, &positionBuffer);
+    sb7::glstate::bind_buffer(GL_ARRAY_BUFFER, positionBuffer);
+    glBufferStorage(GL_ARRAY_BUFFER, (GLsizeiptr)maxVertices * 3 * sizeof(float), NULL, GL_DYNAMIC_STORAGE_BIT);
+
+    //w is filled in as 1 by GL, the same as every position in the full vertices
+    glGenVertexArrays(1, &positionVao);
+    sb7::glstate::bind_vertex_array(positionVao);
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), NULL);
+    sb7::glstate::bind_buffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    if(drawIDBuffer){
+        setDrawIDAttrib(drawIDLocation);
+    }
+    sb7::glstate::bind_vertex_array(0);
+}
+
+void MeshArena::bind() const {
+    sb7::glstate::bind_vertex_array(vao);
+}
+
+void MeshArena::bindPositionOnly() const {
+    sb7::glstate::bind_vertex_array(positionVao ? positionVao : vao);
+}
+
+void MeshArena::draw(const mesh_t &mesh, GLuint instanceCount, GLuint baseInstance) const {
+    glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES,
+                                                  mesh.indexCount,
+                                                  GL_UNSIGNED_INT,
+                                                  (const void*)(uintptr_t)(mesh.firstIndex * sizeof(GLuint)),
+                                                  instanceCount,
+                                                  mesh.baseVertex,
+                                                  baseInstance);
+}
+
+void MeshArena::multiDraw(const mesh_t* meshes, GLsizei count, const GLuint* baseInstances, sb7::ring_buffer* stream){
+    if(count <= 0){
+        return;
+    }
+
+    //Commands go straight into this frame's part of the ring, the GPU reads them from there
+    const GLsizeiptr bytes = count * sizeof(draw_elements_indirect_t);
+    GLintptr offset = 0;
+    draw_elements_indirect_t* commands = NULL;
+    if(stream && stream->in_frame()){
+        commands = static_cast<draw_elements_indirect_t*>(stream->allocate(bytes, sizeof(GLuint), offset));
+    }
+    const bool streamed = commands != NULL;
+    if(!streamed){
+        scratchCommands.resize(count);
+        commands = scratchCommands.data();
+    }
+
+    //Build one indirect command per mesh, baseInstance carries the draw id
+    for(GLsizei i = 0; i < count; i++){
+        draw_elements_indirect_t &cmd = commands[i];
+        cmd.count = meshes[i].indexCount;
+        cmd.instanceCount = 1;
+        cmd.firstIndex = meshes[i].firstIndex;
+        cmd.baseVertex = meshes[i].baseVertex;
+        cmd.baseInstance = baseInstances ? baseInstances[i] : static_cast<GLuint>(i);
+    }
+
+    if(streamed){
+        sb7::glstate::bind_buffer(GL_DRAW_INDIRECT_BUFFER, stream->buffer());
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)(uintptr_t)offset, count, 0);
+        return;
+    }
+
+    //No room in a stream: the arena's own buffer, only re-allocated when it has to grow
+    if(!indirectBuffer){
+        glGenBuffers(1, &indirectBuffer);
+    }
+    sb7::glstate::bind_buffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+    if(count > indirectCapacity){
+        indirectCapacity = count * 2;
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, indirectCapacity * sizeof(draw_elements_indirect_t), NULL, GL_STREAM_DRAW);
+    }
+    glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, bytes, commands);
+
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, NULL, count, 0);
+}
@@ -0,0 +1,326 @@
+/*
+* Occlusion
+* See ./include/occlusion.h for usage
+*/
+#include <occlusion.h>
+#include <math.h>
+
+//SSE2 is always there on x86-64
+#include <emmintrin.h>
+
+void OcclusionBuffer::create(int w, int h){
+    tilesX = (w + TILE_WIDTH - 1) / TILE_WIDTH;
+    tilesY = (h + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    width = tilesX * TILE_WIDTH;
+    height = tilesY * TILE_HEIGHT;
+
+    //Mip chain down to a single texel
+    levels.clear();
+    levelWidth.clear();
+    levelHeight.clear();
+    int lw = width;
+    int lh = height;
+    while(true){
+        levels.push_back(std::vector<float>(lw * lh, 1.0f));
+        levelWidth.push_back(lw);
+        levelHeight.push_back(lh);
+        if(lw == 1 && lh == 1){
+            break;
+        }
+        lw = (lw + 1) / 2;
+        lh = (lh + 1) / 2;
+    }
+    beginFrame();
+}
+
+void OcclusionBuffer::beginFrame(){
+    occluderMin.clear();
+    occluderMax.clear();
+    stats.occluders = 0;
+    stats.triangles = 0;
+    stats.tested = 0;
+    stats.occluded = 0;
+}
+
+void OcclusionBuffer::addOccluder(const vmath::vec3 &boxMin, const vmath::vec3 &boxMax){
+    occluderMin.push_back(boxMin);
+    occluderMax.push_back(boxMax);
+}
+
+//Clip space position of a world point (m is column major)
+static inline vmath::vec4 toClip(const float* m, float x, float y, float z){
+    return vmath::vec4(m[0] * x + m[4] * y + m[8]  * z + m[12],
+                       m[1] * x + m[5] * y + m[9]  * z + m[13],
+                       m[2] * x + m[6] * y + m[10] * z + m[14],
+                       m[3] * x + m[7] * y + m[11] * z + m[15]);
+}
+
+void OcclusionBuffer::render(const vmath::mat4 &vp){
+    for(int col = 0; col < 4; col++){
+        for(int row = 0; row < 4; row++){
+            viewProjection[col * 4 + row] = vp[col][row];
+        }
+    }
+
+    //Box corners are indexed by bits (x, y, z), faces are 4 corners each
+    static const int faces[6][4] = {
+        {0, 2, 6, 4}, {1, 5, 7, 3}, //-x, +x
+        {0, 4, 5, 1}, {2, 3, 7, 6}, //-y, +y
+        {0, 1, 3, 2}, {4, 6, 7, 5}  //-z, +z
+    };
+
+    triangles.clear();
+    for(size_t i = 0; i < occluderMin.size(); i++){
+        vmath::vec4 corners[8];
+        for(int c = 0; c < 8; c++){
+            corners[c] = toClip(viewProjection,
+                                (c & 1) ? occluderMax[i][0] : occluderMin[i][0],
+                                (c & 2) ? occluderMax[i][1] : occluderMin[i][1],
+                                (c & 4) ? occluderMax[i][2] : occluderMin[i][2]);
+        }
+        //Both windings are rasterized, the nearest depth wins so back faces never matter
+        for(int f = 0; f < 6; f++){
+            addTriangle(corners[faces[f][0]], corners[faces[f][1]], corners[faces[f][2]]);
+            addTriangle(corners[faces[f][0]], corners[faces[f][2]], corners[faces[f][3]]);
+        }
+    }
+    stats.occluders = occluderMin.size();
+    stats.triangles = triangles.size();
+
+    //Tiles never share pixels, so every tile can be rasterized on its own thread
+    const int tileCount = tilesX * tilesY;
+    #pragma omp parallel for schedule(dynamic)
+    for(int t = 0; t < tileCount; t++){
+        rasterizeTile(t % tilesX, t / tilesX);
+    }
+
+    buildHierarchy();
+}
+
+void OcclusionBuffer::addTriangle(const vmath::vec4 &a, const vmath::vec4 &b, const vmath::vec4 &c){
+    //Clip against the near plane (z >= -w), which turns a triangle into at most a quad
+    const vmath::vec4* in[3] = { &a, &b, &c };
+    vmath::vec4 poly[4];
+    int count = 0;
+    for(int i = 0; i < 3; i++){
+        const vmath::vec4 &p = *in[i];
+        const vmath::vec4 &q = *in[(i + 1) % 3];
+        float dp = p[2] + p[3];
+        float dq = q[2] + q[3];
+        if(dp >= 0.0f){
+            poly[count++] = p;
+        }
+        if((dp >= 0.0f) != (dq >= 0.0f)){
+            float t = dp / (dp - dq);
+            poly[count++] = p + (q - p) * t;
+        }
+    }
+    if(count < 3){
+        return;
+    }
+
+    //Project to pixels
+    float sx[4], sy[4], sz[4];
+    for(int i = 0; i < count; i++){
+        float w = poly[i][3] > 1e-6f ? poly[i][3] : 1e-6f;
+        sx[i] = (poly[i][0] / w * 0.5f + 0.5f) * width;
+        sy[i] = (poly[i][1] / w * 0.5f + 0.5f) * height;
+        sz[i] = poly[i][2] / w * 0.5f + 0.5f;
+    }
+
+    //Fan triangulate
+    for(int i = 1; i + 1 < count; i++){
+        int v[3] = { 0, i, i + 1 };
+        screen_tri_t tri;
+        float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+        for(int k = 0; k < 3; k++){
+            tri.x[k] = sx[v[k]];
+            tri.y[k] = sy[v[k]];
+            tri.z[k] = sz[v[k]];
+            minX = fminf(minX, tri.x[k]);
+            minY = fminf(minY, tri.y[k]);
+            maxX = fmaxf(maxX, tri.x[k]);
+            maxY = fmaxf(maxY, tri.y[k]);
+        }
+
+        //Pixel centers inside the box, skip anything off screen or with no pixels
+        minX = fmaxf(minX, 0.0f);
+        minY = fmaxf(minY, 0.0f);
+        maxX = fminf(maxX, static_cast<float>(width));
+        maxY = fminf(maxY, static_cast<float>(height));
+        tri.minX = static_cast<int>(ceilf(minX - 0.5f));
+        tri.minY = static_cast<int>(ceilf(minY - 0.5f));
+        tri.maxX = static_cast<int>(floorf(maxX - 0.5f));
+        tri.maxY = static_cast<int>(floorf(maxY - 0.5f));
+        if(tri.minX > tri.maxX || tri.minY > tri.maxY){
+            continue;
+        }
+
+        //Make every triangle counter clockwise so inside is always "all edges >= 0"
+        float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.y[1] - tri.y[0]) * (tri.x[2] - tri.x[0]);
+        if(area == 0.0f){
+            continue;
+        }
+        if(area < 0.0f){
+            float tx = tri.x[1], ty = tri.y[1], tz = tri.z[1];
+            tri.x[1] = tri.x[2]; tri.y[1] = tri.y[2]; tri.z[1] = tri.z[2];
+            tri.x[2] = tx;       tri.y[2] = ty;       tri.z[2] = tz;
+        }
+        triangles.push_back(tri);
+    }
+}
+
+void OcclusionBuffer::rasterizeTile(int tileX, int tileY){
+    const int x0 = tileX * TILE_WIDTH;
+    const int y0 = tileY * TILE_HEIGHT;
+    const int x1 = x0 + TILE_WIDTH - 1;
+    const int y1 = y0 + TILE_HEIGHT - 1;
+    std::vector<float> &depth = levels[0];
+
+    //Clear this tile
+    for(int y = y0; y <= y1; y++){
+        for(int x = x0; x <= x1; x++){
+            depth[y * width + x] = 1.0f;
+        }
+    }
+
+    const __m128 laneOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f); //Pixel centers of 4 neighbouring pixels
+    const __m128 zero = _mm_setzero_ps();
+
+    for(size_t i = 0; i < triangles.size(); i++){
+        const screen_tri_t &tri = triangles[i];
+        if(tri.maxX < x0 || tri.minX > x1 || tri.maxY < y0 || tri.minY > y1){
+            continue;
+        }
+
+        //Edge functions E(p) = A * p.x + B * p.y + C, >= 0 on the inside of a CCW triangle
+        float A[3], B[3], C[3];
+        for(int e = 0; e < 3; e++){
+            int a = e;
+            int b = (e + 1) % 3;
+            A[e] = tri.y[a] - tri.y[b];
+            B[e] = tri.x[b] - tri.x[a];
+            C[e] = -(A[e] * tri.x[a] + B[e] * tri.y[a]);
+        }
+
+        //Depth is linear in screen space: z = zA * x + zB * y + zC
+        //Edge e is opposite vertex (e + 2) % 3, so its function is that vertex's barycentric weight
+        float area = A[0] * tri.x[2] + B[0] * tri.y[2] + C[0];
+        float inv = 1.0f / area;
+        float zA = (A[1] * tri.z[0] + A[2] * tri.z[1] + A[0] * tri.z[2]) * inv;
+        float zB = (B[1] * tri.z[0] + B[2] * tri.z[1] + B[0] * tri.z[2]) * inv;
+        float zC = (C[1] * tri.z[0] + C[2] * tri.z[1] + C[0] * tri.z[2]) * inv;
+
+        int startX = (tri.minX > x0 ? tri.minX : x0) & ~3; //Tiles start on multiples of 4
+        int endX = tri.maxX < x1 ? tri.maxX : x1;
+        int startY = tri.minY > y0 ? tri.minY : y0;
+        int endY = tri.maxY < y1 ? tri.maxY : y1;
+
+        __m128 a0 = _mm_set1_ps(A[0]), a1 = _mm_set1_ps(A[1]), a2 = _mm_set1_ps(A[2]);
+        __m128 za = _mm_set1_ps(zA);
+        for(int y = startY; y <= endY; y++){
+            float py = y + 0.5f;
+            __m128 rowE0 = _mm_set1_ps(B[0] * py + C[0]);
+            __m128 rowE1 = _mm_set1_ps(B[1] * py + C[1]);
+            __m128 rowE2 = _mm_set1_ps(B[2] * py + C[2]);
+            __m128 rowZ = _mm_set1_ps(zB * py + zC);
+            float* row = &depth[y * width];
+
+            for(int x = startX; x <= endX; x += 4){
+                __m128 px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), laneOffsets);
+                __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), rowE0);
+                __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), rowE1);
+                __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), rowE2);
+                __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)),
+                                           _mm_cmpge_ps(e2, zero));
+                if(_mm_movemask_ps(inside) == 0){
+                    continue;
+                }
+                __m128 z = _mm_add_ps(_mm_mul_ps(za, px), rowZ);
+                __m128 old = _mm_loadu_ps(row + x);
+                __m128 nearest = _mm_min_ps(old, z);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+            }
+        }
+    }
+}
+
+void OcclusionBuffer::buildHierarchy(){
+    for(size_t level = 1; level < levels.size(); level++){
+        const std::vector<float> &src = levels[level - 1];
+        std::vector<float> &dst = levels[level];
+        int sw = levelWidth[level - 1];
+        int sh = levelHeight[level - 1];
+        int dw = levelWidth[level];
+        int dh = levelHeight[level];
+        for(int y = 0; y < dh; y++){
+            int sy0 = y * 2;
+            int sy1 = sy0 + 1 < sh ? sy0 + 1 : sy0;
+            for(int x = 0; x < dw; x++){
+                int sx0 = x * 2;
+                int sx1 = sx0 + 1 < sw ? sx0 + 1 : sx0;
+                //Farthest of the 4, so a texel is only "in front" if every pixel under it is
+                dst[y * dw + x] = fmaxf(fmaxf(src[sy0 * sw + sx0], src[sy0 * sw + sx1]),
+                                        fmaxf(src[sy1 * sw + sx0], src[sy1 * sw + sx1]));
+            }
+        }
+    }
+}
+
+bool OcclusionBuffer::testBox(const vmath::vec3 &boxMin, const vmath::vec3 &boxMax){
+    //Boxes are tested from several threads at once, the buffer itself is only read
+    #pragma omp atomic
+    stats.tested++;
+
+    //Screen rectangle and nearest depth of the box
+    float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, minZ = 1e30f;
+    for(int c = 0; c < 8; c++){
+        vmath::vec4 p = toClip(viewProjection,
+                               (c & 1) ? boxMax[0] : boxMin[0],
+                               (c & 2) ? boxMax[1] : boxMin[1],
+                               (c & 4) ? boxMax[2] : boxMin[2]);
+        if(p[3] <= 1e-6f || p[2] < -p[3]){
+            return true; //Crosses the near plane, the camera is practically inside it
+        }
+        float inv = 1.0f / p[3];
+        float sx = (p[0] * inv * 0.5f + 0.5f) * width;
+        float sy = (p[1] * inv * 0.5f + 0.5f) * height;
+        float sz = p[2] * inv * 0.5f + 0.5f;
+        minX = fminf(minX, sx);
+        minY = fminf(minY, sy);
+        maxX = fmaxf(maxX, sx);
+        maxY = fmaxf(maxY, sy);
+        minZ = fminf(minZ, sz);
+    }
+
+    int x0 = static_cast<int>(floorf(fmaxf(minX, 0.0f)));
+    int y0 = static_cast<int>(floorf(fmaxf(minY, 0.0f)));
+    int x1 = static_cast<int>(floorf(fminf(maxX, width - 1.0f)));
+    int y1 = static_cast<int>(floorf(fminf(maxY, height - 1.0f)));
+    if(x0 > x1 || y0 > y1){
+        return true; //Off screen, that is for frustum culling to decide
+    }
+
+    //Go up the chain until the rectangle is only a few texels across
+    size_t level = 0;
+    while((x1 - x0 > 3 || y1 - y0 > 3) && level + 1 < levels.size()){
+        x0 >>= 1;
+        y0 >>= 1;
+        x1 >>= 1;
+        y1 >>= 1;
+        level++;
+    }
+
+    const std::vector<float> &depth = levels[level];
+    int lw = levelWidth[level];
+    for(int y = y0; y <= y1; y++){
+        for(int x = x0; x <= x1; x++){
+            if(depth[y * lw + x] >= minZ){
+                return true; //Something behind the box's nearest point, it might show there
+            }
+        }
+    }
+    #pragma omp atomic
+    stats.occluded++;
+    return false;
+}
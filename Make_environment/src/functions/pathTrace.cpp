@@ -0,0 +1,63 @@
+/*
+* Path Trace
+* See ./include/pathTrace.h for usage
+*/
+#include <pathTrace.h>
+#include <cfloat>
+#include <cmath>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+vmath::vec3 sunLight(const trace_scene_t &scene, const vmath::vec3 &position, const vmath::vec3 &normal, long long &rays){
+    vmath::vec3 toSun = -vmath::normalize(scene.sunDirection);
+    float nDotL = vmath::dot(normal, toSun);
+    if(nDotL <= 0.0f){
+        return vmath::vec3(0.0f, 0.0f, 0.0f);
+    }
+    rays++;
+    if(scene.bvh->occluded(position, toSun, FLT_MAX)){
+        return vmath::vec3(0.0f, 0.0f, 0.0f);
+    }
+    return scene.sunColor * nDotL;
+}
+
+vmath::vec3 traceRadiance(const trace_scene_t &scene, vmath::vec3 origin, vmath::vec3 direction, int bounces,
+                          bake_random_t &random, long long &rays, bool &backFace){
+    vmath::vec3 light(0.0f, 0.0f, 0.0f);
+    vmath::vec3 throughput(1.0f, 1.0f, 1.0f);
+    backFace = false;
+    for(int bounce = 0; ; bounce++){
+        rays++;
+        bvh_hit_t hit;
+        if(!scene.bvh->intersect(origin, direction, FLT_MAX, hit)){
+            //Escaped, the sky seen along direction is looked up at -direction (see sc_vs.glsl)
+            light += throughput * sampleCube(*scene.sky, -direction) * scene.skyIntensity;
+            break;
+        }
+        const vmath::vec3 &normal = (*scene.triangleNormals)[hit.triangle];
+        if(vmath::dot(normal, direction) > 0.0f){
+            //Back of a wall, nothing comes from there
+            backFace = bounce == 0;
+            break;
+        }
+        if(bounce == bounces){
+            break;
+        }
+
+        //Light leaving the hit point towards us: its sun now, the rest on the next ray
+        throughput = throughput * scene.albedo;
+        origin = origin + direction * hit.t + normal * RAY_OFFSET;
+        light += throughput * sunLight(scene, origin, normal, rays);
+        direction = cosineDirection(normal, random.next(), random.next());
+    }
+    return light;
+}
+
+int bakeThreadCount(){
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
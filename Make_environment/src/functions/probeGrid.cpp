@@ -0,0 +1,203 @@
+/*
+* Probe Grid
+* See ./include/probeGrid.h for usage
+*/
+#include <probeGrid.h>
+#include <timing.h>
+#include <mazeGeometry.h>
+#include <pathTrace.h>
+#include <sb7glstate.h>
+#include <cmath>
+#include <cstring>
+
+//Chunk size the maze is meshed with for the bake, chunks don't matter to the BVH
+const int PROBE_MESH_CHUNK = 16;
+
+probe_settings_t defaultProbeSettings(){
+    probe_settings_t settings;
+    settings.strata = 16;
+    settings.bounces = 2;
+    settings.sunDirection = vmath::vec3(0.33f, -1.0f, 0.23f);
+    settings.sunColor = vmath::vec3(0.9f, 0.85f, 0.7f);
+    settings.skyIntensity = 1.0f;
+    settings.albedo = vmath::vec3(0.6f, 0.6f, 0.6f);
+    settings.seed = 1;
+    return settings;
+}
+
+ProbeGrid::ProbeGrid(){
+    uniformBuffer = 0;
+    texture = 0;
+    width = 0;
+    height = 0;
+    uniforms.gridMin = vmath::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    uniforms.gridSize = vmath::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    memset(&stats, 0, sizeof(stats));
+}
+
+void ProbeGrid::bake(Maze &maze, const sky_cube_t &sky, const probe_settings_t &settings){
+    memset(&stats, 0, sizeof(stats));
+    int tilesX = vmath::min(maze.getWidth(), PROBE_MAX_TILES);
+    int tilesZ = vmath::min(maze.getHeight(), PROBE_MAX_TILES);
+    width = tilesX * 2;
+    height = tilesZ * 2;
+    texels.assign((size_t)width * height * 3 * PROBE_LAYERS, vmath::vec4(0.0f, 0.0f, 0.0f, 0.0f));
+    stats.width = width;
+    stats.height = height;
+    if(width == 0 || height == 0){
+        return;
+    }
+
+    //Texture coordinate 0 is the outside edge of tile (0, 0), the layers sit evenly up the walls
+    float lowest = (0.5f / PROBE_LAYERS) * 2.0f * MAZE_WALL_HALF_HEIGHT - MAZE_WALL_HALF_HEIGHT;
+    float spacing = 2.0f * MAZE_WALL_HALF_HEIGHT / PROBE_LAYERS;
+    vmath::vec3 corner = mazeTileToWorld(0, 0) - vmath::vec3(MAZE_TILE_SIZE * 0.5f, 0.0f, MAZE_TILE_SIZE * 0.5f);
+    uniforms.gridMin = vmath::vec4(corner[0], lowest, corner[2], MAZE_TILE_SIZE * 0.25f);
+    uniforms.gridSize = vmath::vec4(tilesX * MAZE_TILE_SIZE, spacing * vmath::max(PROBE_LAYERS - 1, 1), tilesZ * MAZE_TILE_SIZE,
+                                    static_cast<float>(PROBE_LAYERS));
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    std::vector<arena_vertex_t> vertices;
+    std::vector<GLuint> indices;
+    std::vector<maze_chunk_t> chunks;
+    buildMazeMesh(maze, PROBE_MESH_CHUNK, vertices, indices, chunks);
+    std::vector<vmath::vec3> positions(vertices.size());
+    for(size_t i = 0; i < vertices.size(); i++){
+        positions[i] = vmath::vec3(vertices[i].position[0], vertices[i].position[1], vertices[i].position[2]);
+    }
+    TriangleBVH bvh;
+    bvh.build(positions, indices);
+    std::vector<vmath::vec3> triangleNormals(indices.size() / 3);
+    for(size_t t = 0; t < triangleNormals.size(); t++){
+        const vmath::vec4 &n = vertices[indices[t * 3]].normal;
+        triangleNormals[t] = vmath::vec3(n[0], n[1], n[2]);
+    }
+    stats.bvhSeconds = secondsSince(start);
+
+    int threads = bakeThreadCount();
+    trace_scene_t scene = { &bvh, &triangleNormals, &sky, settings.sunDirection, settings.sunColor, settings.skyIntensity, settings.albedo };
+
+    start = std::chrono::high_resolution_clock::now();
+    int strata = vmath::max(1, settings.strata);
+    int samples = strata * strata;
+    unsigned int seed = hashSeed(settings.seed);
+    int probeCount = width * height * PROBE_LAYERS;
+    long long rays = 0;
+    long long traced = 0;
+
+    //Probes are independent, each one only writes its own texels
+    #pragma omp parallel for schedule(dynamic, 16) reduction(+:rays, traced)
+    for(int index = 0; index < probeCount; index++){
+        int layer = index % PROBE_LAYERS;
+        int x = (index / PROBE_LAYERS) % width;
+        int z = (index / PROBE_LAYERS) / width;
+        if(maze.isWall(x / 2, z / 2)){
+            continue; //Filled from its open neighbours below
+        }
+        traced++;
+
+        vmath::vec3 probe = mazeTileToWorld(x / 2, z / 2) +
+                            vmath::vec3(((x % 2) - 0.5f) * MAZE_TILE_SIZE * 0.5f, lowest + spacing * layer, ((z % 2) - 0.5f) * MAZE_TILE_SIZE * 0.5f);
+
+        bake_random_t random;
+        random.state = hashSeed(static_cast<unsigned int>(index) ^ seed);
+
+        //Mean of L and of L * w over the sphere, per channel
+        vmath::vec3 sum(0.0f, 0.0f, 0.0f);
+        vmath::vec3 sumDirected[3];
+        for(int c = 0; c < 3; c++){
+            sumDirected[c] = vmath::vec3(0.0f, 0.0f, 0.0f);
+        }
+        for(int s = 0; s < samples; s++){
+            vmath::vec3 sampleDirection = uniformSphereDirection((s / strata + random.next()) / strata, (s % strata + random.next()) / strata);
+            //The probe is in the air, so its first hit is what lights it directly and bounces come after that
+            bool backFace;
+            vmath::vec3 light = traceRadiance(scene, probe, sampleDirection, settings.bounces + 1, random, rays, backFace);
+
+            sum += light;
+            for(int c = 0; c < 3; c++){
+                sumDirected[c] += sampleDirection * light[c];
+            }
+        }
+
+        //base is the mean, slope is 3 * the mean of L * w (the integral of (s . w) w over the sphere is 4 pi / 3 s)
+        for(int c = 0; c < 3; c++){
+            vmath::vec3 slope = sumDirected[c] * (3.0f / samples);
+            texels[texelIndex(x, z, layer, c)] = vmath::vec4(sum[c] / samples, slope[0], slope[1], slope[2]);
+        }
+    }
+
+    //Wall probes copy the open probes beside them on their side of the wall, so filtering never crosses it
+    for(int z = 0; z < height; z++){
+        for(int x = 0; x < width; x++){
+            if(!maze.isWall(x / 2, z / 2)){
+                continue;
+            }
+            int stepX = (x % 2) ? 1 : -1;
+            int stepZ = (z % 2) ? 1 : -1;
+            int neighbourX[3] = { x + stepX, x, x + stepX };
+            int neighbourZ[3] = { z, z + stepZ, z + stepZ };
+            for(int layer = 0; layer < PROBE_LAYERS; layer++){
+                for(int c = 0; c < 3; c++){
+                    vmath::vec4 fill(0.0f, 0.0f, 0.0f, 0.0f);
+                    int found = 0;
+                    for(int k = 0; k < 3; k++){
+                        int nx = neighbourX[k];
+                        int nz = neighbourZ[k];
+                        if(nx < 0 || nz < 0 || nx >= width || nz >= height || maze.isWall(nx / 2, nz / 2)){
+                            continue;
+                        }
+                        fill += texels[texelIndex(nx, nz, layer, c)];
+                        found++;
+                    }
+                    texels[texelIndex(x, z, layer, c)] = found ? fill / static_cast<float>(found) : fill;
+                }
+            }
+        }
+    }
+
+    stats.probes = static_cast<size_t>(traced);
+    stats.rays = static_cast<size_t>(rays);
+    stats.threads = threads;
+    stats.traceSeconds = secondsSince(start);
+}
+
+void ProbeGrid::upload(){
+    destroy(); //Just in case this is being re-used
+    if(texels.empty()){
+        return;
+    }
+
+    glGenTextures(1, &texture);
+    sb7::glstate::bind_texture_unit(PROBE_TEXTURE_UNIT, GL_TEXTURE_3D, texture);
+    glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA16F, width, 3 * PROBE_LAYERS, height);
+    glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, width, 3 * PROBE_LAYERS, height, GL_RGBA, GL_FLOAT, texels.data());
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+    glGenBuffers(1, &uniformBuffer);
+    sb7::glstate::bind_buffer(GL_UNIFORM_BUFFER, uniformBuffer);
+    glBufferStorage(GL_UNIFORM_BUFFER, sizeof(probe_uniforms_t), &uniforms, 0);
+}
+
+void ProbeGrid::destroy(){
+    if(uniformBuffer){
+        sb7::glstate::delete_buffers(1, &uniformBuffer);
+    }
+    if(texture){
+        sb7::glstate::delete_textures(1, &texture);
+    }
+    uniformBuffer = 0;
+    texture = 0;
+}
+
+void ProbeGrid::bind(){
+    if(uniformBuffer == 0){
+        return;
+    }
+    sb7::glstate::bind_buffer_base(GL_UNIFORM_BUFFER, PROBE_UBO_BINDING, uniformBuffer);
+    sb7::glstate::bind_texture_unit(PROBE_TEXTURE_UNIT, GL_TEXTURE_3D, texture);
+}
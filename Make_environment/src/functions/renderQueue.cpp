@@ -0,0 +1,206 @@
+/*
+* Render Queue
+* See ./include/renderQueue.h for usage
+*/
+#include <renderQueue.h>
+#include <sb7glstate.h>
+
+//Depth as a 24 bit integer in draw order
+static uint64_t quantizeDepth(GLuint pass, float depth){
+    depth = depth < 0.0f ? 0.0f : (depth > 1.0f ? 1.0f : depth);
+    if(pass == PASS_TRANSPARENT){
+        depth = 1.0f - depth; //Farthest first
+    }
+    return static_cast<uint64_t>(depth * 16777215.0f);
+}
+
+uint64_t makeSortKey(GLuint pass, GLuint program, GLuint texture, GLuint arena, GLuint mesh, float depth){
+    uint64_t quantized = quantizeDepth(pass, depth);
+
+    return (static_cast<uint64_t>(pass    & 0xF)   << 60) |
+           (static_cast<uint64_t>(program & 0xFF)  << 52) |
+           (static_cast<uint64_t>(texture & 0xFFF) << 40) |
+           (static_cast<uint64_t>(arena   & 0x3F)  << 34) |
+           (static_cast<uint64_t>(mesh    & 0x3FF) << 24) |
+           quantized;
+}
+
+uint64_t makeDepthFirstSortKey(GLuint pass, GLuint program, GLuint texture, GLuint arena, GLuint mesh, float depth){
+    uint64_t quantized = quantizeDepth(pass, depth);
+
+    return (static_cast<uint64_t>(pass    & 0xF)   << 60) |
+           (quantized                              << 36) |
+           (static_cast<uint64_t>(program & 0xFF)  << 28) |
+           (static_cast<uint64_t>(texture & 0xFFF) << 16) |
+           (static_cast<uint64_t>(arena   & 0x3F)  << 10) |
+            static_cast<uint64_t>(mesh    & 0x3FF);
+}
+
+void RenderQueue::clear(){
+    keys.clear();
+    order.clear();
+    packets.clear();
+    stats.depthDrawCalls = 0; //Only set when there is a depth pass
+}
+
+void RenderQueue::push(uint64_t key, const render_packet_t &packet){
+    order.push_back(static_cast<uint32_t>(keys.size()));
+    keys.push_back(key);
+    packets.push_back(packet);
+}
+
+void RenderQueue::append(const RenderQueue &other){
+    uint32_t base = static_cast<uint32_t>(keys.size());
+    for(size_t i = 0; i < other.keys.size(); i++){
+        order.push_back(base + other.order[i]);
+    }
+    keys.insert(keys.end(), other.keys.begin(), other.keys.end());
+    packets.insert(packets.end(), other.packets.begin(), other.packets.end());
+}
+
+void RenderQueue::sort(){
+    //Count what drawing in push order would have cost, so the savings can be shown
+    stats.unsortedProgramSwitches = 0;
+    stats.unsortedVaoSwitches = 0;
+    stats.unsortedTextureSwitches = 0;
+    for(size_t i = 0; i < packets.size(); i++){
+        const render_packet_t &p = packets[i];
+        const render_packet_t* prev = i > 0 ? &packets[i - 1] : NULL;
+        if(!prev || prev->program != p.program){
+            stats.unsortedProgramSwitches++;
+        }
+        if(!prev || prev->arena != p.arena){
+            stats.unsortedVaoSwitches++;
+        }
+        if(p.texture && (!prev || prev->texture != p.texture)){
+            stats.unsortedTextureSwitches++;
+        }
+    }
+
+    size_t count = keys.size();
+    scratchKeys.resize(count);
+    scratchOrder.resize(count);
+    for(int shift = 0; shift < 64; shift += 8){
+        size_t histogram[256] = {0};
+        for(size_t i = 0; i < count; i++){
+            histogram[(keys[i] >> shift) & 0xFF]++;
+        }
+        //Every key has the same byte here, this pass would not move anything
+        if(count == 0 || histogram[(keys[0] >> shift) & 0xFF] == count){
+            continue;
+        }
+
+        size_t offset = 0;
+        for(int b = 0; b < 256; b++){
+            size_t n = histogram[b];
+            histogram[b] = offset;
+            offset += n;
+        }
+        for(size_t i = 0; i < count; i++){
+            size_t dst = histogram[(keys[i] >> shift) & 0xFF]++;
+            scratchKeys[dst] = keys[i];
+            scratchOrder[dst] = order[i];
+        }
+        keys.swap(scratchKeys);
+        order.swap(scratchOrder);
+    }
+}
+
+void RenderQueue::flush(){
+    if(batchMeshes.empty()){
+        return;
+    }
+    batchArena->multiDraw(batchMeshes.data(), batchMeshes.size(), batchDrawIDs.data(), commandStream);
+    stats.drawCalls++;
+    batchMeshes.clear();
+    batchDrawIDs.clear();
+}
+
+void RenderQueue::submit(){
+    stats.packets = keys.size();
+    stats.drawCalls = 0;
+    stats.programSwitches = 0;
+    stats.vaoSwitches = 0;
+    stats.textureSwitches = 0;
+
+    //Nothing is assumed about what was bound before
+    GLuint currentProgram = ~0u;
+    MeshArena* currentArena = NULL;
+    GLuint currentTexture = ~0u;
+    batchArena = NULL;
+
+    for(size_t i = 0; i < order.size(); i++){
+        const render_packet_t &p = packets[order[i]];
+
+        //Any state change ends the current batch
+        bool programChange = (p.program != currentProgram);
+        bool arenaChange = (p.arena != currentArena);
+        bool textureChange = (p.texture != 0 && p.texture != currentTexture);
+        if(programChange || arenaChange || textureChange){
+            flush();
+        }
+        if(programChange){
+            sb7::glstate::use_program(p.program);
+            currentProgram = p.program;
+            stats.programSwitches++;
+        }
+        if(arenaChange){
+            p.arena->bind();
+            currentArena = p.arena;
+            stats.vaoSwitches++;
+        }
+        if(textureChange){
+            sb7::glstate::bind_texture_unit(0, GL_TEXTURE_2D, p.texture);
+            currentTexture = p.texture;
+            stats.textureSwitches++;
+        }
+
+        if(p.instanceCount > 1){
+            //Instanced draws go straight out, they are already one call for many things
+            flush();
+            p.arena->draw(p.mesh, p.instanceCount, p.drawID);
+            stats.drawCalls++;
+        } else {
+            batchArena = p.arena;
+            batchMeshes.push_back(p.mesh);
+            batchDrawIDs.push_back(p.drawID);
+        }
+    }
+    flush();
+}
+
+void RenderQueue::submitDepth(GLuint depthProgram){
+    //flush() counts into drawCalls, which belongs to submit(), so the depth pass is counted separately
+    size_t shadedDrawCalls = stats.drawCalls;
+    stats.drawCalls = 0;
+    sb7::glstate::use_program(depthProgram);
+
+    //One program and no textures, so only a change of arena breaks a batch
+    MeshArena* currentArena = NULL;
+    batchArena = NULL;
+    for(size_t i = 0; i < order.size(); i++){
+        //Keys are sorted by pass first, so the opaque ones are all at the front
+        if((keys[i] >> 60) != PASS_OPAQUE){
+            break;
+        }
+        const render_packet_t &p = packets[order[i]];
+        if(p.arena != currentArena){
+            flush();
+            p.arena->bindPositionOnly();
+            currentArena = p.arena;
+        }
+
+        if(p.instanceCount > 1){
+            flush();
+            p.arena->draw(p.mesh, p.instanceCount, p.drawID);
+            stats.drawCalls++;
+        } else {
+            batchArena = p.arena;
+            batchMeshes.push_back(p.mesh);
+            batchDrawIDs.push_back(p.drawID);
+        }
+    }
+    flush();
+    stats.depthDrawCalls = stats.drawCalls;
+    stats.drawCalls = shadedDrawCalls;
+}
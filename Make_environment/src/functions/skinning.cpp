@@ -0,0 +1,574 @@
+/*
+* Skinning
+* See ./include/skinning.h for usage
+*/
+#include <skinning.h>
+#include <timing.h>
+#include <sb7glstate.h>
+#include <emmintrin.h>
+#include <cmath>
+#include <cstring>
+#include <cstddef>
+
+//The palette is read as 8 floats a joint, by the SSE loop and by skin_vs.glsl
+static_assert(sizeof(dual_quat_t) == 8 * sizeof(float), "dual_quat_t must be two packed vec4s");
+
+//Rings of the tube between two joints
+const int TUBE_RINGS_PER_JOINT = 4;
+
+//Largest sway of one joint (radians), the whole chain bends by joints times this at most
+const float SWAY_AMPLITUDE = 0.12f;
+
+static vmath::vec3 cross3(const vmath::vec3 &a, const vmath::vec3 &b){
+    return vmath::vec3(a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]);
+}
+
+vertex_format_t skinnedVertexFormat(){
+    vertex_format_t format;
+    format.stride = sizeof(skin_vertex_t);
+
+    //Each attribute: location, components, type, normalize, offset
+    format.attribs.push_back({ATTRIB_POSITION, 4, GL_FLOAT, GL_FALSE, (GLuint)offsetof(skin_vertex_t, position)});
+    format.attribs.push_back({ATTRIB_NORMAL,   4, GL_FLOAT, GL_FALSE, (GLuint)offsetof(skin_vertex_t, normal)});
+    format.attribs.push_back({ATTRIB_UV,       2, GL_FLOAT, GL_FALSE, (GLuint)offsetof(skin_vertex_t, uv)});
+    format.attribs.push_back({ATTRIB_JOINTS,   4, GL_UNSIGNED_BYTE, GL_FALSE, (GLuint)offsetof(skin_vertex_t, joints)});
+    format.attribs.push_back({ATTRIB_WEIGHTS,  4, GL_UNSIGNED_BYTE, GL_TRUE, (GLuint)offsetof(skin_vertex_t, weights)});
+    return format;
+}
+
+vmath::quaternion axisAngleQuaternion(const vmath::vec3 &axis, float angle){
+    float s = sinf(angle * 0.5f);
+    return vmath::quaternion(axis[0] * s, axis[1] * s, axis[2] * s, cosf(angle * 0.5f));
+}
+
+dual_quat_t makeDualQuat(const vmath::quaternion &rotation, const vmath::vec3 &translation){
+    dual_quat_t dq;
+    dq.real = rotation;
+    dq.dual = vmath::quaternion(translation[0], translation[1], translation[2], 0.0f) * rotation * 0.5f;
+    return dq;
+}
+
+dual_quat_t multiplyDualQuat(const dual_quat_t &a, const dual_quat_t &b){
+    dual_quat_t dq;
+    dq.real = a.real * b.real;
+    //vmath's quaternion + doesn't compile, so the sum is done by hand
+    vmath::quaternion first = a.real * b.dual;
+    vmath::quaternion second = a.dual * b.real;
+    dq.dual = vmath::quaternion(first[0] + second[0], first[1] + second[1], first[2] + second[2], first[3] + second[3]);
+    return dq;
+}
+
+vmath::vec3 dualQuatVector(const dual_quat_t &dq, const vmath::vec3 &vector){
+    //v + 2 r x (r x v + w v)
+    vmath::vec3 r(dq.real[0], dq.real[1], dq.real[2]);
+    return vector + cross3(r, cross3(r, vector) + vector * dq.real[3]) * 2.0f;
+}
+
+vmath::vec3 dualQuatPoint(const dual_quat_t &dq, const vmath::vec3 &point){
+    //Rotated point + translation, the translation being 2 * vector part of dual * conjugate(real)
+    vmath::vec3 r(dq.real[0], dq.real[1], dq.real[2]);
+    vmath::vec3 d(dq.dual[0], dq.dual[1], dq.dual[2]);
+    vmath::vec3 translation = (d * dq.real[3] - r * dq.dual[3] + cross3(r, d)) * 2.0f;
+    return dualQuatVector(dq, point) + translation;
+}
+
+void buildTubeCharacter(int joints, float height, float radius, int sides,
+                        skeleton_t &skeleton, std::vector<skin_vertex_t> &vertices, std::vector<GLuint> &indices){
+    joints = joints < 1 ? 1 : (joints > SKIN_MAX_JOINTS ? SKIN_MAX_JOINTS : joints);
+    sides = sides < 3 ? 3 : sides;
+    float segment = height / joints;
+
+    //A straight chain up the y axis, joint j sits at the bottom of bone j
+    skeleton.parents.resize(joints);
+    skeleton.offsets.resize(joints);
+    skeleton.inverseBind.resize(joints);
+    vmath::quaternion identity(0.0f, 0.0f, 0.0f, 1.0f);
+    for(int j = 0; j < joints; j++){
+        skeleton.parents[j] = j - 1;
+        skeleton.offsets[j] = vmath::vec3(0.0f, j == 0 ? 0.0f : segment, 0.0f);
+        skeleton.inverseBind[j] = makeDualQuat(identity, vmath::vec3(0.0f, -j * segment, 0.0f));
+    }
+
+    vertices.clear();
+    indices.clear();
+    int rings = joints * TUBE_RINGS_PER_JOINT + 1;
+    for(int i = 0; i < rings; i++){
+        float y = height * i / (rings - 1);
+
+        //Blend between the two bones whose middles the ring is between, fully one bone past the ends
+        float s = y / segment - 0.5f;
+        int j0 = static_cast<int>(floorf(s));
+        float t = s - j0;
+        if(j0 < 0){
+            j0 = 0;
+            t = 0.0f;
+        } else if(j0 >= joints - 1){
+            j0 = joints - 1;
+            t = 0.0f;
+        }
+        int j1 = j0 + 1 < joints ? j0 + 1 : j0;
+        unsigned char w1 = static_cast<unsigned char>(t * 255.0f + 0.5f);
+
+        //One extra column so the seam gets its own uvs
+        for(int k = 0; k <= sides; k++){
+            float angle = 6.2831853f * k / sides;
+            skin_vertex_t v;
+            v.position = vmath::vec4(cosf(angle) * radius, y, sinf(angle) * radius, 1.0f);
+            v.normal = vmath::vec4(cosf(angle), 0.0f, sinf(angle), 0.0f);
+            v.uv = vmath::vec2(static_cast<float>(k) / sides, y / height);
+            v.joints[0] = static_cast<unsigned char>(j0);
+            v.joints[1] = static_cast<unsigned char>(j1);
+            v.joints[2] = 0;
+            v.joints[3] = 0;
+            v.weights[0] = static_cast<unsigned char>(255 - w1);
+            v.weights[1] = w1;
+            v.weights[2] = 0;
+            v.weights[3] = 0;
+            vertices.push_back(v);
+        }
+    }
+    for(int i = 0; i + 1 < rings; i++){
+        for(int k = 0; k < sides; k++){
+            GLuint a = i * (sides + 1) + k;
+            GLuint b = a + 1;
+            GLuint c = a + sides + 1;
+            GLuint d = c + 1;
+            //Counter clockwise seen from outside
+            indices.push_back(a); indices.push_back(c); indices.push_back(b);
+            indices.push_back(b); indices.push_back(c); indices.push_back(d);
+        }
+    }
+
+    //Flat cap on top, all on the last joint (the bottom stands on the floor)
+    GLuint center = static_cast<GLuint>(vertices.size());
+    skin_vertex_t cap;
+    cap.position = vmath::vec4(0.0f, height, 0.0f, 1.0f);
+    cap.normal = vmath::vec4(0.0f, 1.0f, 0.0f, 0.0f);
+    cap.uv = vmath::vec2(0.5f, 1.0f);
+    cap.joints[0] = static_cast<unsigned char>(joints - 1);
+    cap.joints[1] = cap.joints[2] = cap.joints[3] = 0;
+    cap.weights[0] = 255;
+    cap.weights[1] = cap.weights[2] = cap.weights[3] = 0;
+    vertices.push_back(cap);
+    for(int k = 0; k <= sides; k++){
+        float angle = 6.2831853f * k / sides;
+        skin_vertex_t v = cap;
+        v.position = vmath::vec4(cosf(angle) * radius, height, sinf(angle) * radius, 1.0f);
+        v.uv = vmath::vec2(0.5f + 0.5f * cosf(angle), 0.5f + 0.5f * sinf(angle));
+        vertices.push_back(v);
+    }
+    for(int k = 0; k < sides; k++){
+        indices.push_back(center);
+        indices.push_back(center + k + 2);
+        indices.push_back(center + k + 1);
+    }
+}
+
+void computeSkinPalette(const skeleton_t &skeleton, const vmath::quaternion* localRotations,
+                        const dual_quat_t &root, dual_quat_t* palette){
+    //Model transforms first (parents come before children, so theirs are always ready)
+    size_t joints = skeleton.parents.size();
+    for(size_t j = 0; j < joints; j++){
+        dual_quat_t local = makeDualQuat(localRotations[j], skeleton.offsets[j]);
+        int parent = skeleton.parents[j];
+        palette[j] = multiplyDualQuat(parent < 0 ? root : palette[parent], local);
+    }
+    for(size_t j = 0; j < joints; j++){
+        palette[j] = multiplyDualQuat(palette[j], skeleton.inverseBind[j]);
+    }
+}
+
+void swayPose(int joints, float time, vmath::quaternion* rotations){
+    rotations[0] = vmath::quaternion(0.0f, 0.0f, 0.0f, 1.0f); //The root stays upright
+    for(int j = 1; j < joints; j++){
+        float a = time - j * 0.7f;
+        rotations[j] = axisAngleQuaternion(vmath::vec3(0.0f, 0.0f, 1.0f), SWAY_AMPLITUDE * sinf(a)) *
+                       axisAngleQuaternion(vmath::vec3(1.0f, 0.0f, 0.0f), SWAY_AMPLITUDE * 0.5f * cosf(a * 0.8f));
+    }
+}
+
+//Blend the influences of one vertex (dual quaternion linear blending), normalized
+static dual_quat_t blendInfluences(const skin_vertex_t &vertex, const dual_quat_t* palette){
+    const dual_quat_t &first = palette[vertex.joints[0]];
+    vmath::vec4 real(0.0f, 0.0f, 0.0f, 0.0f);
+    vmath::vec4 dual(0.0f, 0.0f, 0.0f, 0.0f);
+    for(int k = 0; k < SKIN_MAX_INFLUENCES; k++){
+        const dual_quat_t &dq = palette[vertex.joints[k]];
+        float w = vertex.weights[k] * (1.0f / 255.0f);
+        float dot = dq.real[0] * first.real[0] + dq.real[1] * first.real[1] + dq.real[2] * first.real[2] + dq.real[3] * first.real[3];
+        if(dot < 0.0f){
+            w = -w; //Same rotation from the other side, blending with it would cancel out
+        }
+        for(int c = 0; c < 4; c++){
+            real[c] += dq.real[c] * w;
+            dual[c] += dq.dual[c] * w;
+        }
+    }
+    float inverseLength = 1.0f / sqrtf(real[0] * real[0] + real[1] * real[1] + real[2] * real[2] + real[3] * real[3]);
+    dual_quat_t blend;
+    blend.real = vmath::quaternion(real[0] * inverseLength, real[1] * inverseLength, real[2] * inverseLength, real[3] * inverseLength);
+    blend.dual = vmath::quaternion(dual[0] * inverseLength, dual[1] * inverseLength, dual[2] * inverseLength, dual[3] * inverseLength);
+    return blend;
+}
+
+void skinVerticesScalar(const skin_vertex_t* vertices, size_t count, const dual_quat_t* palette,
+                        vmath::vec4* positions, vmath::vec4* normals){
+    for(size_t i = 0; i < count; i++){
+        dual_quat_t blend = blendInfluences(vertices[i], palette);
+        const vmath::vec4 &p = vertices[i].position;
+        const vmath::vec4 &n = vertices[i].normal;
+        vmath::vec3 position = dualQuatPoint(blend, vmath::vec3(p[0], p[1], p[2]));
+        vmath::vec3 normal = dualQuatVector(blend, vmath::vec3(n[0], n[1], n[2]));
+        positions[i] = vmath::vec4(position[0], position[1], position[2], 1.0f);
+        normals[i] = vmath::vec4(normal[0], normal[1], normal[2], 0.0f);
+    }
+}
+
+void skinVerticesSSE(const skin_vertex_t* vertices, size_t count, const dual_quat_t* palette,
+                     vmath::vec4* positions, vmath::vec4* normals){
+    const float* joints = reinterpret_cast<const float*>(palette);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 signBit = _mm_set1_ps(-0.0f);
+    const __m128 toWeight = _mm_set1_ps(1.0f / 255.0f);
+
+    for(size_t base = 0; base < count; base += 4){
+        //Lanes past the end repeat the last vertex, their results are not stored
+        size_t lanes = count - base < 4 ? count - base : 4;
+        const skin_vertex_t* v[4];
+        for(size_t l = 0; l < 4; l++){
+            v[l] = &vertices[base + (l < lanes ? l : lanes - 1)];
+        }
+
+        //Blend the influences, one lane per vertex: rx, ry, rz, rw / dx, dy, dz, dw
+        __m128 real[4] = {zero, zero, zero, zero};
+        __m128 dual[4] = {zero, zero, zero, zero};
+        __m128 firstReal[4];
+        for(int k = 0; k < SKIN_MAX_INFLUENCES; k++){
+            //Gather the 4 joints' dual quaternions and turn them into structure of arrays
+            __m128 qr[4], qd[4];
+            for(int l = 0; l < 4; l++){
+                const float* dq = joints + (size_t)v[l]->joints[k] * 8;
+                qr[l] = _mm_loadu_ps(dq);
+                qd[l] = _mm_loadu_ps(dq + 4);
+            }
+            _MM_TRANSPOSE4_PS(qr[0], qr[1], qr[2], qr[3]);
+            _MM_TRANSPOSE4_PS(qd[0], qd[1], qd[2], qd[3]);
+            if(k == 0){
+                for(int c = 0; c < 4; c++){
+                    firstReal[c] = qr[c];
+                }
+            }
+
+            __m128 w = _mm_mul_ps(_mm_set_ps(v[3]->weights[k], v[2]->weights[k], v[1]->weights[k], v[0]->weights[k]), toWeight);
+            __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(qr[0], firstReal[0]), _mm_mul_ps(qr[1], firstReal[1])),
+                                    _mm_add_ps(_mm_mul_ps(qr[2], firstReal[2]), _mm_mul_ps(qr[3], firstReal[3])));
+            w = _mm_xor_ps(w, _mm_and_ps(_mm_cmplt_ps(dot, zero), signBit)); //Flip onto the first one's side
+            for(int c = 0; c < 4; c++){
+                real[c] = _mm_add_ps(real[c], _mm_mul_ps(qr[c], w));
+                dual[c] = _mm_add_ps(dual[c], _mm_mul_ps(qd[c], w));
+            }
+        }
+
+        __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(real[0], real[0]), _mm_mul_ps(real[1], real[1])),
+                                          _mm_add_ps(_mm_mul_ps(real[2], real[2]), _mm_mul_ps(real[3], real[3])));
+        __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSquared));
+        for(int c = 0; c < 4; c++){
+            real[c] = _mm_mul_ps(real[c], inverseLength);
+            dual[c] = _mm_mul_ps(dual[c], inverseLength);
+        }
+
+        //Positions and normals as structure of arrays too
+        __m128 p[4], n[4];
+        for(int l = 0; l < 4; l++){
+            p[l] = _mm_loadu_ps(&v[l]->position[0]);
+            n[l] = _mm_loadu_ps(&v[l]->normal[0]);
+        }
+        _MM_TRANSPOSE4_PS(p[0], p[1], p[2], p[3]);
+        _MM_TRANSPOSE4_PS(n[0], n[1], n[2], n[3]);
+
+        //Rotation: v + 2 r x (r x v + w v)
+        #define SKIN_CROSS(ax, ay, az, bx, by, bz, ox, oy, oz) \
+            ox = _mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(az, by)); \
+            oy = _mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(ax, bz)); \
+            oz = _mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(ay, bx));
+        __m128 tx, ty, tz, ux, uy, uz;
+        SKIN_CROSS(real[0], real[1], real[2], p[0], p[1], p[2], tx, ty, tz)
+        tx = _mm_add_ps(tx, _mm_mul_ps(real[3], p[0]));
+        ty = _mm_add_ps(ty, _mm_mul_ps(real[3], p[1]));
+        tz = _mm_add_ps(tz, _mm_mul_ps(real[3], p[2]));
+        SKIN_CROSS(real[0], real[1], real[2], tx, ty, tz, ux, uy, uz)
+        __m128 px = _mm_add_ps(p[0], _mm_mul_ps(two, ux));
+        __m128 py = _mm_add_ps(p[1], _mm_mul_ps(two, uy));
+        __m128 pz = _mm_add_ps(p[2], _mm_mul_ps(two, uz));
+
+        //Translation: 2 (w d - dw r + r x d)
+        SKIN_CROSS(real[0], real[1], real[2], dual[0], dual[1], dual[2], tx, ty, tz)
+        px = _mm_add_ps(px, _mm_mul_ps(two, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(real[3], dual[0]), _mm_mul_ps(dual[3], real[0])), tx)));
+        py = _mm_add_ps(py, _mm_mul_ps(two, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(real[3], dual[1]), _mm_mul_ps(dual[3], real[1])), ty)));
+        pz = _mm_add_ps(pz, _mm_mul_ps(two, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(real[3], dual[2]), _mm_mul_ps(dual[3], real[2])), tz)));
+
+        SKIN_CROSS(real[0], real[1], real[2], n[0], n[1], n[2], tx, ty, tz)
+        tx = _mm_add_ps(tx, _mm_mul_ps(real[3], n[0]));
+        ty = _mm_add_ps(ty, _mm_mul_ps(real[3], n[1]));
+        tz = _mm_add_ps(tz, _mm_mul_ps(real[3], n[2]));
+        SKIN_CROSS(real[0], real[1], real[2], tx, ty, tz, ux, uy, uz)
+        __m128 nx = _mm_add_ps(n[0], _mm_mul_ps(two, ux));
+        __m128 ny = _mm_add_ps(n[1], _mm_mul_ps(two, uy));
+        __m128 nz = _mm_add_ps(n[2], _mm_mul_ps(two, uz));
+        #undef SKIN_CROSS
+
+        //Back to one vec4 per vertex
+        __m128 pw = one;
+        __m128 nw = zero;
+        _MM_TRANSPOSE4_PS(px, py, pz, pw);
+        _MM_TRANSPOSE4_PS(nx, ny, nz, nw);
+        __m128 outPositions[4] = {px, py, pz, pw};
+        __m128 outNormals[4] = {nx, ny, nz, nw};
+        for(size_t l = 0; l < lanes; l++){
+            _mm_storeu_ps(&positions[base + l][0], outPositions[l]);
+            _mm_storeu_ps(&normals[base + l][0], outNormals[l]);
+        }
+    }
+}
+
+void benchmarkCpuSkinning(int characters, int frames, skin_benchmark_t &result){
+    skeleton_t skeleton;
+    std::vector<skin_vertex_t> vertices;
+    std::vector<GLuint> indices;
+    buildTubeCharacter(8, 1.4f, 0.2f, 12, skeleton, vertices, indices);
+    const int joints = static_cast<int>(skeleton.parents.size());
+    characters = characters < 1 ? 1 : characters;
+    frames = frames < 1 ? 1 : frames;
+
+    //Every character gets its own palette and output, like a real crowd would
+    std::vector<dual_quat_t> roots(characters);
+    std::vector<dual_quat_t> palettes((size_t)characters * joints);
+    std::vector<vmath::quaternion> rotations((size_t)characters * joints);
+    std::vector<vmath::vec4> positions((size_t)characters * vertices.size());
+    std::vector<vmath::vec4> normals((size_t)characters * vertices.size());
+    for(int c = 0; c < characters; c++){
+        roots[c] = makeDualQuat(axisAngleQuaternion(vmath::vec3(0.0f, 1.0f, 0.0f), c * 0.37f),
+                                vmath::vec3(static_cast<float>(c % 32), 0.0f, static_cast<float>(c / 32)));
+    }
+
+    int threads = 0;
+    #pragma omp parallel
+    {
+        #pragma omp atomic
+        threads++;
+    }
+
+    double poseSeconds = 0.0;
+    double skinSeconds = 0.0;
+    for(int frame = 0; frame < frames; frame++){
+        float time = frame / 60.0f;
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        #pragma omp parallel for schedule(static)
+        for(int c = 0; c < characters; c++){
+            swayPose(joints, time + c * 0.1f, &rotations[(size_t)c * joints]);
+            computeSkinPalette(skeleton, &rotations[(size_t)c * joints], roots[c], &palettes[(size_t)c * joints]);
+        }
+        poseSeconds += secondsSince(start);
+
+        start = std::chrono::high_resolution_clock::now();
+        #pragma omp parallel for schedule(static)
+        for(int c = 0; c < characters; c++){
+            size_t first = (size_t)c * vertices.size();
+            skinVerticesSSE(vertices.data(), vertices.size(), &palettes[(size_t)c * joints], &positions[first], &normals[first]);
+        }
+        skinSeconds += secondsSince(start);
+    }
+
+    //Last frame again one vertex at a time, the SSE path should match it up to rounding
+    std::vector<vmath::vec4> referencePositions(vertices.size());
+    std::vector<vmath::vec4> referenceNormals(vertices.size());
+    result.maxPositionDifference = 0.0f;
+    result.maxNormalDifference = 0.0f;
+    for(int c = 0; c < characters; c++){
+        size_t first = (size_t)c * vertices.size();
+        skinVerticesScalar(vertices.data(), vertices.size(), &palettes[(size_t)c * joints], referencePositions.data(), referenceNormals.data());
+        for(size_t v = 0; v < vertices.size(); v++){
+            for(int k = 0; k < 3; k++){
+                result.maxPositionDifference = vmath::max(result.maxPositionDifference, fabsf(referencePositions[v][k] - positions[first + v][k]));
+                result.maxNormalDifference = vmath::max(result.maxNormalDifference, fabsf(referenceNormals[v][k] - normals[first + v][k]));
+            }
+        }
+    }
+
+    result.characters = characters;
+    result.frames = frames;
+    result.vertices = (size_t)characters * frames * vertices.size();
+    result.threads = threads;
+    result.poseSeconds = poseSeconds;
+    result.skinSeconds = skinSeconds;
+    result.verticesPerSecond = skinSeconds > 0.0 ? result.vertices / skinSeconds : 0.0;
+}
+
+SkinnedCrowd::SkinnedCrowd(){
+    maxCharacters = 0;
+    posed = 0;
+    drawn = 0;
+    timerQueries[0] = 0;
+    timerQueries[1] = 0;
+    timerFrame = 0;
+    memset(&mesh, 0, sizeof(mesh));
+    memset(&stats, 0, sizeof(stats));
+}
+
+void SkinnedCrowd::create(const skeleton_t &newSkeleton, const std::vector<skin_vertex_t> &vertices,
+                          const std::vector<GLuint> &indices, GLuint newMaxCharacters){
+    destroy(); //Just in case this is being re-used
+    skeleton = newSkeleton;
+    maxCharacters = newMaxCharacters;
+    characters.clear();
+    characters.reserve(maxCharacters);
+
+    //Draw id i is the i'th posed character, skin_vs.glsl finds its palette with it
+    arena.create(skinnedVertexFormat(), static_cast<GLuint>(vertices.size()), static_cast<GLuint>(indices.size()));
+    arena.enableDrawID(ATTRIB_DRAW_ID, maxCharacters);
+    arena.addMesh(vertices.data(), static_cast<GLuint>(vertices.size()), indices.data(), static_cast<GLuint>(indices.size()), mesh);
+
+    //Poses only bend the chain, so no vertex gets further from the root than the chain is long
+    //(the box is round the y axis, so it holds whichever way a character faces)
+    float reach = 0.0f;
+    for(size_t i = 0; i < vertices.size(); i++){
+        reach = vmath::max(reach, vmath::length(vmath::vec3(vertices[i].position[0], vertices[i].position[1], vertices[i].position[2])));
+    }
+    meshMin = vmath::vec3(-reach, -reach, -reach);
+    meshMax = vmath::vec3(reach, reach, reach);
+
+    //Header plus every character's palette, every frame
+    size_t jointCount = skeleton.parents.size();
+    stream.init((GLsizeiptr)(4 * sizeof(GLuint) + (size_t)maxCharacters * jointCount * sizeof(dual_quat_t) + 256));
+    palettes.reserve((size_t)maxCharacters * jointCount);
+    rotations.reserve((size_t)maxCharacters * jointCount);
+    glGenQueries(2, timerQueries);
+    timerFrame = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+void SkinnedCrowd::destroy(){
+    arena.destroy();
+    stream.teardown();
+    if(timerQueries[0]){
+        glDeleteQueries(2, timerQueries);
+    }
+    timerQueries[0] = 0;
+    timerQueries[1] = 0;
+    posed = 0;
+    drawn = 0;
+}
+
+bool SkinnedCrowd::addCharacter(const vmath::vec3 &position, float yaw, float phase, float speed){
+    if(characters.size() >= maxCharacters){
+        return false;
+    }
+    character_t character;
+    character.root = makeDualQuat(axisAngleQuaternion(vmath::vec3(0.0f, 1.0f, 0.0f), yaw), position);
+    character.boundsMin = position + meshMin;
+    character.boundsMax = position + meshMax;
+    character.phase = phase;
+    character.speed = speed;
+    characters.push_back(character);
+    return true;
+}
+
+void SkinnedCrowd::characterBounds(size_t i, vmath::vec3 &worldMin, vmath::vec3 &worldMax) const{
+    worldMin = characters[i].boundsMin;
+    worldMax = characters[i].boundsMax;
+}
+
+void SkinnedCrowd::pose(const std::vector<uint32_t> &characterList, size_t drawnCount, double time){
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    const int joints = static_cast<int>(skeleton.parents.size());
+    posed = characterList.size() < maxCharacters ? characterList.size() : maxCharacters;
+    drawn = drawnCount < posed ? drawnCount : posed;
+    palettes.resize(posed * joints);
+    rotations.resize(posed * joints);
+
+    //Each character only writes its own block of the palette
+    const int count = static_cast<int>(posed);
+    #pragma omp parallel for schedule(static) if(count > 32)
+    for(int k = 0; k < count; k++){
+        const character_t &character = characters[characterList[k]];
+        float t = static_cast<float>(time) * character.speed + character.phase;
+        swayPose(joints, t, &rotations[(size_t)k * joints]);
+        computeSkinPalette(skeleton, &rotations[(size_t)k * joints], character.root, &palettes[(size_t)k * joints]);
+    }
+
+    stats.characters = characters.size();
+    stats.posed = drawn;
+    stats.shadowOnly = posed - drawn;
+    stats.joints = posed * joints;
+    stats.vertices = drawn * mesh.vertexCount;
+    stats.poseSeconds = secondsSince(start);
+}
+
+void SkinnedCrowd::upload(){
+    stats.paletteBytes = 0;
+    if(posed == 0){
+        return;
+    }
+    GLsizeiptr paletteBytes = (GLsizeiptr)(palettes.size() * sizeof(dual_quat_t));
+    GLsizeiptr bytes = 4 * sizeof(GLuint) + paletteBytes;
+    GLintptr offset;
+    char* dst = static_cast<char*>(stream.allocate(bytes, stream.storage_alignment(), offset));
+    if(!dst){
+        return; //Only outside beginFrame/endFrame, the stream is sized for the most create() allows
+    }
+
+    //skinInfo.x is the joints per character, the draw id times it is where a palette starts
+    GLuint header[4] = { static_cast<GLuint>(skeleton.parents.size()), 0, 0, 0 };
+    memcpy(dst, header, sizeof(header));
+    memcpy(dst + sizeof(header), palettes.data(), paletteBytes);
+    sb7::glstate::bind_buffer_range(GL_SHADER_STORAGE_BUFFER, SKIN_SSBO_BINDING, stream.buffer(), offset, bytes);
+    stats.paletteBytes = static_cast<size_t>(bytes);
+}
+
+void SkinnedCrowd::draw(GLuint program){
+    if(drawn == 0){
+        return;
+    }
+
+    //Pick up the GPU time of the previous draw, without waiting if the GPU is not done with it
+    if(timerFrame > 0){
+        GLuint query = timerQueries[(timerFrame - 1) & 1];
+        GLuint available = 0;
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available){
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+            stats.gpuMilliseconds = nanoseconds * 1e-6;
+        }
+    }
+
+    sb7::glstate::use_program(program);
+    arena.bind();
+    glBeginQuery(GL_TIME_ELAPSED, timerQueries[timerFrame & 1]);
+    arena.draw(mesh, static_cast<GLuint>(drawn), 0);
+    glEndQuery(GL_TIME_ELAPSED);
+    timerFrame++;
+}
+
+void SkinnedCrowd::drawDepth(GLuint program, const std::vector<uint32_t> &slots){
+    if(slots.empty()){
+        return;
+    }
+    sb7::glstate::use_program(program);
+    arena.bind();
+    for(size_t k = 0; k < slots.size(); k++){
+        if(slots[k] < posed){
+            arena.draw(mesh, 1, slots[k]); //Draw id = slot, where its palette is
+        }
+    }
+}
+
+void SkinnedCrowd::beginFrame(){
+    stream.begin_frame();
+}
+
+void SkinnedCrowd::endFrame(){
+    stream.end_frame();
+}
@@ -0,0 +1,338 @@
+/*
+* Sky Lighting
+* See ./include/skyLighting.h for usage
+*/
+#include <skyLighting.h>
+#include <sb7glstate.h>
+#include <math.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include <emmintrin.h>
+
+static const float PI = 3.14159265f;
+
+//Where each face's texels point, as lookup vector = major + sc * sAxis + tc * tAxis (GL spec table 8.19 run backwards)
+static const float FACE_MAJOR[6][3] = { { 1, 0, 0}, {-1, 0, 0}, {0,  1, 0}, {0, -1, 0}, {0, 0,  1}, { 0, 0, -1} };
+static const float FACE_S[6][3]     = { { 0, 0,-1}, { 0, 0, 1}, {1,  0, 0}, {1,  0, 0}, {1, 0,  0}, {-1, 0,  0} };
+static const float FACE_T[6][3]     = { { 0,-1, 0}, { 0,-1, 0}, {0,  0, 1}, {0,  0,-1}, {0,-1,  0}, { 0,-1,  0} };
+
+//Per row sums kept by the projection: 9 coefficients * rgb, then the total solid angle
+static const int ROW_SUMS = 28;
+
+static inline float horizontalSum(__m128 v){
+    float lanes[4];
+    _mm_storeu_ps(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+//Direction a face texel's center looks up (not unit length)
+static inline vmath::vec3 faceDirection(int face, float sc, float tc){
+    return vmath::vec3(FACE_MAJOR[face][0] + sc * FACE_S[face][0] + tc * FACE_T[face][0],
+                       FACE_MAJOR[face][1] + sc * FACE_S[face][1] + tc * FACE_T[face][1],
+                       FACE_MAJOR[face][2] + sc * FACE_S[face][2] + tc * FACE_T[face][2]);
+}
+
+void projectSkySH9(const sky_cube_t &sky, vmath::vec3 radiance[9]){
+    for(int i = 0; i < 9; i++){
+        radiance[i] = vmath::vec3(0.0f, 0.0f, 0.0f);
+    }
+    int size = sky.size;
+    if(size <= 0){
+        return;
+    }
+
+    //Every row of every face gets its own sums, added up in order below so threads can't change the result
+    int rows = 6 * size;
+    std::vector<float> rowSums((size_t)rows * ROW_SUMS);
+    float texelScale = 2.0f / size;
+    float areaScale = 4.0f / ((float)size * size);
+
+    #pragma omp parallel for schedule(dynamic, 16)
+    for(int row = 0; row < rows; row++){
+        int face = row / size;
+        int t = row % size;
+        const float *texels = &sky.faces[face][0];
+        __m128 sum[ROW_SUMS];
+        for(int i = 0; i < ROW_SUMS; i++){
+            sum[i] = _mm_setzero_ps();
+        }
+
+        __m128 tc = _mm_set1_ps((t + 0.5f) * texelScale - 1.0f);
+        for(int s = 0; s < size; s += 4){
+            //Four texels across, lanes past the end of the row weigh nothing
+            float lane[4], red[4], green[4], blue[4], valid[4];
+            for(int k = 0; k < 4; k++){
+                int column = s + k < size ? s + k : size - 1;
+                const float *texel = texels + ((size_t)t * size + column) * 3;
+                lane[k] = (s + k + 0.5f) * texelScale - 1.0f;
+                red[k] = texel[0];
+                green[k] = texel[1];
+                blue[k] = texel[2];
+                valid[k] = s + k < size ? 1.0f : 0.0f;
+            }
+            __m128 sc = _mm_loadu_ps(lane);
+
+            //World direction is minus the lookup vector (sc_vs.glsl), divided by its length
+            __m128 lengthSquared = _mm_add_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_mul_ps(sc, sc), _mm_mul_ps(tc, tc)));
+            __m128 inverseLength = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(lengthSquared));
+            __m128 d[3];
+            for(int a = 0; a < 3; a++){
+                __m128 r = _mm_add_ps(_mm_set1_ps(FACE_MAJOR[face][a]),
+                           _mm_add_ps(_mm_mul_ps(sc, _mm_set1_ps(FACE_S[face][a])), _mm_mul_ps(tc, _mm_set1_ps(FACE_T[face][a]))));
+                d[a] = _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(r, inverseLength));
+            }
+
+            //Solid angle of the texel, 4 / (N^2 (1 + sc^2 + tc^2)^1.5)
+            __m128 weight = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(areaScale), _mm_loadu_ps(valid)),
+                                       _mm_mul_ps(inverseLength, _mm_mul_ps(inverseLength, inverseLength)));
+
+            __m128 x = d[0], y = d[1], z = d[2];
+            __m128 basis[9];
+            basis[0] = _mm_set1_ps(0.282095f);
+            basis[1] = _mm_mul_ps(_mm_set1_ps(0.488603f), y);
+            basis[2] = _mm_mul_ps(_mm_set1_ps(0.488603f), z);
+            basis[3] = _mm_mul_ps(_mm_set1_ps(0.488603f), x);
+            basis[4] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(x, y));
+            basis[5] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(y, z));
+            basis[6] = _mm_mul_ps(_mm_set1_ps(0.315392f), _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(z, z)), _mm_set1_ps(1.0f)));
+            basis[7] = _mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(x, z));
+            basis[8] = _mm_mul_ps(_mm_set1_ps(0.546274f), _mm_sub_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)));
+
+            __m128 color[3] = { _mm_mul_ps(_mm_loadu_ps(red), weight),
+                                _mm_mul_ps(_mm_loadu_ps(green), weight),
+                                _mm_mul_ps(_mm_loadu_ps(blue), weight) };
+            for(int i = 0; i < 9; i++){
+                for(int c = 0; c < 3; c++){
+                    sum[i * 3 + c] = _mm_add_ps(sum[i * 3 + c], _mm_mul_ps(basis[i], color[c]));
+                }
+            }
+            sum[27] = _mm_add_ps(sum[27], weight);
+        }
+
+        for(int i = 0; i < ROW_SUMS; i++){
+            rowSums[(size_t)row * ROW_SUMS + i] = horizontalSum(sum[i]);
+        }
+    }
+
+    //Doubles for the merge, there are thousands of rows
+    double total[ROW_SUMS] = {0.0};
+    for(int row = 0; row < rows; row++){
+        for(int i = 0; i < ROW_SUMS; i++){
+            total[i] += rowSums[(size_t)row * ROW_SUMS + i];
+        }
+    }
+
+    //The texel areas only add up to 4 pi approximately, so share out the difference
+    double normalize = total[27] > 0.0 ? 4.0 * PI / total[27] : 0.0;
+    for(int i = 0; i < 9; i++){
+        radiance[i] = vmath::vec3((float)(total[i * 3 + 0] * normalize),
+                                  (float)(total[i * 3 + 1] * normalize),
+                                  (float)(total[i * 3 + 2] * normalize));
+    }
+}
+
+void irradianceSH9(const vmath::vec3 radiance[9], vmath::vec3 irradiance[9]){
+    //Cosine lobe in SH is pi, 2pi/3, pi/4 per band (Ramamoorthi & Hanrahan 2001), divided by pi here
+    static const float band[9] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+    for(int i = 0; i < 9; i++){
+        irradiance[i] = radiance[i] * band[i];
+    }
+}
+
+vmath::vec3 evaluateSH9(const vmath::vec3 coefficients[9], const vmath::vec3 &direction){
+    float x = direction[0], y = direction[1], z = direction[2];
+    float basis[9] = { 0.282095f,
+                       0.488603f * y, 0.488603f * z, 0.488603f * x,
+                       1.092548f * x * y, 1.092548f * y * z, 0.315392f * (3.0f * z * z - 1.0f),
+                       1.092548f * x * z, 0.546274f * (x * x - y * y) };
+    vmath::vec3 result(0.0f, 0.0f, 0.0f);
+    for(int i = 0; i < 9; i++){
+        result += coefficients[i] * basis[i];
+    }
+    return result;
+}
+
+//Half size copy of a sky, every texel the average of the four under it
+static void downsampleCube(const sky_cube_t &source, sky_cube_t &target){
+    target.size = vmath::max(source.size / 2, 1);
+    for(int f = 0; f < 6; f++){
+        target.faces[f].resize((size_t)target.size * target.size * 3);
+        for(int t = 0; t < target.size; t++){
+            for(int s = 0; s < target.size; s++){
+                int s0 = vmath::min(s * 2, source.size - 1), s1 = vmath::min(s * 2 + 1, source.size - 1);
+                int t0 = vmath::min(t * 2, source.size - 1), t1 = vmath::min(t * 2 + 1, source.size - 1);
+                for(int c = 0; c < 3; c++){
+                    target.faces[f][((size_t)t * target.size + s) * 3 + c] = 0.25f *
+                        (source.faces[f][((size_t)t0 * source.size + s0) * 3 + c] + source.faces[f][((size_t)t0 * source.size + s1) * 3 + c] +
+                         source.faces[f][((size_t)t1 * source.size + s0) * 3 + c] + source.faces[f][((size_t)t1 * source.size + s1) * 3 + c]);
+                }
+            }
+        }
+    }
+}
+
+//Trilinear lookup in a box filtered chain
+static vmath::vec3 sampleChain(const std::vector<sky_cube_t> &chain, const vmath::vec3 &direction, float lod){
+    lod = vmath::min(vmath::max(lod, 0.0f), static_cast<float>(chain.size() - 1));
+    int lower = static_cast<int>(lod);
+    int upper = vmath::min(lower + 1, static_cast<int>(chain.size()) - 1);
+    float blend = lod - lower;
+    vmath::vec3 result = sampleCube(chain[lower], direction);
+    if(blend > 0.0f){
+        result = result * (1.0f - blend) + sampleCube(chain[upper], direction) * blend;
+    }
+    return result;
+}
+
+//Hammersley point i of count, second coordinate is the bit reversed index
+static inline float radicalInverse(unsigned int bits){
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return bits * 2.3283064365386963e-10f;
+}
+
+//Sky seen along direction n, blurred by a GGX lobe (view along n, the usual split sum simplification)
+// baseLod -> chain level whose texels match the output's, so the sharpest level doesn't alias
+static vmath::vec3 prefilter(const std::vector<sky_cube_t> &chain, const vmath::vec3 &n, float alpha, float baseLod){
+    if(alpha <= 0.0f){
+        return sampleChain(chain, -n, baseLod);
+    }
+    vmath::vec3 tangent, bitangent;
+    if(fabsf(n[2]) < 0.999f){
+        tangent = vmath::normalize(vmath::cross(vmath::vec3(0.0f, 0.0f, 1.0f), n));
+    } else {
+        tangent = vmath::vec3(1.0f, 0.0f, 0.0f);
+    }
+    bitangent = vmath::cross(n, tangent);
+
+    //Solid angle of one texel of the full size sky
+    float texelAngle = 4.0f * PI / (6.0f * chain[0].size * chain[0].size);
+    float alpha2 = alpha * alpha;
+    vmath::vec3 sum(0.0f, 0.0f, 0.0f);
+    float weight = 0.0f;
+    for(int i = 0; i < SKY_SPECULAR_SAMPLES; i++){
+        float u1 = (i + 0.5f) / SKY_SPECULAR_SAMPLES;
+        float u2 = radicalInverse(i);
+        float cosTheta = sqrtf((1.0f - u1) / (1.0f + (alpha2 - 1.0f) * u1));
+        float sinTheta = sqrtf(vmath::max(0.0f, 1.0f - cosTheta * cosTheta));
+        float phi = 2.0f * PI * u2;
+        vmath::vec3 h = tangent * (sinTheta * cosf(phi)) + bitangent * (sinTheta * sinf(phi)) + n * cosTheta;
+        vmath::vec3 l = h * (2.0f * cosTheta) - n;
+        float nDotL = vmath::dot(n, l);
+        if(nDotL <= 0.0f){
+            continue;
+        }
+
+        //Filtered importance sampling: read from the mip whose texels cover the sample's share of the lobe
+        float denominator = cosTheta * cosTheta * (alpha2 - 1.0f) + 1.0f;
+        float pdf = alpha2 / (PI * denominator * denominator) * 0.25f; //D * (n.h) / (4 v.h), with v = n
+        float sampleAngle = 1.0f / (SKY_SPECULAR_SAMPLES * pdf);
+        float lod = vmath::max(0.5f * log2f(sampleAngle / texelAngle) + 1.0f, baseLod);
+
+        sum += sampleChain(chain, -l, lod) * nDotL;
+        weight += nDotL;
+    }
+    return weight > 0.0f ? sum / weight : sampleChain(chain, -n, baseLod);
+}
+
+SkyLighting::SkyLighting(){
+    uniformBuffer = 0;
+    specularTexture = 0;
+    for(int i = 0; i < 9; i++){
+        uniforms.irradiance[i] = vmath::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    }
+    uniforms.specular = vmath::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    memset(&stats, 0, sizeof(stats));
+}
+
+void SkyLighting::create(const sky_cube_t &sky, float intensity){
+    destroy(); //Just in case this is being re-used
+    memset(&stats, 0, sizeof(stats));
+
+    //Diffuse
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    vmath::vec3 radiance[9], irradiance[9];
+    projectSkySH9(sky, radiance);
+    irradianceSH9(radiance, irradiance);
+    for(int i = 0; i < 9; i++){
+        uniforms.irradiance[i] = vmath::vec4(irradiance[i][0] * intensity, irradiance[i][1] * intensity, irradiance[i][2] * intensity, 0.0f);
+    }
+    uniforms.specular = vmath::vec4(static_cast<float>(SKY_SPECULAR_LEVELS - 1), 0.0f, 0.0f, 0.0f);
+    stats.texels = (size_t)6 * sky.size * sky.size;
+    stats.projectSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    glGenBuffers(1, &uniformBuffer);
+    sb7::glstate::bind_buffer(GL_UNIFORM_BUFFER, uniformBuffer);
+    glBufferStorage(GL_UNIFORM_BUFFER, sizeof(sky_uniforms_t), &uniforms, 0);
+
+    //Specular, from a box filtered chain of the sky down to 1x1
+    start = std::chrono::high_resolution_clock::now();
+    std::vector<sky_cube_t> chain(1, sky);
+    while(chain.back().size > 1){
+        sky_cube_t smaller;
+        downsampleCube(chain.back(), smaller);
+        chain.push_back(smaller);
+    }
+
+    glGenTextures(1, &specularTexture);
+    sb7::glstate::bind_texture_unit(SKY_SPECULAR_UNIT, GL_TEXTURE_CUBE_MAP, specularTexture);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, SKY_SPECULAR_LEVELS, GL_RGBA16F, SKY_SPECULAR_SIZE, SKY_SPECULAR_SIZE);
+
+    std::vector<float> texels;
+    for(int level = 0; level < SKY_SPECULAR_LEVELS; level++){
+        int size = vmath::max(SKY_SPECULAR_SIZE >> level, 1);
+        float roughness = static_cast<float>(level) / (SKY_SPECULAR_LEVELS - 1);
+        float alpha = roughness * roughness;
+        float baseLod = vmath::max(log2f(static_cast<float>(sky.size) / size), 0.0f);
+        texels.resize((size_t)6 * size * size * 3);
+
+        #pragma omp parallel for schedule(dynamic, 4)
+        for(int row = 0; row < 6 * size; row++){
+            int face = row / size;
+            int t = row % size;
+            for(int s = 0; s < size; s++){
+                vmath::vec3 n = vmath::normalize(faceDirection(face, (s + 0.5f) * 2.0f / size - 1.0f, (t + 0.5f) * 2.0f / size - 1.0f));
+                vmath::vec3 color = prefilter(chain, n, alpha, baseLod) * intensity;
+                float *texel = &texels[((size_t)row * size + s) * 3];
+                texel[0] = color[0];
+                texel[1] = color[1];
+                texel[2] = color[2];
+            }
+        }
+
+        for(int face = 0; face < 6; face++){
+            glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, 0, 0, size, size, GL_RGB, GL_FLOAT,
+                            &texels[(size_t)face * size * size * 3]);
+        }
+    }
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, SKY_SPECULAR_LEVELS - 1);
+    stats.prefilterSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void SkyLighting::destroy(){
+    if(uniformBuffer){
+        sb7::glstate::delete_buffers(1, &uniformBuffer);
+    }
+    if(specularTexture){
+        sb7::glstate::delete_textures(1, &specularTexture);
+    }
+    uniformBuffer = 0;
+    specularTexture = 0;
+}
+
+void SkyLighting::bind(){
+    if(uniformBuffer == 0){
+        return;
+    }
+    sb7::glstate::bind_buffer_base(GL_UNIFORM_BUFFER, SKY_UBO_BINDING, uniformBuffer);
+    sb7::glstate::bind_texture_unit(SKY_SPECULAR_UNIT, GL_TEXTURE_CUBE_MAP, specularTexture);
+}
@@ -10,6 +10,7 @@
 */
 #include <skybox.h>
 #include <loadingFunctions.h>
+#include <sb7glstate.h>
 #include <fstream>
 
 void createCube(std::vector<vmath::vec4> &vertices){
@@ -63,7 +64,7 @@ void loadCubeTextures(std::string directory, GLuint texture_ID){
 void loadCubeSide(GLint texture_ID, GLenum side, std::string file){
     //If you are curious why so many unsigned chars: https://stackoverflow.com/questions/75191/what-is-an-unsigned-char
     // Bind the next call to this CUBE_MAP
-    glBindTexture(GL_TEXTURE_CUBE_MAP, texture_ID);
+    sb7::glstate::bind_texture(GL_TEXTURE_CUBE_MAP, texture_ID);
 
     //Set up some function variables
     //Memory location of where we will put the texture data
@@ -91,3 +92,80 @@ void loadCubeSide(GLint texture_ID, GLenum side, std::string file){
 
     return; 
 }
+
+bool loadCubeImages(std::string directory, sky_cube_t &sky){
+    //Same files as loadCubeTextures(), in GL face order
+    static const char *sides[6] = { "sc_right", "sc_left", "sc_down", "sc_up", "sc_front", "sc_back" };
+    sky.size = 0;
+    for(int f = 0; f < 6; f++){
+        unsigned char *texture_data = NULL;
+        unsigned int width = 0;
+        unsigned int height = 0;
+        load_BMP(directory + ".\\" + sides[f] + ".bmp", texture_data, width, height);
+        if(texture_data == NULL || width == 0 || width != height || (f > 0 && static_cast<int>(width) != sky.size)){
+            delete[] texture_data;
+            sky.size = 0; //Nothing half loaded gets sampled
+            return false;
+        }
+        sky.size = width;
+
+        //Drop alpha and go to floats once, lookups happen millions of times
+        sky.faces[f].resize(width * height * 3);
+        for(unsigned int i = 0; i < width * height; i++){
+            for(int c = 0; c < 3; c++){
+                sky.faces[f][i * 3 + c] = texture_data[i * 4 + c] / 255.0f;
+            }
+        }
+        delete[] texture_data;
+    }
+    return true;
+}
+
+vmath::vec3 sampleCube(const sky_cube_t &sky, const vmath::vec3 &direction){
+    //Face selection from the GL spec (table 8.19), sc/tc are the face coordinates before the divide
+    float ax = fabsf(direction[0]);
+    float ay = fabsf(direction[1]);
+    float az = fabsf(direction[2]);
+    int face;
+    float sc, tc, ma;
+    if(ax >= ay && ax >= az){
+        face = direction[0] > 0.0f ? 0 : 1;
+        sc = direction[0] > 0.0f ? -direction[2] : direction[2];
+        tc = -direction[1];
+        ma = ax;
+    } else if(ay >= az){
+        face = direction[1] > 0.0f ? 2 : 3;
+        sc = direction[0];
+        tc = direction[1] > 0.0f ? direction[2] : -direction[2];
+        ma = ay;
+    } else {
+        face = direction[2] > 0.0f ? 4 : 5;
+        sc = direction[2] > 0.0f ? direction[0] : -direction[0];
+        tc = -direction[1];
+        ma = az;
+    }
+    if(ma <= 0.0f || sky.size == 0){
+        return vmath::vec3(0.0f, 0.0f, 0.0f);
+    }
+
+    //Texel centers are at half texels, clamped to the edge like GL_CLAMP_TO_EDGE
+    float s = ((sc / ma + 1.0f) * 0.5f) * sky.size - 0.5f;
+    float t = ((tc / ma + 1.0f) * 0.5f) * sky.size - 0.5f;
+    s = vmath::min(vmath::max(s, 0.0f), static_cast<float>(sky.size - 1));
+    t = vmath::min(vmath::max(t, 0.0f), static_cast<float>(sky.size - 1));
+    int s0 = static_cast<int>(s);
+    int t0 = static_cast<int>(t);
+    int s1 = vmath::min(s0 + 1, sky.size - 1);
+    int t1 = vmath::min(t0 + 1, sky.size - 1);
+    float fs = s - s0;
+    float ft = t - t0;
+
+    const float *texels = &sky.faces[face][0];
+    vmath::vec3 result;
+    for(int c = 0; c < 3; c++){
+        float top = texels[(t0 * sky.size + s0) * 3 + c] * (1.0f - fs) + texels[(t0 * sky.size + s1) * 3 + c] * fs;
+        float bottom = texels[(t1 * sky.size + s0) * 3 + c] * (1.0f - fs) + texels[(t1 * sky.size + s1) * 3 + c] * fs;
+        result[c] = top * (1.0f - ft) + bottom * ft;
+    }
+    return result;
+}
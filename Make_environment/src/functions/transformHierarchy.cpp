@@ -0,0 +1,243 @@
+/*
+* Transform Hierarchy
+* See ./include/transformHierarchy.h for usage
+*/
+#include <transformHierarchy.h>
+#include <timing.h>
+#include <emmintrin.h>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+
+//out = a * b, column major 4x4 matrices (out must not be b)
+//Every column of out is the columns of a weighted by one column of b
+static inline void multiplyMat4(const float* a, const float* b, float* out){
+    __m128 a0 = _mm_loadu_ps(a);
+    __m128 a1 = _mm_loadu_ps(a + 4);
+    __m128 a2 = _mm_loadu_ps(a + 8);
+    __m128 a3 = _mm_loadu_ps(a + 12);
+    for(int j = 0; j < 4; j++){
+        const float* column = b + j * 4;
+        __m128 r = _mm_mul_ps(a0, _mm_set1_ps(column[0]));
+        r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(column[1])));
+        r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(column[2])));
+        r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(column[3])));
+        _mm_storeu_ps(out + j * 4, r);
+    }
+}
+
+TransformHierarchy::TransformHierarchy(){
+    changed = 0;
+    stats.nodes = 0;
+    stats.changed = 0;
+    stats.updated = 0;
+    stats.seconds = 0.0;
+}
+
+void TransformHierarchy::clear(){
+    tx.clear(); ty.clear(); tz.clear();
+    rx.clear(); ry.clear(); rz.clear(); rw.clear();
+    sx.clear(); sy.clear(); sz.clear();
+    dirty.clear();
+    parents.clear();
+    locals.clear();
+    worlds.clear();
+    changed = 0;
+}
+
+void TransformHierarchy::padArrays(){
+    size_t padded = (parents.size() + 3) & ~static_cast<size_t>(3);
+    if(dirty.size() >= padded){
+        return;
+    }
+    //Identity transforms, never marked dirty, so the SSE pass can always read whole blocks of 4
+    tx.resize(padded, 0.0f); ty.resize(padded, 0.0f); tz.resize(padded, 0.0f);
+    rx.resize(padded, 0.0f); ry.resize(padded, 0.0f); rz.resize(padded, 0.0f); rw.resize(padded, 1.0f);
+    sx.resize(padded, 1.0f); sy.resize(padded, 1.0f); sz.resize(padded, 1.0f);
+    dirty.resize(padded, 0);
+}
+
+int TransformHierarchy::addNode(int parent, const vmath::vec3 &translation, const vmath::quaternion &rotation, const vmath::vec3 &scale){
+    int node = static_cast<int>(parents.size());
+    if(parent < -1 || parent >= node){
+        return -1;
+    }
+    parents.push_back(parent);
+    locals.push_back(vmath::mat4::identity());
+    worlds.push_back(vmath::mat4::identity());
+    padArrays();
+    setLocal(node, translation, rotation, scale);
+    return node;
+}
+
+void TransformHierarchy::setTranslation(int node, const vmath::vec3 &translation){
+    tx[node] = translation[0];
+    ty[node] = translation[1];
+    tz[node] = translation[2];
+    changed += dirty[node] ? 0 : 1;
+    dirty[node] = 1;
+}
+
+void TransformHierarchy::setRotation(int node, const vmath::quaternion &rotation){
+    rx[node] = rotation[0];
+    ry[node] = rotation[1];
+    rz[node] = rotation[2];
+    rw[node] = rotation[3];
+    changed += dirty[node] ? 0 : 1;
+    dirty[node] = 1;
+}
+
+void TransformHierarchy::setScale(int node, const vmath::vec3 &scale){
+    sx[node] = scale[0];
+    sy[node] = scale[1];
+    sz[node] = scale[2];
+    changed += dirty[node] ? 0 : 1;
+    dirty[node] = 1;
+}
+
+void TransformHierarchy::setLocal(int node, const vmath::vec3 &translation, const vmath::quaternion &rotation, const vmath::vec3 &scale){
+    setTranslation(node, translation);
+    setRotation(node, rotation);
+    setScale(node, scale);
+}
+
+void TransformHierarchy::update(){
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    size_t count = parents.size();
+    stats.nodes = count;
+    stats.changed = changed;
+    stats.updated = 0;
+    if(changed == 0){
+        stats.seconds = secondsSince(start);
+        return;
+    }
+
+    //Local matrices of the changed nodes, 4 at a time straight from the structure of arrays
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    for(size_t base = 0; base < count; base += 4){
+        uint32_t blockDirty;
+        memcpy(&blockDirty, &dirty[base], sizeof(blockDirty));
+        if(blockDirty == 0){
+            continue;
+        }
+        __m128 x = _mm_loadu_ps(&rx[base]), y = _mm_loadu_ps(&ry[base]);
+        __m128 z = _mm_loadu_ps(&rz[base]), w = _mm_loadu_ps(&rw[base]);
+        __m128 scaleX = _mm_loadu_ps(&sx[base]), scaleY = _mm_loadu_ps(&sy[base]), scaleZ = _mm_loadu_ps(&sz[base]);
+        __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+        __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+        __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+
+        //columns[j][r] holds row r of column j for all 4 nodes, same terms as trsMatrix
+        __m128 columns[4][4];
+        columns[0][0] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), scaleX);
+        columns[0][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), scaleX);
+        columns[0][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), scaleX);
+        columns[0][3] = _mm_setzero_ps();
+        columns[1][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), scaleY);
+        columns[1][1] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), scaleY);
+        columns[1][2] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), scaleY);
+        columns[1][3] = _mm_setzero_ps();
+        columns[2][0] = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), scaleZ);
+        columns[2][1] = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), scaleZ);
+        columns[2][2] = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), scaleZ);
+        columns[2][3] = _mm_setzero_ps();
+        columns[3][0] = _mm_loadu_ps(&tx[base]);
+        columns[3][1] = _mm_loadu_ps(&ty[base]);
+        columns[3][2] = _mm_loadu_ps(&tz[base]);
+        columns[3][3] = one;
+
+        //Back to one matrix per node, only the changed ones are written
+        size_t lanes = count - base < 4 ? count - base : 4;
+        for(int j = 0; j < 4; j++){
+            _MM_TRANSPOSE4_PS(columns[j][0], columns[j][1], columns[j][2], columns[j][3]);
+            for(size_t l = 0; l < lanes; l++){
+                if(dirty[base + l]){
+                    _mm_storeu_ps(&locals[base + l][j][0], columns[j][l]);
+                }
+            }
+        }
+    }
+
+    //Parents first: a node's world matrix is fresh by the time its children read it
+    size_t updated = 0;
+    for(size_t i = 0; i < count; i++){
+        int parent = parents[i];
+        if(parent >= 0 && dirty[parent]){
+            dirty[i] = 1;
+        }
+        if(!dirty[i]){
+            continue;
+        }
+        if(parent < 0){
+            worlds[i] = locals[i];
+        } else {
+            multiplyMat4(&worlds[parent][0][0], &locals[i][0][0], &worlds[i][0][0]);
+        }
+        updated++;
+    }
+    memset(&dirty[0], 0, dirty.size());
+    changed = 0;
+
+    stats.updated = updated;
+    stats.seconds = secondsSince(start);
+}
+
+//Spins and slides a node a little differently for every node
+static void animateNode(TransformHierarchy &nodes, int node, float time){
+    float angle = 0.5f * sinf(time * (1.0f + (node % 7) * 0.1f) + node * 0.37f);
+    nodes.setRotation(node, vmath::quaternion(0.0f, sinf(angle * 0.5f), 0.0f, cosf(angle * 0.5f)));
+    nodes.setTranslation(node, vmath::vec3(0.5f + 0.05f * sinf(time + node), 0.1f, 0.0f));
+}
+
+void benchmarkTransformHierarchy(int nodes, int frames, hierarchy_benchmark_t &result){
+    memset(&result, 0, sizeof(result));
+    nodes = vmath::max(nodes, 1);
+    frames = vmath::max(frames, 1);
+
+    //A random tree: every node under some earlier node (hashed, so the same tree every run)
+    TransformHierarchy hierarchy;
+    std::vector<int> depths(nodes, 0);
+    for(int i = 0; i < nodes; i++){
+        int parent = -1;
+        if(i > 0){
+            uint32_t hash = static_cast<uint32_t>(i) * 2654435761u;
+            parent = static_cast<int>((hash ^ (hash >> 16)) % static_cast<uint32_t>(i));
+            depths[i] = depths[parent] + 1;
+            result.depth = vmath::max(result.depth, depths[i]);
+        }
+        hierarchy.addNode(parent, vmath::vec3(0.5f, 0.1f, 0.0f), vmath::quaternion(0.0f, 0.0f, 0.0f, 1.0f), vmath::vec3(1.0f, 1.0f, 1.0f));
+    }
+    hierarchy.update();
+
+    //Only update() is timed, setting the local transforms is the animation's cost
+    double allDirty = 0.0, someDirty = 0.0, clean = 0.0;
+    for(int f = 0; f < frames; f++){
+        float time = f / 60.0f;
+        for(int i = 0; i < nodes; i++){
+            animateNode(hierarchy, i, time);
+        }
+        hierarchy.update();
+        allDirty += hierarchy.getStats().seconds;
+    }
+    for(int f = 0; f < frames; f++){
+        float time = f / 60.0f;
+        for(int i = f % 16; i < nodes; i += 16){
+            animateNode(hierarchy, i, time);
+        }
+        hierarchy.update();
+        someDirty += hierarchy.getStats().seconds;
+        result.someDirtyUpdated += hierarchy.getStats().updated;
+    }
+    for(int f = 0; f < frames; f++){
+        hierarchy.update();
+        clean += hierarchy.getStats().seconds;
+    }
+
+    result.nodes = nodes;
+    result.frames = frames;
+    result.allDirtyMilliseconds = allDirty * 1000.0 / frames;
+    result.someDirtyMilliseconds = someDirty * 1000.0 / frames;
+    result.cleanMilliseconds = clean * 1000.0 / frames;
+    result.someDirtyUpdated /= frames;
+}
@@ -0,0 +1,111 @@
+/*
+* Vertex Transfer
+* See ./include/vertexTransfer.h for usage
+*/
+#include <vertexTransfer.h>
+#include <bvh.h>
+#include <sampling.h>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+
+//Signed normalized byte, the way GL reads GL_BYTE back (-127 and -128 are both -1)
+static signed char toSnorm8(float value){
+    value = vmath::min(vmath::max(value, -1.0f), 1.0f);
+    return static_cast<signed char>(floorf(value * 127.0f + 0.5f));
+}
+
+transfer_settings_t defaultTransferSettings(){
+    transfer_settings_t settings;
+    settings.strata = 16;
+    settings.range = 0.5f;
+    settings.seed = 1;
+    return settings;
+}
+
+void packTransfer(float visibility, const vmath::vec3 &bent, const vmath::vec3 &normal, signed char transfer[4]){
+    vmath::vec3 offset = (bent - normal * (2.0f / 3.0f)) * 0.75f;
+    transfer[0] = toSnorm8(1.0f - visibility);
+    transfer[1] = toSnorm8(offset[0]);
+    transfer[2] = toSnorm8(offset[1]);
+    transfer[3] = toSnorm8(offset[2]);
+}
+
+void bakeVertexTransfer(std::vector<arena_vertex_t> &vertices, const std::vector<GLuint> &indices,
+                        const transfer_settings_t &settings, transfer_stats_t* stats){
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    //Object space BVH of the mesh itself
+    int vertexCount = static_cast<int>(vertices.size());
+    std::vector<vmath::vec3> positions(vertexCount);
+    vmath::vec3 low(FLT_MAX), high(-FLT_MAX);
+    for(int i = 0; i < vertexCount; i++){
+        positions[i] = vmath::vec3(vertices[i].position[0], vertices[i].position[1], vertices[i].position[2]);
+        low = vmath::min<float, 3>(low, positions[i]);
+        high = vmath::max<float, 3>(high, positions[i]);
+    }
+    TriangleBVH bvh;
+    bvh.build(positions, indices);
+    double bvhSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    //Ray lengths and the start offset scale with the mesh, obj files come in any units
+    float size = vertexCount > 0 ? vmath::length(high - low) : 0.0f;
+    float maxDistance = size * settings.range;
+    float bias = size * 1e-4f;
+
+    int threads = 0;
+    #pragma omp parallel
+    {
+        #pragma omp atomic
+        threads++;
+    }
+
+    start = std::chrono::high_resolution_clock::now();
+    int strata = vmath::max(1, settings.strata);
+    float cell = 1.0f / strata;
+    unsigned int seed = hashSeed(settings.seed);
+    double occlusionSum = 0.0;
+
+    //Vertices are independent, each one only writes itself
+    #pragma omp parallel for schedule(dynamic, 64) reduction(+:occlusionSum)
+    for(int i = 0; i < vertexCount; i++){
+        arena_vertex_t &vertex = vertices[i];
+        vmath::vec3 normal(vertex.normal[0], vertex.normal[1], vertex.normal[2]);
+        float length = vmath::length(normal);
+        if(length <= 0.0f){
+            packTransfer(1.0f, vmath::vec3(0.0f, 0.0f, 0.0f), vmath::vec3(0.0f, 0.0f, 0.0f), vertex.transfer);
+            continue; //No normal, nothing to bake against
+        }
+        normal /= length;
+
+        bake_random_t random;
+        random.state = hashSeed(static_cast<unsigned int>(i) ^ seed);
+
+        //Cosine weighted rays, so A and B are plain averages over the open ones
+        vmath::vec3 origin = positions[i] + normal * bias;
+        int open = 0;
+        vmath::vec3 bent(0.0f, 0.0f, 0.0f);
+        for(int sy = 0; sy < strata; sy++){
+            for(int sx = 0; sx < strata; sx++){
+                vmath::vec3 direction = cosineDirection(normal, (sx + random.next()) * cell, (sy + random.next()) * cell);
+                if(!bvh.occluded(origin, direction, maxDistance)){
+                    open++;
+                    bent += direction;
+                }
+            }
+        }
+        float samples = static_cast<float>(strata * strata);
+        float visibility = open / samples;
+        packTransfer(visibility, bent / samples, normal, vertex.transfer);
+        occlusionSum += 1.0 - visibility;
+    }
+
+    if(stats){
+        stats->vertices = vertices.size();
+        stats->rays = vertices.size() * strata * strata;
+        stats->averageOcclusion = vertexCount > 0 ? occlusionSum / vertexCount : 0.0;
+        stats->threads = threads;
+        stats->bvhSeconds = bvhSeconds;
+        stats->traceSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+}
@@ -0,0 +1,39 @@
+#version 450 core
+
+//Deferred shading, first pass: surface attributes into the G-buffer (see gBuffer.h)
+//Lighting happens afterwards in deferred_fs.glsl
+
+in vec4 vs_color;
+in vec2 vs_uv;
+in vec3 vs_world_pos;
+in vec3 vs_normal;
+in float vs_view_depth;
+in float vs_visibility;
+
+layout (location = 0) out vec4 gNormal; //Octahedral normal, roughness, metalness
+layout (location = 1) out vec4 gAlbedo; //Albedo, ambient visibility (see vertexTransfer.h)
+
+//Same material as fs.glsl
+const vec3 albedo = vec3(0.6, 0.6, 0.6);
+const float roughness = 0.5;
+const float metalness = 0.0;
+
+//Sign that is never 0, so normals on the folds encode correctly
+vec2 signNotZero(vec2 v)
+{
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+//Unit vector -> [0,1]^2, the lower half of the octahedron is folded over the upper
+vec2 octEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * signNotZero(n.xy);
+    return e * 0.5 + 0.5;
+}
+
+void main(void)
+{
+    gNormal = vec4(octEncode(normalize(vs_normal)), roughness, metalness);
+    gAlbedo = vec4(albedo, vs_visibility);
+}
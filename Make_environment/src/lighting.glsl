@@ -0,0 +1,179 @@
+//Lighting shared by every shading pass (fs.glsl, deferred_fs.glsl, lightmap_fs.glsl)
+//Not a shader on its own: sb7::shader::load_with_header puts it right after the shader's #version line
+
+//Camera info, uploaded once per frame (see frameData.h)
+layout (std140, binding = 0) uniform FrameBlock {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPosition;
+    float time;
+} frame;
+
+//Lights and the clusters they were binned into (see clusteredLights.h)
+struct Light {
+    vec4 positionRadius; //xyz world position, w radius
+    vec4 colorType;      //rgb color, w 0 = point, 1 = spot
+    vec4 direction;      //xyz spot direction, w cos of the outer angle
+    vec4 spot;           //x cos of the inner angle
+};
+
+layout (std430, binding = 5) readonly buffer LightBlock {
+    Light lights[];
+};
+
+layout (std430, binding = 6) readonly buffer ClusterBlock {
+    uvec4 grid;        //xyz cluster counts, w number of lights
+    vec4 depthParams;  //near, far, slice scale, slice bias
+    vec4 tileParams;   //xy tile size in pixels
+    uvec2 clusters[];  //Offset into lightIndices and count, per cluster
+};
+
+layout (std430, binding = 7) readonly buffer LightIndexBlock {
+    uint lightIndices[];
+};
+
+//Sun and its shadow cascades (see cascadedShadows.h)
+layout (std140, binding = 1) uniform ShadowBlock {
+    mat4 cascadeViewProjection[4]; //World to shadow map
+    vec4 splits;                   //View distance where each cascade ends
+    vec4 lightDirection;           //Direction the light travels
+    vec4 lightColor;
+    vec4 texelSize;                //World size of a shadow texel, per cascade
+} shadow;
+
+layout (binding = 1) uniform sampler2DArrayShadow shadowMap;
+
+//Light from the sky (see skyLighting.h): irradiance as 9 SH coefficients, and a cube prefiltered for specular
+layout (std140, binding = 2) uniform SkyBlock {
+    vec4 irradiance[9]; //rgb, already convolved with the cosine lobe and divided by pi
+    vec4 specular;      //x highest mip level of skySpecular (roughness 1)
+} sky;
+
+layout (binding = 6) uniform samplerCube skySpecular;
+
+//Indirect light baked into probes on the maze grid (see probeGrid.h)
+layout (std140, binding = 3) uniform ProbeBlock {
+    vec4 gridMin;  //xyz world position at texture coordinate 0, w how far lookups are pushed off the surface
+    vec4 gridSize; //xyz world size the texture covers, w layers per channel (0 until baked)
+} probes;
+
+layout (binding = 7) uniform sampler3D probeGrid;
+
+//Blinn-Phong exponent of a roughness
+float blinnPhongExponent(float roughness)
+{
+    return 2.0 / (roughness * roughness * roughness * roughness) - 2.0;
+}
+
+//Lights of the cluster a fragment is in (same slicing as ClusteredLights::sliceOf): offset into lightIndices and count
+uvec2 clusterRange(vec2 fragCoord, float viewDepth)
+{
+    uint slice = uint(clamp(floor(log(viewDepth) * depthParams.z - depthParams.w), 0.0, float(grid.z - 1)));
+    uvec2 tile = min(uvec2(fragCoord / tileParams.xy), grid.xy - 1);
+    return clusters[(slice * grid.y + tile.y) * grid.x + tile.x];
+}
+
+//How much of the sun reaches world position p (1 = all of it), 4 filtered taps in its cascade
+float sunVisibility(vec3 p, float viewDepth, vec3 n)
+{
+    if (viewDepth > shadow.splits[3])
+    {
+        return 1.0; //Past the last cascade
+    }
+    int cascade = 0;
+    while (cascade < 3 && viewDepth > shadow.splits[cascade])
+    {
+        cascade++;
+    }
+
+    //Pushed out along the normal by about a texel, so surfaces don't shadow themselves
+    vec3 position = p + n * shadow.texelSize[cascade] * 1.5;
+    vec3 coord = (shadow.cascadeViewProjection[cascade] * vec4(position, 1.0)).xyz * 0.5 + 0.5;
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float visible = 0.0;
+    visible += texture(shadowMap, vec4(coord.xy + vec2(-0.5, -0.5) * texel, cascade, coord.z));
+    visible += texture(shadowMap, vec4(coord.xy + vec2( 0.5, -0.5) * texel, cascade, coord.z));
+    visible += texture(shadowMap, vec4(coord.xy + vec2(-0.5,  0.5) * texel, cascade, coord.z));
+    visible += texture(shadowMap, vec4(coord.xy + vec2( 0.5,  0.5) * texel, cascade, coord.z));
+    return visible * 0.25;
+}
+
+//Sun on a surface at p, shadowed
+vec3 sunLight(vec3 p, float viewDepth, vec3 n, vec3 albedo)
+{
+    float sunDiffuse = max(dot(n, -shadow.lightDirection.xyz), 0.0);
+    if (sunDiffuse <= 0.0)
+    {
+        return vec3(0.0);
+    }
+    return shadow.lightColor.rgb * albedo * sunDiffuse * sunVisibility(p, viewDepth, n);
+}
+
+//Sky irradiance at normal n, shadowed by the mesh (see vertexTransfer.h)
+//The constant and quadratic bands are scaled by visibility, the linear band goes along the bent normal,
+//which already holds the cosine: 0.732905 = 0.488603 * 3/2 turns an irradiance coefficient back into its slope
+vec3 skyAmbient(vec3 n, float visibility, vec3 bent)
+{
+    vec3 l0 = 0.282095 * sky.irradiance[0].rgb;
+    vec3 l1 = 0.732905 * (sky.irradiance[3].rgb * bent.x + sky.irradiance[1].rgb * bent.y + sky.irradiance[2].rgb * bent.z);
+    vec3 l2 = 1.092548 * (sky.irradiance[4].rgb * n.x * n.y + sky.irradiance[5].rgb * n.y * n.z + sky.irradiance[7].rgb * n.x * n.z) +
+              0.315392 * sky.irradiance[6].rgb * (3.0 * n.z * n.z - 1.0) +
+              0.546274 * sky.irradiance[8].rgb * (n.x * n.x - n.y * n.y);
+    return max((l0 + l2) * visibility + l1, 0.0);
+}
+
+//Ambient light at p: the probes inside the maze, the open sky anywhere else
+//Pushed along the normal first, so a wall's own surface reads the tile it faces
+vec3 ambientLight(vec3 p, vec3 n, float visibility, vec3 bent)
+{
+    vec3 g = (p + n * probes.gridMin.w - probes.gridMin.xyz) / probes.gridSize.xyz;
+    float layers = probes.gridSize.w;
+    if (layers == 0.0 || any(lessThan(g.xz, vec2(0.0))) || any(greaterThan(g.xz, vec2(1.0))))
+    {
+        return skyAmbient(n, visibility, bent);
+    }
+    //Each channel has its own run of layers in y, clamped between its first and last so channels never blend
+    float layer = 0.5 + clamp(g.y, 0.0, 1.0) * (layers - 1.0);
+    vec3 light;
+    for (int c = 0; c < 3; c++)
+    {
+        vec4 probe = texture(probeGrid, vec3(g.x, (float(c) * layers + layer) / (3.0 * layers), g.z)); //base, slope
+        light[c] = probe.x * visibility + dot(probe.yzw, bent);
+    }
+    return max(light, 0.0);
+}
+
+//Sky reflected off a dielectric (F0 = 0.04), from the mip that matches the roughness
+vec3 skyReflection(vec3 n, vec3 v, float roughness, float visibility)
+{
+    float fresnel = 0.04 + 0.96 * pow(1.0 - max(dot(n, v), 0.0), 5.0);
+    return textureLod(skySpecular, reflect(-v, n), roughness * sky.specular.x).rgb * fresnel * visibility;
+}
+
+//Every light of a cluster on a surface at p, seen from direction v
+vec3 clusterLights(uvec2 range, vec3 p, vec3 n, vec3 v, vec3 albedo, float shininess)
+{
+    vec3 lit = vec3(0.0);
+    for (uint i = 0; i < range.y; i++)
+    {
+        Light light = lights[lightIndices[range.x + i]];
+        vec3 toLight = light.positionRadius.xyz - p;
+        float dist = length(toLight);
+        vec3 l = toLight / max(dist, 1e-4);
+
+        //Inverse square, windowed so it reaches zero exactly at the radius (nothing past it was binned)
+        float window = clamp(1.0 - pow(dist / light.positionRadius.w, 4.0), 0.0, 1.0);
+        float attenuation = window * window / (dist * dist + 1.0);
+        if (light.colorType.w > 0.5)
+        {
+            attenuation *= smoothstep(light.direction.w, light.spot.x, dot(-l, light.direction.xyz));
+        }
+
+        //Lambert + Blinn-Phong
+        float diffuse = max(dot(n, l), 0.0);
+        float specular = diffuse > 0.0 ? pow(max(dot(n, normalize(l + v)), 0.0), shininess) : 0.0;
+        lit += light.colorType.rgb * attenuation * (albedo * diffuse + specular);
+    }
+    return lit;
+}
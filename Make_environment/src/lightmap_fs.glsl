@@ -0,0 +1,34 @@
+#version 450 core
+
+//Forward shading for baked static geometry (the maze): sky, sun and their bounces come
+//from the lightmap (see lightmapBaker.h), only the moving lights are still added per pixel
+
+in vec4 vs_color;
+in vec2 vs_uv;
+in vec3 vs_world_pos;
+in vec3 vs_normal;
+in float vs_view_depth;
+in vec2 vs_lightmap_uv;
+
+layout (binding = 5) uniform sampler2D lightmap;
+
+out vec4 color;
+
+//Uniform blocks and the clustered lights come from lighting.glsl
+
+//Same material as fs.glsl (the bake used the same albedo)
+const vec3 albedo = vec3(0.6, 0.6, 0.6);
+const float roughness = 0.5;
+
+void main(void)
+{
+    //Baked light is stored divided by pi, the same scale fs.glsl uses for the sun
+    vec3 lit = albedo * texture(lightmap, vs_lightmap_uv).rgb;
+
+    //Same clustered lights as fs.glsl
+    vec3 n = normalize(vs_normal);
+    vec3 v = normalize(frame.cameraPosition.xyz - vs_world_pos);
+    lit += clusterLights(clusterRange(gl_FragCoord.xy, vs_view_depth), vs_world_pos, n, v, albedo, blinnPhongExponent(roughness));
+
+    color = vec4(lit, 1.0);
+}
@@ -13,6 +13,25 @@
 
 #include <loadingFunctions.h>
 #include <skybox.h>
+#include <meshArena.h>
+#include <frameData.h>
+#include <mazeGeometry.h>
+#include <culling.h>
+#include <mazeVisibility.h>
+#include <occlusion.h>
+#include <renderQueue.h>
+#include <gpuCulling.h>
+#include <clusteredLights.h>
+#include <cascadedShadows.h>
+#include <gBuffer.h>
+#include <lightmapBaker.h>
+#include <vertexTransfer.h>
+#include <skyLighting.h>
+#include <probeGrid.h>
+#include <skinning.h>
+#include <animationClip.h>
+#include <transformHierarchy.h>
+#include <sb7glstate.h>
 
 //Needed for file loading (also vector)
 #include <string>
@@ -20,6 +39,8 @@
 
 // For error checking
 #include <vector>
+#include <algorithm>
+#include <chrono>
 #include <cassert>
 #define GL_CHECK_ERRORS assert(glGetError()== GL_NO_ERROR);
 
@@ -37,19 +58,19 @@ class test_app : public sb7::application{
 
         info.windowWidth = 900; //Make sure things are square to start with
         info.windowHeight = 900;
+        info.updateRate = 60;   //Simulation ticks per second (see update())
+        info.frameRateCap = 60; //No point drawing frames nobody sees (see sb7framepacer.h)
+        info.flags.vsync = 1;   //Wait for vblank, but tear rather than drop to half rate when a frame is late
+        info.flags.adaptive_vsync = 1;
     }
     
     void startup(){
 
-        //Generate the maze and create cube objects for the maze walls
-        std::vector<std::pair<int, int>> walls;
+        //Generate the maze and find the end flag
         std::pair<int, int> endFlag;
-        maze = Maze(20, 20);
+        maze = Maze(maze_width, maze_height);
         for(int i = 0; i < maze.getHeight(); i++){
             for(int j = 0; j < maze.getWidth(); j++){
-                if(maze.getTile(j, i) == wall){
-                    walls.push_back(std::pair<int, int>(j, i));
-                }
                 if(maze.getTile(j, i) == end){
                     endFlag = std::pair<int, int>(j, i);
                 }
@@ -71,36 +92,34 @@ class test_app : public sb7::application{
 
         //Load two objects
         load_obj(".\\bin\\media\\car23.obj", objects[0].verticies, objects[0].uv, objects[0].normals, objects[0].vertNum);
+        objects[0].bounds = computeBounds(objects[0].verticies); //Box/sphere for culling, object space
+        buildObjectAnimation();
 
-         //Create a wall object for each item in vector and set their position
-         /*
-        for(int i = 1; i < walls.size() + 1; i++){
-            objects.push_back(objects[0]);
-            objects[i].obj2world = vmath::mat4::identity() * vmath::translate((float)(walls[i].first* 2) + 2, 0.0f, (float)(walls[i].second * 2) + 2);
-        }*/
-
-        //Generate the outer walls of the maze
-        //top wall
-        /*
-        for(int i = 0; i < maze.getWidth(); i++){
-            obj_t temp = objects[0];
-            temp.obj2world = vmath::mat4::identity() * vmath::translate((float)(i * 2), 0.0f, 0.0f);
-            objects.push_back(temp);
-
-            temp.obj2world = vmath::mat4::identity() * vmath::translate((float)(i * 2), 0.0f, (float)(maze.getHeight() * 2));
-            objects.push_back(temp);
+        //CPU copy of the sky, for the lightmap bake and the sky lighting (freed once both are done)
+        if(!loadCubeImages(".\\bin\\media\\Skycube\\", sky_images)){
+            printf("Sky: cube images missing, nothing is lit by the sky\n");
         }
 
-        // right wall
-        for(int i = 0; i < maze.getHeight(); i++){
-            obj_t temp = objects[0];
-            temp.obj2world = vmath::mat4::identity() * vmath::translate((float)(maze.getWidth() * 2), 0.0f, (float)(i * 2));
-            objects.push_back(temp);
-
-            //Left wall
-            temp.obj2world = vmath::mat4::identity() * vmath::translate(0.0f, 0.0f, (float)(i * 2));
-            objects.push_back(temp); 
-        }*/
+        //Walls are not objects, there are two ways to draw them:
+        // greedy_maze  -> one static mesh with hidden faces removed and wall runs merged (default)
+        // !greedy_maze -> one cube mesh drawn once per wall tile with instancing
+        if(greedy_maze){
+            maze_mesh_stats_t mazeStats;
+            buildMazeMesh(maze, maze_chunk_size, maze_vertices, maze_indices, maze_chunks, &mazeStats);
+            printf("Maze mesh: %zu wall tiles, %zu triangles as cubes -> %zu triangles meshed (%zu chunks)\n",
+                   mazeStats.wallTiles, mazeStats.cubeTriangles, mazeStats.triangles, maze_chunks.size());
+
+            //The bake writes the lightmap uvs, so it has to happen before the mesh is uploaded
+            if(baked_lighting && !deferred_shading){
+                bakeLightmap();
+            }
+        } else {
+            load_obj(".\\bin\\media\\cube.obj", wall_piece.verticies, wall_piece.uv, wall_piece.normals, wall_piece.vertNum);
+            buildWallTransforms(maze, wall_transforms); //Interior walls and the outer boundary
+        }
+        if(probe_lighting){
+            bakeProbes();
+        }
 
 
         ////////////////////////////////
@@ -109,51 +128,184 @@ class test_app : public sb7::application{
         GLuint shaders[2];
 
         //Load scene rendering based shaders
-        //These need to be co-located with main.cpp in src
+        //These need to be co-located with main.cpp in src, the shading ones get lighting.glsl put in front
         shaders[0] = sb7::shader::load(".\\src\\vs.glsl", GL_VERTEX_SHADER);
         compiler_error_check(shaders[0]);
-        shaders[1] = sb7::shader::load(".\\src\\fs.glsl", GL_FRAGMENT_SHADER);
+        shaders[1] = sb7::shader::load_with_header(".\\src\\lighting.glsl", ".\\src\\fs.glsl", GL_FRAGMENT_SHADER);
         compiler_error_check(shaders[1]);
         //Put together scene rendering program from the two loaded shaders
         rendering_program = sb7::program::link_from_shaders(shaders, 2, true);
         GL_CHECK_ERRORS
 
+        //Depth prepass program, vertex shader only (nothing to shade, color writes are off)
+        GLuint depth_shader = sb7::shader::load(".\\src\\depth_vs.glsl", GL_VERTEX_SHADER);
+        compiler_error_check(depth_shader);
+        depth_program = sb7::program::link_from_shaders(&depth_shader, 1, true);
+
+        //Overdraw view, same vertex shader with a fragment shader that only counts
+        shaders[0] = sb7::shader::load(".\\src\\vs.glsl", GL_VERTEX_SHADER);
+        compiler_error_check(shaders[0]);
+        shaders[1] = sb7::shader::load(".\\src\\overdraw_fs.glsl", GL_FRAGMENT_SHADER);
+        compiler_error_check(shaders[1]);
+        overdraw_program = sb7::program::link_from_shaders(shaders, 2, true);
+        glGenQueries(2, overdraw_queries);
+        GL_CHECK_ERRORS
+
+        //Shadow map depth, positions only with the light's matrix as a uniform
+        GLuint shadow_shader = sb7::shader::load(".\\src\\shadow_vs.glsl", GL_VERTEX_SHADER);
+        compiler_error_check(shadow_shader);
+        shadow_program = sb7::program::link_from_shaders(&shadow_shader, 1, true);
+        shadow_vp_location = glGetUniformLocation(shadow_program, "lightViewProjection");
+
+        //Deferred renderer: scene into the G-buffer (same vertex shader), then one full screen light pass
+        if(deferred_shading){
+            shaders[0] = sb7::shader::load(".\\src\\vs.glsl", GL_VERTEX_SHADER);
+            compiler_error_check(shaders[0]);
+            shaders[1] = sb7::shader::load(".\\src\\gbuffer_fs.glsl", GL_FRAGMENT_SHADER);
+            compiler_error_check(shaders[1]);
+            gbuffer_program = sb7::program::link_from_shaders(shaders, 2, true);
+
+            shaders[0] = sb7::shader::load(".\\src\\deferred_vs.glsl", GL_VERTEX_SHADER);
+            compiler_error_check(shaders[0]);
+            shaders[1] = sb7::shader::load_with_header(".\\src\\lighting.glsl", ".\\src\\deferred_fs.glsl", GL_FRAGMENT_SHADER);
+            compiler_error_check(shaders[1]);
+            deferred_program = sb7::program::link_from_shaders(shaders, 2, true);
+
+            glGenVertexArrays(1, &fullscreen_vao); //Core profile needs a vao bound even with no attributes
+            gbuffer.create(info.windowWidth, info.windowHeight);
+        }
+        printf("Renderer: %s\n", deferred_shading ? "deferred" : "forward");
+
+        //Skinned characters, blended on the GPU and shaded like everything else (G-buffer when deferred)
+        shaders[0] = sb7::shader::load(".\\src\\skin_vs.glsl", GL_VERTEX_SHADER);
+        compiler_error_check(shaders[0]);
+        shaders[1] = deferred_shading ? sb7::shader::load(".\\src\\gbuffer_fs.glsl", GL_FRAGMENT_SHADER)
+                                      : sb7::shader::load_with_header(".\\src\\lighting.glsl", ".\\src\\fs.glsl", GL_FRAGMENT_SHADER);
+        compiler_error_check(shaders[1]);
+        skin_program = sb7::program::link_from_shaders(shaders, 2, true);
+
+        //Their shadows, depth only with the light's matrix as a uniform like shadow_vs.glsl
+        GLuint skin_shadow_shader = sb7::shader::load(".\\src\\skin_shadow_vs.glsl", GL_VERTEX_SHADER);
+        compiler_error_check(skin_shadow_shader);
+        skin_shadow_program = sb7::program::link_from_shaders(&skin_shadow_shader, 1, true);
+        skin_shadow_vp_location = glGetUniformLocation(skin_shadow_program, "lightViewProjection");
+
+        //Baked maze: same vertex shader, lighting from the lightmap plus the moving lights (forward only)
+        if(lightmap_texture){
+            shaders[0] = sb7::shader::load(".\\src\\vs.glsl", GL_VERTEX_SHADER);
+            compiler_error_check(shaders[0]);
+            shaders[1] = sb7::shader::load_with_header(".\\src\\lighting.glsl", ".\\src\\lightmap_fs.glsl", GL_FRAGMENT_SHADER);
+            compiler_error_check(shaders[1]);
+            lightmap_program = sb7::program::link_from_shaders(shaders, 2, true);
+        }
+
         /////////////////////////////////
         // Transfer Object Into OpenGL //
         /////////////////////////////////
 
-        //Set up vao
+        //All meshes share one vertex buffer, one index buffer and one vao (see meshArena.h)
+        //Sized generously so more objects can be loaded without re-creating the arena
         glUseProgram(rendering_program); //TODO:: This might not be necessary (because of the above link_from_shaders)
-        glCreateVertexArrays(1,&vertex_array_object);
-        glBindVertexArray(vertex_array_object);
-
-        for(int i = 0; i < objects.size(); i++){
-            //For each object in objects, set up openGL buffers
-            glGenBuffers(1,&objects[i].vertices_buffer_ID); //Create the buffer id for this object
-            glBindBuffer( GL_ARRAY_BUFFER, objects[i].vertices_buffer_ID);
-            glBufferData( GL_ARRAY_BUFFER,
-                objects[i].verticies.size() * sizeof(objects[i].verticies[0]), //Size of element * number of elements
-                objects[i].verticies.data(),                                   //Actual data
-                GL_STATIC_DRAW);                                               //Set to static draw (read only)  
-
-            //Set up UV buffers
-            glGenBuffers(1,&objects[i].uv_buffer_ID); //Create the buffer id for this object
-            glBindBuffer( GL_ARRAY_BUFFER, objects[i].uv_buffer_ID);
-            glBufferData( GL_ARRAY_BUFFER,
-                objects[i].uv.size() * sizeof(objects[i].uv[0]), //Size of element * number of elements
-                objects[i].uv.data(),                            //Actual data
-                GL_STATIC_DRAW); 
+        mesh_arena.create(standardVertexFormat(), 1 << 20, 1 << 22);
+        mesh_arena.enablePositionStream(); //Positions only, for the depth prepass
+
+        //Transform buffer layout: [ identity (maze mesh) | wall instances | objects | shadow casters (both updated every frame) ]
+        //The first two never move, so they are uploaded once here
+        wall_instance_base = 1;
+        object_base = wall_instance_base + wall_transforms.size();
+        shadow_base = object_base + max_objects;
+        GLuint transformCapacity = shadow_base + max_shadow_objects;
+        mesh_arena.enableDrawID(ATTRIB_DRAW_ID, transformCapacity); //Draw id i reads transform i
+        //Walls are uploaded once below, not streamed
+        //The ring also carries the render queue's indirect commands: every object and chunk, depth prepass and colour pass
+        GLsizeiptr commandBytes = 2 * (max_objects + maze_chunks.size() + 1) * sizeof(draw_elements_indirect_t);
+        frame_data.create(transformCapacity, max_objects + max_shadow_objects, commandBytes);
+        render_queue.setCommandStream(&frame_data.getStream());
+        vmath::mat4 mazeTransform = vmath::mat4::identity(); //Maze mesh is built in world space
+        frame_data.updateObjects(&mazeTransform, 1, 0);
+        frame_data.updateObjects(wall_transforms.data(), wall_transforms.size(), wall_instance_base);
+
+        std::vector<arena_vertex_t> arenaVertices; //Scratch space for indexing
+        std::vector<GLuint> arenaIndices;
+        for(size_t i = 0; i < objects.size(); i++){
+            //Weld the triangle soup from load_obj into indexed form, then suballocate it
+            indexTriangles(objects[i].verticies, objects[i].normals, objects[i].uv, arenaVertices, arenaIndices);
+            if(baked_transfer){
+                //Soft self shadowing for the ambient light, baked once against the mesh itself
+                transfer_stats_t transferStats;
+                bakeVertexTransfer(arenaVertices, arenaIndices, defaultTransferSettings(), &transferStats);
+                printf("Vertex transfer: object %zu, %zu vertices, %.1f M rays on %d threads, bvh %.3f s, trace %.3f s, average occlusion %.2f\n",
+                       i, transferStats.vertices, transferStats.rays / 1e6, transferStats.threads,
+                       transferStats.bvhSeconds, transferStats.traceSeconds, transferStats.averageOcclusion);
+            }
+            if(!mesh_arena.addMesh(arenaVertices.data(), arenaVertices.size(), arenaIndices.data(), arenaIndices.size(), objects[i].mesh)){
+                char buf[50];
+                sprintf(buf, "Mesh arena is full!");
+                MessageBoxA(NULL, buf, "Error in loading object", MB_OK);
+            }
+        }
+        if(greedy_maze){
+            //Whole maze is one mesh, each chunk is a range inside it
+            mesh_t mazeMesh;
+            mesh_arena.addMesh(maze_vertices.data(), maze_vertices.size(), maze_indices.data(), maze_indices.size(), mazeMesh);
+            setMazeChunkMeshes(mazeMesh, maze_chunks);
+
+            //Chunks never move, their boxes only go into the cull list again when the camera's PVS changes
+            rebuildMazeCullList();
+
+            //Every chunk casts shadows, PVS or not (the light sees more than the camera)
+            shadow_caster_list.clear();
+            for(size_t i = 0; i < maze_chunks.size(); i++){
+                shadow_caster_list.add(maze_chunks[i].boundsMin, maze_chunks[i].boundsMax);
+            }
+            maze_vertices.clear(); //CPU copy no longer needed
+            maze_indices.clear();
+        } else {
+            indexTriangles(wall_piece.verticies, wall_piece.normals, wall_piece.uv, arenaVertices, arenaIndices);
+            mesh_arena.addMesh(arenaVertices.data(), arenaVertices.size(), arenaIndices.data(), arenaIndices.size(), wall_piece.mesh);
+
+            //Wall instances are culled on the GPU, which writes the draw commands itself (see gpuCulling.h)
+            if(gpu_culling){
+                GLuint cull_shader = sb7::shader::load(".\\src\\cull_cs.glsl", GL_COMPUTE_SHADER);
+                compiler_error_check(cull_shader);
+                cull_program = sb7::program::link_from_shaders(&cull_shader, 1, true);
+
+                bounds_t wallBounds = computeBounds(wall_piece.verticies);
+                std::vector<gpu_instance_t> wallInstances;
+                for(size_t i = 0; i < wall_transforms.size(); i++){
+                    vmath::vec3 worldMin, worldMax;
+                    transformBounds(wallBounds, wall_transforms[i], worldMin, worldMax);
+                    wallInstances.push_back(makeGpuInstance(wall_piece.mesh, worldMin, worldMax, wall_instance_base + i));
+                }
+                wall_culler.create(cull_program, wallInstances);
+                printf("GPU culling: %u wall instances (%s)\n", wall_culler.getInstanceCount(),
+                       wall_culler.usesIndirectCount() ? "compacted, indirect count" : "per instance commands");
+            }
         }
         
+        //Wall runs are the occluders for software occlusion culling, they never move so they are culled from a static list
+        buildWallRuns(maze, occluder_min, occluder_max);
+        occluder_cull_list.clear();
+        for(size_t i = 0; i < occluder_min.size(); i++){
+            occluder_cull_list.add(occluder_min[i], occluder_max[i]);
+        }
+        occlusion_buffer.create(256, 128);
+
+        //Dynamic lights around the maze, binned into view clusters every frame (see clusteredLights.h)
+        cluster_lights.create(max_lights, max_light_indices);
+        spawnLights();
+
+        //A crowd standing around the maze (see skinning.h)
+        spawnCrowd();
+
+        //Sun shadows, the box covers the maze with its boundary ring and the objects around it
+        vmath::vec3 sceneMin = mazeTileToWorld(-1, -1) - vmath::vec3(MAZE_TILE_SIZE, 3.0f, MAZE_TILE_SIZE);
+        vmath::vec3 sceneMax = mazeTileToWorld(maze.getWidth(), maze.getHeight()) + vmath::vec3(MAZE_TILE_SIZE, 3.0f, MAZE_TILE_SIZE);
+        shadows.create(sceneMin, sceneMax);
+
         GL_CHECK_ERRORS
-        ////////////////////////////////////
-        // Grab IDs for rendering program //
-        ////////////////////////////////////
-        transform_ID = glGetUniformLocation(rendering_program,"transform");
-        perspec_ID = glGetUniformLocation(rendering_program,"perspective");
-        toCam_ID = glGetUniformLocation(rendering_program,"toCamera");
-        vertex_ID = glGetAttribLocation(rendering_program,"obj_vertex");
-        uv_ID = glGetAttribLocation(rendering_program,"obj_uv");        
+        //No uniform IDs to grab for the rendering program
+        //Camera and transforms come from buffers (frameData.h), attributes have fixed locations (meshArena.h)
 
         ///////////////////////////
         // Set Up Simple Texture //
@@ -212,7 +364,7 @@ class test_app : public sb7::application{
 
         //Assign Texture from CPU memory to GPU memory
         /*
-        for(int i = 0; i < objects.size(); i++){
+        for(size_t i = 0; i < objects.size(); i++){
             glGenTextures(1,&objects[i].texture_ID);
             glBindTexture(GL_TEXTURE_2D, objects[i].texture_ID);
             glTexImage2D( GL_TEXTURE_2D, //What kind of texture are we loading in
@@ -278,6 +430,14 @@ class test_app : public sb7::application{
         loadCubeTextures(".\\bin\\media\\Skycube\\",sc_map_texture);
         GL_CHECK_ERRORS
 
+        //Sky light for everything the lightmap doesn't cover, same brightness as the bake
+        sky_lighting.create(sky_images, defaultLightmapSettings().skyIntensity);
+        const sky_lighting_stats_t &skyStats = sky_lighting.getStats();
+        printf("Sky lighting: %zu texels to SH9 in %.3f s, %d specular levels prefiltered in %.3f s\n",
+               skyStats.texels, skyStats.projectSeconds, SKY_SPECULAR_LEVELS, skyStats.prefilterSeconds);
+        sky_images = sky_cube_t();
+        GL_CHECK_ERRORS
+
         //Get uniform handles for perspective and camera matrices
         sc_Perspective = glGetUniformLocation(sc_program,"perspective");
         sc_Camera= glGetUniformLocation(sc_program,"toCamera");
@@ -292,11 +452,21 @@ class test_app : public sb7::application{
         //Initial camera details
         camera.position = vmath::vec3(2.0f, 0.0f, 2.0f); //Starting camera at position (0,0,5)
         camera.focus = vmath::vec3(0.0f, 0.0f, 0.0f); //Camera is looking at origin
+        player_position = camera.position; //Simulated position starts where the camera is
+        player_previous = camera.position;
+        camera_look = camera.focus - camera.position;
         
         //Now that we have parameters set, calculate the Projection and View information for this camera
         calcProjection(camera); //Calculate the projection matrix used by this camera
         calcView(camera); //Calculate the View matrix for camera
 
+        //Which tiles each maze cell can see, nothing past the far plane counts
+        buildPVS();
+        const pvs_stats_t &pvsStats = maze_pvs.getStats();
+        printf("Maze PVS: %zu cells, %.1f visible tiles per cell, %zu bytes (%zu as bitsets), built in %.3fs\n",
+               pvsStats.cells, pvsStats.cells ? static_cast<double>(pvsStats.visibleTiles) / pvsStats.cells : 0.0,
+               pvsStats.compressedBytes, pvsStats.rawBytes, pvsStats.buildSeconds);
+
         //Link locations to Uniforms
         glUseProgram(sc_program);
         glUniformMatrix4fv(sc_Perspective,1,GL_FALSE,camera.proj_Matrix);
@@ -312,104 +482,836 @@ class test_app : public sb7::application{
         glFrontFace( GL_CCW );              // set counter-clock-wise vertex order to mean the front
         glClearColor( 0.2, 0.2, 0.2, 1.0 ); // grey background to help spot mistakes
 
+        //Everything above bound things behind the state cache's back, start it from a clean slate
+        sb7::glstate::invalidate();
+
         //End of set up check
         GL_CHECK_ERRORS
     }
 
     void shutdown(){
         //Clean up Buffers
-        glDeleteVertexArrays(1, &sc_vertex_array_object);
-        glDeleteTextures(1,&sc_map_texture);
-        glDeleteProgram(sc_program);
+        mesh_arena.destroy();
+        frame_data.destroy();
+        wall_culler.destroy();
+        cluster_lights.destroy();
+        shadows.destroy();
+        sky_lighting.destroy();
+        probe_grid.destroy();
+        crowd.destroy();
+        sb7::glstate::delete_program(skin_program);
+        sb7::glstate::delete_program(skin_shadow_program);
+        sb7::glstate::delete_program(shadow_program);
+        if(deferred_shading){
+            gbuffer.destroy();
+            sb7::glstate::delete_program(gbuffer_program);
+            sb7::glstate::delete_program(deferred_program);
+            sb7::glstate::delete_vertex_arrays(1, &fullscreen_vao);
+        }
+        if(cull_program){
+            sb7::glstate::delete_program(cull_program);
+        }
+        if(lightmap_texture){
+            sb7::glstate::delete_textures(1, &lightmap_texture);
+            sb7::glstate::delete_program(lightmap_program);
+        }
+        sb7::glstate::delete_vertex_arrays(1, &sc_vertex_array_object);
+        sb7::glstate::delete_textures(1,&sc_map_texture);
+        sb7::glstate::delete_program(sc_program);
+        sb7::glstate::delete_program(depth_program);
+        sb7::glstate::delete_program(overdraw_program);
+        glDeleteQueries(2, overdraw_queries);
     }
 
+    //A frame is split in two:
+    // prepareFrame -> CPU only (animation, camera, visibility, draw packets), spread over threads with OpenMP
+    // submitFrame  -> the merged, sorted draw list turned into GL calls on this (the GL) thread
     void render(double curTime){
+        sb7::glstate::begin_frame(); //Count redundant GL calls per frame
 
-        glViewport( 0, 0, info.windowWidth, info.windowHeight ); //Set Viewport information
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        prepareFrame();
+        std::chrono::high_resolution_clock::time_point prepared = std::chrono::high_resolution_clock::now();
+        submitFrame();
+        std::chrono::high_resolution_clock::time_point submitted = std::chrono::high_resolution_clock::now();
+        prepare_ms = std::chrono::duration<double, std::milli>(prepared - start).count();
+        submit_ms = std::chrono::duration<double, std::milli>(submitted - prepared).count();
+
+        showStats(curTime);
+    }
+
+    //Simulated time render() is drawing: between the last two ticks by update_alpha, like the camera
+    double drawnSimTime() const {
+        double step = info.updateRate > 0 ? 1.0 / info.updateRate : 0.0;
+        return sim_time - (1.0 - update_alpha) * step;
+    }
+
+    //Fixed rate simulation tick (info.updateRate times a second, see sb7::application::run)
+    //Everything that changes the world happens here, render() only draws the latest state
+    void update(double dt){
+        sim_time += dt;
+        player_previous = player_position;
 
         //if Auto rotate flag is set, update the position of the camera
         if(autoRotate){
-            camera.position = vmath::vec3(static_cast<float>(cos(curTime/10.0) * 5.0),
+            player_position = vmath::vec3(static_cast<float>(cos(sim_time/10.0) * 5.0),
                                           0.0f,
-                                          static_cast<float>(sin(curTime/10.0) * 5.0) );
+                                          static_cast<float>(sin(sim_time/10.0) * 5.0) );
+        } else {
+            //Held keys move the player at move_speed units a second, whatever the key repeat rate is
+            static const int moveKeys[4] = {'W', 'A', 'S', 'D'};
+            for(int i = 0; i < 4; i++){
+                if(keys_held[i]){
+                    movePlayer(moveKeys[i], move_speed * static_cast<float>(dt));
+                }
+            }
+        }
+    }
+
+    //Pose the objects at time seconds of simulation: sample the clip, then the hierarchy gives every obj2world
+    //Only depends on time, so render() can draw them between the last two ticks like the camera
+    void animateObjects(double time){
+        //Animated objects get their local transform from the clip (channels without a track keep their rest value),
+        //the rest of scene_nodes isn't touched and only the changed subtrees get new obj->world transforms
+        object_animation.sample(static_cast<float>(time));
+        for(size_t i = 0; i < objects.size(); i++){
+            const int* tracks = objects[i].anim_tracks;
+            if(tracks[ANIM_TRANSLATION] < 0 && tracks[ANIM_ROTATION] < 0 && tracks[ANIM_SCALE] < 0){
+                continue;
+            }
+            vmath::vec4 t = tracks[ANIM_TRANSLATION] >= 0 ? object_animation.getValue(tracks[ANIM_TRANSLATION]) : vmath::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+            vmath::vec4 r = tracks[ANIM_ROTATION] >= 0 ? object_animation.getValue(tracks[ANIM_ROTATION]) : vmath::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            vmath::vec4 s = tracks[ANIM_SCALE] >= 0 ? object_animation.getValue(tracks[ANIM_SCALE]) : vmath::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+            scene_nodes.setLocal(objects[i].node, vmath::vec3(t[0], t[1], t[2]), vmath::quaternion(r[0], r[1], r[2], r[3]), vmath::vec3(s[0], s[1], s[2]));
+        }
+        scene_nodes.update();
+        for(size_t i = 0; i < objects.size(); i++){
+            objects[i].obj2world = scene_nodes.getWorld(objects[i].node);
         }
+    }
+
+    //Scatter lights over the open maze cells, every fourth one a spot light
+    void spawnLights(){
+        std::vector<std::pair<int, int> > openTiles;
+        for(int z = 0; z < maze.getHeight(); z++){
+            for(int x = 0; x < maze.getWidth(); x++){
+                if(!maze.isWall(x, z)){
+                    openTiles.push_back(std::pair<int, int>(x, z));
+                }
+            }
+        }
+        scene_lights.clear();
+        light_anchors.clear();
+        if(openTiles.empty()){
+            return;
+        }
+        for(GLuint i = 0; i < max_lights; i++){
+            const std::pair<int, int> &tile = openTiles[rand() % openTiles.size()];
+            light_anchor_t anchor;
+            anchor.center = mazeTileToWorld(tile.first, tile.second);
+            anchor.phase = (rand() % 1000) * 0.001f * 6.2831853f;
+            anchor.speed = 0.5f + (rand() % 1000) * 0.001f;
+            light_anchors.push_back(anchor);
+
+            //Bright saturated colors, so overlapping lights are easy to tell apart
+            light_t light;
+            float hue = (rand() % 1000) * 0.006f;
+            light.color = vmath::vec3(fabsf(hue - 3.0f) - 1.0f, 2.0f - fabsf(hue - 2.0f), 2.0f - fabsf(hue - 4.0f));
+            for(int c = 0; c < 3; c++){
+                light.color[c] = (light.color[c] < 0.0f ? 0.0f : (light.color[c] > 1.0f ? 1.0f : light.color[c])) * 4.0f;
+            }
+            light.type = (i % 4 == 3) ? LIGHT_SPOT : LIGHT_POINT;
+            light.radius = light.type == LIGHT_SPOT ? 6.0f : 3.0f;
+            light.position = anchor.center;
+            light.direction = vmath::vec3(0.0f, -1.0f, 0.0f);
+            light.cosOuter = cosf(0.6f);
+            light.cosInner = cosf(0.4f);
+            scene_lights.push_back(light);
+        }
+        animateLights(sim_time);
+    }
+
+    //Keyframes for the objects, sampled every frame in prepareFrame() (see animateObjects)
+    //The car turns on the spot once every 8 seconds and bobs a little, recorded at 30 Hz and left to compress() to thin out
+    void buildObjectAnimation(){
+        const float rate = 30.0f;
+        const int frames = 8 * 30 + 1;
+        std::vector<anim_raw_track_t> raw(ANIM_CHANNELS);
+        for(int c = 0; c < ANIM_CHANNELS; c++){
+            raw[c].target = 0;
+            raw[c].channel = c;
+            raw[c].samples.resize(frames);
+        }
+        for(int f = 0; f < frames; f++){
+            float t = f / rate;
+            float yaw = 6.2831853f * t / 8.0f;
+            raw[ANIM_TRANSLATION].samples[f] = vmath::vec4(1.0f, -2.0f + 0.05f * sinf(3.14159265f * t), 1.0f, 0.0f);
+            raw[ANIM_ROTATION].samples[f] = vmath::vec4(0.0f, sinf(yaw * 0.5f), 0.0f, cosf(yaw * 0.5f));
+            raw[ANIM_SCALE].samples[f] = vmath::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+        }
+        object_clip.compress(raw, frames, rate, defaultAnimCompressSettings());
+        object_animation.setClip(object_clip);
+        //Every object is a root node at its rest transform, parent one to another to carry it along
+        scene_nodes.clear();
+        for(size_t i = 0; i < objects.size(); i++){
+            objects[i].node = scene_nodes.addNode(-1, vmath::vec3(0.0f, 0.0f, 0.0f), vmath::quaternion(0.0f, 0.0f, 0.0f, 1.0f), vmath::vec3(1.0f, 1.0f, 1.0f));
+            for(int c = 0; c < ANIM_CHANNELS; c++){
+                objects[i].anim_tracks[c] = object_clip.findTrack(i, c);
+            }
+        }
+        animateObjects(0.0); //obj2world is read (by collisions) before the first frame is drawn
+    }
+
+    //Characters standing on the open maze cells, each swaying at its own pace
+    void spawnCrowd(){
+        skeleton_t skeleton;
+        std::vector<skin_vertex_t> vertices;
+        std::vector<GLuint> indices;
+        buildTubeCharacter(8, 1.4f, 0.2f, 12, skeleton, vertices, indices);
+        crowd.create(skeleton, vertices, indices, max_characters);
+
+        std::vector<std::pair<int, int> > openTiles;
+        for(int z = 0; z < maze.getHeight(); z++){
+            for(int x = 0; x < maze.getWidth(); x++){
+                if(!maze.isWall(x, z)){
+                    openTiles.push_back(std::pair<int, int>(x, z));
+                }
+            }
+        }
+        crowd_cull_list.clear();
+        if(openTiles.empty()){
+            return;
+        }
+        for(GLuint i = 0; i < max_characters; i++){
+            const std::pair<int, int> &tile = openTiles[rand() % openTiles.size()];
+            vmath::vec3 offset(((rand() % 1000) * 0.001f - 0.5f) * MAZE_TILE_SIZE * 0.6f, -MAZE_WALL_HALF_HEIGHT,
+                               ((rand() % 1000) * 0.001f - 0.5f) * MAZE_TILE_SIZE * 0.6f);
+            float yaw = (rand() % 1000) * 0.001f * 6.2831853f;
+            float phase = (rand() % 1000) * 0.001f * 6.2831853f;
+            float speed = 1.0f + (rand() % 1000) * 0.002f;
+            crowd.addCharacter(mazeTileToWorld(tile.first, tile.second) + offset, yaw, phase, speed);
+
+            //Characters stay where they are, their boxes go into the cull list once
+            vmath::vec3 boxMin, boxMax;
+            crowd.characterBounds(i, boxMin, boxMax);
+            crowd_cull_list.add(boxMin, boxMax);
+        }
+    }
+
+    //Lights bob around their cell, spot lights sweep in a circle, placed at time seconds of simulation
+    void animateLights(double time){
+        float t = static_cast<float>(time);
+        for(size_t i = 0; i < scene_lights.size(); i++){
+            const light_anchor_t &anchor = light_anchors[i];
+            float a = anchor.phase + t * anchor.speed;
+            light_t &light = scene_lights[i];
+            light.position = anchor.center + vmath::vec3(cosf(a) * 0.5f, MAZE_WALL_HALF_HEIGHT * (0.3f + 0.2f * sinf(a * 1.3f)), sinf(a) * 0.5f);
+            if(light.type == LIGHT_SPOT){
+                light.direction = vmath::normalize(vmath::vec3(cosf(a) * 0.7f, -1.0f, sinf(a) * 0.7f));
+            }
+        }
+    }
+
+    //Everything that decides what gets drawn this frame, no GL calls allowed in here
+    void prepareFrame(){
+        //The camera is drawn between the last two simulated positions, so movement stays smooth
+        //when rendering runs faster (or slower) than the simulation
+        float alpha = static_cast<float>(update_alpha);
+        camera.position = player_previous + (player_position - player_previous) * alpha;
+        camera.focus = camera.position + camera_look;
 
         //recalculate the View matrix for camera
         //calcProjection(camera);
         calcView(camera);
 
+        //Camera info is the same for every object, it is uploaded once for the whole frame
+        frame_uniforms.view = camera.view_mat;
+        frame_uniforms.projection = camera.proj_Matrix;
+        frame_uniforms.viewProjection = camera.proj_Matrix * camera.view_mat;
+        frame_uniforms.cameraPosition = vmath::vec4(camera.position[0], camera.position[1], camera.position[2], 1.0f);
+        frame_uniforms.time = static_cast<float>(drawnSimTime()); //Simulated time, so shader animation pauses and steps with the rest
+
+        //Lights move with the same interpolated time as everything they light, then get binned into the view clusters
+        //(the lists are uploaded in submitFrame)
+        animateLights(drawnSimTime());
+        cluster_lights.bin(scene_lights, camera.view_mat, camera.proj_Matrix, camera.camera_near, camera.camera_far,
+                           info.windowWidth, info.windowHeight);
+
+        //Shadow cascades for this camera, and which static pages are not cached yet
+        shadows.update(sunDirection(), sun_color, camera.position, vmath::normalize(camera_look),
+                       camera.fovy, camera.aspect, camera.camera_near, camera.camera_far, shadow_distance);
+
+        //Potentially visible set of the camera's cell, only decoded when the camera changes cells
+        updatePVS();
+
+        //Objects are posed at the same point between ticks as the camera and the crowd, so they don't judder
+        //when a frame gets no tick or two
+        animateObjects(drawnSimTime());
+
+        //World boxes of every object (and whether the PVS allows them), each object on its own
+        const int objectCount = static_cast<int>(objects.size());
+        object_world_min.resize(objectCount);
+        object_world_max.resize(objectCount);
+        object_keep.resize(objectCount);
+        #pragma omp parallel for schedule(static) if(objectCount > prepare_block_size)
+        for(int i = 0; i < objectCount; i++){
+            transformBounds(objects[i].bounds, objects[i].obj2world, object_world_min[i], object_world_max[i]);
+            object_keep[i] = pvsTestBox(object_world_min[i], object_world_max[i]) ? 1 : 0;
+        }
+
+        //Frustum culling, only things touching the view frustum get a draw
+        //Anything the PVS rules out never makes it into a cull list
+        frame_frustum = extractFrustum(frame_uniforms.viewProjection);
+        cull_stats.tested = 0;
+        cull_stats.visible = 0;
+        pvs_rejected = 0;
+        object_cull_list.clear();
+        object_cull_ids.clear();
+        object_box_min.clear();
+        object_box_max.clear();
+        for(int i = 0; i < objectCount; i++){
+            if(!object_keep[i]){
+                pvs_rejected++;
+                continue;
+            }
+            object_cull_list.add(object_world_min[i], object_world_max[i]);
+            object_cull_ids.push_back(i); //Index in the list -> index in objects
+            object_box_min.push_back(object_world_min[i]);
+            object_box_max.push_back(object_world_max[i]);
+        }
+        object_cull_list.cull(frame_frustum, visible_objects, cull_stats);
+
+        //Occlusion culling, the nearest walls go into a small software depth buffer
+        //and whatever survived the frustum is tested against it
+        occlusion_buffer.beginFrame();
+        if(occlusion_culling){
+            renderOccluders(frame_frustum, frame_uniforms.viewProjection);
+            const int visibleCount = static_cast<int>(visible_objects.size());
+            object_keep.resize(visibleCount);
+            #pragma omp parallel for schedule(static) if(visibleCount > prepare_block_size)
+            for(int k = 0; k < visibleCount; k++){
+                uint32_t c = visible_objects[k];
+                object_keep[k] = occlusion_buffer.testBox(object_box_min[c], object_box_max[c]) ? 1 : 0;
+            }
+            size_t kept = 0;
+            for(int k = 0; k < visibleCount; k++){
+                if(object_keep[k]){
+                    visible_objects[kept++] = visible_objects[k];
+                }
+            }
+            visible_objects.resize(kept);
+        }
+
+        //Characters go through the same frustum, PVS and occlusion tests, then the survivors are posed
+        crowd_cull_list.cull(frame_frustum, visible_characters, cull_stats);
+        crowd_draw_list.clear();
+        for(size_t k = 0; k < visible_characters.size(); k++){
+            vmath::vec3 boxMin, boxMax;
+            crowd.characterBounds(visible_characters[k], boxMin, boxMax);
+            if(!pvsTestBox(boxMin, boxMax)){
+                pvs_rejected++;
+                continue;
+            }
+            if(occlusion_culling && !occlusion_buffer.testBox(boxMin, boxMax)){
+                continue;
+            }
+            crowd_draw_list.push_back(visible_characters[k]);
+        }
+
+        //What casts into each shadow cascade, then every character either drawn or casting is posed
+        collectShadowCasters();
+        crowd.pose(crowd_pose_list, crowd_draw_list.size(), drawnSimTime());
+
+        //Every visible draw goes into the render queue, which sorts them by state and then depth
+        //Packets are built in blocks, each block into its own queue, which are then joined in block order
+        //Without a depth prepass opaque draws go strictly front to back instead, so hidden pixels are rejected before shading
+        render_queue.clear();
+        uint64_t (*sortKey)(GLuint, GLuint, GLuint, GLuint, GLuint, float) = depth_prepass ? makeSortKey : makeDepthFirstSortKey;
+        scene_program = show_overdraw ? overdraw_program : (deferred_shading ? gbuffer_program : rendering_program);
+
+        //The k'th visible object is drawn with draw id (object_base + k), its transform is gathered here
+        size_t drawCount = visible_objects.size() < max_objects ? visible_objects.size() : max_objects;
+        object_transforms.resize(drawCount);
+        int jobs = startPrepareJobs(drawCount);
+        #pragma omp parallel for schedule(dynamic) if(jobs > 1)
+        for(int job = 0; job < jobs; job++){
+            size_t begin = static_cast<size_t>(job) * prepare_block_size;
+            size_t end = begin + prepare_block_size < drawCount ? begin + prepare_block_size : drawCount;
+            for(size_t k = begin; k < end; k++){
+                uint32_t c = visible_objects[k];
+                const obj_t &obj = objects[object_cull_ids[c]];
+                object_transforms[k] = obj.obj2world;
+                render_packet_t packet = { scene_program, &mesh_arena, obj.texture_ID, obj.mesh, object_base + static_cast<GLuint>(k), 1 };
+                float depth = viewDepth((object_box_min[c] + object_box_max[c]) * 0.5f);
+                prepare_queues[job].push(sortKey(PASS_OPAQUE, scene_program, obj.texture_ID, 0, object_cull_ids[c], depth), packet);
+            }
+        }
+        finishPrepareJobs(jobs);
+
+        if(greedy_maze){
+            //Every visible chunk of the static maze mesh, all reading the identity transform
+            //With a lightmap, forward shading of the maze reads it instead of lighting the sun and sky
+            GLuint maze_program = (lightmap_program && scene_program == rendering_program) ? lightmap_program : scene_program;
+            maze_cull_list.cull(frame_frustum, visible_chunks, cull_stats);
+            jobs = startPrepareJobs(visible_chunks.size());
+            #pragma omp parallel for schedule(dynamic) if(jobs > 1)
+            for(int job = 0; job < jobs; job++){
+                size_t begin = static_cast<size_t>(job) * prepare_block_size;
+                size_t end = begin + prepare_block_size < visible_chunks.size() ? begin + prepare_block_size : visible_chunks.size();
+                for(size_t k = begin; k < end; k++){
+                    const maze_chunk_t &chunk = maze_chunks[maze_cull_ids[visible_chunks[k]]];
+                    if(occlusion_culling && !occlusion_buffer.testBox(chunk.boundsMin, chunk.boundsMax)){
+                        continue;
+                    }
+                    render_packet_t packet = { maze_program, &mesh_arena, 0, chunk.mesh, 0, 1 };
+                    float depth = viewDepth((chunk.boundsMin + chunk.boundsMax) * 0.5f);
+                    prepare_queues[job].push(sortKey(PASS_OPAQUE, maze_program, 0, 0, maze_mesh_id, depth), packet);
+                }
+            }
+            finishPrepareJobs(jobs);
+        } else if(!gpu_culling){
+            //All maze walls (and the outer boundary) in one instanced draw, instance i reads wall transform i
+            //(with gpu_culling the walls are culled and drawn from a compute pass in submitFrame instead)
+            render_packet_t packet = { scene_program, &mesh_arena, 0, wall_piece.mesh, wall_instance_base, static_cast<GLuint>(wall_transforms.size()) };
+            render_queue.push(sortKey(PASS_OPAQUE, scene_program, 0, 0, maze_mesh_id, 1.0f), packet);
+        }
+
+        render_queue.sort();
+    }
+
+    //Turn what prepareFrame decided into GL calls
+    void submitFrame(){
+        glViewport( 0, 0, info.windowWidth, info.windowHeight ); //Set Viewport information
+
         //Clear output
         glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         runtime_error_check(1);
 
         //Draw the skyCube!
-        drawSkyCube(curTime);
+        drawSkyCube();
 
         runtime_error_check(2);
 
-        /////////////////////////////////////////////////////////////////////////////////
-        // This would be where you want to call another program to render your 'stuff' //
-        // This could also go into a function for organizational ease                  //
-        /////////////////////////////////////////////////////////////////////////////////
-
-        //Set up obj->world transforms for each object (these could be modified for animation)
-        //Cube
-        //objects[0].obj2world = vmath::translate(1.5f, 0.2f, 1.5f) * vmath::scale(0.5f); // translate for object0
-        objects[0].obj2world = vmath::mat4::identity() * vmath::translate(1.0f, -2.0f, 1.0f);
-
-        for(int i = 0; i < objects.size(); i++ ){
-            //render loop, go through each object and render it!
-            glUseProgram(rendering_program); //activate the render program
-            glBindVertexArray(vertex_array_object); //Select base vao
-
-            //glBindTexture(GL_TEXTURE_2D, objects[i].texture_ID);
-
-            //Copy over all the transforms
-            glUniformMatrix4fv(transform_ID, 1,GL_FALSE, objects[i].obj2world); //Load in transform for this object
-            //TODO::These might only need to be loaded once (for all objects)
-            glUniformMatrix4fv(perspec_ID, 1,GL_FALSE, camera.proj_Matrix); //Load camera projection
-            glUniformMatrix4fv(toCam_ID, 1,GL_FALSE, camera.view_mat); //Load in view matrix for camera
-
-            //link to object buffer
-            glEnableVertexAttribArray(vertex_ID); //Recall the vertex ID
-            glBindBuffer(GL_ARRAY_BUFFER,objects[i].vertices_buffer_ID);//Link object buffer to vertex_ID
-            glVertexAttribPointer( //Index into the buffer
-                    vertex_ID, //Attribute in question
-                    4,         //Number of elements per vertex call (vec4)
-                    GL_FLOAT,  //Type of element
-                    GL_FALSE,  //Normalize? Nope
-                    0,         //No stride (steps between indexes)
-                    0);       //initial offset
-
-            /*
-            glEnableVertexAttribArray(uv_ID); //Recall the vertex ID
-            glBindBuffer(GL_ARRAY_BUFFER,objects[i].uv_buffer_ID);//Link object buffer to vertex_ID
-            glVertexAttribPointer( //Index into the buffer
-                    uv_ID, //Attribute in question
-                    2,         //Number of elements per vertex call (vec2)
-                    GL_FLOAT,  //Type of element
-                    GL_FALSE,  //Normalize? Nope
-                    0,         //No stride (steps between indexes)
-                    0);       //initial offset
-            */
-            glDrawArrays( GL_TRIANGLES, 0, objects[i].verticies.size());
+        //Uploads until endFrame() are streamed through frame_data's ring buffer
+        frame_data.beginFrame();
+        frame_data.updateFrame(frame_uniforms);
+        frame_data.updateObjects(object_transforms.data(), object_transforms.size(), object_base);
+        frame_data.updateObjects(shadow_object_transforms.data(), shadow_object_transforms.size(), shadow_base);
+
+        if(!greedy_maze && gpu_culling){
+            //Walls are culled on the GPU, the compute pass writes their draw commands before anything is drawn
+            wall_culler.cull(frame_frustum);
+        }
+
+        frame_data.bind();
+        cluster_lights.beginFrame();
+        cluster_lights.upload();
+        crowd.beginFrame();
+        crowd.upload();
+        shadows.beginFrame();
+        renderShadows();
+        sky_lighting.bind();
+        probe_grid.bind();
+        if(lightmap_texture){
+            sb7::glstate::bind_texture_unit(LIGHTMAP_TEXTURE_UNIT, GL_TEXTURE_2D, lightmap_texture);
+        }
+
+        //Deferred: the opaque passes below fill the G-buffer instead of the window
+        if(deferred_shading){
+            gbuffer.resize(info.windowWidth, info.windowHeight);
+            gbuffer.bindForWrite();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         }
+        const bool gpuWalls = !greedy_maze && gpu_culling;
+
+        //Depth prepass: lay down the depth of every opaque draw with no color writes and no fragment shader,
+        //then shade with GL_EQUAL so each pixel runs the real fragment shader once
+        if(depth_prepass){
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            render_queue.submitDepth(depth_program);
+            if(gpuWalls){
+                mesh_arena.bindPositionOnly();
+                wall_culler.draw();
+            }
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            sb7::glstate::depth_mask(GL_FALSE); //Already there
+            sb7::glstate::depth_func(GL_EQUAL);
+        }
+
+        //Overdraw view: every shaded fragment adds to the color, and the query counts them
+        if(show_overdraw){
+            readOverdrawQuery();
+            glBeginQuery(GL_SAMPLES_PASSED, overdraw_queries[overdraw_query_frame & 1]);
+            sb7::glstate::enable(GL_BLEND);
+            glBlendFunc(GL_ONE, GL_ONE);
+        }
+
+        //Draws that share a program, vao and texture are merged into one multi-draw by the queue
+        render_queue.submit();
+        if(gpuWalls){
+            sb7::glstate::use_program(scene_program);
+            mesh_arena.bind();
+            wall_culler.draw();
+        }
+
+        if(show_overdraw){
+            sb7::glstate::disable(GL_BLEND);
+            glEndQuery(GL_SAMPLES_PASSED);
+            overdraw_query_frame++;
+        }
+        if(depth_prepass){
+            sb7::glstate::depth_func(GL_LESS);
+            sb7::glstate::depth_mask(GL_TRUE);
+        }
+
+        //Skinned characters are not in the depth prepass (depth_vs.glsl can't bend them), they test and write depth as usual
+        crowd.draw(skin_program);
+        if(deferred_shading){
+            lightGBuffer();
+        }
+        frame_data.endFrame(); //Fence this frame's uploads
+        cluster_lights.endFrame();
+        crowd.endFrame();
+        shadows.endFrame();
 
         runtime_error_check(4);
     }
 
-    void drawSkyCube(double curTime){
+    //Sun shadow maps: static pages the cache is missing, then the cascades put together from the cache
+    //with the dynamic objects drawn over them
+    void renderShadows(){
+        sb7::glstate::use_program(shadow_program);
+        mesh_arena.bindPositionOnly();
+        for(size_t i = 0; i < shadows.getDirtyPageCount(); i++){
+            const vmath::mat4 &lightViewProjection = shadows.beginPage(i);
+            glUniformMatrix4fv(shadow_vp_location, 1, GL_FALSE, lightViewProjection);
+            drawStaticCasters(lightViewProjection);
+        }
+        shadows.composeCascades();
+
+        //Dynamic casters were picked per cascade in prepareFrame (see collectShadowCasters)
+        for(int c = 0; c < SHADOW_CASCADES; c++){
+            const vmath::mat4 &lightViewProjection = shadows.beginCascade(c);
+            if(!shadow_cascade_objects[c].empty()){
+                sb7::glstate::use_program(shadow_program);
+                glUniformMatrix4fv(shadow_vp_location, 1, GL_FALSE, lightViewProjection);
+                mesh_arena.bindPositionOnly();
+                for(size_t k = 0; k < shadow_cascade_objects[c].size(); k++){
+                    GLuint slot = shadow_cascade_objects[c][k];
+                    mesh_arena.draw(objects[shadow_object_ids[slot]].mesh, 1, shadow_base + slot);
+                }
+            }
+            if(!shadow_cascade_characters[c].empty()){
+                sb7::glstate::use_program(skin_shadow_program);
+                glUniformMatrix4fv(skin_shadow_vp_location, 1, GL_FALSE, lightViewProjection);
+                crowd.drawDepth(skin_shadow_program, shadow_cascade_characters[c]);
+            }
+        }
+        shadows.endPasses(info.windowWidth, info.windowHeight);
+        shadows.upload();
+    }
+
+    //Dynamic shadow casters of every cascade, tested against the cascade's light frustum rather than the camera's:
+    //something behind the camera, or hidden by walls, can still throw its shadow into view
+    //Each caster gets one transform slot (each character one pose) however many cascades it falls in
+    void collectShadowCasters(){
+        const shadow_uniforms_t &cascades = shadows.getUniforms();
+        const int objectCount = static_cast<int>(objects.size());
+        shadow_object_list.clear();
+        for(int i = 0; i < objectCount; i++){
+            shadow_object_list.add(object_world_min[i], object_world_max[i]);
+        }
+        shadow_object_slots.assign(objectCount, -1);
+        shadow_object_ids.clear();
+        shadow_object_transforms.clear();
+
+        //Characters drawn in the view are posed first, in draw order, the ones only casting go after them
+        crowd_pose_list = crowd_draw_list;
+        crowd_pose_slots.assign(crowd.getCharacterCount(), -1);
+        for(size_t k = 0; k < crowd_draw_list.size(); k++){
+            crowd_pose_slots[crowd_draw_list[k]] = static_cast<int>(k);
+        }
+
+        cull_stats_t casterStats = {0, 0}; //Not part of the scene counts
+        for(int c = 0; c < SHADOW_CASCADES; c++){
+            frustum_t lightFrustum = extractFrustum(cascades.cascadeViewProjection[c]);
+
+            shadow_cascade_objects[c].clear();
+            shadow_object_list.cull(lightFrustum, shadow_candidates, casterStats);
+            for(size_t k = 0; k < shadow_candidates.size(); k++){
+                uint32_t i = shadow_candidates[k];
+                if(shadow_object_slots[i] < 0){
+                    if(shadow_object_transforms.size() >= max_shadow_objects){
+                        continue;
+                    }
+                    shadow_object_slots[i] = static_cast<int>(shadow_object_transforms.size());
+                    shadow_object_ids.push_back(i);
+                    shadow_object_transforms.push_back(objects[i].obj2world);
+                }
+                shadow_cascade_objects[c].push_back(static_cast<uint32_t>(shadow_object_slots[i]));
+            }
+
+            shadow_cascade_characters[c].clear();
+            crowd_cull_list.cull(lightFrustum, shadow_candidates, casterStats);
+            for(size_t k = 0; k < shadow_candidates.size(); k++){
+                uint32_t i = shadow_candidates[k];
+                if(crowd_pose_slots[i] < 0){
+                    crowd_pose_slots[i] = static_cast<int>(crowd_pose_list.size());
+                    crowd_pose_list.push_back(i);
+                }
+                shadow_cascade_characters[c].push_back(static_cast<uint32_t>(crowd_pose_slots[i]));
+            }
+        }
+    }
+
+    //Direction the sun's light travels, it circles the y axis with sun_angle
+    vmath::vec3 sunDirection() const{
+        return vmath::vec3(cosf(sun_angle) * 0.4f, -1.0f, sinf(sun_angle) * 0.4f);
+    }
+
+    //Sky and sun (and their bounces) on the static maze, baked once at startup (see lightmapBaker.h)
+    //The bake uses the sun where it starts, moving it afterwards (L key) is not baked again
+    void bakeLightmap(){
+        if(sky_images.size == 0){
+            printf("Lightmap: sky cube images missing, baking the sun only\n");
+        }
+        lightmap_settings_t settings = defaultLightmapSettings();
+        settings.sunDirection = sunDirection();
+        settings.sunColor = sun_color;
+
+        LightmapBaker baker;
+        baker.bake(maze_vertices, maze_indices, sky_images, settings);
+        const lightmap_stats_t &stats = baker.getStats();
+        printf("Lightmap: %dx%d, %zu charts, %zu texels, %.1f M rays on %d threads\n",
+               stats.width, stats.height, stats.charts, stats.texels, stats.rays / 1e6, stats.threads);
+        printf("Lightmap bake: unwrap %.3f s, bvh %.3f s, trace %.3f s, denoise %.3f s, total %.3f s\n",
+               stats.unwrapSeconds, stats.bvhSeconds, stats.traceSeconds, stats.denoiseSeconds, stats.totalSeconds);
+
+        if(!baker.save(".\\bin\\media\\lightmap.ktx")){
+            printf("Lightmap: could not write lightmap.ktx\n");
+        }
+        lightmap_texture = baker.createTexture();
+    }
+
+    //Indirect light for everything moving through the maze, baked once at startup (see probeGrid.h)
+    //Like the lightmap, the bounces use the sun where it starts
+    void bakeProbes(){
+        probe_settings_t settings = defaultProbeSettings();
+        settings.sunDirection = sunDirection();
+        settings.sunColor = sun_color;
+
+        probe_grid.bake(maze, sky_images, settings);
+        const probe_stats_t &stats = probe_grid.getStats();
+        printf("Light probes: %dx%dx%d grid, %zu traced, %.1f M rays on %d threads, bvh %.3f s, trace %.3f s\n",
+               stats.width, stats.height, PROBE_LAYERS, stats.probes, stats.rays / 1e6, stats.threads,
+               stats.bvhSeconds, stats.traceSeconds);
+        probe_grid.upload();
+    }
+
+    //Deferred light pass: every covered pixel of the G-buffer is lit once, over the sky already in the window
+    void lightGBuffer(){
+        gbuffer.bindForRead();
+        glViewport(0, 0, info.windowWidth, info.windowHeight);
+        sb7::glstate::disable(GL_DEPTH_TEST);
+        sb7::glstate::use_program(deferred_program);
+        sb7::glstate::bind_vertex_array(fullscreen_vao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        sb7::glstate::enable(GL_DEPTH_TEST);
+    }
+
+    //Maze walls inside one shadow page
+    void drawStaticCasters(const vmath::mat4 &lightViewProjection){
+        if(greedy_maze){
+            cull_stats_t casterStats = {0, 0}; //Not part of the scene counts
+            shadow_caster_list.cull(extractFrustum(lightViewProjection), shadow_casters, casterStats);
+            for(size_t k = 0; k < shadow_casters.size(); k++){
+                mesh_arena.draw(maze_chunks[shadow_casters[k]].mesh, 1, 0);
+            }
+        } else {
+            mesh_arena.draw(wall_piece.mesh, static_cast<GLuint>(wall_transforms.size()), wall_instance_base);
+        }
+    }
+
+    //Pick up the shaded fragment count of the previous overdraw frame, without waiting if the GPU is not done with it
+    void readOverdrawQuery(){
+        if(overdraw_query_frame == 0){
+            return;
+        }
+        GLuint query = overdraw_queries[(overdraw_query_frame - 1) & 1];
+        GLuint available = 0;
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available){
+            GLuint samples = 0;
+            glGetQueryObjectuiv(query, GL_QUERY_RESULT, &samples);
+            overdraw = static_cast<double>(samples) / (static_cast<double>(info.windowWidth) * info.windowHeight);
+        }
+    }
+
+    //Make sure there is an empty queue for every block of items, returns the number of blocks
+    int startPrepareJobs(size_t items){
+        int jobs = static_cast<int>((items + prepare_block_size - 1) / prepare_block_size);
+        if(prepare_queues.size() < static_cast<size_t>(jobs)){
+            prepare_queues.resize(jobs);
+        }
+        for(int job = 0; job < jobs; job++){
+            prepare_queues[job].clear();
+        }
+        return jobs;
+    }
+
+    //Move the packets of every block into render_queue (in block order, so the result never depends on thread timing)
+    void finishPrepareJobs(int jobs){
+        for(int job = 0; job < jobs; job++){
+            render_queue.append(prepare_queues[job]);
+        }
+    }
+
+    //How far from the camera anything can be seen, in tiles: the far plane's corners are farther than its center
+    float pvsViewDistance() const {
+        float t = tanf(vmath::radians(camera.fovy * 0.5f));
+        float cornerFactor = sqrtf(1.0f + t * t * (1.0f + camera.aspect * camera.aspect));
+        return camera.camera_far * cornerFactor / MAZE_TILE_SIZE;
+    }
+
+    //(Re)build the PVS for the current view distance, the camera's cell is decoded again next frame
+    void buildPVS(){
+        pvs_distance = pvsViewDistance();
+        maze_pvs.build(maze, pvs_distance);
+        pvs_cell_valid = false;
+    }
+
+    //Decode the PVS of the camera's cell when the camera has moved into another cell
+    //Outside the maze (or inside a wall) there is no PVS and everything goes to frustum culling
+    void updatePVS(){
+        int tileX, tileZ;
+        worldToMazeTile(camera.position[0], camera.position[2], tileX, tileZ);
+        if(pvs_cell_valid && tileX == pvs_tile_x && tileZ == pvs_tile_z){
+            return;
+        }
+        pvs_cell_valid = true;
+        pvs_tile_x = tileX;
+        pvs_tile_z = tileZ;
+        pvs_active = maze_pvs.decode(tileX, tileZ, pvs_window);
+        if(greedy_maze){
+            rebuildMazeCullList();
+        }
+    }
+
+    //Could a world space box be seen from the camera's cell
+    //The PVS is 2D, anything reaching over the walls is always kept
+    bool pvsTestBox(const vmath::vec3 &worldMin, const vmath::vec3 &worldMax){
+        if(!pvs_active || worldMax[1] > MAZE_WALL_HALF_HEIGHT){
+            return true;
+        }
+        int x0, z0, x1, z1;
+        worldToMazeTile(worldMin[0], worldMin[2], x0, z0);
+        worldToMazeTile(worldMax[0], worldMax[2], x1, z1);
+        //Not over the maze at all (the PVS only knows maze tiles)
+        if(x1 < -1 || z1 < -1 || x0 > maze.getWidth() || z0 > maze.getHeight()){
+            return true;
+        }
+        return pvs_window.testRange(x0, z0, x1, z1);
+    }
+
+    //Distance from the camera scaled to 0 (camera) .. 1 (far plane), for sort keys
+    float viewDepth(const vmath::vec3 &point){
+        return vmath::length(point - camera.position) / camera.camera_far;
+    }
+
+    //Rasterize the wall runs closest to the camera (and inside the frustum) into the occlusion buffer
+    void renderOccluders(const frustum_t &frustum, const vmath::mat4 &viewProjection){
+        cull_stats_t occluderStats = {0, 0}; //Not part of the scene counts
+        occluder_cull_list.cull(frustum, visible_occluders, occluderStats);
+
+        //Sort by distance to the camera, only nearby walls cover enough of the screen to be worth it
+        occluder_order.clear();
+        for(size_t k = 0; k < visible_occluders.size(); k++){
+            uint32_t i = visible_occluders[k];
+            vmath::vec3 center = (occluder_min[i] + occluder_max[i]) * 0.5f;
+            float dx = center[0] - camera.position[0];
+            float dz = center[2] - camera.position[2];
+            occluder_order.push_back(std::make_pair(dx * dx + dz * dz, i));
+        }
+        size_t count = occluder_order.size() < max_occluders ? occluder_order.size() : max_occluders;
+        std::partial_sort(occluder_order.begin(), occluder_order.begin() + count, occluder_order.end());
+        for(size_t k = 0; k < count; k++){
+            uint32_t i = occluder_order[k].second;
+            occlusion_buffer.addOccluder(occluder_min[i], occluder_max[i]);
+        }
+        occlusion_buffer.render(viewProjection);
+    }
+
+    //Put every maze chunk that touches a visible tile into the chunk cull list
+    void rebuildMazeCullList(){
+        maze_cull_list.clear();
+        maze_cull_ids.clear();
+        for(size_t i = 0; i < maze_chunks.size(); i++){
+            const maze_chunk_t &chunk = maze_chunks[i];
+            if(pvs_active && !pvs_window.testRange(chunk.tileX0, chunk.tileZ0, chunk.tileX1, chunk.tileZ1)){
+                continue;
+            }
+            maze_cull_list.add(chunk.boundsMin, chunk.boundsMax);
+            maze_cull_ids.push_back(i); //Index in the list -> index in maze_chunks
+        }
+        pvs_rejected_chunks = maze_chunks.size() - maze_cull_ids.size();
+    }
+
+    //Put per-frame counters in the window title (a couple times a second so it is readable)
+    double last_stats_time = 0.0;
+    void showStats(double curTime){
+        if(curTime - last_stats_time < 0.5){
+            return;
+        }
+        last_stats_time = curTime;
+
+        char overdrawText[32];
+        if(show_overdraw){
+            snprintf(overdrawText, sizeof(overdrawText), "%.2f per pixel", overdraw);
+        } else {
+            snprintf(overdrawText, sizeof(overdrawText), "off (O)");
+        }
 
-        glDepthMask( GL_FALSE ); //Used to force skybox 'into' the back, making sure everything is rendered over it
-        glUseProgram( sc_program ); //Select the skycube program
+        char title[1024];
+        const occlusion_stats_t &occlusion = occlusion_buffer.getStats();
+        const render_queue_stats_t &queue = render_queue.getStats();
+        const sb7::glstate::counters &gl = sb7::glstate::frame_counters();
+        const cluster_stats_t &lighting = cluster_lights.getStats();
+        const shadow_stats_t &shadowStats = shadows.getStats();
+        const skin_stats_t &skin = crowd.getStats();
+        snprintf(title, sizeof(title), "%s | culling: %zu tested, %zu visible | pvs: %zu rejected | occlusion: %zu occluders, %zu occluded"
+                 " | %zu draws in %zu calls, switches (sorted/unsorted): program %zu/%zu vao %zu/%zu texture %zu/%zu"
+                 " | gl state: %u issued, %u skipped | stream waits since start: %u (%.1f ms) | prepare %.2f ms, submit %.2f ms"
+                 " | frame %.2f ms, jitter %.2f ms (max %.2f) | %s, %zu depth calls | overdraw %s"
+                 " | lights: %zu (%zu visible), %zu in %zu clusters, %zu dropped, bin %.2f ms"
+                 " | shadows: %zu pages drawn, %zu copied, %zu cached"
+                 " | skinning: %zu/%zu characters (+%zu for shadows), %zu joints, %zu vertices, pose %.2f ms, palettes %zu KB, gpu %.2f ms | renderer: %s",
+                 info.title, cull_stats.tested, cull_stats.visible, pvs_rejected + pvs_rejected_chunks,
+                 occlusion.occluders, occlusion.occluded,
+                 queue.packets, queue.drawCalls, queue.programSwitches, queue.unsortedProgramSwitches,
+                 queue.vaoSwitches, queue.unsortedVaoSwitches, queue.textureSwitches, queue.unsortedTextureSwitches,
+                 gl.total_issued(), gl.total_skipped(), frame_data.getStream().wait_count(), frame_data.getStream().wait_seconds() * 1000.0,
+                 prepare_ms, submit_ms,
+                 pacer.smoothed_seconds() * 1000.0, pacer.mean_jitter_seconds() * 1000.0, pacer.max_jitter_seconds() * 1000.0,
+                 depth_prepass ? "depth prepass" : "front to back", queue.depthDrawCalls, overdrawText,
+                 lighting.lights, lighting.visibleLights, lighting.indices, lighting.usedClusters, lighting.dropped,
+                 lighting.binSeconds * 1000.0, shadowStats.pagesDrawn, shadowStats.pagesCopied, shadowStats.cachedPages,
+                 skin.posed, skin.characters, skin.shadowOnly, skin.joints, skin.vertices, skin.poseSeconds * 1000.0, skin.paletteBytes / 1024,
+                 skin.gpuMilliseconds,
+                 deferred_shading ? "deferred" : "forward");
+        setWindowTitle(title);
+    }
+
+    void drawSkyCube(){
+
+        sb7::glstate::depth_mask( GL_FALSE ); //Used to force skybox 'into' the back, making sure everything is rendered over it
+        sb7::glstate::use_program( sc_program ); //Select the skycube program
         glUniformMatrix4fv( sc_Perspective, 1, GL_FALSE, camera.proj_Matrix); //Update the projection matrix (if needed)
         glUniformMatrix4fv( sc_Camera, 1, GL_FALSE, camera.view_mat_no_translation); //Update the projection matrix (if needed)
-        glActiveTexture( GL_TEXTURE0 ); //Make sure we are using the CUBE_MAP texture we already set up
-        glBindTexture( GL_TEXTURE_CUBE_MAP, sc_map_texture ); //Link to the texture
-        glBindVertexArray( sc_vertex_array_object ); // Set up the vertex array
+        sb7::glstate::bind_texture_unit( 0, GL_TEXTURE_CUBE_MAP, sc_map_texture ); //Link to the CUBE_MAP texture we already set up
+        sb7::glstate::bind_vertex_array( sc_vertex_array_object ); // Set up the vertex array
         glDrawArrays( GL_TRIANGLES, 0, skycube_vertices.size() ); //Start drawing triangles
-        glDepthMask( GL_TRUE ); //Turn depth masking back on
+        sb7::glstate::depth_mask( GL_TRUE ); //Turn depth masking back on
 
         runtime_error_check();
     }
@@ -419,122 +1321,190 @@ class test_app : public sb7::application{
         info.windowHeight = h;
         //Recalculate the projection matrix used by camera
         calcProjection(camera); 
+        //A wider window sees farther out of the frustum's corners than the PVS was built for
+        if(pvs_distance > 0.0f && pvsViewDistance() > pvs_distance){
+            buildPVS();
+        }
     }
 
     const float player_box_radius = 0.7f;
     void onKey(int key, int action) {
-        //If something did happen
-      if (action) {
-            //WASD movement locked to the x,z plane
-            double speed = 0.3;
-            double x1, x2, z1, z2;
-            x1 = camera.position[0];
-            z1 = camera.position[2];
-            x2 = camera.focus[0];
-            z2 = camera.focus[2];
-            //Angle of rotation of the lookat around camera
-            double theta = atan(((z2 - z1))/(x2 - x1)); 
-
-            //If outside the range of arctan, then add 180 to get to the other two quadrents
-            if(x2 - x1 < 0){
-                theta += M_PI;
-            }
-
-            //Calculate the new theoretical position of the camera based on what key is pressed
-            float newCamX = camera.position[0];
-            float newCamZ = camera.position[2];
+        //Only remember which movement keys are down, update() does the moving
+        const bool down = (action != GLFW_RELEASE);
+        switch (key) {
+            case 'W': keys_held[0] = down; break;
+            case 'A': keys_held[1] = down; break;
+            case 'S': keys_held[2] = down; break;
+            case 'D': keys_held[3] = down; break;
+        }
+
+        //Rendering modes, so the cheaper one can be picked per scene
+        if(action == GLFW_PRESS){
             switch (key) {
-                case 'W':
-                    newCamX += speed * cos(theta);
-                    newCamZ += speed * sin(theta);
-                    break;
-                case 'A': 
-                    newCamX += speed * cos(theta - M_PI/2);
-                    newCamZ += speed * sin(theta - M_PI/2);
-                    break;
-                case 'S':
-                    newCamX += speed * cos(theta + M_PI);
-                    newCamZ += speed * sin(theta + M_PI);
-                    break;
-                case 'D':
-                    newCamX += speed * cos(theta + M_PI/2);
-                    newCamZ += speed * sin(theta + M_PI/2);
+                case 'P': depth_prepass = !depth_prepass; break;
+                case 'O': //Counts shaded fragments of the forward renderer, deferred shades each pixel once anyway
+                    if(!deferred_shading){
+                        show_overdraw = !show_overdraw; overdraw_query_frame = 0; overdraw = 0.0;
+                    }
                     break;
+                case 'L': sun_angle += 0.1f; break; //Moving the sun throws away the shadow cache
+                case 'B': runBenchmarks(); break;
+            }
+        }
+    }
+
+    //CPU benchmarks of the systems the scene only uses a little of, printed to the console (B)
+    //Kept off the startup path, they take a while and normal runs don't need them
+    void runBenchmarks(){
+        //How well the clip format holds up with a lot more tracks than the scene has (see animationClip.h)
+        anim_benchmark_t animBenchmark;
+        benchmarkAnimation(1000, 300, animBenchmark);
+        printf("Animation: %zu tracks, %zu of %zu keys kept (%zu KB of %zu KB), max error %.4f / %.4f rad / %.4f, compressed in %.3f s\n",
+               animBenchmark.tracks, animBenchmark.clip.keys, animBenchmark.clip.rawKeys, animBenchmark.clip.bytes / 1024,
+               animBenchmark.clip.rawBytes / 1024, animBenchmark.clip.maxError[ANIM_TRANSLATION], animBenchmark.clip.maxError[ANIM_ROTATION],
+               animBenchmark.clip.maxError[ANIM_SCALE], animBenchmark.clip.compressSeconds);
+        printf("Animation sampling: %.1f M tracks/s with cursors (SSE), %.1f M tracks/s with binary search, largest difference %g\n",
+               animBenchmark.tracksPerSecond / 1e6, animBenchmark.referenceTracksPerSecond / 1e6, animBenchmark.maxDifference);
+
+        //How long a deep scene graph would take to keep up to date (see transformHierarchy.h)
+        hierarchy_benchmark_t hierarchyBenchmark;
+        benchmarkTransformHierarchy(4096, 300, hierarchyBenchmark);
+        printf("Transform hierarchy: %zu nodes %d deep, update %.3f ms all animated, %.3f ms with 1 in 16 animated (%zu world matrices), %.4f ms unchanged\n",
+               hierarchyBenchmark.nodes, hierarchyBenchmark.depth, hierarchyBenchmark.allDirtyMilliseconds, hierarchyBenchmark.someDirtyMilliseconds,
+               hierarchyBenchmark.someDirtyUpdated, hierarchyBenchmark.cleanMilliseconds);
+
+        //How fast the CPU could skin the crowd, and that the SSE path agrees with the scalar one
+        skin_benchmark_t skinBenchmark;
+        benchmarkCpuSkinning(max_characters, 30, skinBenchmark);
+        printf("CPU skinning (SSE): %d characters x %d frames, %.1f M vertices/s on %d threads, pose %.3f ms, skin %.3f ms a frame, largest difference from scalar %g / %g (normal)\n",
+               skinBenchmark.characters, skinBenchmark.frames, skinBenchmark.verticesPerSecond / 1e6, skinBenchmark.threads,
+               skinBenchmark.poseSeconds * 1000.0 / skinBenchmark.frames, skinBenchmark.skinSeconds * 1000.0 / skinBenchmark.frames,
+               skinBenchmark.maxPositionDifference, skinBenchmark.maxNormalDifference);
+    }
+
+    //Move the simulated player distance units in the direction of a WASD key, sliding along whatever it runs into
+    void movePlayer(int key, float distance) {
+        //WASD movement locked to the x,z plane
+        double speed = distance;
+        double x1, x2, z1, z2;
+        x1 = player_position[0];
+        z1 = player_position[2];
+        x2 = player_position[0] + camera_look[0];
+        z2 = player_position[2] + camera_look[2];
+        //Angle of rotation of the lookat around camera
+        double theta = atan(((z2 - z1))/(x2 - x1)); 
+
+        //If outside the range of arctan, then add 180 to get to the other two quadrents
+        if(x2 - x1 < 0){
+            theta += M_PI;
+        }
+
+        //Calculate the new theoretical position of the camera based on what key is pressed
+        float newCamX = player_position[0];
+        float newCamZ = player_position[2];
+        switch (key) {
+            case 'W':
+                newCamX += speed * cos(theta);
+                newCamZ += speed * sin(theta);
+                break;
+            case 'A': 
+                newCamX += speed * cos(theta - M_PI/2);
+                newCamZ += speed * sin(theta - M_PI/2);
+                break;
+            case 'S':
+                newCamX += speed * cos(theta + M_PI);
+                newCamZ += speed * sin(theta + M_PI);
+                break;
+            case 'D':
+                newCamX += speed * cos(theta + M_PI/2);
+                newCamZ += speed * sin(theta + M_PI/2);
+                break;
+        }
+
+        //Things that can be collided with: every object plus the wall tiles around the camera
+        //Walls come straight from the maze grid, so this doesn't grow with the size of the maze
+        std::vector<vmath::vec2> colliders;
+        for(size_t i = 0; i < objects.size(); i++){
+            colliders.push_back(vmath::vec2(objects[i].obj2world[3][0], objects[i].obj2world[3][2]));
+        }
+        int camTileX, camTileZ;
+        worldToMazeTile(newCamX, newCamZ, camTileX, camTileZ);
+        for(int tz = camTileZ - 1; tz <= camTileZ + 1; tz++){
+            for(int tx = camTileX - 1; tx <= camTileX + 1; tx++){
+                //Only the maze and its boundary ring have walls
+                if(tx >= -1 && tz >= -1 && tx <= maze.getWidth() && tz <= maze.getHeight() && maze.isWall(tx, tz)){
+                    vmath::vec3 wallPos = mazeTileToWorld(tx, tz);
+                    colliders.push_back(vmath::vec2(wallPos[0], wallPos[2]));
+                }
             }
+        }
 
-            //Check for collisions
-            //If there is a collision, then shorten the end location of the camera
-            for(int i = 0; i < objects.size(); i++){
-                float objX = objects[i].obj2world[3][0];
-                float objZ = objects[i].obj2world[3][2];
-                float objRad = 1.0f;
-
-                float clipX = 0;
-                float clipZ = 0;
-                //Object is +x,+z to the camera
-                if(objX - newCamX >= 0 && objZ - newCamZ >= 0){
-                    clipX = (objX - objRad) - (newCamX + player_box_radius);
-                    clipZ = (objZ - objRad) - (newCamZ + player_box_radius);
-                    if(clipX < 0 && clipZ  < 0){
-                        //std::cout << "Overlap +x +z" << std::endl;
-                        if(-clipX > -clipZ){
-                            newCamZ += clipZ;
-                        } else{
-                            newCamX += clipX;
-                        }
+        //Check for collisions
+        //If there is a collision, then shorten the end location of the camera
+        for(size_t i = 0; i < colliders.size(); i++){
+            float objX = colliders[i][0];
+            float objZ = colliders[i][1];
+            float objRad = MAZE_TILE_SIZE / 2.0f;
+
+            float clipX = 0;
+            float clipZ = 0;
+            //Object is +x,+z to the camera
+            if(objX - newCamX >= 0 && objZ - newCamZ >= 0){
+                clipX = (objX - objRad) - (newCamX + player_box_radius);
+                clipZ = (objZ - objRad) - (newCamZ + player_box_radius);
+                if(clipX < 0 && clipZ  < 0){
+                    //std::cout << "Overlap +x +z" << std::endl;
+                    if(-clipX > -clipZ){
+                        newCamZ += clipZ;
+                    } else{
+                        newCamX += clipX;
                     }
                 }
-                //Object is +x, -z to the camera
-                else if(objX - newCamX >= 0 && objZ - newCamZ < 0){
-                    clipX = (objX - objRad) - (newCamX + player_box_radius);
-                    clipZ = (newCamZ - player_box_radius) - (objZ + objRad);
-                    if( clipX < 0 && clipZ < 0){
-                        //std::cout << "Overlap +x -z" << std::endl;
-                        if(-clipX > -clipZ){
-                            newCamZ -= clipZ;
-                        } else{
-                            newCamX += clipX;
-                        }
+            }
+            //Object is +x, -z to the camera
+            else if(objX - newCamX >= 0 && objZ - newCamZ < 0){
+                clipX = (objX - objRad) - (newCamX + player_box_radius);
+                clipZ = (newCamZ - player_box_radius) - (objZ + objRad);
+                if( clipX < 0 && clipZ < 0){
+                    //std::cout << "Overlap +x -z" << std::endl;
+                    if(-clipX > -clipZ){
+                        newCamZ -= clipZ;
+                    } else{
+                        newCamX += clipX;
                     }
                 }
-                //Object is -x, +z to the camera
-                else if(objX - newCamX < 0 && objZ - newCamZ >= 0){
-                    clipX = (newCamX - player_box_radius) - (objX + objRad);
-                    clipZ = (objZ - objRad) - (newCamZ + player_box_radius);
-                    if(clipX < 0 && clipZ < 0){
-                        //std::cout << "Overlap -x +z" << std::endl;
-                        if(-clipX > -clipZ){
-                            newCamZ += clipZ;
-                        } else{
-                            newCamX -= clipX;
-                        }
+            }
+            //Object is -x, +z to the camera
+            else if(objX - newCamX < 0 && objZ - newCamZ >= 0){
+                clipX = (newCamX - player_box_radius) - (objX + objRad);
+                clipZ = (objZ - objRad) - (newCamZ + player_box_radius);
+                if(clipX < 0 && clipZ < 0){
+                    //std::cout << "Overlap -x +z" << std::endl;
+                    if(-clipX > -clipZ){
+                        newCamZ += clipZ;
+                    } else{
+                        newCamX -= clipX;
                     }
                 }
-                //Object is -x, -z to the camera
-                else{
-                    clipX = (newCamX - player_box_radius) - (objX + objRad);
-                    clipZ = (newCamZ - player_box_radius) - (objZ + objRad);
-                    if(clipX < 0 && clipZ < 0){
-                        //std::cout << "Overlap -x -z" << std::endl;
-                        if(-clipX > -clipZ){
-                            newCamZ -= clipZ;
-                        } else{
-                            newCamX -= clipX;
-                        }
+            }
+            //Object is -x, -z to the camera
+            else{
+                clipX = (newCamX - player_box_radius) - (objX + objRad);
+                clipZ = (newCamZ - player_box_radius) - (objZ + objRad);
+                if(clipX < 0 && clipZ < 0){
+                    //std::cout << "Overlap -x -z" << std::endl;
+                    if(-clipX > -clipZ){
+                        newCamZ -= clipZ;
+                    } else{
+                        newCamX -= clipX;
                     }
                 }
             }
-
-            //Move the camera to it's new pos
-            camera.position[0] = newCamX;
-            camera.position[2] = newCamZ;
-
-            //Change lookat to follow direction
-            int x, y;
-            getMousePosition(x, y);
-            onMouseMove(x, y);
         }
 
+        //Move the player to it's new pos (the camera follows in prepareFrame)
+        player_position[0] = newCamX;
+        player_position[2] = newCamZ;
     }
 
     double offsetX = 0;
@@ -583,6 +1553,7 @@ class test_app : public sb7::application{
         //std::cout << "LookatX = " << lookatX << " | LookatY = " << lookatY << " | LookatZ = " << lookatZ << std::endl;
 
         //The focus is relative to the camera position so add the postion to the lookat
+        camera_look = vmath::vec3(lookatX, lookatY, lookatZ);
         camera.focus[0] = lookatX + camera.position[0];
         camera.focus[1] = lookatY + camera.position[1];
         camera.focus[2] = lookatZ + camera.position[2];
@@ -630,14 +1601,67 @@ class test_app : public sb7::application{
     private:
         //Scene Rendering Information
         GLuint rendering_program; //Program reference for scene generation
-        GLuint vertex_array_object;
-        
-        //Uniform attributes for Scene Render
-        GLuint transform_ID; //Dynamic transform of object
-        GLuint perspec_ID;   //Perspective transform
-        GLuint toCam_ID;     //World to Camera transform
-        GLuint vertex_ID;    //This will be mapped to different objects as we load them
-        GLuint uv_ID;
+        GLuint depth_program;     //Depth prepass (depth_vs.glsl only)
+        GLuint overdraw_program;  //vs.glsl + overdraw_fs.glsl
+        GLuint scene_program;     //Program the scene is shaded with this frame (one of the two above)
+
+        //Opaque drawing modes (P / O keys)
+        bool depth_prepass = true;     //Depth only pass first, then shade with GL_EQUAL (otherwise front to back order)
+        bool show_overdraw = false;    //Additive view of how often each pixel is shaded, plus the average
+        GLuint overdraw_queries[2];    //GL_SAMPLES_PASSED, alternating so last frame's can be read without a stall
+        GLuint overdraw_query_frame = 0;
+        double overdraw = 0.0;         //Shaded fragments per pixel (scene only, not the sky)
+        MeshArena mesh_arena;     //Shared vertex/index storage (and vao) for every object
+        FrameData frame_data;     //Per-frame camera uniform buffer and per-object transform buffer
+        static const GLuint max_objects = 1 << 16; //Capacity of the transform buffer
+
+        RenderQueue render_queue; //Every draw of the frame, sorted to keep state changes down
+        static const GLuint maze_mesh_id = 1023;  //Sort key mesh id of the maze (objects use their index)
+
+        //Per frame scratch lists (kept around so they don't reallocate every frame)
+        std::vector<vmath::mat4> object_transforms;    //Transform of each visible object, in draw id order
+        std::vector<vmath::vec3> object_world_min;     //World box of every object
+        std::vector<vmath::vec3> object_world_max;
+        std::vector<unsigned char> object_keep;        //Per item results of the threaded loops (kept / thrown away)
+
+        //Frame preparation (see render())
+        static const int prepare_block_size = 256;     //Items handed to a thread at a time
+        std::vector<RenderQueue> prepare_queues;       //One per block, joined into render_queue
+        frame_uniforms_t frame_uniforms;               //Camera info for this frame
+        frustum_t frame_frustum;                       //Camera frustum for this frame
+        double prepare_ms = 0.0;                       //CPU time of the two halves of the last frame
+        double submit_ms = 0.0;
+
+        //Frustum culling
+        CullList object_cull_list;             //Rebuilt every frame (objects move)
+        CullList maze_cull_list;               //Built once (chunks are static)
+        std::vector<uint32_t> visible_objects; //Indices into objects
+        std::vector<uint32_t> visible_chunks;  //Indices into maze_chunks
+        cull_stats_t cull_stats;               //Tested/visible this frame
+        std::vector<uint32_t> object_cull_ids; //Cull list index -> objects index
+        std::vector<uint32_t> maze_cull_ids;   //Cull list index -> maze_chunks index
+
+        //Precomputed visibility between maze cells
+        MazePVS maze_pvs;
+        float pvs_distance = 0.0f;             //View distance (tiles) maze_pvs was built for
+        pvs_window_t pvs_window;               //Decoded set of the camera's cell
+        bool pvs_active = false;               //pvs_window is usable (camera is in an empty maze cell)
+        bool pvs_cell_valid = false;           //pvs_tile_x/z hold the cell that was last decoded
+        int pvs_tile_x, pvs_tile_z;
+        size_t pvs_rejected = 0;               //Objects thrown away by the PVS this frame
+        size_t pvs_rejected_chunks = 0;        //Maze chunks thrown away by the current PVS
+
+        //Software occlusion culling against the nearest maze walls
+        bool occlusion_culling = true;
+        static const size_t max_occluders = 48;        //Nearest wall runs rasterized each frame
+        OcclusionBuffer occlusion_buffer;
+        std::vector<vmath::vec3> occluder_min;         //Every wall run in the maze
+        std::vector<vmath::vec3> occluder_max;
+        CullList occluder_cull_list;                   //Built once (walls are static)
+        std::vector<uint32_t> visible_occluders;
+        std::vector<std::pair<float, uint32_t> > occluder_order; //Distance, occluder index
+        std::vector<vmath::vec3> object_box_min;       //World box of each object in object_cull_list
+        std::vector<vmath::vec3> object_box_max;
 
         //Structure to hold all the object info
         struct obj_t{
@@ -647,12 +1671,16 @@ class test_app : public sb7::application{
             std::vector<vmath::vec2> uv;
             GLuint vertNum; //This should be the same as vertivies.size()
 
-            //Handle from OpenGL set up
-            GLuint vertices_buffer_ID; 
-            GLuint uv_buffer_ID;       
+            //Where this object's mesh lives inside mesh_arena
+            mesh_t mesh;
 
             //Object to World transforms
             vmath::mat4 obj2world;
+            int node;                           //In scene_nodes, obj2world is its world matrix
+            int anim_tracks[ANIM_CHANNELS];     //Track of each channel in object_clip, -1 when it isn't animated
+
+            //Object space bounding box/sphere, computed when loaded
+            bounds_t bounds;
 
             //Texture Info
             GLuint texture_ID;
@@ -660,6 +1688,89 @@ class test_app : public sb7::application{
 
         //Hold all of our objects
         std::vector<obj_t> objects;
+        AnimationClip object_clip;         //Keyframes of every animated object (see animationClip.h)
+        AnimationSampler object_animation;
+        TransformHierarchy scene_nodes;    //Object transforms, parents before children (see transformHierarchy.h)
+
+        //Maze walls, a merged mesh in culled chunks (or one cube instance per wall tile without greedy_maze)
+        static const int maze_width = 20;  //Tiles
+        static const int maze_height = 20;
+        bool greedy_maze = true;                  //Static merged mesh instead of one cube per wall tile
+        static const int maze_chunk_size = 16;    //Tiles per side of a maze mesh chunk
+        std::vector<arena_vertex_t> maze_vertices;//Static maze mesh (only kept until it is uploaded)
+        std::vector<GLuint> maze_indices;
+        std::vector<maze_chunk_t> maze_chunks;    //Drawable pieces of the maze mesh
+        obj_t wall_piece;                         //Cube mesh (obj2world unused)
+        std::vector<vmath::mat4> wall_transforms; //One per wall tile, uploaded once at startup
+        GLuint wall_instance_base;                //Where the wall transforms start in the transform buffer
+        GLuint object_base;                       //Where the object transforms start
+        GLuint shadow_base;                       //Where the dynamic shadow caster transforms start
+        bool gpu_culling = true;                  //Cull wall instances in a compute shader (only without greedy_maze)
+        GpuCuller wall_culler;                    //Wall boxes and the draw commands written for them
+        GLuint cull_program = 0;                  //cull_cs.glsl
+
+        //Clustered forward lighting
+        static const GLuint max_lights = 256;            //Lights spawned in the maze
+        static const GLuint max_light_indices = 1 << 18; //Light index list length (lights touching each cluster, summed)
+        ClusteredLights cluster_lights;
+        std::vector<light_t> scene_lights;
+        struct light_anchor_t{                    //What each light moves around
+            vmath::vec3 center;
+            float phase;
+            float speed;
+        };
+        std::vector<light_anchor_t> light_anchors;
+
+        //Skinned crowd, posed on the CPU and blended on the GPU (see skinning.h)
+        static const GLuint max_characters = 256;
+        SkinnedCrowd crowd;
+        GLuint skin_program = 0;                  //skin_vs.glsl + fs.glsl (gbuffer_fs.glsl when deferred)
+        GLuint skin_shadow_program = 0;           //skin_shadow_vs.glsl
+        GLint skin_shadow_vp_location = -1;       //lightViewProjection uniform
+        CullList crowd_cull_list;                 //Built once (characters stand in place)
+        std::vector<uint32_t> visible_characters; //Indices into the crowd that touch the frustum
+        std::vector<uint32_t> crowd_draw_list;    //and that the PVS and occlusion kept, posed and drawn in this order
+        std::vector<uint32_t> crowd_pose_list;    //crowd_draw_list, then characters that only cast shadows
+        std::vector<int> crowd_pose_slots;        //Per character, its place in crowd_pose_list this frame (-1 none)
+
+        //Deferred shading, picked at startup so both renderers can be compared on the same scene
+        //Not quite the same shading: the G-buffer has no room for the lightmap, so deferred lights the maze with the probes
+        //and live sun shadows like everything else, where forward uses the lightmap. Turn baked_lighting off to compare like for like
+        bool deferred_shading = false;            //G-buffer + full screen light pass instead of shading while drawing
+        GBuffer gbuffer;
+        GLuint gbuffer_program = 0;               //vs.glsl + gbuffer_fs.glsl
+        GLuint deferred_program = 0;              //deferred_vs.glsl + deferred_fs.glsl
+        GLuint fullscreen_vao = 0;                //Empty, for the full screen triangle
+
+        //Lightmap for the maze, baked at startup (greedy_maze only, forward shading only)
+        bool baked_lighting = true;               //Sky and sun on the maze come from the lightmap
+        GLuint lightmap_texture = 0;              //RGBA16F, 0 until baked
+        GLuint lightmap_program = 0;              //vs.glsl + lightmap_fs.glsl
+        bool baked_transfer = true;               //Per vertex ambient occlusion for loaded objects (see vertexTransfer.h)
+
+        //Sky light on everything else: SH9 irradiance and a prefiltered specular cube (see skyLighting.h)
+        sky_cube_t sky_images;                    //CPU copy of the sky cube, only kept through startup
+        SkyLighting sky_lighting;
+        bool probe_lighting = true;               //Maze probes instead of the open sky for ambient light (see probeGrid.h)
+        ProbeGrid probe_grid;
+
+        //Sun shadows
+        CascadedShadows shadows;
+        GLuint shadow_program = 0;                //shadow_vs.glsl
+        GLint shadow_vp_location = -1;            //lightViewProjection uniform
+        float sun_angle = 0.6f;                   //Where the sun is around the y axis (L key)
+        vmath::vec3 sun_color = vmath::vec3(0.9f, 0.85f, 0.7f);
+        const float shadow_distance = 60.0f;      //No shadows past this view distance
+        CullList shadow_caster_list;              //Every maze chunk (greedy_maze only)
+        std::vector<uint32_t> shadow_casters;     //Chunks inside the page being drawn
+        static const GLuint max_shadow_objects = 1 << 12; //Dynamic shadow casters a frame (objects, all cascades together)
+        CullList shadow_object_list;              //Every object's world box, rebuilt every frame (they move)
+        std::vector<uint32_t> shadow_candidates;  //Objects or characters touching the cascade being collected
+        std::vector<int> shadow_object_slots;     //Per object, its shadow transform slot this frame (-1 none)
+        std::vector<uint32_t> shadow_object_ids;  //Per slot, the object
+        std::vector<vmath::mat4> shadow_object_transforms;             //Per slot, drawn with draw id shadow_base + slot
+        std::vector<uint32_t> shadow_cascade_objects[SHADOW_CASCADES];    //Slots of the objects casting into each cascade
+        std::vector<uint32_t> shadow_cascade_characters[SHADOW_CASCADES]; //Pose slots of the characters casting into each cascade
 
 
 
@@ -677,6 +1788,14 @@ class test_app : public sb7::application{
 
         bool autoRotate = false;
 
+        //Simulation state (changed only by update())
+        double sim_time = 0.0;                 //Simulated seconds
+        vmath::vec3 player_position;           //Camera position after the latest tick
+        vmath::vec3 player_previous;           //and the one before, render() blends the two
+        vmath::vec3 camera_look;               //Focus - position, set by the mouse
+        bool keys_held[4] = {false, false, false, false}; //W, A, S, D
+        const float move_speed = 8.0f;         //Units a second while a movement key is held
+
         // Camera Stuff
         struct camera_t{ //Keep all of our camera stuff together
             float camera_near;   //Near clipping mask
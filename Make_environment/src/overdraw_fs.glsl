@@ -0,0 +1,15 @@
+#version 450 core
+
+//Overdraw view, every fragment that gets shaded adds a little
+//Drawn with additive blending, so brighter means the pixel was shaded more times
+//(1 layer = dark blue, 4 = mid, 8+ = white)
+
+in vec4 vs_color;
+in vec2 vs_uv;
+
+out vec4 color;
+
+void main(void)
+{
+    color = vec4(0.125, 0.125, 0.25, 1.0);
+}
@@ -0,0 +1,202 @@
+/*
+ * Frame pacing
+ * See ./include/sb7framepacer.h for usage
+ */
+
+#include <sb7.h>
+#include <sb7framepacer.h>
+
+#ifndef WIN32
+#include <time.h>
+#endif
+
+namespace sb7
+{
+
+static void sleep_1ms()
+{
+#ifdef WIN32
+    ::Sleep(1);
+#else
+    struct timespec ts = { 0, 1000000 };
+    nanosleep(&ts, NULL);
+#endif
+}
+
+frame_pacer::frame_pacer()
+    : target_period(0.0),
+      next_deadline(0.0),
+      last_time(0.0),
+      last_frame(0.0),
+      smoothed_frame(0.0),
+      last_jitter(0.0),
+      last_wait(0.0),
+      jitter_count(0),
+      jitter_next(0),
+      started(false),
+      vsync_current(VSYNC_OFF),
+      sleep_mean(0.002),
+      sleep_m2(0.0),
+      sleep_samples(1)
+{
+}
+
+void frame_pacer::init(double target_fps)
+{
+    set_target_fps(target_fps);
+    last_time = glfwGetTime();
+    next_deadline = last_time + target_period;
+    last_frame = 0.0;
+    smoothed_frame = target_period;
+    jitter_count = 0;
+    jitter_next = 0;
+    started = false;
+}
+
+void frame_pacer::set_target_fps(double target_fps)
+{
+    target_period = target_fps > 0.0 ? 1.0 / target_fps : 0.0;
+    next_deadline = glfwGetTime() + target_period;
+}
+
+frame_pacer::vsync_mode frame_pacer::set_vsync(vsync_mode mode)
+{
+    if (mode == VSYNC_ADAPTIVE)
+    {
+        if (glfwExtensionSupported("WGL_EXT_swap_control_tear") ||
+            glfwExtensionSupported("GLX_EXT_swap_control_tear"))
+        {
+            glfwSwapInterval(-1);
+            vsync_current = VSYNC_ADAPTIVE;
+            return vsync_current;
+        }
+        mode = VSYNC_ON;
+    }
+
+    glfwSwapInterval(mode == VSYNC_ON ? 1 : 0);
+    vsync_current = mode;
+    return vsync_current;
+}
+
+double frame_pacer::begin_frame()
+{
+    double now = glfwGetTime();
+    last_frame = now - last_time;
+    last_time = now;
+
+    // The first call only marks the start, there is no frame before it to measure
+    if (!started)
+    {
+        started = true;
+        last_frame = 0.0;
+        return smoothed_frame;
+    }
+
+    // Jitter is measured against what the frame should have taken
+    double expected = target_period > 0.0 ? target_period : smoothed_frame;
+    last_jitter = fabs(last_frame - expected);
+    jitter[jitter_next] = last_jitter;
+    jitter_next = (jitter_next + 1) % HISTORY;
+    if (jitter_count < HISTORY)
+    {
+        jitter_count++;
+    }
+
+    // Exponential moving average, follows real changes in rate within a few frames
+    if (smoothed_frame <= 0.0)
+    {
+        smoothed_frame = last_frame;
+    }
+    else
+    {
+        smoothed_frame += (last_frame - smoothed_frame) * 0.2;
+    }
+    return smoothed_frame;
+}
+
+void frame_pacer::limit()
+{
+    last_wait = 0.0;
+    if (target_period <= 0.0)
+    {
+        return;
+    }
+
+    double start = glfwGetTime();
+    double now = start;
+
+    // Sleep while there is more time left than a sleep could plausibly take
+    for (;;)
+    {
+        double estimate = sleep_mean + sqrt(sleep_m2 / sleep_samples);
+        if (next_deadline - now <= estimate)
+        {
+            break;
+        }
+
+        double before = now;
+        sleep_1ms();
+        now = glfwGetTime();
+
+        double observed = now - before;
+        sleep_samples++;
+        double delta = observed - sleep_mean;
+        sleep_mean += delta / sleep_samples;
+        sleep_m2 += delta * (observed - sleep_mean);
+
+        // Old samples age out so a change in timer resolution is picked up
+        if (sleep_samples > 1000)
+        {
+            sleep_m2 *= 0.5;
+            sleep_samples = 500;
+        }
+    }
+
+    // Spin the rest
+    while (now < next_deadline)
+    {
+        now = glfwGetTime();
+    }
+    last_wait = now - start;
+
+    // Fixed schedule, so short and long frames average out to the target.
+    // More than a whole frame late starts over instead of rushing to catch up.
+    if (now - next_deadline > target_period)
+    {
+        next_deadline = now + target_period;
+    }
+    else
+    {
+        next_deadline += target_period;
+    }
+}
+
+double frame_pacer::mean_jitter_seconds() const
+{
+    if (jitter_count == 0)
+    {
+        return 0.0;
+    }
+
+    double total = 0.0;
+    for (unsigned i = 0; i < jitter_count; i++)
+    {
+        total += jitter[i];
+    }
+    return total / jitter_count;
+}
+
+double frame_pacer::max_jitter_seconds() const
+{
+    double result = 0.0;
+    for (unsigned i = 0; i < jitter_count; i++)
+    {
+        if (jitter[i] > result)
+        {
+            result = jitter[i];
+        }
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,403 @@
+/*
+ * GL state cache
+ * See ./include/sb7glstate.h for usage
+ */
+
+#include <sb7glstate.h>
+
+#include <cstring>
+
+namespace sb7
+{
+
+namespace glstate
+{
+
+namespace
+{
+
+const GLuint UNKNOWN = ~0u;
+
+const GLenum buffer_targets[] =
+{
+    GL_ARRAY_BUFFER, GL_ELEMENT_ARRAY_BUFFER, GL_UNIFORM_BUFFER, GL_SHADER_STORAGE_BUFFER,
+    GL_DRAW_INDIRECT_BUFFER, GL_DISPATCH_INDIRECT_BUFFER, GL_PIXEL_PACK_BUFFER, GL_PIXEL_UNPACK_BUFFER,
+    GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, GL_ATOMIC_COUNTER_BUFFER, GL_TEXTURE_BUFFER,
+    GL_TRANSFORM_FEEDBACK_BUFFER, GL_QUERY_BUFFER
+};
+const int NUM_BUFFER_TARGETS = sizeof(buffer_targets) / sizeof(buffer_targets[0]);
+
+const GLenum indexed_targets[] =
+{
+    GL_UNIFORM_BUFFER, GL_SHADER_STORAGE_BUFFER, GL_ATOMIC_COUNTER_BUFFER, GL_TRANSFORM_FEEDBACK_BUFFER
+};
+const int NUM_INDEXED_TARGETS = sizeof(indexed_targets) / sizeof(indexed_targets[0]);
+const int MAX_INDEXED_BINDINGS = 32;
+
+const GLenum texture_targets[] =
+{
+    GL_TEXTURE_1D, GL_TEXTURE_2D, GL_TEXTURE_3D, GL_TEXTURE_1D_ARRAY, GL_TEXTURE_2D_ARRAY,
+    GL_TEXTURE_RECTANGLE, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_BUFFER,
+    GL_TEXTURE_2D_MULTISAMPLE, GL_TEXTURE_2D_MULTISAMPLE_ARRAY
+};
+const int NUM_TEXTURE_TARGETS = sizeof(texture_targets) / sizeof(texture_targets[0]);
+const int MAX_TEXTURE_UNITS = 32;
+
+const GLenum caps[] =
+{
+    GL_DEPTH_TEST, GL_CULL_FACE, GL_BLEND, GL_SCISSOR_TEST, GL_STENCIL_TEST, GL_DEPTH_CLAMP,
+    GL_POLYGON_OFFSET_FILL, GL_TEXTURE_CUBE_MAP_SEAMLESS, GL_PROGRAM_POINT_SIZE, GL_FRAMEBUFFER_SRGB,
+    GL_MULTISAMPLE
+};
+const int NUM_CAPS = sizeof(caps) / sizeof(caps[0]);
+
+struct state
+{
+    GLuint      program;
+    GLuint      vao;
+    GLuint      buffers[NUM_BUFFER_TARGETS];
+    GLuint      indexed[NUM_INDEXED_TARGETS][MAX_INDEXED_BINDINGS];
+    GLuint      active_unit;                                    // 0 based
+    GLuint      textures[MAX_TEXTURE_UNITS][NUM_TEXTURE_TARGETS];
+    int         enabled[NUM_CAPS];                              // -1 unknown, 0, 1
+    GLenum      depth_func;
+    int         depth_mask;                                     // -1 unknown, 0, 1
+    counters    frame;
+};
+
+state current;
+bool initialized = false;
+
+void reset_state()
+{
+    current.program = UNKNOWN;
+    current.vao = UNKNOWN;
+    for (int i = 0; i < NUM_BUFFER_TARGETS; i++)
+        current.buffers[i] = UNKNOWN;
+    for (int t = 0; t < NUM_INDEXED_TARGETS; t++)
+        for (int i = 0; i < MAX_INDEXED_BINDINGS; i++)
+            current.indexed[t][i] = UNKNOWN;
+    current.active_unit = UNKNOWN;
+    for (int u = 0; u < MAX_TEXTURE_UNITS; u++)
+        for (int t = 0; t < NUM_TEXTURE_TARGETS; t++)
+            current.textures[u][t] = UNKNOWN;
+    for (int i = 0; i < NUM_CAPS; i++)
+        current.enabled[i] = -1;
+    current.depth_func = UNKNOWN;
+    current.depth_mask = -1;
+}
+
+state& get()
+{
+    if (!initialized)
+    {
+        reset_state();
+        memset(&current.frame, 0, sizeof(current.frame));
+        initialized = true;
+    }
+    return current;
+}
+
+int find(const GLenum * list, int count, GLenum value)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (list[i] == value)
+            return i;
+    }
+    return -1;
+}
+
+// Returns true if the call should go through, counting it either way
+bool changed(GLuint& cached, GLuint value, call_id id)
+{
+    state& s = get();
+    if (cached == value)
+    {
+        s.frame.skipped[id]++;
+        return false;
+    }
+    cached = value;
+    s.frame.issued[id]++;
+    return true;
+}
+
+void passthrough(call_id id)
+{
+    get().frame.issued[id]++;
+}
+
+void set_cap(GLenum cap, int value)
+{
+    state& s = get();
+    int i = find(caps, NUM_CAPS, cap);
+    if (i >= 0 && s.enabled[i] == value)
+    {
+        s.frame.skipped[CALL_ENABLE]++;
+        return;
+    }
+    if (i >= 0)
+        s.enabled[i] = value;
+    s.frame.issued[CALL_ENABLE]++;
+    if (value)
+        glEnable(cap);
+    else
+        glDisable(cap);
+}
+
+}
+
+unsigned int counters::total_issued() const
+{
+    unsigned int total = 0;
+    for (int i = 0; i < CALL_COUNT; i++)
+        total += issued[i];
+    return total;
+}
+
+unsigned int counters::total_skipped() const
+{
+    unsigned int total = 0;
+    for (int i = 0; i < CALL_COUNT; i++)
+        total += skipped[i];
+    return total;
+}
+
+void use_program(GLuint program)
+{
+    if (changed(get().program, program, CALL_USE_PROGRAM))
+        glUseProgram(program);
+}
+
+void bind_vertex_array(GLuint vao)
+{
+    state& s = get();
+    if (changed(s.vao, vao, CALL_BIND_VERTEX_ARRAY))
+    {
+        glBindVertexArray(vao);
+        // The element buffer binding is part of the vao
+        s.buffers[find(buffer_targets, NUM_BUFFER_TARGETS, GL_ELEMENT_ARRAY_BUFFER)] = UNKNOWN;
+    }
+}
+
+void bind_buffer(GLenum target, GLuint buffer)
+{
+    state& s = get();
+    int t = find(buffer_targets, NUM_BUFFER_TARGETS, target);
+    if (t < 0)
+    {
+        passthrough(CALL_BIND_BUFFER);
+        glBindBuffer(target, buffer);
+        return;
+    }
+    if (changed(s.buffers[t], buffer, CALL_BIND_BUFFER))
+        glBindBuffer(target, buffer);
+}
+
+void bind_buffer_base(GLenum target, GLuint index, GLuint buffer)
+{
+    state& s = get();
+    int t = find(indexed_targets, NUM_INDEXED_TARGETS, target);
+    if (t < 0 || index >= (GLuint)MAX_INDEXED_BINDINGS)
+    {
+        passthrough(CALL_BIND_BUFFER_BASE);
+        glBindBufferBase(target, index, buffer);
+        return;
+    }
+    if (changed(s.indexed[t][index], buffer, CALL_BIND_BUFFER_BASE))
+    {
+        glBindBufferBase(target, index, buffer);
+        // Binding an indexed point binds the generic point too
+        s.buffers[find(buffer_targets, NUM_BUFFER_TARGETS, target)] = buffer;
+    }
+}
+
+void bind_buffer_range(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    state& s = get();
+    // Ranges move every frame (streamed data), so they are always issued
+    passthrough(CALL_BIND_BUFFER_RANGE);
+    glBindBufferRange(target, index, buffer, offset, size);
+
+    int t = find(indexed_targets, NUM_INDEXED_TARGETS, target);
+    if (t >= 0 && index < (GLuint)MAX_INDEXED_BINDINGS)
+        s.indexed[t][index] = UNKNOWN;  // A later bind_buffer_base of the same buffer must not be skipped
+    int g = find(buffer_targets, NUM_BUFFER_TARGETS, target);
+    if (g >= 0)
+        s.buffers[g] = buffer;
+}
+
+void active_texture(GLenum unit)
+{
+    state& s = get();
+    GLuint index = unit - GL_TEXTURE0;
+    if (index >= (GLuint)MAX_TEXTURE_UNITS)
+    {
+        passthrough(CALL_ACTIVE_TEXTURE);
+        s.active_unit = UNKNOWN;
+        glActiveTexture(unit);
+        return;
+    }
+    if (changed(s.active_unit, index, CALL_ACTIVE_TEXTURE))
+        glActiveTexture(unit);
+}
+
+void bind_texture(GLenum target, GLuint texture)
+{
+    state& s = get();
+    int t = find(texture_targets, NUM_TEXTURE_TARGETS, target);
+    if (t < 0 || s.active_unit == UNKNOWN)
+    {
+        // Which unit is active is not known, so neither is what this replaces
+        passthrough(CALL_BIND_TEXTURE);
+        glBindTexture(target, texture);
+        if (t >= 0)
+        {
+            for (int u = 0; u < MAX_TEXTURE_UNITS; u++)
+                s.textures[u][t] = UNKNOWN;
+        }
+        return;
+    }
+    if (changed(s.textures[s.active_unit][t], texture, CALL_BIND_TEXTURE))
+        glBindTexture(target, texture);
+}
+
+void bind_texture_unit(GLuint unit, GLenum target, GLuint texture)
+{
+    state& s = get();
+    int t = find(texture_targets, NUM_TEXTURE_TARGETS, target);
+    if (t >= 0 && unit < (GLuint)MAX_TEXTURE_UNITS && s.textures[unit][t] == texture)
+    {
+        // Already there, don't even touch the active unit
+        s.frame.skipped[CALL_BIND_TEXTURE]++;
+        return;
+    }
+    active_texture(GL_TEXTURE0 + unit);
+    bind_texture(target, texture);
+}
+
+void enable(GLenum cap)
+{
+    set_cap(cap, 1);
+}
+
+void disable(GLenum cap)
+{
+    set_cap(cap, 0);
+}
+
+void depth_func(GLenum func)
+{
+    if (changed(get().depth_func, func, CALL_DEPTH_FUNC))
+        glDepthFunc(func);
+}
+
+void depth_mask(GLboolean flag)
+{
+    state& s = get();
+    int value = flag ? 1 : 0;
+    if (s.depth_mask == value)
+    {
+        s.frame.skipped[CALL_DEPTH_MASK]++;
+        return;
+    }
+    s.depth_mask = value;
+    s.frame.issued[CALL_DEPTH_MASK]++;
+    glDepthMask(flag);
+}
+
+void delete_program(GLuint program)
+{
+    state& s = get();
+    if (s.program == program)
+        s.program = UNKNOWN;
+    glDeleteProgram(program);
+}
+
+void delete_vertex_arrays(GLsizei n, const GLuint * vaos)
+{
+    state& s = get();
+    for (GLsizei i = 0; i < n; i++)
+    {
+        if (s.vao == vaos[i])
+            s.vao = UNKNOWN;
+    }
+    glDeleteVertexArrays(n, vaos);
+}
+
+void delete_buffers(GLsizei n, const GLuint * buffers)
+{
+    state& s = get();
+    for (GLsizei i = 0; i < n; i++)
+    {
+        for (int t = 0; t < NUM_BUFFER_TARGETS; t++)
+        {
+            if (s.buffers[t] == buffers[i])
+                s.buffers[t] = UNKNOWN;
+        }
+        for (int t = 0; t < NUM_INDEXED_TARGETS; t++)
+        {
+            for (int b = 0; b < MAX_INDEXED_BINDINGS; b++)
+            {
+                if (s.indexed[t][b] == buffers[i])
+                    s.indexed[t][b] = UNKNOWN;
+            }
+        }
+    }
+    glDeleteBuffers(n, buffers);
+}
+
+void delete_textures(GLsizei n, const GLuint * textures)
+{
+    state& s = get();
+    for (GLsizei i = 0; i < n; i++)
+    {
+        for (int u = 0; u < MAX_TEXTURE_UNITS; u++)
+        {
+            for (int t = 0; t < NUM_TEXTURE_TARGETS; t++)
+            {
+                if (s.textures[u][t] == textures[i])
+                    s.textures[u][t] = UNKNOWN;
+            }
+        }
+    }
+    glDeleteTextures(n, textures);
+}
+
+void invalidate()
+{
+    get();
+    reset_state();
+}
+
+void begin_frame()
+{
+    memset(&get().frame, 0, sizeof(current.frame));
+}
+
+const counters& frame_counters()
+{
+    return get().frame;
+}
+
+const char* call_name(call_id id)
+{
+    static const char * names[CALL_COUNT] =
+    {
+        "glUseProgram",
+        "glBindVertexArray",
+        "glBindBuffer",
+        "glBindBufferBase",
+        "glBindBufferRange",
+        "glActiveTexture",
+        "glBindTexture",
+        "glEnable/glDisable",
+        "glDepthFunc",
+        "glDepthMask"
+    };
+    return (id >= 0 && id < CALL_COUNT) ? names[id] : "unknown";
+}
+
+}
+
+}
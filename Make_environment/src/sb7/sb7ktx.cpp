@@ -329,8 +329,48 @@ bool save(const char * filename, unsigned int target, unsigned int tex)
     glGetTexLevelParameteriv(target, 0, GL_TEXTURE_WIDTH, (GLint *)&h.pixelwidth);
     glGetTexLevelParameteriv(target, 0, GL_TEXTURE_HEIGHT, (GLint *)&h.pixelheight);
     glGetTexLevelParameteriv(target, 0, GL_TEXTURE_DEPTH, (GLint *)&h.pixeldepth);
+    glGetTexLevelParameteriv(target, 0, GL_TEXTURE_INTERNAL_FORMAT, (GLint *)&h.glinternalformat);
 
-    return true;
+    // Only the base level of uncompressed 2D RGBA textures is written
+    if (target != GL_TEXTURE_2D)
+        return false;
+
+    h.glformat = GL_RGBA;
+    h.glbaseinternalformat = GL_RGBA;
+    switch (h.glinternalformat)
+    {
+        case GL_RGBA8:      h.gltype = GL_UNSIGNED_BYTE;    h.gltypesize = 1;
+            break;
+        case GL_RGBA16F:    h.gltype = GL_HALF_FLOAT;       h.gltypesize = 2;
+            break;
+        case GL_RGBA32F:    h.gltype = GL_FLOAT;            h.gltypesize = 4;
+            break;
+        default:
+            return false;
+    }
+    h.pixeldepth = 0;
+    h.miplevels = 1;
+
+    unsigned int image_size = calculate_face_size(h);
+    unsigned char * data = new unsigned char [image_size];
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glGetTexImage(target, 0, h.glformat, h.gltype, data);
+
+    FILE * fp = fopen(filename, "wb");
+    bool result = false;
+
+    if (fp)
+    {
+        result = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+                 fwrite(&image_size, sizeof(image_size), 1, fp) == 1 &&
+                 fwrite(data, 1, image_size, fp) == image_size;
+        fclose(fp);
+    }
+
+    delete [] data;
+
+    return result;
 }
 
 }
@@ -0,0 +1,146 @@
+/*
+ * Streaming ring buffer
+ * See ./include/sb7ringbuffer.h for usage
+ */
+
+#include <sb7ringbuffer.h>
+#include <sb7glstate.h>
+
+#include <chrono>
+
+namespace sb7
+{
+
+ring_buffer::ring_buffer()
+    : buf(0),
+      mapped(nullptr),
+      region_size(0),
+      region_count(0),
+      region(0),
+      head(0),
+      inside_frame(false),
+      ubo_alignment(256),
+      ssbo_alignment(256),
+      waits(0),
+      wait_time(0.0)
+{
+    for (int i = 0; i < MAX_FRAMES; i++)
+        fences[i] = 0;
+}
+
+bool ring_buffer::init(GLsizeiptr frame_size, int frames)
+{
+    teardown();
+
+    if (frames < 1)
+        frames = 1;
+    if (frames > MAX_FRAMES)
+        frames = MAX_FRAMES;
+
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    ubo_alignment = alignment > 0 ? alignment : 256;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    ssbo_alignment = alignment > 0 ? alignment : 256;
+
+    // Keep every region starting on an alignment any use will accept
+    GLsizeiptr align = ubo_alignment > ssbo_alignment ? ubo_alignment : ssbo_alignment;
+    region_size = (frame_size + align - 1) / align * align;
+    region_count = frames;
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &buf);
+    glstate::bind_buffer(GL_COPY_WRITE_BUFFER, buf);
+    glBufferStorage(GL_COPY_WRITE_BUFFER, region_size * region_count, nullptr, flags);
+    mapped = (char *)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, region_size * region_count, flags);
+    if (!mapped)
+    {
+        teardown();
+        return false;
+    }
+
+    region = region_count - 1;  // The first begin_frame() moves to region 0
+    head = 0;
+    waits = 0;
+    wait_time = 0.0;
+    return true;
+}
+
+void ring_buffer::teardown()
+{
+    for (int i = 0; i < MAX_FRAMES; i++)
+    {
+        if (fences[i])
+            glDeleteSync(fences[i]);
+        fences[i] = 0;
+    }
+    if (buf)
+    {
+        if (mapped)
+        {
+            glstate::bind_buffer(GL_COPY_WRITE_BUFFER, buf);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        }
+        glstate::delete_buffers(1, &buf);
+    }
+    buf = 0;
+    mapped = nullptr;
+    region_size = 0;
+    region_count = 0;
+    inside_frame = false;
+}
+
+void ring_buffer::begin_frame()
+{
+    if (!buf)
+        return;
+
+    region = (region + 1) % region_count;
+    head = 0;
+    inside_frame = true;
+
+    GLsync fence = fences[region];
+    if (!fence)
+        return;
+
+    // Usually the GPU finished this region long ago, check without waiting first
+    GLenum result = glClientWaitSync(fence, 0, 0);
+    if (result == GL_TIMEOUT_EXPIRED)
+    {
+        waits++;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        do
+        {
+            result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1ms at a time
+        } while (result == GL_TIMEOUT_EXPIRED);
+        wait_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    glDeleteSync(fence);
+    fences[region] = 0;
+}
+
+void ring_buffer::end_frame()
+{
+    if (!inside_frame)
+        return;
+
+    if (head > 0)
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    inside_frame = false;
+}
+
+void * ring_buffer::allocate(GLsizeiptr size, GLsizeiptr alignment, GLintptr& offset)
+{
+    if (!inside_frame || size <= 0)
+        return nullptr;
+
+    GLsizeiptr start = alignment > 1 ? (head + alignment - 1) / alignment * alignment : head;
+    if (start + size > region_size)
+        return nullptr;
+
+    head = start + size;
+    offset = region * region_size + start;
+    return mapped + offset;
+}
+
+}
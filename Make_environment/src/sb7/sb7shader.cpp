@@ -26,6 +26,7 @@
 #include "GL/gl3w.h"
 
 #include <cstdio>
+#include <cstring>
 
 namespace sb7
 {
@@ -101,6 +102,94 @@ fail_data_alloc:
     return result;
 }
 
+// Whole file as a zero terminated string, delete [] it when done (NULL if it can't be read)
+static char * read_text(const char * filename)
+{
+    FILE * fp = fopen(filename, "rb");
+
+    if (!fp)
+        return NULL;
+
+    fseek(fp, 0, SEEK_END);
+    size_t filesize = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    char * data = new char [filesize + 1];
+    size_t got = fread(data, 1, filesize, fp);
+    data[got] = 0;
+    fclose(fp);
+
+    return data;
+}
+
+extern
+GLuint load_with_header(const char * header_filename, const char * filename, GLenum shader_type, bool check_errors)
+{
+    GLuint result = 0;
+    char * header = read_text(header_filename);
+    char * data = read_text(filename);
+    const char * body;
+    const char * strings[5];
+    GLint lengths[5];
+
+    if (!header || !data)
+        goto fail_read;
+
+    // The #version line has to come before anything else, the header goes right after it
+    body = data;
+    if (strncmp(data, "#version", 8) == 0)
+    {
+        body = strchr(data, '\n');
+        body = body ? body + 1 : data + strlen(data);
+    }
+
+    // #line keeps error messages pointing at the right file: the header is source string 1,
+    // the shader goes on as source string 0 from the line after #version
+    strings[0] = data;
+    strings[1] = "#line 1 1\n";
+    strings[2] = header;
+    strings[3] = body != data ? "\n#line 2 0\n" : "\n#line 1 0\n";
+    strings[4] = body;
+    lengths[0] = static_cast<GLint>(body - data);
+    lengths[1] = lengths[2] = lengths[3] = lengths[4] = -1;
+
+    result = glCreateShader(shader_type);
+
+    if (!result)
+        goto fail_read;
+
+    glShaderSource(result, 5, strings, lengths);
+
+    glCompileShader(result);
+
+    if (check_errors)
+    {
+        GLint status = 0;
+        glGetShaderiv(result, GL_COMPILE_STATUS, &status);
+
+        if (!status)
+        {
+            char buffer[4096];
+            glGetShaderInfoLog(result, 4096, NULL, buffer);
+#ifdef _WIN32
+            OutputDebugStringA(filename);
+            OutputDebugStringA(":");
+            OutputDebugStringA(buffer);
+            OutputDebugStringA("\n");
+#else
+            fprintf(stderr, "%s: %s\n", filename, buffer);
+#endif
+            glDeleteShader(result);
+            result = 0;
+        }
+    }
+
+fail_read:
+    delete [] header;
+    delete [] data;
+    return result;
+}
+
 GLuint from_string(const char * source,
                    GLenum shader_type,
                    bool check_errors)
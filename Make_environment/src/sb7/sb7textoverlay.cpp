@@ -26,6 +26,7 @@
 #include <sb7textoverlay.h>
 
 #include <sb7ktx.h>
+#include <sb7glstate.h>
 
 namespace sb7
 {
@@ -100,31 +101,51 @@ void text_overlay::init(int width, int height, const char* font)
 
     screen_buffer = new char[width * height];
     memset(screen_buffer, 0, width * height);
+
+    upload_stream.init(width * height);
 }
 
 void text_overlay::teardown()
 {
     delete[] screen_buffer;
-    glDeleteTextures(1, &font_texture);
-    glDeleteTextures(1, &text_buffer);
-    glDeleteVertexArrays(1, &vao);
-    glDeleteProgram(text_program);
+    upload_stream.teardown();
+    glstate::delete_textures(1, &font_texture);
+    glstate::delete_textures(1, &text_buffer);
+    glstate::delete_vertex_arrays(1, &vao);
+    glstate::delete_program(text_program);
 }
 
 void text_overlay::draw()
 {
-    glUseProgram(text_program);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, text_buffer);
+    glstate::use_program(text_program);
+    glstate::bind_texture_unit(0, GL_TEXTURE_2D, text_buffer);
     if (dirty)
     {
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, buffer_width, buffer_height, GL_RED_INTEGER, GL_UNSIGNED_BYTE, screen_buffer);
+        // Make sure the upload goes to the text texture
+        glstate::active_texture(GL_TEXTURE0);
+
+        // Copy the text into the ring and upload from there, so the driver never has to
+        // wait for the GPU to finish with the texture before taking the data
+        GLintptr offset = 0;
+        upload_stream.begin_frame();
+        void * dst = upload_stream.allocate(buffer_width * buffer_height, 1, offset);
+        if (dst)
+        {
+            memcpy(dst, screen_buffer, buffer_width * buffer_height);
+            glstate::bind_buffer(GL_PIXEL_UNPACK_BUFFER, upload_stream.buffer());
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, buffer_width, buffer_height, GL_RED_INTEGER, GL_UNSIGNED_BYTE, (const void *)offset);
+            glstate::bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        else
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, buffer_width, buffer_height, GL_RED_INTEGER, GL_UNSIGNED_BYTE, screen_buffer);
+        }
+        upload_stream.end_frame();
         dirty = false;
     }
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D_ARRAY, font_texture);
+    glstate::bind_texture_unit(1, GL_TEXTURE_2D_ARRAY, font_texture);
 
-    glBindVertexArray(vao);
+    glstate::bind_vertex_array(vao);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 }
 
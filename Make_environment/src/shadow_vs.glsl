@@ -0,0 +1,17 @@
+#version 450 core
+
+//Shadow map depth, positions only (see cascadedShadows.h)
+//Drawn once per cached page (static geometry) and once per cascade (dynamic objects)
+uniform mat4 lightViewProjection;
+
+//Every object's transform, indexed by draw_id
+layout (std430, binding = 1) readonly buffer ObjectBlock {
+    mat4 obj2world[];
+};
+
+layout (location = 0) in vec4 obj_vertex; //xyz from the position stream, w defaults to 1
+layout (location = 3) in uint draw_id;    //baseInstance + gl_InstanceID, picks the transform
+
+void main(void) {
+    gl_Position = lightViewProjection * obj2world[draw_id] * obj_vertex;
+}
@@ -0,0 +1,44 @@
+#version 450 core
+
+//Shadow map depth of skinned characters (see skinning.h), the same blend as skin_vs.glsl
+//Drawn once per cascade for every character whose box touches the cascade
+uniform mat4 lightViewProjection;
+
+//Every posed character's palette, a dual quaternion (real, dual) per joint, already in world space
+layout (std430, binding = 0) readonly buffer SkinBlock {
+    uvec4 skinInfo;      //x joints per character
+    vec4 joints[];
+};
+
+layout (location = 0) in vec4 obj_vertex;  //Bind pose, model space
+layout (location = 3) in uint draw_id;     //Which posed character this is
+layout (location = 6) in vec4 obj_joints;  //Joint indices (unnormalized bytes)
+layout (location = 7) in vec4 obj_weights; //Weights, adding up to 1
+
+//v + 2 r x (r x v + w v)
+vec3 rotate(vec4 real, vec3 v)
+{
+    return v + 2.0 * cross(real.xyz, cross(real.xyz, v) + real.w * v);
+}
+
+void main(void) {
+    //Dual quaternion linear blend, every influence on the same side as the first
+    uint palette = draw_id * skinInfo.x;
+    vec4 firstReal = joints[(palette + uint(obj_joints.x)) * 2u];
+    vec4 real = vec4(0.0);
+    vec4 dual = vec4(0.0);
+    for (int i = 0; i < 4; i++)
+    {
+        uint joint = (palette + uint(obj_joints[i])) * 2u;
+        vec4 r = joints[joint];
+        float w = dot(r, firstReal) < 0.0 ? -obj_weights[i] : obj_weights[i];
+        real += r * w;
+        dual += joints[joint + 1u] * w;
+    }
+    float inverseLength = 1.0 / length(real);
+    real *= inverseLength;
+    dual *= inverseLength;
+
+    vec3 translation = 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+    gl_Position = lightViewProjection * vec4(rotate(real, obj_vertex.xyz) + translation, 1.0);
+}
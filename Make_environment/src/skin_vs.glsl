@@ -0,0 +1,75 @@
+#version 450 core
+
+//Skinned characters (see skinning.h), same outputs as vs.glsl so fs.glsl and gbuffer_fs.glsl shade them as they are
+
+out vec4 vs_color; //Ouput to fragment shader
+out vec2 vs_uv;
+out vec3 vs_world_pos;    //For lighting
+out vec3 vs_normal;       //World space, not normalized
+out float vs_view_depth;  //Distance in front of the camera, picks the cluster depth slice
+out vec2 vs_lightmap_uv;  //Characters are never lightmapped
+out float vs_visibility;  //No baked occlusion, the mesh bends
+out vec3 vs_bent;         //World space bent normal, scaled by vs_visibility
+
+//Camera info, uploaded once per frame (see frameData.h)
+layout (std140, binding = 0) uniform FrameBlock {
+    mat4 view;           //world to Camera transform
+    mat4 projection;     //Perspective transform
+    mat4 viewProjection; //projection * view
+    vec4 cameraPosition; //World space camera position
+    float time;          //Seconds since start
+} frame;
+
+//Every posed character's palette, a dual quaternion (real, dual) per joint, already in world space
+layout (std430, binding = 0) readonly buffer SkinBlock {
+    uvec4 skinInfo;      //x joints per character
+    vec4 joints[];
+};
+
+layout (location = 0) in vec4 obj_vertex;  //Bind pose, model space
+layout (location = 1) in vec4 obj_normal;
+layout (location = 2) in vec2 obj_uv;
+layout (location = 3) in uint draw_id;     //Which posed character this is
+layout (location = 6) in vec4 obj_joints;  //Joint indices (unnormalized bytes)
+layout (location = 7) in vec4 obj_weights; //Weights, adding up to 1
+
+//v + 2 r x (r x v + w v)
+vec3 rotate(vec4 real, vec3 v)
+{
+    return v + 2.0 * cross(real.xyz, cross(real.xyz, v) + real.w * v);
+}
+
+void main(void) {
+    //Dual quaternion linear blend, every influence on the same side as the first
+    uint palette = draw_id * skinInfo.x;
+    vec4 firstReal = joints[(palette + uint(obj_joints.x)) * 2u];
+    vec4 real = vec4(0.0);
+    vec4 dual = vec4(0.0);
+    for (int i = 0; i < 4; i++)
+    {
+        uint joint = (palette + uint(obj_joints[i])) * 2u;
+        vec4 r = joints[joint];
+        float w = dot(r, firstReal) < 0.0 ? -obj_weights[i] : obj_weights[i];
+        real += r * w;
+        dual += joints[joint + 1u] * w;
+    }
+    float inverseLength = 1.0 / length(real);
+    real *= inverseLength;
+    dual *= inverseLength;
+
+    vec3 translation = 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+    vec4 world = vec4(rotate(real, obj_vertex.xyz) + translation, 1.0);
+    gl_Position = frame.viewProjection * world;
+
+    vs_world_pos = world.xyz;
+    vs_normal = rotate(real, obj_normal.xyz);
+    vs_view_depth = -(frame.view * world).z;
+
+    vs_uv = obj_uv;
+    vs_lightmap_uv = vec2(0.0);
+
+    //Same as an unbaked vertex in vs.glsl: fully open, bent normal 2/3 n
+    vs_visibility = 1.0;
+    vs_bent = normalize(vs_normal) * (2.0 / 3.0);
+    vs_color = vec4(0.5,0.5,0.5,1.0);
+}
@@ -1,20 +1,55 @@
-#version 450 core  
+#version 450 core
+
+//Bit for bit the same position as depth_vs.glsl, so the shading pass can test depth with GL_EQUAL
+invariant gl_Position;
 
 out vec4 vs_color; //Ouput to fragment shader
 out vec2 vs_uv;
+out vec3 vs_world_pos;    //For lighting
+out vec3 vs_normal;       //World space, not normalized
+out float vs_view_depth;  //Distance in front of the camera, picks the cluster depth slice
+out vec2 vs_lightmap_uv;  //Baked lighting (see lightmapBaker.h), only lightmap_fs.glsl reads it
+out float vs_visibility;  //Share of the ambient light the mesh doesn't block itself (see vertexTransfer.h)
+out vec3 vs_bent;         //World space bent normal, scaled by vs_visibility
+
+//Camera info, uploaded once per frame (see frameData.h)
+layout (std140, binding = 0) uniform FrameBlock {
+    mat4 view;           //world to Camera transform
+    mat4 projection;     //Perspective transform
+    mat4 viewProjection; //projection * view
+    vec4 cameraPosition; //World space camera position
+    float time;          //Seconds since start
+} frame;
+
+//Every object's transform, indexed by draw_id
+layout (std430, binding = 1) readonly buffer ObjectBlock {
+    mat4 obj2world[];
+};
 
-uniform mat4 transform; //Transformation matrix
-uniform mat4 perspective; //Perspective transform
-uniform mat4 toCamera; //world to Camera transform
+//Locations are fixed so every mesh in the arena can share one vao (see meshArena.h)
+layout (location = 0) in vec4 obj_vertex; //Currently being drawn point (of a triangle)
+layout (location = 1) in vec4 obj_normal; //Normal of the point
+layout (location = 2) in vec2 obj_uv;     //Currently being drawn texture maping of point
+layout (location = 3) in uint draw_id;    //baseInstance + gl_InstanceID, picks the transform
+layout (location = 4) in vec2 obj_lightmap_uv; //Where the point is in the lightmap atlas
+layout (location = 5) in vec4 obj_transfer;    //Baked occlusion and bent normal, relative to an open vertex
 
-in vec4 obj_vertex; //Currently being drawn point (of a triangle)
-in vec2 obj_uv;     //Currently being drawn texture maping of point
-                                                                  
 void main(void) {
-    //All modifications are pulled in via attributes    
-    gl_Position = perspective * toCamera * transform * obj_vertex;
+    //All modifications are pulled in via attributes
+    gl_Position = frame.viewProjection * obj2world[draw_id] * obj_vertex;
+
+    vec4 world = obj2world[draw_id] * obj_vertex;
+    vs_world_pos = world.xyz;
+    vs_normal = mat3(obj2world[draw_id]) * obj_normal.xyz; //Transforms are rotation + uniform scale
+    vs_view_depth = -(frame.view * world).z;
 
     vs_uv = obj_uv;
+    vs_lightmap_uv = obj_lightmap_uv;
+
+    //Undo the packing (difference from A = 1, B = 2/3 n), then into world space without the scale
+    vec3 bent = normalize(obj_normal.xyz) * (2.0 / 3.0) + obj_transfer.yzw / 0.75;
+    vs_visibility = 1.0 - obj_transfer.x;
+    vs_bent = mat3(obj2world[draw_id]) * bent / length(obj2world[draw_id][0].xyz);
     vs_color = vec4(0.5,0.5,0.5,1.0); //Not currently being used, but nice for debugging
 }
-                                                      
\ No newline at end of file
+